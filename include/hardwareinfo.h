@@ -0,0 +1,130 @@
+#ifndef HARDWAREINFO_H
+#define HARDWAREINFO_H
+
+/*
+ * libhardwareinfo - embeddable hardware, CPU and memory collector.
+ *
+ * A hwinfo_collector handle owns everything needed to sample repeatedly:
+ * the procfs/sysfs descriptors kept open between samples, the previous
+ * sample that usage deltas are computed against, and the static hardware
+ * information probed when the handle is opened. No call sleeps; callers
+ * sample at their own cadence and usage covers the time between the last
+ * two hwinfo_sample() calls.
+ *
+ * Handles are not thread-safe; use one per thread or serialize access.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HWINFO_API_VERSION 1
+
+#if defined(__GNUC__)
+#define HWINFO_API __attribute__((visibility("default")))
+#else
+#define HWINFO_API
+#endif
+
+typedef struct hwinfo_collector hwinfo_collector;
+
+/* Flags for hwinfo_open(). */
+#define HWINFO_REFRESH_STATIC 0x1  /* ignore the per-boot hardware cache */
+#define HWINFO_VIRT_HELPER    0x2  /* allow systemd-detect-virt as a fallback */
+
+/* Formats for hwinfo_serialize(). */
+#define HWINFO_JSON_PRETTY  0
+#define HWINFO_JSON_COMPACT 1
+
+typedef struct {
+    uint64_t total;
+    uint64_t free;
+    uint64_t available;
+    uint64_t cached;
+    uint64_t swap_total;
+    uint64_t swap_free;
+} hwinfo_memory;
+
+/* Resource usage of the cgroup v2 group the process runs in. Limits of
+ * "max" are reported as 0. Percentages are relative to the limits, or to
+ * all online CPUs when there is no CPU quota. */
+typedef struct {
+    int available;
+    double cpu_limit;
+    double cpu_usage;
+    double throttled_percent;
+    uint64_t memory_current;
+    uint64_t memory_max;
+    double memory_usage;
+} hwinfo_cgroup;
+
+HWINFO_API int hwinfo_api_version(void);
+
+/* Reads every system file below root instead of /, for all collectors
+ * opened afterwards in this process; NULL returns to the live system.
+ * Returns 0, or -1 when the path is too long. */
+HWINFO_API int hwinfo_set_sysroot(const char *root);
+
+/* Probes static hardware information and takes the baseline sample.
+ * A probe that misses its deadline is reported as null in the
+ * serialized hardware object. Returns NULL on allocation failure. */
+HWINFO_API hwinfo_collector *hwinfo_open(unsigned flags);
+HWINFO_API void hwinfo_close(hwinfo_collector *c);
+
+/* Takes a new sample; usage is measured against the previous one.
+ * Returns 0 on success and -1 if /proc/stat could not be read. */
+HWINFO_API int hwinfo_sample(hwinfo_collector *c);
+
+/* Writes the latest sample as JSON into buf (NUL-terminated when size
+ * allows). Returns the length of the full document, which is larger than
+ * or equal to size when buf was too small, or -1 on error. */
+HWINFO_API long hwinfo_serialize(hwinfo_collector *c, char *buf, size_t size, int format);
+
+/* Accessors for the latest sample. cpu is a logical CPU id in
+ * [0, hwinfo_cpu_capacity()). Usage values are percentages. */
+HWINFO_API int hwinfo_cpu_capacity(const hwinfo_collector *c);
+HWINFO_API int hwinfo_cpu_online(const hwinfo_collector *c, int cpu);
+HWINFO_API double hwinfo_cpu_usage(const hwinfo_collector *c, int cpu);
+HWINFO_API double hwinfo_total_usage(const hwinfo_collector *c);
+
+/* CPU and package (socket) temperatures in degrees Celsius. Each returns
+ * 0 and stores the value, or -1 when the CPU or package has no sensor. */
+HWINFO_API int hwinfo_cpu_temperature(const hwinfo_collector *c, int cpu, int *celsius);
+HWINFO_API int hwinfo_package_count(const hwinfo_collector *c);
+HWINFO_API int hwinfo_package_temperature(const hwinfo_collector *c, int package, int *celsius);
+
+/* Trailing usage windows. hwinfo_set_windows() keeps enough history to
+ * answer each window length (in milliseconds, at most 8) when sampling
+ * every interval_ms; count 0 turns them off. Returns 0 or -1 on
+ * allocation failure. hwinfo_window_usage() stores the usage of one CPU,
+ * or of the whole system when cpu is -1, over window index window, and
+ * the time actually covered in span_ms (shorter until enough history has
+ * been collected). Returns -1 when there is no data yet. */
+HWINFO_API int hwinfo_set_windows(hwinfo_collector *c, const unsigned *window_ms, int count,
+                                  unsigned interval_ms);
+HWINFO_API int hwinfo_window_usage(const hwinfo_collector *c, int window, int cpu,
+                                   double *usage, double *span_ms);
+
+/* Effective frequency of a CPU in MHz, from APERF/MPERF when the msr
+ * device is readable and from cpufreq otherwise. Returns -1 when unknown.
+ * cpuidle states are numbered [0, hwinfo_idle_state_count()) in kernel
+ * order; hwinfo_cpu_idle() stores the percentage of the last interval
+ * the CPU spent in a state, or returns -1 before the second sample. */
+HWINFO_API int hwinfo_cpu_frequency(const hwinfo_collector *c, int cpu, double *mhz);
+HWINFO_API int hwinfo_idle_state_count(const hwinfo_collector *c);
+HWINFO_API const char *hwinfo_idle_state_name(const hwinfo_collector *c, int state);
+HWINFO_API int hwinfo_cpu_idle(const hwinfo_collector *c, int cpu, int state, double *residency);
+
+HWINFO_API void hwinfo_get_memory(const hwinfo_collector *c, hwinfo_memory *out);
+/* Returns 0, or -1 (with out->available == 0) outside cgroup v2. */
+HWINFO_API int hwinfo_get_cgroup(const hwinfo_collector *c, hwinfo_cgroup *out);
+HWINFO_API uint64_t hwinfo_timestamp_ms(const hwinfo_collector *c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,334 @@
+#include "cgroup.h"
+#include "psi.h"
+#include "tokenizer.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PROC_SELF_CGROUP "/proc/self/cgroup"
+#define PROC_SELF_MOUNTINFO "/proc/self/mountinfo"
+#define MOUNTINFO_SIZE 65536
+#define CGROUP_BUF_SIZE 8192
+
+static const char *const file_names[CGROUP_FILE_COUNT] = {
+    [CGROUP_CPU_STAT] = "cpu.stat",
+    [CGROUP_CPU_MAX] = "cpu.max",
+    [CGROUP_MEMORY_CURRENT] = "memory.current",
+    [CGROUP_MEMORY_MAX] = "memory.max",
+    [CGROUP_MEMORY_STAT] = "memory.stat",
+    [CGROUP_IO_STAT] = "io.stat",
+    [CGROUP_CPU_PRESSURE] = "cpu.pressure",
+    [CGROUP_MEMORY_PRESSURE] = "memory.pressure",
+    [CGROUP_IO_PRESSURE] = "io.pressure",
+};
+
+static const char *const memory_keys[CGROUP_MEM_FIELD_COUNT] = {
+    [CGROUP_MEM_ANON] = "anon",
+    [CGROUP_MEM_FILE] = "file",
+    [CGROUP_MEM_KERNEL] = "kernel",
+    [CGROUP_MEM_KERNEL_STACK] = "kernel_stack",
+    [CGROUP_MEM_PAGETABLES] = "pagetables",
+    [CGROUP_MEM_SOCK] = "sock",
+    [CGROUP_MEM_SHMEM] = "shmem",
+    [CGROUP_MEM_FILE_MAPPED] = "file_mapped",
+    [CGROUP_MEM_FILE_DIRTY] = "file_dirty",
+    [CGROUP_MEM_FILE_WRITEBACK] = "file_writeback",
+    [CGROUP_MEM_SLAB] = "slab",
+    [CGROUP_MEM_ACTIVE_ANON] = "active_anon",
+    [CGROUP_MEM_INACTIVE_ANON] = "inactive_anon",
+    [CGROUP_MEM_ACTIVE_FILE] = "active_file",
+    [CGROUP_MEM_INACTIVE_FILE] = "inactive_file",
+    [CGROUP_MEM_PGFAULT] = "pgfault",
+    [CGROUP_MEM_PGMAJFAULT] = "pgmajfault",
+};
+
+static const char *const io_keys[CGROUP_IO_FIELD_COUNT] = {
+    [CGROUP_IO_RBYTES] = "rbytes",
+    [CGROUP_IO_WBYTES] = "wbytes",
+    [CGROUP_IO_RIOS] = "rios",
+    [CGROUP_IO_WIOS] = "wios",
+};
+
+enum {
+    CPU_STAT_USAGE,
+    CPU_STAT_USER,
+    CPU_STAT_SYSTEM,
+    CPU_STAT_PERIODS,
+    CPU_STAT_THROTTLED,
+    CPU_STAT_THROTTLED_USEC,
+    CPU_STAT_FIELD_COUNT
+};
+
+static const char *const cpu_stat_keys[CPU_STAT_FIELD_COUNT] = {
+    [CPU_STAT_USAGE] = "usage_usec",
+    [CPU_STAT_USER] = "user_usec",
+    [CPU_STAT_SYSTEM] = "system_usec",
+    [CPU_STAT_PERIODS] = "nr_periods",
+    [CPU_STAT_THROTTLED] = "nr_throttled",
+    [CPU_STAT_THROTTLED_USEC] = "throttled_usec",
+};
+
+const char *cgroup_memory_key(CgroupMemField field) {
+    return memory_keys[field];
+}
+
+const char *cgroup_io_key(CgroupIoField field) {
+    return io_keys[field];
+}
+
+static int find_key(const char *const *keys, int count, const char *key, size_t len) {
+    for (int i = 0; i < count; i++) {
+        if (strncmp(keys[i], key, len) == 0 && keys[i][len] == '\0') return i;
+    }
+    return -1;
+}
+
+// Parses "key value" lines as in cpu.stat and memory.stat; keys that are
+// not in the table are skipped, and missing ones keep the value 0.
+static void parse_keyed(const char *p, const char *end, const char *const *keys, int count,
+                        uint64_t *out) {
+    memset(out, 0, count * sizeof(uint64_t));
+    while (p < end) {
+        const char *key = p;
+        while (p < end && *p != ' ' && *p != '\n') p++;
+        int field = find_key(keys, count, key, p - key);
+        if (field >= 0) parse_u64(p, end, &out[field]);
+        p = skip_line(p, end);
+    }
+}
+
+// io.stat has one "MAJ:MIN rbytes=N wbytes=N ..." line per device; the
+// group's I/O is the sum over all of them.
+static void parse_io_stat(const char *p, const char *end, uint64_t *out) {
+    memset(out, 0, CGROUP_IO_FIELD_COUNT * sizeof(uint64_t));
+    while (p < end && *p != '\n') {
+        const char *line_end = memchr(p, '\n', end - p);
+        if (!line_end) line_end = end;
+        while (p < line_end && *p != ' ') p++;
+        while (p < line_end) {
+            const char *key = ++p;
+            while (p < line_end && *p != '=' && *p != ' ') p++;
+            int field = find_key(io_keys, CGROUP_IO_FIELD_COUNT, key, p - key);
+            if (p < line_end && *p == '=') {
+                uint64_t value;
+                const char *next = parse_u64(p + 1, line_end, &value);
+                if (next && field >= 0) out[field] += value;
+                p = next ? next : p + 1;
+            }
+            while (p < line_end && *p != ' ') p++;
+        }
+        p = line_end + 1;
+    }
+}
+
+// "max" or a byte/microsecond count, as in memory.max and cpu.max.
+static const char *parse_limit(const char *p, const char *end, uint64_t *out) {
+    p = skip_blanks(p, end);
+    if (end - p >= 3 && memcmp(p, "max", 3) == 0) {
+        *out = CGROUP_UNLIMITED;
+        return p + 3;
+    }
+    return parse_u64(p, end, out);
+}
+
+static ssize_t read_cgroup_file(CgroupFiles *cg, CgroupFile file) {
+    return cached_file_read(&cg->files[file], cg->buf, CGROUP_BUF_SIZE);
+}
+
+void cgroup_clear(CgroupFiles *cg) {
+    memset(cg, 0, sizeof(*cg));
+    for (int f = 0; f < CGROUP_FILE_COUNT; f++) cg->files[f] = (CachedFile)CACHED_FILE_INIT(NULL);
+}
+
+int cgroup_open(CgroupFiles *cg, const char *dir, const char *path) {
+    char file_path[PATH_MAX];
+
+    cgroup_clear(cg);
+
+    snprintf(file_path, sizeof(file_path), "%s/cpu.stat", dir);
+    if (!file_exists(file_path)) return 0;
+
+    cg->path = strdup(path);
+    cg->buf = malloc(CGROUP_BUF_SIZE);
+    if (!cg->path || !cg->buf) {
+        cgroup_free(cg);
+        return 0;
+    }
+    for (int f = 0; f < CGROUP_FILE_COUNT; f++) {
+        snprintf(file_path, sizeof(file_path), "%s/%s", dir, file_names[f]);
+        cg->files[f].path = strdup(file_path);
+        if (!cg->files[f].path) {
+            cgroup_free(cg);
+            return 0;
+        }
+    }
+    cg->available = 1;
+    return 1;
+}
+
+// The cgroup2 mount point and the root of the hierarchy it exposes. In a
+// cgroup namespace both /proc/self/cgroup and the mount are relative to
+// the namespace root, so the two still join up.
+static int find_cgroup2_mount(char *mount, size_t mount_size, char *root, size_t root_size) {
+    char *buf = malloc(MOUNTINFO_SIZE);
+    int found = 0;
+
+    if (!buf) return 0;
+    ssize_t len = read_file(PROC_SELF_MOUNTINFO, buf, MOUNTINFO_SIZE);
+    for (char *line = buf, *next; len > 0 && line && *line; line = next) {
+        next = strchr(line, '\n');
+        if (next) *next++ = '\0';
+
+        char *sep = strstr(line, " - ");
+        if (!sep || strncmp(sep + 3, "cgroup2 ", 8) != 0) continue;
+
+        char line_root[PATH_MAX], line_mount[PATH_MAX];
+        if (sscanf(line, "%*s %*s %*s %4095s %4095s", line_root, line_mount) != 2) continue;
+        snprintf(mount, mount_size, "%s", line_mount);
+        snprintf(root, root_size, "%s", line_root);
+        found = 1;
+        break;
+    }
+    free(buf);
+    return found;
+}
+
+// Resolves the cgroup2 directory of this process and its path within
+// the hierarchy. The "0::<path>" line only exists with the unified
+// hierarchy mounted; on pure cgroup v1 systems there is nothing to find.
+int cgroup_resolve(char *dir, size_t dir_size, char *path, size_t path_size) {
+    char buf[4096], mount[PATH_MAX], root[PATH_MAX];
+    const char *rel = NULL;
+
+    if (read_file(PROC_SELF_CGROUP, buf, sizeof(buf)) <= 0) return 0;
+    for (char *line = buf, *next; line && *line; line = next) {
+        next = strchr(line, '\n');
+        if (next) *next++ = '\0';
+        if (strncmp(line, "0::", 3) == 0) {
+            rel = line + 3;
+            break;
+        }
+    }
+    if (!rel || !find_cgroup2_mount(mount, sizeof(mount), root, sizeof(root))) return 0;
+
+    snprintf(path, path_size, "%s", rel);
+    size_t root_len = strlen(root);
+    if (strcmp(root, "/") != 0 && strncmp(rel, root, root_len) == 0 &&
+        (rel[root_len] == '/' || rel[root_len] == '\0')) {
+        rel += root_len;
+    }
+    snprintf(dir, dir_size, "%s%s", mount, strcmp(rel, "/") == 0 ? "" : rel);
+    return 1;
+}
+
+int cgroup_discover(CgroupFiles *cg) {
+    char dir[PATH_MAX], path[PATH_MAX];
+
+    cgroup_clear(cg);
+    if (!cgroup_resolve(dir, sizeof(dir), path, sizeof(path))) return 0;
+    return cgroup_open(cg, dir, path);
+}
+
+void cgroup_free(CgroupFiles *cg) {
+    for (int f = 0; f < CGROUP_FILE_COUNT; f++) {
+        cached_file_close(&cg->files[f]);
+        free((char *)cg->files[f].path);
+        cg->files[f].path = NULL;
+    }
+    free(cg->path);
+    free(cg->buf);
+    cg->path = cg->buf = NULL;
+    cg->available = 0;
+}
+
+static uint64_t delta(uint64_t curr, uint64_t prev) {
+    return curr > prev ? curr - prev : 0;
+}
+
+static void read_counters(CgroupFiles *cg, CgroupStats *out) {
+    uint64_t cpu[CPU_STAT_FIELD_COUNT];
+    ssize_t len;
+
+    len = read_cgroup_file(cg, CGROUP_CPU_STAT);
+    parse_keyed(cg->buf, cg->buf + (len > 0 ? len : 0), cpu_stat_keys, CPU_STAT_FIELD_COUNT, cpu);
+    out->usage_usec = cpu[CPU_STAT_USAGE];
+    out->user_usec = cpu[CPU_STAT_USER];
+    out->system_usec = cpu[CPU_STAT_SYSTEM];
+    out->nr_periods = cpu[CPU_STAT_PERIODS];
+    out->nr_throttled = cpu[CPU_STAT_THROTTLED];
+    out->throttled_usec = cpu[CPU_STAT_THROTTLED_USEC];
+
+    // cpu.max is "<quota> <period>"; quota is "max" without a limit.
+    out->quota_usec = CGROUP_UNLIMITED;
+    out->period_usec = 0;
+    len = read_cgroup_file(cg, CGROUP_CPU_MAX);
+    out->has_cpu_max = len > 0;
+    if (len > 0) {
+        const char *end = cg->buf + len;
+        const char *p = parse_limit(cg->buf, end, &out->quota_usec);
+        if (p) parse_u64(p, end, &out->period_usec);
+    }
+
+    out->memory_current = 0;
+    len = read_cgroup_file(cg, CGROUP_MEMORY_CURRENT);
+    out->has_memory = len > 0;
+    if (len > 0) parse_u64(cg->buf, cg->buf + len, &out->memory_current);
+
+    out->memory_max = CGROUP_UNLIMITED;
+    len = read_cgroup_file(cg, CGROUP_MEMORY_MAX);
+    if (len > 0) parse_limit(cg->buf, cg->buf + len, &out->memory_max);
+
+    len = read_cgroup_file(cg, CGROUP_MEMORY_STAT);
+    parse_keyed(cg->buf, cg->buf + (len > 0 ? len : 0), memory_keys, CGROUP_MEM_FIELD_COUNT,
+                out->memory_stat);
+
+    len = read_cgroup_file(cg, CGROUP_IO_STAT);
+    out->has_io = len >= 0;
+    parse_io_stat(cg->buf, cg->buf + (len > 0 ? len : 0), out->io);
+
+    read_pressure(&cg->files[CGROUP_CPU_PRESSURE], &out->pressure);
+}
+
+// Rates are deltas against prev over the monotonic time between the two
+// samples; counters that went backwards (the group was recreated) count
+// as zero rather than wrapping.
+void cgroup_sample(CgroupFiles *cg, CgroupStats *out, const CgroupStats *prev, int num_cpus) {
+    struct timespec now;
+
+    out->available = cg->available;
+    out->path = cg->path;
+    if (!cg->available) return;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    out->sample_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+    read_counters(cg, out);
+
+    out->cpu_limit = out->quota_usec != CGROUP_UNLIMITED && out->period_usec > 0
+                         ? (double)out->quota_usec / out->period_usec
+                         : 0.0;
+    out->memory_usage = out->memory_max != CGROUP_UNLIMITED && out->memory_max > 0
+                            ? 100.0 * out->memory_current / out->memory_max
+                            : 0.0;
+
+    out->cpu_usage = out->cpus_used = 0.0;
+    out->throttled_percent = out->throttled_ms = 0.0;
+    memset(out->io_rate, 0, sizeof(out->io_rate));
+    if (!prev || !prev->available || out->sample_ns <= prev->sample_ns) return;
+
+    double elapsed_ns = (double)(out->sample_ns - prev->sample_ns);
+    double capacity = out->cpu_limit > 0.0 ? out->cpu_limit : (double)num_cpus;
+    out->cpus_used = delta(out->usage_usec, prev->usage_usec) * 1000.0 / elapsed_ns;
+    if (capacity > 0.0) out->cpu_usage = 100.0 * out->cpus_used / capacity;
+
+    uint64_t periods = delta(out->nr_periods, prev->nr_periods);
+    if (periods > 0) {
+        out->throttled_percent = 100.0 * delta(out->nr_throttled, prev->nr_throttled) / periods;
+    }
+    out->throttled_ms = delta(out->throttled_usec, prev->throttled_usec) / 1000.0;
+
+    for (int f = 0; f < CGROUP_IO_FIELD_COUNT; f++) {
+        out->io_rate[f] = delta(out->io[f], prev->io[f]) * 1e9 / elapsed_ns;
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef CGROUP_H
+#define CGROUP_H
+
+#include "hardware_info.h"
+#include "reader.h"
+
+typedef enum {
+    CGROUP_CPU_STAT,
+    CGROUP_CPU_MAX,
+    CGROUP_MEMORY_CURRENT,
+    CGROUP_MEMORY_MAX,
+    CGROUP_MEMORY_STAT,
+    CGROUP_IO_STAT,
+    CGROUP_CPU_PRESSURE,
+    CGROUP_MEMORY_PRESSURE,
+    CGROUP_IO_PRESSURE,
+    CGROUP_FILE_COUNT
+} CgroupFile;
+
+// The interface files of the process's cgroup v2 group, resolved once
+// from /proc/self/cgroup and the cgroup2 mount. Files missing at the
+// root group or for disabled controllers are simply skipped.
+typedef struct {
+    int available;
+    char *path;
+    CachedFile files[CGROUP_FILE_COUNT];
+    char *buf;
+} CgroupFiles;
+
+int cgroup_resolve(char *dir, size_t dir_size, char *path, size_t path_size);
+void cgroup_clear(CgroupFiles *cg);
+int cgroup_discover(CgroupFiles *cg);
+int cgroup_open(CgroupFiles *cg, const char *dir, const char *path);
+void cgroup_sample(CgroupFiles *cg, CgroupStats *out, const CgroupStats *prev, int num_cpus);
+void cgroup_free(CgroupFiles *cg);
+const char *cgroup_memory_key(CgroupMemField field);
+const char *cgroup_io_key(CgroupIoField field);
+
+#endif
@@ -0,0 +1,374 @@
+#include "collector.h"
+#include "cpustat.h"
+#include "fields.h"
+#include "meminfo.h"
+#include "psi.h"
+#include "selfstats.h"
+#include "topology.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sysinfo.h>
+#include <time.h>
+
+#define PROC_STAT "/proc/stat"
+#define PROC_MEMINFO "/proc/meminfo"
+#define NODE_SYSFS "/sys/devices/system/node"
+#define PROC_PRESSURE_CPU PROC_PRESSURE "/cpu"
+#define PROC_PRESSURE_MEMORY PROC_PRESSURE "/memory"
+#define PROC_PRESSURE_IO PROC_PRESSURE "/io"
+
+// Node meminfo files are CachedFiles like the rest, so each costs one
+// pread per sample after the first.
+static int discover_nodes(Collector *c) {
+    char path[BUFFER_SIZE];
+    int nodes[MAX_NODES];
+    int count = list_numbered(NODE_SYSFS, "node", "", nodes, MAX_NODES);
+
+    if (count == 0) return 1;
+    c->node_meminfo = calloc(count, sizeof(CachedFile));
+    c->node_ids = calloc(count, sizeof(int));
+    if (!c->node_meminfo || !c->node_ids) return 0;
+    for (int i = 0; i < count; i++) {
+        snprintf(path, sizeof(path), NODE_SYSFS "/node%d/meminfo", nodes[i]);
+        char *copy = strdup(path);
+        if (!copy) return 0;
+        c->node_meminfo[i] = (CachedFile)CACHED_FILE_INIT(copy);
+        c->node_ids[i] = nodes[i];
+        c->num_node_files++;
+    }
+    return 1;
+}
+
+int collector_init(Collector *c) {
+    return collector_init_fields(c, FIELDS_ALL);
+}
+
+// Only the files behind the given fields are discovered, and only their
+// collectors run in collector_sample().
+int collector_init_fields(Collector *c, uint32_t fields) {
+    int capacity = possible_cpu_count();
+
+    memset(c, 0, sizeof(*c));
+    c->fields = fields;
+    c->proc_stat = (CachedFile)CACHED_FILE_INIT(PROC_STAT);
+    c->proc_meminfo = (CachedFile)CACHED_FILE_INIT(PROC_MEMINFO);
+    c->pressure[PSI_CPU] = (CachedFile)CACHED_FILE_INIT(PROC_PRESSURE_CPU);
+    c->pressure[PSI_MEMORY] = (CachedFile)CACHED_FILE_INIT(PROC_PRESSURE_MEMORY);
+    c->pressure[PSI_IO] = (CachedFile)CACHED_FILE_INIT(PROC_PRESSURE_IO);
+    // Outside a cgroup v2 hierarchy there is simply no cgroup section.
+    if (fields & FIELD_BIT(FIELD_CGROUP)) {
+        cgroup_discover(&c->cgroup);
+    } else {
+        cgroup_clear(&c->cgroup);
+    }
+    c->stat_buf = malloc(PROC_STAT_SIZE);
+    c->meminfo_buf = malloc(PROC_MEMINFO_SIZE);
+    if (!c->stat_buf || !c->meminfo_buf || !iostats_init(&c->io) ||
+        ((fields & FIELD_BIT(FIELD_MEMORY)) && !discover_nodes(c)) ||
+        ((fields & FIELD_BIT(FIELD_FREQUENCY)) && !cpufreq_discover(&c->cpufreq, capacity))) {
+        collector_free(c);
+        return 0;
+    }
+    return 1;
+}
+
+void collector_free(Collector *c) {
+    cached_file_close(&c->proc_stat);
+    cached_file_close(&c->proc_meminfo);
+    for (int r = 0; r < PSI_RESOURCE_COUNT; r++) cached_file_close(&c->pressure[r]);
+    sensors_free(&c->sensors);
+    cpufreq_free(&c->cpufreq);
+    cgroup_free(&c->cgroup);
+    iostats_free(&c->io);
+    for (int i = 0; i < c->num_node_files; i++) {
+        cached_file_close(&c->node_meminfo[i]);
+        free((char *)c->node_meminfo[i].path);
+    }
+    free(c->node_meminfo);
+    free(c->node_ids);
+    c->node_meminfo = NULL;
+    c->node_ids = NULL;
+    c->num_node_files = 0;
+    free(c->stat_buf);
+    free(c->meminfo_buf);
+    free(c->topology_scratch);
+    window_ring_free(&c->windows);
+    collector_set_top(c, 0);
+    c->stat_buf = c->meminfo_buf = NULL;
+    c->topology_scratch = NULL;
+}
+
+// Keeps a ring deep enough for the longest window at this interval.
+// Replaces any previous set of windows; count == 0 disables them.
+int collector_set_windows(Collector *c, const unsigned *window_ms, int count, unsigned interval_ms) {
+    window_ring_free(&c->windows);
+    if (count == 0) return 1;
+    int depth = window_ring_depth(window_ms, count, interval_ms);
+    return window_ring_init(&c->windows, window_ms, count, depth, possible_cpu_count());
+}
+
+// Enables the process scan with the top count CPU and memory consumers
+// in every sample; count == 0 turns it off again.
+int collector_set_top(Collector *c, int count) {
+    if (c->processes) {
+        process_scanner_free(c->processes);
+        free(c->processes);
+        c->processes = NULL;
+    }
+    if (count == 0) return 1;
+
+    c->processes = malloc(sizeof(ProcessScanner));
+    if (!c->processes || !process_scanner_init(c->processes, count)) {
+        free(c->processes);
+        c->processes = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+// The scratch buffer is sized on first use because the topology is
+// attached to the samples rather than to the collector.
+static void aggregate_topology(Collector *c, SystemInfo *info, const SystemInfo *prev) {
+    const Topology *topo = info->topology;
+    if (!topo || !topo->storage) return;
+
+    if (c->scratch_capacity != topo->capacity) {
+        free(c->topology_scratch);
+        c->topology_scratch = malloc(topology_scratch_size(topo->capacity));
+        c->scratch_capacity = c->topology_scratch ? topo->capacity : 0;
+        if (!c->topology_scratch) return;
+    }
+    topology_aggregate(topo, info, prev, c->topology_scratch);
+}
+
+// Sensors are mapped to CPUs through the topology of the hardware
+// section, so they are discovered with the first sample that brings one.
+// Without it, as for a collector used on its own, a topology is walked
+// for the purpose. sensors_state is 1 once they are, -1 if that failed.
+static void discover_sensors(Collector *c, const SystemInfo *info) {
+    Topology own;
+    const Topology *topo = info->topology;
+
+    c->sensors_state = -1;
+    if (!topo || !topo->storage) {
+        if (!collect_topology(&own, info->cpus.capacity)) return;
+        topo = &own;
+    }
+    if (sensors_discover(&c->sensors, info->cpus.capacity, topo)) c->sensors_state = 1;
+    if (topo == &own) topology_free(&own);
+}
+
+// The sensors count the packages when they are read; without them the
+// count comes from the topology.
+static int package_count(const Topology *topo) {
+    int count = 0;
+    for (int cpu = 0; topo && topo->storage && cpu < topo->capacity; cpu++) {
+        int package = topo->package[cpu];
+        if (package >= count && package < MAX_PACKAGES) count = package + 1;
+    }
+    return count;
+}
+
+static void sample_node_memory(Collector *c, SystemInfo *info) {
+    info->num_mem_nodes = 0;
+    if (!info->node_memory) return;
+
+    for (int n = 0; n < info->node_capacity; n++) info->node_memory[n].present = 0;
+    for (int i = 0; i < c->num_node_files; i++) {
+        int node = c->node_ids[i];
+        if (node >= info->node_capacity) continue;
+        ssize_t len = cached_file_read(&c->node_meminfo[i], c->meminfo_buf, PROC_MEMINFO_SIZE);
+        if (len <= 0) continue;
+        parse_meminfo(c->meminfo_buf, len, &info->node_memory[node]);
+        if (node + 1 > info->num_mem_nodes) info->num_mem_nodes = node + 1;
+    }
+}
+
+// The summary fields predate the full table. Kernels before 3.14 have no
+// MemAvailable, where free + cached is the closest estimate; without a
+// readable /proc/meminfo at all, sysinfo(2) still provides the totals.
+static void summarize_memory(SystemInfo *info) {
+    const MemoryInfo *m = &info->memory;
+    struct sysinfo si;
+
+    if (!(m->present & (1ULL << MEMINFO_MEM_TOTAL))) {
+        if (sysinfo(&si) == 0) {
+            info->total_memory = si.totalram * si.mem_unit;
+            info->free_memory = si.freeram * si.mem_unit;
+            info->swap_total = si.totalswap * si.mem_unit;
+            info->swap_free = si.freeswap * si.mem_unit;
+        }
+        info->cached_memory = 0;
+        info->available_memory = info->free_memory;
+        return;
+    }
+    info->total_memory = m->value[MEMINFO_MEM_TOTAL];
+    info->free_memory = m->value[MEMINFO_MEM_FREE];
+    info->cached_memory = m->value[MEMINFO_CACHED];
+    info->swap_total = m->value[MEMINFO_SWAP_TOTAL];
+    info->swap_free = m->value[MEMINFO_SWAP_FREE];
+    info->available_memory = m->present & (1ULL << MEMINFO_MEM_AVAILABLE)
+                                 ? m->value[MEMINFO_MEM_AVAILABLE]
+                                 : info->free_memory + info->cached_memory;
+}
+
+void collector_sample(Collector *c, SystemInfo *info, SystemInfo *prev_info) {
+    struct timespec now;
+    PhaseTimer sample, phase;
+
+    phase_begin(&sample);
+    clock_gettime(CLOCK_REALTIME, &now);
+    info->timestamp = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+    // Rates and window spans are measured on the monotonic clock so that
+    // wall-clock steps cannot stretch or shrink them.
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    info->monotonic_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+    info->windows = NULL;
+    info->cpufreq = NULL;
+    info->processes = NULL;
+    info->fields = c->fields;
+    if (c->processes && (c->fields & FIELD_BIT(FIELD_PROCESSES))) {
+        phase_begin(&phase);
+        info->processes = process_scan(c->processes, info->monotonic_ns);
+        phase_end(&phase, PHASE_PROCESSES);
+    }
+
+    // Sensors and cpufreq only need to know which CPUs are online, so the
+    // usage arithmetic is done first and timed with the /proc/stat read.
+    ssize_t len = 0;
+    phase_begin(&phase);
+    if (c->fields & FIELDS_NEED_STAT) len = cached_file_read(&c->proc_stat, c->stat_buf, PROC_STAT_SIZE);
+    if (len > 0) {
+        info->num_cores = parse_proc_stat(c->stat_buf, len, &info->total_stats, &info->cpus);
+        info->total_usage = 0.0;
+        memset(info->total_state_usage, 0, sizeof(info->total_state_usage));
+        if (prev_info) {
+            info->total_usage = calculate_cpu_usage(&prev_info->total_stats, &info->total_stats);
+            calculate_state_usage(&prev_info->total_stats, &info->total_stats, info->total_state_usage);
+            calculate_percpu_usage(&info->cpus, &prev_info->cpus);
+            aggregate_topology(c, info, prev_info);
+        }
+        if (c->windows.depth) {
+            window_ring_update(&c->windows, info, info->monotonic_ns);
+            info->windows = &c->windows.results;
+        }
+    }
+    if (c->fields & FIELDS_NEED_STAT) phase_end(&phase, PHASE_STAT);
+
+    if (len > 0 && (c->fields & FIELD_BIT(FIELD_TEMPERATURE)) && c->sensors_state >= 0) {
+        phase_begin(&phase);
+        if (c->sensors_state == 0) discover_sensors(c, info);
+        if (c->sensors_state > 0) sensors_read(&c->sensors, info);
+        phase_end(&phase, PHASE_SENSORS);
+    }
+    if (len <= 0 || !(c->fields & FIELD_BIT(FIELD_TEMPERATURE)) || c->sensors_state < 0) {
+        info->num_packages = package_count(info->topology);
+    }
+    if (len > 0 && (c->fields & FIELD_BIT(FIELD_FREQUENCY))) {
+        phase_begin(&phase);
+        info->cpufreq = cpufreq_sample(&c->cpufreq, info);
+        phase_end(&phase, PHASE_CPUFREQ);
+    }
+
+    if (c->fields & FIELD_BIT(FIELD_MEMORY)) {
+        phase_begin(&phase);
+        len = cached_file_read(&c->proc_meminfo, c->meminfo_buf, PROC_MEMINFO_SIZE);
+        if (len > 0) {
+            parse_meminfo(c->meminfo_buf, len, &info->memory);
+        } else {
+            info->memory.present = 0;
+        }
+        sample_node_memory(c, info);
+        summarize_memory(info);
+        phase_end(&phase, PHASE_MEMINFO);
+    }
+
+    if (c->fields & FIELD_BIT(FIELD_PRESSURE)) {
+        phase_begin(&phase);
+        read_pressure(c->pressure, &info->pressure);
+        phase_end(&phase, PHASE_PRESSURE);
+    }
+    if (c->fields & FIELD_BIT(FIELD_DISKS)) {
+        phase_begin(&phase);
+        collect_disks(&c->io, info, prev_info);
+        phase_end(&phase, PHASE_DISKS);
+    }
+    if (c->fields & FIELD_BIT(FIELD_NETWORK)) {
+        phase_begin(&phase);
+        collect_net_devices(&c->io, info, prev_info);
+        phase_end(&phase, PHASE_NETWORK);
+    }
+    if (c->fields & FIELD_BIT(FIELD_CGROUP)) {
+        phase_begin(&phase);
+        cgroup_sample(&c->cgroup, &info->cgroup, prev_info ? &prev_info->cgroup : NULL, info->num_cores);
+        phase_end(&phase, PHASE_CGROUP);
+    }
+    phase_end(&sample, PHASE_SAMPLE);
+    info->self_stats = selfstats_results();
+}
+
+// Per-CPU storage is sized at runtime from the possible-CPU mask, so
+// SystemInfo has to be initialized before the first sample.
+int system_info_init(SystemInfo *info) {
+    return system_info_init_capacity(info, possible_cpu_count());
+}
+
+int system_info_init_capacity(SystemInfo *info, int capacity) {
+    memset(info, 0, sizeof(SystemInfo));
+    info->fields = FIELDS_ALL;
+    info->node_capacity = possible_node_count();
+    info->node_memory = calloc(info->node_capacity, sizeof(MemoryInfo));
+    if (!info->node_memory || !percpu_init(&info->cpus, capacity)) {
+        system_info_free(info);
+        return 0;
+    }
+    return 1;
+}
+
+void system_info_free(SystemInfo *info) {
+    percpu_free(&info->cpus);
+    free(info->node_memory);
+    info->node_memory = NULL;
+    info->node_capacity = info->num_mem_nodes = 0;
+    free(info->disks);
+    info->disks = NULL;
+    info->disk_capacity = info->num_disks = 0;
+    free(info->net_devices);
+    info->net_devices = NULL;
+    info->net_capacity = info->num_net_devices = 0;
+}
+
+static uint32_t collected_fields = FIELDS_ALL;
+
+static Collector *process_collector(void) {
+    static Collector collector;
+    static int initialized = 0;
+
+    if (!initialized) {
+        if (!collector_init_fields(&collector, collected_fields)) return NULL;
+        initialized = 1;
+    }
+    return &collector;
+}
+
+void collect_system_info(SystemInfo *info, SystemInfo *prev_info) {
+    Collector *c = process_collector();
+    if (c) collector_sample(c, info, prev_info);
+}
+
+int set_usage_windows(const unsigned *window_ms, int count, unsigned interval_ms) {
+    Collector *c = process_collector();
+    return c && collector_set_windows(c, window_ms, count, interval_ms);
+}
+
+// Must be called before anything else uses the process-wide collector,
+// which discovers only what these fields need when it is created.
+void set_collected_fields(uint32_t fields) {
+    collected_fields = fields;
+}
+
+int set_top_processes(int count) {
+    Collector *c = process_collector();
+    return c && collector_set_top(c, count);
+}
@@ -0,0 +1,47 @@
+#ifndef COLLECTOR_H
+#define COLLECTOR_H
+
+#include "hardware_info.h"
+#include "cgroup.h"
+#include "cpufreq.h"
+#include "iostats.h"
+#include "procscan.h"
+#include "reader.h"
+#include "sensors.h"
+#include "window.h"
+
+#define PROC_STAT_SIZE 131072
+#define PROC_MEMINFO_SIZE 8192
+
+// Per-sample collection state: the descriptors that stay open between
+// samples and the buffers they are read into. collect_system_info() uses
+// a process-wide instance; library handles own their own.
+typedef struct {
+    CachedFile proc_stat;
+    CachedFile proc_meminfo;
+    CachedFile pressure[PSI_RESOURCE_COUNT];
+    SensorMap sensors;
+    int sensors_state;
+    CpuFreqMap cpufreq;
+    CgroupFiles cgroup;
+    IoStats io;
+    char *stat_buf;
+    char *meminfo_buf;
+    CachedFile *node_meminfo;
+    int *node_ids;
+    int num_node_files;
+    uint64_t *topology_scratch;
+    int scratch_capacity;
+    WindowRing windows;
+    ProcessScanner *processes;
+    uint32_t fields;
+} Collector;
+
+int collector_init(Collector *c);
+int collector_init_fields(Collector *c, uint32_t fields);
+void collector_free(Collector *c);
+int collector_set_windows(Collector *c, const unsigned *window_ms, int count, unsigned interval_ms);
+int collector_set_top(Collector *c, int count);
+void collector_sample(Collector *c, SystemInfo *info, SystemInfo *prev_info);
+
+#endif
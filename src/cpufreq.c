@@ -0,0 +1,324 @@
+#include "cpufreq.h"
+#include "selfstats.h"
+#include "tokenizer.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#define CPU_SYSFS "/sys/devices/system/cpu"
+#define MSR_DEVICE "/dev/cpu/%d/msr"
+#define CPUFREQ_PATH_LENGTH 128
+#define COUNTER_UNREAD UINT64_MAX
+// An MSR device past the descriptor budget, opened for each sample.
+#define MSR_CLOSED -2
+
+// The TSC ticks at the nominal frequency, MPERF at the same rate but only
+// while the CPU is not halted, and APERF at the actual frequency.
+enum { MSR_TSC, MSR_MPERF, MSR_APERF, MSR_COUNT };
+static const off_t msr_address[MSR_COUNT] = {0x10, 0xe7, 0xe8};
+
+enum { IDLE_TIME, IDLE_USAGE, IDLE_COUNTERS };
+static const char *const idle_counter_names[IDLE_COUNTERS] = {"time", "usage"};
+
+const char *freq_source_name(FreqSource source) {
+    switch (source) {
+    case FREQ_SOURCE_CPUFREQ: return "cpufreq";
+    case FREQ_SOURCE_APERF_MPERF: return "aperf_mperf";
+    default: return "none";
+    }
+}
+
+// A quarter of the descriptor limit: the process scan may take half.
+static int keep_budget(void) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0) return 0;
+    rlim_t quarter = limit.rlim_cur == RLIM_INFINITY ? INT_MAX : limit.rlim_cur / 4;
+    return quarter > INT_MAX ? INT_MAX : (int)quarter;
+}
+
+static int read_msr(int fd, off_t reg, uint64_t *out) {
+    ssize_t n;
+    do {
+        n = pread(fd, out, sizeof(*out), reg);
+        count_read(n);
+    } while (n < 0 && errno == EINTR);
+    return n == sizeof(*out);
+}
+
+// The msr driver needs CAP_SYS_RAWIO and the CPU has to implement
+// APERF/MPERF; if the first CPU that has a device cannot read them,
+// cpufreq is used instead. The devices share the descriptor budget with
+// the sysfs files, ahead of them like scaling_cur_freq would be.
+static int open_msrs(CpuFreqMap *map) {
+    char path[CPUFREQ_PATH_LENGTH];
+    int opened = 0;
+
+    for (int cpu = 0; cpu < map->capacity; cpu++) {
+        uint64_t value;
+        snprintf(path, sizeof(path), MSR_DEVICE, cpu);
+        map->msr[cpu] = sysroot_open(path, O_RDONLY | O_CLOEXEC);
+        if (map->msr[cpu] < 0) continue;
+        if (!opened && !read_msr(map->msr[cpu], msr_address[MSR_APERF], &value)) break;
+        opened++;
+        if (cpu >= map->keep_files) {
+            close(map->msr[cpu]);
+            map->msr[cpu] = MSR_CLOSED;
+        }
+    }
+    if (opened > 0) return 1;
+    for (int cpu = 0; cpu < map->capacity; cpu++) {
+        if (map->msr[cpu] >= 0) close(map->msr[cpu]);
+        map->msr[cpu] = -1;
+    }
+    return 0;
+}
+
+static int init_file(CachedFile *file, const char *path) {
+    char *copy = strdup(path);
+    if (!copy) return 0;
+    *file = (CachedFile)CACHED_FILE_INIT(copy);
+    return 1;
+}
+
+static int discover_cur_freq(CpuFreqMap *map) {
+    char path[CPUFREQ_PATH_LENGTH];
+    int found = 0;
+
+    for (int cpu = 0; cpu < map->capacity; cpu++) {
+        snprintf(path, sizeof(path), CPU_SYSFS "/cpu%d/cpufreq/scaling_cur_freq", cpu);
+        if (!init_file(&map->cur_freq[cpu], path)) return -1;
+        found |= file_exists(path);
+    }
+    return found;
+}
+
+// Every CPU normally has the same states as the first one that has any.
+// A CPU without them only has absent files, which read as unknown.
+static int discover_idle_states(CpuFreqMap *map, int states[MAX_IDLE_STATES]) {
+    CpuFreqStats *r = &map->results;
+    char path[CPUFREQ_PATH_LENGTH], name[IDLE_STATE_NAME_MAX];
+
+    for (int cpu = 0; cpu < map->capacity && r->num_idle_states == 0; cpu++) {
+        snprintf(path, sizeof(path), CPU_SYSFS "/cpu%d/cpuidle", cpu);
+        r->num_idle_states = list_numbered(path, "state", "", states, MAX_IDLE_STATES);
+        for (int s = 0; s < r->num_idle_states; s++) {
+            snprintf(path, sizeof(path), CPU_SYSFS "/cpu%d/cpuidle/state%d/name", cpu, states[s]);
+            if (!read_file_line(path, name, sizeof(name))) snprintf(name, sizeof(name), "state%d", states[s]);
+            memcpy(r->idle_names[s], name, IDLE_STATE_NAME_MAX);
+        }
+    }
+    return r->num_idle_states;
+}
+
+static int open_idle_files(CpuFreqMap *map, const int states[MAX_IDLE_STATES]) {
+    char path[CPUFREQ_PATH_LENGTH];
+    int n = map->results.num_idle_states * IDLE_COUNTERS;
+
+    map->idle_files = calloc((size_t)n * map->capacity, sizeof(CachedFile));
+    map->idle_prev = malloc((size_t)n * map->capacity * sizeof(uint64_t));
+    if (!map->idle_files || !map->idle_prev) return 0;
+    for (int i = 0; i < n * map->capacity; i++) {
+        map->idle_files[i] = (CachedFile)CACHED_FILE_INIT(NULL);
+        map->idle_prev[i] = COUNTER_UNREAD;
+    }
+    for (int s = 0; s < map->results.num_idle_states; s++) {
+        for (int k = 0; k < IDLE_COUNTERS; k++) {
+            CachedFile *files = map->idle_files + (size_t)(s * IDLE_COUNTERS + k) * map->capacity;
+            for (int cpu = 0; cpu < map->capacity; cpu++) {
+                snprintf(path, sizeof(path), CPU_SYSFS "/cpu%d/cpuidle/state%d/%s", cpu, states[s],
+                         idle_counter_names[k]);
+                if (!init_file(&files[cpu], path)) return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+static int alloc_results(CpuFreqMap *map) {
+    CpuFreqStats *r = &map->results;
+    int arrays = 1 + 2 * r->num_idle_states;
+    double *p = calloc((size_t)arrays * map->capacity, sizeof(double));
+
+    if (!p) return 0;
+    map->storage = p;
+    r->capacity = map->capacity;
+    r->mhz = p;
+    for (int s = 0; s < r->num_idle_states; s++) {
+        r->idle_residency[s] = p + (size_t)(1 + s) * map->capacity;
+        r->idle_rate[s] = p + (size_t)(1 + r->num_idle_states + s) * map->capacity;
+    }
+    return 1;
+}
+
+// Resolves every path once. Returns 0 only on allocation failure; a
+// machine without cpufreq, cpuidle and msr access simply has no data.
+int cpufreq_discover(CpuFreqMap *map, int capacity) {
+    int states[MAX_IDLE_STATES];
+
+    memset(map, 0, sizeof(*map));
+    map->capacity = capacity;
+    map->keep_files = keep_budget();
+    map->msr = malloc(capacity * sizeof(int));
+    map->msr_prev = malloc((size_t)capacity * MSR_COUNT * sizeof(uint64_t));
+    map->cur_freq = calloc(capacity, sizeof(CachedFile));
+    if (!map->msr || !map->msr_prev || !map->cur_freq) goto fail;
+    for (int cpu = 0; cpu < capacity; cpu++) {
+        map->cur_freq[cpu] = (CachedFile)CACHED_FILE_INIT(NULL);
+        map->msr[cpu] = -1;
+    }
+    for (int i = 0; i < capacity * MSR_COUNT; i++) map->msr_prev[i] = COUNTER_UNREAD;
+
+    int has_cpufreq = discover_cur_freq(map);
+    if (has_cpufreq < 0) goto fail;
+    if (open_msrs(map)) {
+        map->results.source = FREQ_SOURCE_APERF_MPERF;
+    } else if (has_cpufreq) {
+        map->results.source = FREQ_SOURCE_CPUFREQ;
+    }
+    if (discover_idle_states(map, states) && !open_idle_files(map, states)) goto fail;
+    if (!alloc_results(map)) goto fail;
+    return 1;
+
+fail:
+    cpufreq_free(map);
+    return 0;
+}
+
+void cpufreq_free(CpuFreqMap *map) {
+    int idle_files = map->results.num_idle_states * IDLE_COUNTERS * map->capacity;
+
+    for (int cpu = 0; map->cur_freq && cpu < map->capacity; cpu++) {
+        cached_file_close(&map->cur_freq[cpu]);
+        free((char *)map->cur_freq[cpu].path);
+    }
+    for (int i = 0; map->idle_files && i < idle_files; i++) {
+        cached_file_close(&map->idle_files[i]);
+        free((char *)map->idle_files[i].path);
+    }
+    for (int cpu = 0; map->msr && cpu < map->capacity; cpu++) {
+        if (map->msr[cpu] >= 0) close(map->msr[cpu]);
+    }
+    free(map->cur_freq);
+    free(map->idle_files);
+    free(map->idle_prev);
+    free(map->msr);
+    free(map->msr_prev);
+    free(map->storage);
+    memset(map, 0, sizeof(*map));
+}
+
+// Files past the descriptor budget are opened and closed around each read.
+static int read_counter(const CpuFreqMap *map, CachedFile *file, int index, uint64_t *out) {
+    char buf[32];
+    ssize_t n = cached_file_read(file, buf, sizeof(buf));
+    if (index >= map->keep_files && file->fd >= 0) cached_file_close(file);
+    return n > 0 && parse_u64(buf, buf + n, out) != NULL;
+}
+
+static double counter_delta(uint64_t curr, uint64_t prev) {
+    return prev != COUNTER_UNREAD && curr >= prev ? (double)(curr - prev) : -1.0;
+}
+
+// Ticks of the TSC per microsecond is its frequency in MHz; scaled by
+// APERF/MPERF it becomes the average frequency while running.
+static void sample_msr(CpuFreqMap *map, const uint8_t *online, int count, double elapsed_us) {
+    char path[CPUFREQ_PATH_LENGTH];
+
+    for (int cpu = 0; cpu < count; cpu++) {
+        uint64_t v[MSR_COUNT], *prev = &map->msr_prev[cpu * MSR_COUNT];
+        int fd = map->msr[cpu];
+        if (fd == MSR_CLOSED && online[cpu]) {
+            snprintf(path, sizeof(path), MSR_DEVICE, cpu);
+            fd = sysroot_open(path, O_RDONLY | O_CLOEXEC);
+        }
+        int ok = online[cpu] && fd >= 0;
+        for (int i = 0; ok && i < MSR_COUNT; i++) ok = read_msr(fd, msr_address[i], &v[i]);
+        if (fd >= 0 && map->msr[cpu] == MSR_CLOSED) {
+            close(fd);
+            count_syscalls(1);
+        }
+
+        map->results.mhz[cpu] = 0.0;
+        if (!ok) {
+            for (int i = 0; i < MSR_COUNT; i++) prev[i] = COUNTER_UNREAD;
+            continue;
+        }
+        double tsc = counter_delta(v[MSR_TSC], prev[MSR_TSC]);
+        double mperf = counter_delta(v[MSR_MPERF], prev[MSR_MPERF]);
+        double aperf = counter_delta(v[MSR_APERF], prev[MSR_APERF]);
+        if (elapsed_us > 0 && tsc > 0 && mperf > 0 && aperf >= 0) {
+            map->results.mhz[cpu] = tsc / elapsed_us * aperf / mperf;
+        }
+        memcpy(prev, v, sizeof(v));
+    }
+}
+
+static void sample_cur_freq(CpuFreqMap *map, const uint8_t *online, int count) {
+    for (int cpu = 0; cpu < count; cpu++) {
+        uint64_t khz;
+        int ok = online[cpu] && read_counter(map, &map->cur_freq[cpu], cpu, &khz);
+        map->results.mhz[cpu] = ok ? khz / 1000.0 : 0.0;
+    }
+}
+
+// Counters are walked state by state so that each pass fills one
+// contiguous per-CPU array.
+static void sample_idle(CpuFreqMap *map, const uint8_t *online, int count, double elapsed_us) {
+    CpuFreqStats *r = &map->results;
+    int first = r->source != FREQ_SOURCE_NONE ? map->capacity : 0;
+
+    for (int s = 0; s < r->num_idle_states; s++) {
+        for (int k = 0; k < IDLE_COUNTERS; k++) {
+            size_t base = (size_t)(s * IDLE_COUNTERS + k) * map->capacity;
+            double *out = k == IDLE_TIME ? r->idle_residency[s] : r->idle_rate[s];
+            for (int cpu = 0; cpu < count; cpu++) {
+                uint64_t value;
+                uint64_t *prev = &map->idle_prev[base + cpu];
+                int index = first + (int)(base + cpu);
+                if (!online[cpu] || !read_counter(map, &map->idle_files[base + cpu], index, &value)) {
+                    *prev = COUNTER_UNREAD;
+                    out[cpu] = 0.0;
+                    continue;
+                }
+                double d = elapsed_us > 0 ? counter_delta(value, *prev) : -1.0;
+                *prev = value;
+                if (d < 0) {
+                    out[cpu] = 0.0;
+                } else if (k == IDLE_TIME) {
+                    out[cpu] = d * 100.0 / elapsed_us;
+                    if (out[cpu] > 100.0) out[cpu] = 100.0;
+                } else {
+                    out[cpu] = d * 1e6 / elapsed_us;
+                }
+            }
+        }
+    }
+}
+
+const CpuFreqStats *cpufreq_sample(CpuFreqMap *map, const SystemInfo *info) {
+    CpuFreqStats *r = &map->results;
+    if (r->source == FREQ_SOURCE_NONE && r->num_idle_states == 0) return NULL;
+
+    // A sample sized for fewer CPUs than the map leaves the rest at 0.
+    const uint8_t *online = info->cpus.online;
+    int count = info->cpus.capacity < map->capacity ? info->cpus.capacity : map->capacity;
+    double elapsed_us = 0.0;
+    if (map->has_prev && info->monotonic_ns > map->prev_ns) {
+        elapsed_us = (info->monotonic_ns - map->prev_ns) / 1e3;
+    }
+    if (r->source == FREQ_SOURCE_APERF_MPERF) {
+        sample_msr(map, online, count, elapsed_us);
+    } else if (r->source == FREQ_SOURCE_CPUFREQ) {
+        sample_cur_freq(map, online, count);
+    }
+    sample_idle(map, online, count, elapsed_us);
+    r->idle_valid = r->num_idle_states > 0 && elapsed_us > 0;
+    map->prev_ns = info->monotonic_ns;
+    map->has_prev = 1;
+    return r;
+}
@@ -0,0 +1,62 @@
+#ifndef CPUFREQ_H
+#define CPUFREQ_H
+
+#include "hardware_info.h"
+#include "reader.h"
+
+// The kernel's CPUIDLE_STATE_MAX.
+#define MAX_IDLE_STATES 10
+#define IDLE_STATE_NAME_MAX 16
+
+typedef enum {
+    FREQ_SOURCE_NONE,
+    FREQ_SOURCE_CPUFREQ,
+    FREQ_SOURCE_APERF_MPERF
+} FreqSource;
+
+// Per-CPU frequency and C-state residency over the interval since the
+// previous sample. With APERF/MPERF, mhz is the average frequency while
+// the CPU was not halted (turbostat's Bzy_MHz); from cpufreq it is
+// scaling_cur_freq at the time of the sample. 0 means unknown. Idle
+// residency is the percentage of the interval spent in each cpuidle
+// state and idle_rate how often per second the state was entered; both
+// are 0 until there is a previous sample (idle_valid).
+struct CpuFreqStats {
+    FreqSource source;
+    int capacity;
+    int num_idle_states;
+    int idle_valid;
+    char idle_names[MAX_IDLE_STATES][IDLE_STATE_NAME_MAX];
+    double *mhz;
+    double *idle_residency[MAX_IDLE_STATES];
+    double *idle_rate[MAX_IDLE_STATES];
+};
+
+// The counter files of every CPU, resolved once. msr[cpu] is an open
+// /dev/cpu/<cpu>/msr, -2 when it is opened for every sample or -1. The
+// frequency source takes the first capacity descriptors of the budget and
+// the idle files the rest. Idle files are indexed by
+// (state * 2 + IDLE_TIME/IDLE_USAGE) * capacity + cpu; the last reading of
+// each counter is kept for the next delta. Descriptors beyond keep_files
+// are closed after every read so that large machines stay within the
+// descriptor limit.
+typedef struct {
+    int capacity;
+    int keep_files;
+    CachedFile *cur_freq;
+    int *msr;
+    uint64_t *msr_prev;
+    CachedFile *idle_files;
+    uint64_t *idle_prev;
+    uint64_t prev_ns;
+    int has_prev;
+    void *storage;
+    CpuFreqStats results;
+} CpuFreqMap;
+
+int cpufreq_discover(CpuFreqMap *map, int capacity);
+const CpuFreqStats *cpufreq_sample(CpuFreqMap *map, const SystemInfo *info);
+void cpufreq_free(CpuFreqMap *map);
+const char *freq_source_name(FreqSource source);
+
+#endif
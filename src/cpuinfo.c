@@ -0,0 +1,200 @@
+#define _GNU_SOURCE
+#include "cpuinfo.h"
+#include "reader.h"
+#include "selfstats.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CPUINFO_INITIAL_SIZE 65536
+
+static int is_blank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+// procfs reports st_size == 0 for cpuinfo, so grow the buffer until a
+// read returns end of file.
+static int read_all(const char *path, char **out, size_t *out_len) {
+    int fd = sysroot_open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+
+    size_t cap = CPUINFO_INITIAL_SIZE;
+    size_t len = 0;
+    char *buf = malloc(cap);
+    while (buf) {
+        if (len == cap) {
+            char *grown = realloc(buf, cap * 2);
+            if (!grown) {
+                free(buf);
+                buf = NULL;
+                break;
+            }
+            buf = grown;
+            cap *= 2;
+        }
+        ssize_t n = read(fd, buf + len, cap - len);
+        count_read(n);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        len += n;
+    }
+    close(fd);
+    count_syscalls(1);
+
+    if (!buf) return 0;
+    *out = buf;
+    *out_len = len;
+    return 1;
+}
+
+static int push_field(Cpuinfo *ci, int *cap, const CpuinfoField *field) {
+    if (ci->num_fields == *cap) {
+        int new_cap = *cap ? *cap * 2 : 64;
+        CpuinfoField *grown = realloc(ci->fields, new_cap * sizeof(*grown));
+        if (!grown) return 0;
+        ci->fields = grown;
+        *cap = new_cap;
+    }
+    ci->fields[ci->num_fields++] = *field;
+    return 1;
+}
+
+static int push_block(Cpuinfo *ci, int *cap, int is_processor) {
+    if (ci->num_blocks == *cap) {
+        int new_cap = *cap ? *cap * 2 : 4;
+        CpuinfoBlock *grown = realloc(ci->blocks, new_cap * sizeof(*grown));
+        if (!grown) return 0;
+        ci->blocks = grown;
+        *cap = new_cap;
+    }
+    CpuinfoBlock *block = &ci->blocks[ci->num_blocks++];
+    block->first_field = ci->num_fields;
+    block->num_fields = 0;
+    block->is_processor = is_processor;
+    return 1;
+}
+
+// Tokenizes one "key<tabs>: value" line. Returns 0 for lines without a
+// separator.
+static int split_line(const char *line, const char *end, CpuinfoField *field) {
+    const char *colon = memchr(line, ':', end - line);
+    if (!colon) return 0;
+
+    const char *key_end = colon;
+    while (key_end > line && is_blank(key_end[-1])) key_end--;
+    const char *value = colon + 1;
+    while (value < end && is_blank(*value)) value++;
+    const char *value_end = end;
+    while (value_end > value && is_blank(value_end[-1])) value_end--;
+
+    field->key = line;
+    field->key_len = key_end - line;
+    field->value = value;
+    field->value_len = value_end - value;
+    return 1;
+}
+
+static int tokenize(Cpuinfo *ci) {
+    const char *p = ci->buf;
+    const char *end = ci->buf + ci->len;
+    int field_cap = 0, block_cap = 0;
+
+    while (p < end) {
+        // Skip blank lines between blocks.
+        while (p < end && *p == '\n') p++;
+        if (p >= end) break;
+
+        int is_processor = end - p >= 9 && memcmp(p, "processor", 9) == 0;
+        if (is_processor) ci->num_processors++;
+
+        if (is_processor && ci->num_processors > 1) {
+            const char *next = memmem(p, end - p, "\n\n", 2);
+            p = next ? next + 2 : end;
+            continue;
+        }
+
+        if (!push_block(ci, &block_cap, is_processor)) return 0;
+        CpuinfoBlock *block = &ci->blocks[ci->num_blocks - 1];
+        while (p < end && *p != '\n') {
+            const char *eol = memchr(p, '\n', end - p);
+            if (!eol) eol = end;
+            CpuinfoField field;
+            if (split_line(p, eol, &field)) {
+                if (!push_field(ci, &field_cap, &field)) return 0;
+                block->num_fields++;
+            }
+            p = eol < end ? eol + 1 : end;
+        }
+    }
+    return 1;
+}
+
+int cpuinfo_load(Cpuinfo *ci, const char *path) {
+    memset(ci, 0, sizeof(*ci));
+    if (!read_all(path, &ci->buf, &ci->len)) return 0;
+    if (!tokenize(ci)) {
+        cpuinfo_free(ci);
+        return 0;
+    }
+    return 1;
+}
+
+void cpuinfo_free(Cpuinfo *ci) {
+    free(ci->buf);
+    free(ci->fields);
+    free(ci->blocks);
+    memset(ci, 0, sizeof(*ci));
+}
+
+// Returns the first indexed occurrence of key, searching the first
+// processor block before any trailing machine-wide blocks.
+const CpuinfoField *cpuinfo_find(const Cpuinfo *ci, const char *key) {
+    size_t key_len = strlen(key);
+    for (int i = 0; i < ci->num_fields; i++) {
+        const CpuinfoField *field = &ci->fields[i];
+        if (field->key_len == key_len && memcmp(field->key, key, key_len) == 0) {
+            return field;
+        }
+    }
+    return NULL;
+}
+
+int cpuinfo_copy(const Cpuinfo *ci, const char *key, char *dest, size_t size) {
+    const CpuinfoField *field = cpuinfo_find(ci, key);
+    if (!field || size == 0) return 0;
+    size_t n = field->value_len < size - 1 ? field->value_len : size - 1;
+    memcpy(dest, field->value, n);
+    dest[n] = '\0';
+    return 1;
+}
+
+// Checks for a whole word in the "flags" (x86) or "Features" (ARM) line,
+// which can be longer than any fixed-size line buffer.
+int cpuinfo_has_flag(const Cpuinfo *ci, const char *flag) {
+    const CpuinfoField *field = cpuinfo_find(ci, "flags");
+    if (!field) field = cpuinfo_find(ci, "Features");
+    if (!field) return 0;
+
+    size_t flag_len = strlen(flag);
+    const char *p = field->value;
+    const char *end = field->value + field->value_len;
+    while (p < end) {
+        const char *word_end = memchr(p, ' ', end - p);
+        if (!word_end) word_end = end;
+        if ((size_t)(word_end - p) == flag_len && memcmp(p, flag, flag_len) == 0) return 1;
+        p = word_end + 1;
+    }
+    return 0;
+}
+
+// DJB hash of the raw file contents, used as a last-resort VM identifier.
+unsigned long cpuinfo_hash(const Cpuinfo *ci) {
+    unsigned long hash = 5381;
+    const unsigned char *p = (const unsigned char *)ci->buf;
+    for (size_t i = 0; i < ci->len; i++) {
+        hash = ((hash << 5) + hash) + p[i];
+    }
+    return hash;
+}
@@ -0,0 +1,43 @@
+#ifndef CPUINFO_H
+#define CPUINFO_H
+
+#include <stddef.h>
+
+// A key/value line of /proc/cpuinfo. Both point into Cpuinfo.buf and are
+// not NUL-terminated.
+typedef struct {
+    const char *key;
+    size_t key_len;
+    const char *value;
+    size_t value_len;
+} CpuinfoField;
+
+typedef struct {
+    int first_field;
+    int num_fields;
+    int is_processor;
+} CpuinfoBlock;
+
+// /proc/cpuinfo read once into a single buffer and tokenized once. Only
+// the first "processor" block and any non-processor blocks (the trailing
+// Hardware/Revision/Serial block on ARM) are indexed; the identity fields
+// the collectors need are the same for every processor, so later
+// processor blocks are skipped without being tokenized.
+typedef struct {
+    char *buf;
+    size_t len;
+    CpuinfoField *fields;
+    int num_fields;
+    CpuinfoBlock *blocks;
+    int num_blocks;
+    int num_processors;
+} Cpuinfo;
+
+int cpuinfo_load(Cpuinfo *ci, const char *path);
+void cpuinfo_free(Cpuinfo *ci);
+const CpuinfoField *cpuinfo_find(const Cpuinfo *ci, const char *key);
+int cpuinfo_copy(const Cpuinfo *ci, const char *key, char *dest, size_t size);
+int cpuinfo_has_flag(const Cpuinfo *ci, const char *flag);
+unsigned long cpuinfo_hash(const Cpuinfo *ci);
+
+#endif
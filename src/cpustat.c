@@ -0,0 +1,201 @@
+#include "cpustat.h"
+#include "reader.h"
+#include "tokenizer.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CPU_POSSIBLE "/sys/devices/system/cpu/possible"
+#define PERCPU_ALIGN 64
+
+// Parses a cpulist such as "0-383" or "0,2-5,8" and returns the highest
+// CPU id plus one.
+static int cpulist_capacity(const char *list) {
+    int capacity = 0;
+    const char *p = list;
+    while (*p) {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p) break;
+        long last = first;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p) break;
+        }
+        if (last + 1 > capacity) capacity = last + 1;
+        p = end;
+        if (*p == ',') p++;
+    }
+    return capacity;
+}
+
+int possible_cpu_count(void) {
+    char buffer[BUFFER_SIZE];
+    int capacity = 0;
+
+    if (read_file_line(CPU_POSSIBLE, buffer, sizeof(buffer))) {
+        capacity = cpulist_capacity(buffer);
+    }
+    if (capacity <= 0) {
+        long configured = sysconf(_SC_NPROCESSORS_CONF);
+        capacity = configured > 0 ? (int)configured : 1;
+    }
+    return capacity;
+}
+
+static size_t align_up(size_t n) {
+    return (n + PERCPU_ALIGN - 1) & ~(size_t)(PERCPU_ALIGN - 1);
+}
+
+// All arrays live in one cache-line aligned allocation so that a sample
+// is a handful of contiguous streams rather than one record per CPU.
+int percpu_init(PerCPUStats *cpus, int capacity) {
+    size_t u64_bytes = align_up(capacity * sizeof(uint64_t));
+    size_t dbl_bytes = align_up(capacity * sizeof(double));
+    size_t int_bytes = align_up(capacity * sizeof(int));
+    size_t flag_bytes = align_up(capacity);
+    size_t size = (CPU_STATE_COUNT + 1) * u64_bytes + (CPU_STATE_COUNT + 2) * dbl_bytes +
+                  int_bytes + flag_bytes;
+
+    memset(cpus, 0, sizeof(*cpus));
+    char *storage = aligned_alloc(PERCPU_ALIGN, size);
+    if (!storage) return 0;
+    memset(storage, 0, size);
+
+    char *p = storage;
+    for (int s = 0; s < CPU_STATE_COUNT; s++) {
+        cpus->time[s] = (uint64_t *)p;
+        p += u64_bytes;
+    }
+    cpus->total = (uint64_t *)p;
+    p += u64_bytes;
+    cpus->usage = (double *)p;
+    p += dbl_bytes;
+    cpus->core_usage = (double *)p;
+    p += dbl_bytes;
+    for (int s = 0; s < CPU_STATE_COUNT; s++) {
+        cpus->state_usage[s] = (double *)p;
+        p += dbl_bytes;
+    }
+    cpus->temperature = (int *)p;
+    for (int i = 0; i < capacity; i++) cpus->temperature[i] = TEMPERATURE_UNKNOWN;
+    p += int_bytes;
+    cpus->online = (uint8_t *)p;
+
+    cpus->capacity = capacity;
+    cpus->storage = storage;
+    return 1;
+}
+
+void percpu_free(PerCPUStats *cpus) {
+    free(cpus->storage);
+    memset(cpus, 0, sizeof(*cpus));
+}
+
+// Reads the ten counters of a cpu line straight into values. Older
+// kernels print fewer columns; the missing ones are left at zero.
+static const char *parse_cpu_line(const char *p, const char *end, uint64_t *values) {
+    int s = 0;
+    for (; s < CPU_STATE_COUNT; s++) {
+        const char *next = parse_u64(p, end, &values[s]);
+        if (!next) break;
+        p = next;
+    }
+    for (; s < CPU_STATE_COUNT; s++) values[s] = 0;
+    return skip_line(p, end);
+}
+
+static uint64_t sum_states(const uint64_t *values) {
+    uint64_t sum = 0;
+    for (int s = 0; s < CPU_TOTAL_STATES; s++) sum += values[s];
+    return sum;
+}
+
+// Fills the aggregate and per-CPU counters from the cpu lines of
+// /proc/stat in a single pass over the buffer. Offline CPUs have no line,
+// so ids are taken from the line itself instead of assuming the
+// numbering is dense. Returns the number of CPUs seen.
+int parse_proc_stat(const char *buf, size_t len, CPUStats *total, PerCPUStats *cpus) {
+    const char *p = buf;
+    const char *end = buf + len;
+    int seen = 0;
+
+    memset(cpus->online, 0, cpus->capacity);
+    while (end - p > 3 && p[0] == 'c' && p[1] == 'p' && p[2] == 'u') {
+        uint64_t values[CPU_STATE_COUNT];
+        uint64_t cpu;
+
+        if (p[3] == ' ') {
+            p = parse_cpu_line(p + 3, end, total->time);
+            total->total = sum_states(total->time);
+            continue;
+        }
+
+        const char *fields = parse_u64(p + 3, end, &cpu);
+        if (!fields || cpu >= (uint64_t)cpus->capacity) {
+            p = skip_line(p, end);
+            continue;
+        }
+        p = parse_cpu_line(fields, end, values);
+        for (int s = 0; s < CPU_STATE_COUNT; s++) {
+            cpus->time[s][cpu] = values[s];
+        }
+        cpus->total[cpu] = sum_states(values);
+        cpus->online[cpu] = 1;
+        seen++;
+    }
+    return seen;
+}
+
+double calculate_cpu_usage(const CPUStats *prev, const CPUStats *curr) {
+    uint64_t total_diff = curr->total - prev->total;
+    uint64_t idle_diff = curr->time[CPU_IDLE] - prev->time[CPU_IDLE];
+    if (total_diff == 0) return 0.0;
+    return 100.0 * (1.0 - ((double)idle_diff / total_diff));
+}
+
+// Share of the elapsed time spent in each state, in percent. guest and
+// guest_nice are already part of user and nice, so they are reported
+// against the same total and the other states add up to 100.
+void calculate_state_usage(const CPUStats *prev, const CPUStats *curr, double *out) {
+    uint64_t total_diff = curr->total - prev->total;
+    for (int s = 0; s < CPU_STATE_COUNT; s++) {
+        uint64_t diff = curr->time[s] - prev->time[s];
+        out[s] = total_diff ? 100.0 * diff / total_diff : 0.0;
+    }
+}
+
+// Branch-free over the whole array so the compiler can vectorize it. A
+// CPU only gets a usage value when it was online in both samples.
+void calculate_percpu_usage(PerCPUStats *curr, const PerCPUStats *prev) {
+    const uint64_t *restrict total = curr->total;
+    const uint64_t *restrict idle = curr->time[CPU_IDLE];
+    const uint64_t *restrict prev_total = prev->total;
+    const uint64_t *restrict prev_idle = prev->time[CPU_IDLE];
+    const uint8_t *restrict online = curr->online;
+    const uint8_t *restrict prev_online = prev->online;
+    double *restrict usage = curr->usage;
+    int n = curr->capacity < prev->capacity ? curr->capacity : prev->capacity;
+
+    for (int i = 0; i < n; i++) {
+        double total_diff = (double)(total[i] - prev_total[i]);
+        double idle_diff = (double)(idle[i] - prev_idle[i]);
+        double valid = (double)(online[i] & prev_online[i]) * (total_diff > 0.0);
+        double divisor = total_diff > 0.0 ? total_diff : 1.0;
+        usage[i] = valid * 100.0 * (1.0 - idle_diff / divisor);
+    }
+
+    // One pass per state keeps every loop a plain stream over two arrays.
+    for (int s = 0; s < CPU_STATE_COUNT; s++) {
+        const uint64_t *restrict time = curr->time[s];
+        const uint64_t *restrict prev_time = prev->time[s];
+        double *restrict state = curr->state_usage[s];
+        for (int i = 0; i < n; i++) {
+            double total_diff = (double)(total[i] - prev_total[i]);
+            double valid = (double)(online[i] & prev_online[i]) * (total_diff > 0.0);
+            double divisor = total_diff > 0.0 ? total_diff : 1.0;
+            state[i] = valid * 100.0 * (double)(time[i] - prev_time[i]) / divisor;
+        }
+    }
+}
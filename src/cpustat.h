@@ -0,0 +1,15 @@
+#ifndef CPUSTAT_H
+#define CPUSTAT_H
+
+#include "hardware_info.h"
+#include <stddef.h>
+
+int possible_cpu_count(void);
+int percpu_init(PerCPUStats *cpus, int capacity);
+void percpu_free(PerCPUStats *cpus);
+int parse_proc_stat(const char *buf, size_t len, CPUStats *total, PerCPUStats *cpus);
+double calculate_cpu_usage(const CPUStats *prev, const CPUStats *curr);
+void calculate_state_usage(const CPUStats *prev, const CPUStats *curr, double *out);
+void calculate_percpu_usage(PerCPUStats *curr, const PerCPUStats *prev);
+
+#endif
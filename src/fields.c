@@ -0,0 +1,66 @@
+#include "fields.h"
+#include <string.h>
+
+// Selector names follow the JSON: a name selects the field with that
+// path and everything below it, so "hardware" is all of hardware.* and
+// "cpu_usage" all of cpu_usage.*.
+static const char *const field_names[FIELD_COUNT] = {
+    [FIELD_SYSTEM_UUID] = "hardware.system_uuid",
+    [FIELD_MOTHERBOARD_SERIAL] = "hardware.motherboard_serial",
+    [FIELD_PRODUCT_NAME] = "hardware.product_name",
+    [FIELD_VIRTUALIZATION] = "hardware.virtualization",
+    [FIELD_HARDWARE_CPU] = "hardware.cpu",
+    [FIELD_BIOS] = "hardware.bios",
+    [FIELD_TOPOLOGY] = "hardware.topology",
+    [FIELD_CPU_USAGE] = "cpu_usage.usage",
+    [FIELD_TEMPERATURE] = "cpu_usage.temperature",
+    [FIELD_FREQUENCY] = "cpu_usage.frequency",
+    [FIELD_MEMORY] = "memory",
+    [FIELD_PRESSURE] = "pressure",
+    [FIELD_DISKS] = "disks",
+    [FIELD_NETWORK] = "network",
+    [FIELD_PROCESSES] = "processes",
+    [FIELD_CGROUP] = "cgroup",
+    [FIELD_COLLECTOR_STATS] = "collector_stats",
+};
+
+static uint32_t match_selector(const char *selector, size_t len) {
+    uint32_t matched = 0;
+    for (int f = 0; f < FIELD_COUNT; f++) {
+        const char *name = field_names[f];
+        if (strncmp(name, selector, len) == 0 && (name[len] == '\0' || name[len] == '.')) {
+            matched |= FIELD_BIT(f);
+        }
+    }
+    return matched;
+}
+
+// Comma-separated list of selectors. Fails on a selector that matches
+// nothing.
+int fields_parse(const char *spec, uint32_t *out) {
+    *out = 0;
+    while (*spec) {
+        size_t len = strcspn(spec, ",");
+        uint32_t matched = len ? match_selector(spec, len) : 0;
+        if (!matched) return 0;
+        *out |= matched;
+        spec += len;
+        if (*spec == ',') spec++;
+    }
+    return *out != 0;
+}
+
+// The static probes the fields depend on. Identity and firmware fields
+// read differently on a virtual machine and on a Raspberry Pi, so they
+// need every probe; the virtualization probe reads cpuinfo.
+uint32_t fields_probes(uint32_t fields) {
+    uint32_t probes = 0;
+
+    if (fields & FIELD_BIT(FIELD_HARDWARE_CPU)) probes |= 1u << PROBE_CPUINFO;
+    if (fields & FIELD_BIT(FIELD_VIRTUALIZATION)) probes |= 1u << PROBE_CPUINFO | 1u << PROBE_VIRTUALIZATION;
+    if (fields & (FIELD_BIT(FIELD_SYSTEM_UUID) | FIELD_BIT(FIELD_MOTHERBOARD_SERIAL) |
+                  FIELD_BIT(FIELD_PRODUCT_NAME) | FIELD_BIT(FIELD_BIOS))) {
+        probes |= (1u << PROBE_COUNT) - 1;
+    }
+    return probes;
+}
@@ -0,0 +1,30 @@
+#ifndef FIELDS_H
+#define FIELDS_H
+
+#include "hardware_info.h"
+
+#define FIELD_BIT(f) (1u << (f))
+
+#define FIELDS_HARDWARE                                                                  \
+    (FIELD_BIT(FIELD_SYSTEM_UUID) | FIELD_BIT(FIELD_MOTHERBOARD_SERIAL) |                \
+     FIELD_BIT(FIELD_PRODUCT_NAME) | FIELD_BIT(FIELD_VIRTUALIZATION) |                   \
+     FIELD_BIT(FIELD_HARDWARE_CPU) | FIELD_BIT(FIELD_BIOS) | FIELD_BIT(FIELD_TOPOLOGY))
+#define FIELDS_CPU_USAGE \
+    (FIELD_BIT(FIELD_CPU_USAGE) | FIELD_BIT(FIELD_TEMPERATURE) | FIELD_BIT(FIELD_FREQUENCY))
+
+// Fields computed from the difference between two samples. Without any
+// of them a snapshot needs no baseline and is taken at once.
+#define FIELDS_NEED_DELTA                                                                \
+    (FIELD_BIT(FIELD_CPU_USAGE) | FIELD_BIT(FIELD_FREQUENCY) | FIELD_BIT(FIELD_DISKS) |  \
+     FIELD_BIT(FIELD_NETWORK) | FIELD_BIT(FIELD_PROCESSES) | FIELD_BIT(FIELD_CGROUP))
+// Fields that need /proc/stat, if only for the online CPUs or their count.
+#define FIELDS_NEED_STAT (FIELDS_CPU_USAGE | FIELD_BIT(FIELD_CGROUP))
+// Package, node and physical-core usage are aggregated over the topology,
+// and temperature sensors are mapped to CPUs through it.
+#define FIELDS_NEED_TOPOLOGY \
+    (FIELD_BIT(FIELD_TOPOLOGY) | FIELD_BIT(FIELD_CPU_USAGE) | FIELD_BIT(FIELD_TEMPERATURE))
+
+int fields_parse(const char *spec, uint32_t *out);
+uint32_t fields_probes(uint32_t fields);
+
+#endif
@@ -1,30 +1,72 @@
 #include "hardware_info.h"
+#include "reader.h"
+#include "cpuinfo.h"
+#include "selfstats.h"
+#include "virt.h"
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
-#include <sys/sysinfo.h>
-#include <ctype.h>
 #include <fcntl.h>
 #include <sys/utsname.h>
 
 #define RASPBERRY_PI_MODEL "/sys/firmware/devicetree/base/model"
-#define THERMAL_ZONE "/sys/class/thermal/thermal_zone0/temp"
 #define CPUINFO "/proc/cpuinfo"
 #define SYSFS_DMI "/sys/class/dmi/id"
-#define DOCKER_CHECK "/proc/1/cgroup"
-#define OPENVZ_CHECK "/proc/vz"
-#define LXC_CHECK "/proc/1/environ"
-
-static void trim(char *str) {
-    if (!str) return;
-    char *end;
-    while (isspace(*str)) str++;
-    if (*str == 0) return;
-    end = str + strlen(str) - 1;
-    while (end > str && isspace(*end)) end--;
-    *(end + 1) = '\0';
-}
+
+#define ALL_PROBES ((1u << PROBE_COUNT) - 1)
+#define NSEC_PER_MSEC 1000000L
+#define NSEC_PER_SEC 1000000000L
+
+static unsigned probe_timeout_ms = 0;
+
+// How long each probe may take, counted from the start of probing. The
+// virtualization probe runs after cpuinfo and may exec
+// systemd-detect-virt, so it gets the most.
+static const unsigned default_timeout_ms[PROBE_COUNT] = {
+    [PROBE_CPUINFO] = 1000,
+    [PROBE_VIRTUALIZATION] = 3000,
+    [PROBE_DMI] = 1000,
+};
+
+// What the dmi probe read; an empty string is a file that was missing.
+// machine_id and the container ids are only looked up when there is no
+// product_uuid.
+typedef struct {
+    int is_raspberry_pi;
+    char model[MODEL_LENGTH];
+    char product_uuid[UUID_LENGTH];
+    char machine_id[UUID_LENGTH];
+    char cgroup_id[UUID_LENGTH];
+    char container_uuid[UUID_LENGTH];
+    char board_serial[SERIAL_LENGTH];
+    char product_name[MODEL_LENGTH];
+    char sys_vendor[VENDOR_LENGTH];
+    char bios_vendor[VENDOR_LENGTH];
+    char bios_version[VENDOR_LENGTH];
+} FirmwareInfo;
+
+// One round of probing, shared by the caller and the workers. A worker
+// that is stuck past its deadline still holds a reference, so the run
+// is freed by whoever lets go of it last. Each result is written by one
+// worker before it sets the probe's bit in done and is read only after.
+struct HardwareProbe {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int refs;
+    uint32_t probes;
+    uint32_t done;
+    int use_helper;
+    struct timespec deadline[PROBE_COUNT];
+    int is_raspberry_pi;
+    Cpuinfo cpuinfo;
+    VirtualizationType virt_type;
+    FirmwareInfo firmware;
+};
 
 static void safe_strcpy(char *dest, const char *src, size_t size) {
     if (size > 0) {
@@ -36,162 +78,96 @@ static void safe_strcpy(char *dest, const char *src, size_t size) {
     }
 }
 
-static int read_file_line(const char *filepath, char *buffer, size_t size) {
-    FILE *fp = fopen(filepath, "r");
-    if (!fp) return 0;
-    char *result = fgets(buffer, size, fp);
-    fclose(fp);
-    if (result) {
-        trim(buffer);
-        return 1;
-    }
-    return 0;
+static int is_raspberry_pi() {
+    return file_exists(RASPBERRY_PI_MODEL);
 }
 
-static int file_exists(const char *filepath) {
-    return access(filepath, F_OK) == 0;
+static int read_attribute(const char *path, char *dest, size_t size) {
+    char buffer[BUFFER_SIZE];
+
+    if (!read_file_line(path, buffer, sizeof(buffer))) return 0;
+    safe_strcpy(dest, buffer, size);
+    return 1;
 }
 
-static VirtualizationType detect_virtualization() {
+// Boards without DMI describe themselves in the device tree instead.
+static void read_firmware_info(FirmwareInfo *fw) {
     char buffer[BUFFER_SIZE];
-    FILE *fp;
-
-    // Check systemd-detect-virt if available
-    fp = popen("systemd-detect-virt 2>/dev/null", "r");
-    if (fp) {
-        if (fgets(buffer, sizeof(buffer), fp)) {
-            trim(buffer);
-            pclose(fp);
-            
-            if (strcmp(buffer, "kvm") == 0) return VIRT_KVM;
-            if (strcmp(buffer, "qemu") == 0) return VIRT_QEMU;
-            if (strcmp(buffer, "vmware") == 0) return VIRT_VMWARE;
-            if (strcmp(buffer, "virtualbox") == 0) return VIRT_VIRTUALBOX;
-            if (strcmp(buffer, "xen") == 0) return VIRT_XEN;
-            if (strcmp(buffer, "microsoft") == 0) return VIRT_HYPERV;
-            if (strcmp(buffer, "docker") == 0) return VIRT_DOCKER;
-            if (strcmp(buffer, "lxc") == 0) return VIRT_LXC;
-        }
-        pclose(fp);
-    }
+    const char *uuid_paths[] = {
+        SYSFS_DMI "/product_uuid",
+        "/sys/devices/virtual/dmi/id/product_uuid",
+        NULL
+    };
+    const char *machine_id_paths[] = {
+        "/etc/machine-id",
+        "/var/lib/dbus/machine-id",
+        NULL
+    };
 
-    // Check /proc/cpuinfo
-    if (read_file_line(CPUINFO, buffer, sizeof(buffer))) {
-        if (strstr(buffer, "QEMU Virtual CPU")) return VIRT_QEMU;
-        if (strstr(buffer, "VMware")) return VIRT_VMWARE;
-        if (strstr(buffer, "VirtualBox")) return VIRT_VIRTUALBOX;
-        if (strstr(buffer, "Xen")) return VIRT_XEN;
+    if (is_raspberry_pi()) {
+        fw->is_raspberry_pi = 1;
+        read_attribute(RASPBERRY_PI_MODEL, fw->model, MODEL_LENGTH);
+        return;
     }
 
-    // Check DMI for hypervisor
-    if (read_file_line("/sys/class/dmi/id/sys_vendor", buffer, sizeof(buffer))) {
-        if (strstr(buffer, "VMware")) return VIRT_VMWARE;
-        if (strstr(buffer, "VirtualBox")) return VIRT_VIRTUALBOX;
-        if (strstr(buffer, "Xen")) return VIRT_XEN;
-        if (strstr(buffer, "Microsoft Corporation")) return VIRT_HYPERV;
-        if (strstr(buffer, "QEMU")) return VIRT_QEMU;
-        if (strstr(buffer, "Amazon EC2")) return VIRT_CLOUD;
-        if (strstr(buffer, "Google")) return VIRT_CLOUD;
-        if (strstr(buffer, "Azure")) return VIRT_CLOUD;
+    int found = 0;
+    for (int i = 0; !found && uuid_paths[i] != NULL; i++) {
+        found = read_attribute(uuid_paths[i], fw->product_uuid, UUID_LENGTH);
     }
-
-    // Check for containers
-    if (file_exists(DOCKER_CHECK)) {
-        fp = fopen(DOCKER_CHECK, "r");
-        if (fp) {
-            while (fgets(buffer, sizeof(buffer), fp)) {
-                if (strstr(buffer, "docker")) {
-                    fclose(fp);
-                    return VIRT_DOCKER;
-                }
-            }
-            fclose(fp);
-        }
+    for (int i = 0; !found && machine_id_paths[i] != NULL; i++) {
+        found = read_attribute(machine_id_paths[i], fw->machine_id, UUID_LENGTH);
     }
-
-    if (file_exists(OPENVZ_CHECK)) return VIRT_OPENVZ;
-
-    if (file_exists(LXC_CHECK)) {
-        fp = fopen(LXC_CHECK, "r");
-        if (fp) {
-            if (fgets(buffer, sizeof(buffer), fp)) {
-                if (strstr(buffer, "container=lxc")) {
-                    fclose(fp);
-                    return VIRT_LXC;
-                }
-            }
-            fclose(fp);
+    if (!found) {
+        if (read_file_line("/proc/self/cgroup", buffer, sizeof(buffer))) {
+            char *id = strrchr(buffer, '/');
+            if (id) safe_strcpy(fw->cgroup_id, id + 1, UUID_LENGTH);
         }
-    }
-
-    // Final check for any virtualization
-    fp = fopen("/proc/cpuinfo", "r");
-    if (fp) {
-        while (fgets(buffer, sizeof(buffer), fp)) {
-            if (strstr(buffer, "hypervisor")) {
-                fclose(fp);
-                return VIRT_UNKNOWN;
-            }
+        if (read_file_line("/proc/self/environ", buffer, sizeof(buffer))) {
+            char *id = strstr(buffer, "container_uuid=");
+            if (id) safe_strcpy(fw->container_uuid, id + 15, UUID_LENGTH);
         }
-        fclose(fp);
     }
 
-    return VIRT_NONE;
+    read_attribute(SYSFS_DMI "/board_serial", fw->board_serial, SERIAL_LENGTH);
+    read_attribute(SYSFS_DMI "/product_name", fw->product_name, MODEL_LENGTH);
+    read_attribute(SYSFS_DMI "/sys_vendor", fw->sys_vendor, VENDOR_LENGTH);
+    read_attribute(SYSFS_DMI "/bios_vendor", fw->bios_vendor, VENDOR_LENGTH);
+    read_attribute(SYSFS_DMI "/bios_version", fw->bios_version, VENDOR_LENGTH);
 }
 
-static void get_vm_uuid(HardwareInfo *hw) {
+static void get_vm_uuid(HardwareInfo *hw, const Cpuinfo *cpuinfo, const FirmwareInfo *fw) {
     char buffer[BUFFER_SIZE];
-    const char *uuid_paths[] = {
-        "/sys/class/dmi/id/product_uuid",
-        "/sys/devices/virtual/dmi/id/product_uuid",
-        "/etc/machine-id",
-        "/var/lib/dbus/machine-id",
-        NULL
-    };
 
-    for (int i = 0; uuid_paths[i] != NULL; i++) {
-        if (read_file_line(uuid_paths[i], buffer, sizeof(buffer))) {
-            safe_strcpy(hw->system_uuid, buffer, UUID_LENGTH);
-            return;
-        }
+    if (fw->product_uuid[0]) {
+        safe_strcpy(hw->system_uuid, fw->product_uuid, UUID_LENGTH);
+        return;
+    }
+    if (fw->machine_id[0]) {
+        safe_strcpy(hw->system_uuid, fw->machine_id, UUID_LENGTH);
+        return;
     }
 
     switch (hw->virt_type) {
         case VIRT_DOCKER:
-            if (read_file_line("/proc/self/cgroup", buffer, sizeof(buffer))) {
-                char *id = strrchr(buffer, '/');
-                if (id) safe_strcpy(hw->system_uuid, id + 1, UUID_LENGTH);
-            }
+            safe_strcpy(hw->system_uuid, fw->cgroup_id, UUID_LENGTH);
             break;
 
         case VIRT_LXC:
-            if (read_file_line("/proc/self/environ", buffer, sizeof(buffer))) {
-                char *id = strstr(buffer, "container_uuid=");
-                if (id) safe_strcpy(hw->system_uuid, id + 15, UUID_LENGTH);
-            }
+            safe_strcpy(hw->system_uuid, fw->container_uuid, UUID_LENGTH);
             break;
 
         default:
-            FILE *fp = fopen("/proc/cpuinfo", "r");
-            if (fp) {
-                unsigned long hash = 5381;
-                int c;
-                while ((c = fgetc(fp)) != EOF) {
-                    hash = ((hash << 5) + hash) + c;
-                }
-                fclose(fp);
-                snprintf(buffer, sizeof(buffer), "vm-%lx", hash);
+            if (cpuinfo->buf) {
+                snprintf(buffer, sizeof(buffer), "vm-%lx", cpuinfo_hash(cpuinfo));
                 safe_strcpy(hw->system_uuid, buffer, UUID_LENGTH);
             }
             break;
     }
 }
 
-static void get_vm_info(HardwareInfo *hw) {
-    char buffer[BUFFER_SIZE];
-    
+static void get_vm_info(HardwareInfo *hw, const Cpuinfo *cpuinfo, const FirmwareInfo *fw) {
     hw->is_virtual = 1;
-    get_vm_uuid(hw);
+    get_vm_uuid(hw, cpuinfo, fw);
 
     switch (hw->virt_type) {
         case VIRT_KVM:
@@ -206,11 +182,8 @@ static void get_vm_info(HardwareInfo *hw) {
 
         case VIRT_VMWARE:
             safe_strcpy(hw->hypervisor_vendor, "VMware", VENDOR_LENGTH);
-            if (read_file_line("/sys/class/dmi/id/product_name", buffer, sizeof(buffer))) {
-                safe_strcpy(hw->product_name, buffer, MODEL_LENGTH);
-            } else {
-                safe_strcpy(hw->product_name, "VMware Virtual Machine", MODEL_LENGTH);
-            }
+            safe_strcpy(hw->product_name, fw->product_name[0] ? fw->product_name : "VMware Virtual Machine",
+                        MODEL_LENGTH);
             break;
 
         case VIRT_VIRTUALBOX:
@@ -243,14 +216,17 @@ static void get_vm_info(HardwareInfo *hw) {
             safe_strcpy(hw->product_name, "OpenVZ Container", MODEL_LENGTH);
             break;
 
+        case VIRT_PARALLELS:
+            safe_strcpy(hw->hypervisor_vendor, "Parallels", VENDOR_LENGTH);
+            safe_strcpy(hw->product_name, fw->product_name[0] ? fw->product_name : "Parallels Virtual Machine",
+                        MODEL_LENGTH);
+            break;
+
         case VIRT_CLOUD:
-            if (read_file_line("/sys/class/dmi/id/sys_vendor", buffer, sizeof(buffer))) {
-                safe_strcpy(hw->hypervisor_vendor, buffer, VENDOR_LENGTH);
-                if (read_file_line("/sys/class/dmi/id/product_name", buffer, sizeof(buffer))) {
-                    safe_strcpy(hw->product_name, buffer, MODEL_LENGTH);
-                } else {
-                    safe_strcpy(hw->product_name, "Cloud Instance", MODEL_LENGTH);
-                }
+            if (fw->sys_vendor[0]) {
+                safe_strcpy(hw->hypervisor_vendor, fw->sys_vendor, VENDOR_LENGTH);
+                safe_strcpy(hw->product_name, fw->product_name[0] ? fw->product_name : "Cloud Instance",
+                            MODEL_LENGTH);
             }
             break;
 
@@ -266,22 +242,12 @@ static void get_vm_info(HardwareInfo *hw) {
 
     if (hw->is_virtual) {
         safe_strcpy(hw->motherboard_serial, "Virtual Environment", SERIAL_LENGTH);
-        
-        if (read_file_line("/sys/class/dmi/id/bios_vendor", buffer, sizeof(buffer))) {
-            safe_strcpy(hw->bios_vendor, buffer, VENDOR_LENGTH);
-        }
-        if (read_file_line("/sys/class/dmi/id/bios_version", buffer, sizeof(buffer))) {
-            safe_strcpy(hw->bios_version, buffer, VENDOR_LENGTH);
-        }
+        safe_strcpy(hw->bios_vendor, fw->bios_vendor, VENDOR_LENGTH);
+        safe_strcpy(hw->bios_version, fw->bios_version, VENDOR_LENGTH);
     }
 }
-static int is_raspberry_pi() {
-    return file_exists(RASPBERRY_PI_MODEL);
-}
 
-static void read_raspberry_pi_info(HardwareInfo *hw) {
-    char buffer[BUFFER_SIZE] = {0};
-    
+static void read_raspberry_pi_info(HardwareInfo *hw, const Cpuinfo *cpuinfo, const FirmwareInfo *fw) {
     // Initialize all strings to prevent double-free
     safe_strcpy(hw->cpu_model, "Unknown", MODEL_LENGTH);
     safe_strcpy(hw->cpu_vendor, "ARM", VENDOR_LENGTH);
@@ -291,35 +257,14 @@ static void read_raspberry_pi_info(HardwareInfo *hw) {
     safe_strcpy(hw->bios_vendor, "Raspberry Pi", VENDOR_LENGTH);
     safe_strcpy(hw->bios_version, "Unknown", VENDOR_LENGTH);
 
-    FILE *fp = fopen("/proc/cpuinfo", "r");
-    if (fp) {
-        while (fgets(buffer, sizeof(buffer), fp)) {
-            char *value;
-            if ((value = strstr(buffer, ": "))) {
-                value += 2;
-                trim(value);
-                
-                if (strncmp(buffer, "Hardware", 8) == 0) {
-                    safe_strcpy(hw->cpu_model, value, MODEL_LENGTH);
-                }
-                else if (strncmp(buffer, "Revision", 8) == 0) {
-                    safe_strcpy(hw->motherboard_serial, value, SERIAL_LENGTH);
-                }
-                else if (strncmp(buffer, "Serial", 6) == 0) {
-                    safe_strcpy(hw->system_uuid, value, UUID_LENGTH);
-                }
-                else if (strncmp(buffer, "Model", 5) == 0) {
-                    safe_strcpy(hw->product_name, value, MODEL_LENGTH);
-                }
-            }
-            memset(buffer, 0, sizeof(buffer));  // Clear buffer after each line
-        }
-        fclose(fp);
-    }
+    cpuinfo_copy(cpuinfo, "Hardware", hw->cpu_model, MODEL_LENGTH);
+    cpuinfo_copy(cpuinfo, "Revision", hw->motherboard_serial, SERIAL_LENGTH);
+    cpuinfo_copy(cpuinfo, "Serial", hw->system_uuid, UUID_LENGTH);
+    cpuinfo_copy(cpuinfo, "Model", hw->product_name, MODEL_LENGTH);
 
-    // Read model from device tree if available
-    if (read_file_line(RASPBERRY_PI_MODEL, buffer, sizeof(buffer))) {
-        safe_strcpy(hw->product_name, buffer, MODEL_LENGTH);
+    // The device tree model is preferred when there is one
+    if (fw->model[0]) {
+        safe_strcpy(hw->product_name, fw->model, MODEL_LENGTH);
     }
     
     hw->is_arm = 1;
@@ -330,221 +275,195 @@ static void read_raspberry_pi_info(HardwareInfo *hw) {
     hw->cpu_microcode = 0;
 }
 
-static void read_cpu_info(HardwareInfo *hw) {
-    FILE *fp = fopen("/proc/cpuinfo", "r");
-    if (!fp) return;
-
-    char line[BUFFER_SIZE];
-    char *value;
-
-    while (fgets(line, sizeof(line), fp)) {
-        if ((value = strstr(line, ": "))) {
-            value += 2;
-            trim(value);
-            if (strncmp(line, "model name", 10) == 0) {
-                safe_strcpy(hw->cpu_model, value, MODEL_LENGTH);
-            }
-            else if (strncmp(line, "vendor_id", 9) == 0) {
-                safe_strcpy(hw->cpu_vendor, value, VENDOR_LENGTH);
-            }
-            else if (strncmp(line, "cpu family", 10) == 0) {
-                hw->cpu_family = atoi(value);
-            }
-            else if (strncmp(line, "stepping", 8) == 0) {
-                hw->cpu_stepping = atoi(value);
-            }
-            else if (strncmp(line, "microcode", 9) == 0) {
-                hw->cpu_microcode = strtoull(value, NULL, 16);
-            }
-        }
-    }
-    fclose(fp);
-}
-
-static void read_physical_info(HardwareInfo *hw) {
-    char buffer[BUFFER_SIZE];
+static void read_cpu_info(HardwareInfo *hw, const Cpuinfo *cpuinfo) {
+    char value[BUFFER_SIZE];
 
-    if (read_file_line("/sys/class/dmi/id/product_uuid", buffer, sizeof(buffer))) {
-        safe_strcpy(hw->system_uuid, buffer, UUID_LENGTH);
-    }
-    if (read_file_line("/sys/class/dmi/id/board_serial", buffer, sizeof(buffer))) {
-        safe_strcpy(hw->motherboard_serial, buffer, SERIAL_LENGTH);
-    }
-    if (read_file_line("/sys/class/dmi/id/product_name", buffer, sizeof(buffer))) {
-        safe_strcpy(hw->product_name, buffer, MODEL_LENGTH);
+    cpuinfo_copy(cpuinfo, "model name", hw->cpu_model, MODEL_LENGTH);
+    cpuinfo_copy(cpuinfo, "vendor_id", hw->cpu_vendor, VENDOR_LENGTH);
+    if (cpuinfo_copy(cpuinfo, "cpu family", value, sizeof(value))) {
+        hw->cpu_family = atoi(value);
     }
-    if (read_file_line("/sys/class/dmi/id/bios_vendor", buffer, sizeof(buffer))) {
-        safe_strcpy(hw->bios_vendor, buffer, VENDOR_LENGTH);
+    if (cpuinfo_copy(cpuinfo, "stepping", value, sizeof(value))) {
+        hw->cpu_stepping = atoi(value);
     }
-    if (read_file_line("/sys/class/dmi/id/bios_version", buffer, sizeof(buffer))) {
-        safe_strcpy(hw->bios_version, buffer, VENDOR_LENGTH);
+    if (cpuinfo_copy(cpuinfo, "microcode", value, sizeof(value))) {
+        hw->cpu_microcode = strtoull(value, NULL, 16);
     }
 }
 
-static int read_cpu_temp(int core) {
-    char buffer[BUFFER_SIZE];
-    
-    if (read_file_line(THERMAL_ZONE, buffer, sizeof(buffer))) {
-        return atoi(buffer) / 1000;
-    }
+static void read_physical_info(HardwareInfo *hw, const FirmwareInfo *fw) {
+    safe_strcpy(hw->system_uuid, fw->product_uuid, UUID_LENGTH);
+    safe_strcpy(hw->motherboard_serial, fw->board_serial, SERIAL_LENGTH);
+    safe_strcpy(hw->product_name, fw->product_name, MODEL_LENGTH);
+    safe_strcpy(hw->bios_vendor, fw->bios_vendor, VENDOR_LENGTH);
+    safe_strcpy(hw->bios_version, fw->bios_version, VENDOR_LENGTH);
+}
 
-    char path[BUFFER_SIZE];
-    snprintf(path, sizeof(path), "/sys/devices/platform/coretemp.0/hwmon/hwmon*/temp%d_input", core + 1);
-    if (read_file_line(path, buffer, sizeof(buffer))) {
-        return atoi(buffer) / 1000;
-    }
+// 0 goes back to the per-probe defaults.
+void set_probe_timeout(unsigned timeout_ms) {
+    probe_timeout_ms = timeout_ms;
+}
+
+static void probe_release(HardwareProbe *probe) {
+    pthread_mutex_lock(&probe->lock);
+    int refs = --probe->refs;
+    pthread_mutex_unlock(&probe->lock);
+    if (refs > 0) return;
 
-    return 0;
+    cpuinfo_free(&probe->cpuinfo);
+    pthread_cond_destroy(&probe->cond);
+    pthread_mutex_destroy(&probe->lock);
+    free(probe);
 }
 
-static void read_cpu_stats(CPUStats *stats, const char *line) {
-    uint64_t guest, guest_nice;
-    sscanf(line, "cpu%*d %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu",
-           &stats->user, &stats->nice, &stats->system, &stats->idle,
-           &stats->iowait, &stats->irq, &stats->softirq, &stats->steal,
-           &guest, &guest_nice);
-    stats->total = stats->user + stats->nice + stats->system + stats->idle +
-                  stats->iowait + stats->irq + stats->softirq + stats->steal;
+static void probe_done(HardwareProbe *probe, Probe which) {
+    pthread_mutex_lock(&probe->lock);
+    probe->done |= 1u << which;
+    pthread_cond_broadcast(&probe->cond);
+    pthread_mutex_unlock(&probe->lock);
 }
 
-static void calculate_cpu_usage(CoreInfo *prev, CoreInfo *curr) {
-    uint64_t total_diff = curr->stats.total - prev->stats.total;
-    uint64_t idle_diff = curr->stats.idle - prev->stats.idle;
-    if (total_diff > 0) {
-        curr->usage = 100.0 * (1.0 - ((double)idle_diff / total_diff));
+// /proc/cpuinfo is read and tokenized once and shared by every probe.
+// Which fields hold the CPU model depends on whether this is a Raspberry
+// Pi, so that is checked here as well. Virtualization detection looks
+// at cpuinfo last, so it runs on the same worker; on a Raspberry Pi
+// there is nothing to detect.
+static void *cpu_worker(void *arg) {
+    HardwareProbe *probe = arg;
+    PhaseTimer phase;
+
+    phase_begin(&phase);
+    probe->is_raspberry_pi = is_raspberry_pi();
+    cpuinfo_load(&probe->cpuinfo, CPUINFO);
+    phase_end(&phase, PHASE_CPUINFO);
+    probe_done(probe, PROBE_CPUINFO);
+
+    if (probe->probes & (1u << PROBE_VIRTUALIZATION)) {
+        phase_begin(&phase);
+        if (!probe->is_raspberry_pi) {
+            probe->virt_type = detect_virtualization(&probe->cpuinfo, probe->use_helper);
+        }
+        phase_end(&phase, PHASE_VIRTUALIZATION);
+        probe_done(probe, PROBE_VIRTUALIZATION);
     }
+
+    probe_release(probe);
+    return NULL;
 }
 
-void collect_hardware_info(HardwareInfo *info) {
-    memset(info, 0, sizeof(HardwareInfo));
-    
-    if (is_raspberry_pi()) {
-        read_raspberry_pi_info(info);
-        return;  // Early return for Raspberry Pi
+// On boards without DMI the dmi phase covers the device tree instead.
+static void *firmware_worker(void *arg) {
+    HardwareProbe *probe = arg;
+    PhaseTimer phase;
+
+    phase_begin(&phase);
+    read_firmware_info(&probe->firmware);
+    phase_end(&phase, PHASE_DMI);
+    probe_done(probe, PROBE_DMI);
+
+    probe_release(probe);
+    return NULL;
+}
+
+// Starts the given probes (a mask of Probe bits) on their own threads and
+// returns at once; the result is only complete after
+// hardware_probe_finish(). Virtualization detection implies cpuinfo. A
+// worker that cannot be started runs on the calling thread instead.
+// Returns NULL when out of memory.
+HardwareProbe *hardware_probe_start(uint32_t probes, int use_helper) {
+    void *(*workers[2])(void *);
+    int num_workers = 0;
+    pthread_condattr_t attr;
+    pthread_attr_t detached;
+    struct timespec now;
+
+    HardwareProbe *probe = calloc(1, sizeof(*probe));
+    if (!probe) return NULL;
+    pthread_mutex_init(&probe->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&probe->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    if (probes & (1u << PROBE_VIRTUALIZATION)) probes |= 1u << PROBE_CPUINFO;
+    if (probes & (1u << PROBE_CPUINFO)) workers[num_workers++] = cpu_worker;
+    if (probes & (1u << PROBE_DMI)) workers[num_workers++] = firmware_worker;
+    probe->probes = probes & ALL_PROBES;
+    probe->refs = 1 + num_workers;
+    probe->use_helper = use_helper;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (int p = 0; p < PROBE_COUNT; p++) {
+        long ms = probe_timeout_ms ? probe_timeout_ms : default_timeout_ms[p];
+        probe->deadline[p].tv_sec = now.tv_sec + ms / 1000;
+        probe->deadline[p].tv_nsec = now.tv_nsec + ms % 1000 * NSEC_PER_MSEC;
+        if (probe->deadline[p].tv_nsec >= NSEC_PER_SEC) {
+            probe->deadline[p].tv_sec++;
+            probe->deadline[p].tv_nsec -= NSEC_PER_SEC;
+        }
     }
-    
-    info->virt_type = detect_virtualization();
-    
-    if (info->virt_type != VIRT_NONE) {
-        get_vm_info(info);
-        read_cpu_info(info);
-    } else {
-        info->is_virtual = 0;
-        read_physical_info(info);
-        read_cpu_info(info);
+
+    // Workers block SIGINT and SIGTERM, so that the caller's handlers run
+    // on the caller's thread and interrupt its sleeps, even once a worker
+    // has been abandoned. The helper a worker spawns unblocks them again.
+    sigset_t stop, saved;
+    sigemptyset(&stop);
+    sigaddset(&stop, SIGINT);
+    sigaddset(&stop, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop, &saved);
+    pthread_attr_init(&detached);
+    pthread_attr_setdetachstate(&detached, PTHREAD_CREATE_DETACHED);
+    for (int i = 0; i < num_workers; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, &detached, workers[i], probe) != 0) workers[i](probe);
     }
+    pthread_attr_destroy(&detached);
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+    return probe;
 }
 
+// Waits for each probe until its deadline and fills info from those that
+// finished. A probe that did not is left running and abandoned. Returns
+// 1 when every probe ran and finished in time, so info is complete.
+int hardware_probe_finish(HardwareProbe *probe, HardwareInfo *info) {
+    static const Cpuinfo no_cpuinfo;
+    static const FirmwareInfo no_firmware;
 
-void collect_system_info(SystemInfo *info, SystemInfo *prev_info) {
-    FILE *fp;
-    char line[BUFFER_SIZE];
-    struct sysinfo si;
-
-    fp = fopen("/proc/stat", "r");
-    if (fp) {
-        int core = -1;
-        while (fgets(line, sizeof(line), fp) && core < MAX_CORES) {
-            if (strncmp(line, "cpu", 3) == 0) {
-                if (core >= 0) {
-                    read_cpu_stats(&info->cores[core].stats, line);
-                    info->cores[core].temperature = read_cpu_temp(core);
-                    if (prev_info) {
-                        calculate_cpu_usage(&prev_info->cores[core], &info->cores[core]);
-                    }
-                }
-                core++;
-            } else {
-                break;
-            }
+    memset(info, 0, sizeof(HardwareInfo));
+    if (!probe) return 0;
+
+    pthread_mutex_lock(&probe->lock);
+    for (int p = 0; p < PROBE_COUNT; p++) {
+        if (!(probe->probes & (1u << p))) continue;
+        while (!(probe->done & (1u << p))) {
+            if (pthread_cond_timedwait(&probe->cond, &probe->lock, &probe->deadline[p]) == ETIMEDOUT) break;
         }
-        info->num_cores = core;
-        fclose(fp);
     }
+    uint32_t done = probe->done;
+    pthread_mutex_unlock(&probe->lock);
 
-    if (sysinfo(&si) == 0) {
-        info->total_memory = si.totalram * si.mem_unit;
-        info->free_memory = si.freeram * si.mem_unit;
-        info->swap_total = si.totalswap * si.mem_unit;
-        info->swap_free = si.freeswap * si.mem_unit;
-    }
+    const Cpuinfo *cpuinfo = done & (1u << PROBE_CPUINFO) ? &probe->cpuinfo : &no_cpuinfo;
+    const FirmwareInfo *fw = done & (1u << PROBE_DMI) ? &probe->firmware : &no_firmware;
+    info->timed_out = probe->probes & ~done;
 
-    fp = fopen("/proc/meminfo", "r");
-    if (fp) {
-        while (fgets(line, sizeof(line), fp)) {
-            if (strncmp(line, "Cached:", 7) == 0) {
-                uint64_t cached;
-                sscanf(line, "Cached: %lu", &cached);
-                info->cached_memory = cached * 1024;
-                break;
-            }
+    int raspberry_pi = done & (1u << PROBE_CPUINFO) ? probe->is_raspberry_pi : fw->is_raspberry_pi;
+    if (raspberry_pi) {
+        read_raspberry_pi_info(info, cpuinfo, fw);
+    } else {
+        if (done & (1u << PROBE_VIRTUALIZATION)) info->virt_type = probe->virt_type;
+        if (info->virt_type != VIRT_NONE) {
+            get_vm_info(info, cpuinfo, fw);
+        } else {
+            info->is_virtual = 0;
+            read_physical_info(info, fw);
         }
-        fclose(fp);
+        read_cpu_info(info, cpuinfo);
     }
 
-    info->available_memory = info->free_memory + info->cached_memory;
+    int complete = probe->probes == ALL_PROBES && !info->timed_out;
+    probe_release(probe);
+    return complete;
 }
 
-void output_json(const SystemInfo *info) {
-    printf("{\n");
-    
-    printf("  \"hardware\": {\n");
-    printf("    \"system_uuid\": \"%s\",\n", info->hw_info.system_uuid);
-    printf("    \"motherboard_serial\": \"%s\",\n", info->hw_info.motherboard_serial);
-    printf("    \"product_name\": \"%s\",\n", info->hw_info.product_name);
-    
-    printf("    \"virtualization\": {\n");
-    printf("      \"is_virtual\": %s,\n", info->hw_info.is_virtual ? "true" : "false");
-    if (info->hw_info.is_virtual) {
-        printf("      \"type\": \"%s\",\n", info->hw_info.hypervisor_vendor);
-        const char *virt_types[] = {
-            "none", "kvm", "qemu", "vmware", "virtualbox", "xen",
-            "hyper-v", "docker", "lxc", "openvz", "parallels", "cloud", "unknown"
-        };
-        printf("      \"hypervisor\": \"%s\"\n", virt_types[info->hw_info.virt_type]);
-    } else {
-        printf("      \"type\": null,\n");
-        printf("      \"hypervisor\": null\n");
-    }
-    printf("    },\n");
-    
-    printf("    \"cpu\": {\n");
-    printf("      \"model\": \"%s\",\n", info->hw_info.cpu_model);
-    printf("      \"vendor\": \"%s\",\n", info->hw_info.cpu_vendor);
-    printf("      \"family\": %u,\n", info->hw_info.cpu_family);
-    printf("      \"stepping\": %u,\n", info->hw_info.cpu_stepping);
-    printf("      \"microcode\": \"0x%lx\",\n", info->hw_info.cpu_microcode);
-    printf("      \"architecture\": \"%s\"\n", info->hw_info.is_arm ? "ARM" : "x86");
-    printf("    },\n");
-    
-    printf("    \"bios\": {\n");
-    printf("      \"vendor\": \"%s\",\n", info->hw_info.bios_vendor);
-    printf("      \"version\": \"%s\"\n", info->hw_info.bios_version);
-    printf("    }\n");
-    printf("  },\n");
-    
-    printf("  \"cpu_usage\": {\n");
-    printf("    \"cores\": %d,\n", info->num_cores - 1);
-    printf("    \"total_usage\": %.2f,\n", info->cores[0].usage);
-    printf("    \"core_info\": [\n");
-    
-    for (int i = 1; i < info->num_cores; i++) {
-        printf("      {\n");
-        printf("        \"core\": %d,\n", i - 1);
-        printf("        \"usage\": %.2f,\n", info->cores[i].usage);
-        printf("        \"temperature\": %d\n", info->cores[i].temperature);
-        printf("      }%s\n", i < info->num_cores - 1 ? "," : "");
-    }
-    printf("    ]\n");
-    printf("  },\n");
-    
-    printf("  \"memory\": {\n");
-    printf("    \"total\": %lu,\n", info->total_memory);
-    printf("    \"free\": %lu,\n", info->free_memory);
-    printf("    \"available\": %lu,\n", info->available_memory);
-    printf("    \"cached\": %lu,\n", info->cached_memory);
-    printf("    \"swap_total\": %lu,\n", info->swap_total);
-    printf("    \"swap_free\": %lu\n", info->swap_free);
-    printf("  }\n");
-    printf("}\n");
+void collect_hardware_info(HardwareInfo *info) {
+    hardware_probe_finish(hardware_probe_start(ALL_PROBES, 0), info);
 }
@@ -1,14 +1,17 @@
 #ifndef HARDWARE_INFO_H
 #define HARDWARE_INFO_H
 
+#include <limits.h>
 #include <stdint.h>
 
-#define MAX_CORES 128
 #define BUFFER_SIZE 1024
 #define UUID_LENGTH 37
 #define SERIAL_LENGTH 65
 #define MODEL_LENGTH 256
 #define VENDOR_LENGTH 64
+#define MAX_PACKAGES 16
+#define MAX_NODES 64
+#define TEMPERATURE_UNKNOWN INT_MIN
 
 typedef enum {
     VIRT_NONE,
@@ -26,6 +29,18 @@ typedef enum {
     VIRT_UNKNOWN
 } VirtualizationType;
 
+// The static probes, which run concurrently with a deadline each. A probe
+// that misses it sets its bit in HardwareInfo.timed_out and leaves the
+// fields it fills empty.
+typedef enum {
+    PROBE_CPUINFO,
+    PROBE_VIRTUALIZATION,
+    PROBE_DMI,
+    PROBE_COUNT
+} Probe;
+
+typedef struct HardwareProbe HardwareProbe;
+
 typedef struct {
     char system_uuid[UUID_LENGTH];
     char motherboard_serial[SERIAL_LENGTH];
@@ -41,40 +56,362 @@ typedef struct {
     int is_virtual;
     VirtualizationType virt_type;
     char hypervisor_vendor[VENDOR_LENGTH];
+    uint32_t timed_out;
 } HardwareInfo;
 
+// Columns of a cpu line in /proc/stat, in kernel order.
+typedef enum {
+    CPU_USER,
+    CPU_NICE,
+    CPU_SYSTEM,
+    CPU_IDLE,
+    CPU_IOWAIT,
+    CPU_IRQ,
+    CPU_SOFTIRQ,
+    CPU_STEAL,
+    CPU_GUEST,
+    CPU_GUEST_NICE,
+    CPU_STATE_COUNT
+} CPUState;
+
+// Guest time is already included in user and nice, so totals only sum the
+// states before CPU_GUEST.
+#define CPU_TOTAL_STATES CPU_GUEST
+
 typedef struct {
-    uint64_t user;
-    uint64_t nice;
-    uint64_t system;
-    uint64_t idle;
-    uint64_t iowait;
-    uint64_t irq;
-    uint64_t softirq;
-    uint64_t steal;
+    uint64_t time[CPU_STATE_COUNT];
     uint64_t total;
 } CPUStats;
 
+// Parts of a snapshot that can be selected with --fields (see fields.h).
+// Only the collectors and probes the selected fields depend on run, and
+// only those fields are written.
+typedef enum {
+    FIELD_SYSTEM_UUID,
+    FIELD_MOTHERBOARD_SERIAL,
+    FIELD_PRODUCT_NAME,
+    FIELD_VIRTUALIZATION,
+    FIELD_HARDWARE_CPU,
+    FIELD_BIOS,
+    FIELD_TOPOLOGY,
+    FIELD_CPU_USAGE,
+    FIELD_TEMPERATURE,
+    FIELD_FREQUENCY,
+    FIELD_MEMORY,
+    FIELD_PRESSURE,
+    FIELD_DISKS,
+    FIELD_NETWORK,
+    FIELD_PROCESSES,
+    FIELD_CGROUP,
+    FIELD_COLLECTOR_STATS,
+    FIELD_COUNT
+} Field;
+
+#define FIELDS_ALL ((1u << FIELD_COUNT) - 1)
+
+typedef struct Topology Topology;
+typedef struct UsageWindows UsageWindows;
+typedef struct ProcessTop ProcessTop;
+typedef struct CpuFreqStats CpuFreqStats;
+typedef struct SelfStats SelfStats;
+
+// Fields of /proc/meminfo and of the per-node meminfo files, in the
+// kernel's order. Sizes are stored in bytes, HugePages_* as page counts.
+typedef enum {
+    MEMINFO_MEM_TOTAL,
+    MEMINFO_MEM_FREE,
+    MEMINFO_MEM_AVAILABLE,
+    MEMINFO_MEM_USED,
+    MEMINFO_BUFFERS,
+    MEMINFO_CACHED,
+    MEMINFO_SWAP_CACHED,
+    MEMINFO_ACTIVE,
+    MEMINFO_INACTIVE,
+    MEMINFO_ACTIVE_ANON,
+    MEMINFO_INACTIVE_ANON,
+    MEMINFO_ACTIVE_FILE,
+    MEMINFO_INACTIVE_FILE,
+    MEMINFO_UNEVICTABLE,
+    MEMINFO_MLOCKED,
+    MEMINFO_SWAP_TOTAL,
+    MEMINFO_SWAP_FREE,
+    MEMINFO_ZSWAP,
+    MEMINFO_ZSWAPPED,
+    MEMINFO_DIRTY,
+    MEMINFO_WRITEBACK,
+    MEMINFO_FILE_PAGES,
+    MEMINFO_ANON_PAGES,
+    MEMINFO_MAPPED,
+    MEMINFO_SHMEM,
+    MEMINFO_KRECLAIMABLE,
+    MEMINFO_SLAB,
+    MEMINFO_SRECLAIMABLE,
+    MEMINFO_SUNRECLAIM,
+    MEMINFO_KERNEL_STACK,
+    MEMINFO_PAGE_TABLES,
+    MEMINFO_SEC_PAGE_TABLES,
+    MEMINFO_NFS_UNSTABLE,
+    MEMINFO_BOUNCE,
+    MEMINFO_WRITEBACK_TMP,
+    MEMINFO_COMMIT_LIMIT,
+    MEMINFO_COMMITTED_AS,
+    MEMINFO_VMALLOC_TOTAL,
+    MEMINFO_VMALLOC_USED,
+    MEMINFO_VMALLOC_CHUNK,
+    MEMINFO_PERCPU,
+    MEMINFO_HARDWARE_CORRUPTED,
+    MEMINFO_ANON_HUGE_PAGES,
+    MEMINFO_SHMEM_HUGE_PAGES,
+    MEMINFO_SHMEM_PMD_MAPPED,
+    MEMINFO_FILE_HUGE_PAGES,
+    MEMINFO_FILE_PMD_MAPPED,
+    MEMINFO_BALLOON,
+    MEMINFO_CMA_TOTAL,
+    MEMINFO_CMA_FREE,
+    MEMINFO_UNACCEPTED,
+    MEMINFO_HUGEPAGES_TOTAL,
+    MEMINFO_HUGEPAGES_FREE,
+    MEMINFO_HUGEPAGES_RSVD,
+    MEMINFO_HUGEPAGES_SURP,
+    MEMINFO_HUGEPAGE_SIZE,
+    MEMINFO_HUGETLB,
+    MEMINFO_DIRECT_MAP_4K,
+    MEMINFO_DIRECT_MAP_2M,
+    MEMINFO_DIRECT_MAP_1G,
+    MEMINFO_FIELD_COUNT
+} MeminfoField;
+
+// present has bit f set when field f appeared in the file; which fields
+// exist depends on the kernel version and configuration.
+typedef struct {
+    uint64_t value[MEMINFO_FIELD_COUNT];
+    uint64_t present;
+} MemoryInfo;
+
+typedef enum {
+    PSI_CPU,
+    PSI_MEMORY,
+    PSI_IO,
+    PSI_RESOURCE_COUNT
+} PsiResource;
+
+typedef enum {
+    PSI_SOME,
+    PSI_FULL,
+    PSI_KIND_COUNT
+} PsiKind;
+
+// One line of a pressure file: the share of time (percent) some or all
+// non-idle tasks were stalled, averaged over 10 s, 60 s and 300 s, and
+// the cumulative stall time.
+typedef struct {
+    double avg10;
+    double avg60;
+    double avg300;
+    uint64_t total_usec;
+} PsiLine;
+
+// Bit (resource * PSI_KIND_COUNT + kind) of present is set for every line
+// that was read; kernels before 5.13 have no "full" line for the CPU.
+typedef struct {
+    PsiLine line[PSI_RESOURCE_COUNT][PSI_KIND_COUNT];
+    uint32_t present;
+} PressureInfo;
+
+#define CGROUP_UNLIMITED UINT64_MAX
+
+typedef enum {
+    CGROUP_MEM_ANON,
+    CGROUP_MEM_FILE,
+    CGROUP_MEM_KERNEL,
+    CGROUP_MEM_KERNEL_STACK,
+    CGROUP_MEM_PAGETABLES,
+    CGROUP_MEM_SOCK,
+    CGROUP_MEM_SHMEM,
+    CGROUP_MEM_FILE_MAPPED,
+    CGROUP_MEM_FILE_DIRTY,
+    CGROUP_MEM_FILE_WRITEBACK,
+    CGROUP_MEM_SLAB,
+    CGROUP_MEM_ACTIVE_ANON,
+    CGROUP_MEM_INACTIVE_ANON,
+    CGROUP_MEM_ACTIVE_FILE,
+    CGROUP_MEM_INACTIVE_FILE,
+    CGROUP_MEM_PGFAULT,
+    CGROUP_MEM_PGMAJFAULT,
+    CGROUP_MEM_FIELD_COUNT
+} CgroupMemField;
+
+typedef enum {
+    CGROUP_IO_RBYTES,
+    CGROUP_IO_WBYTES,
+    CGROUP_IO_RIOS,
+    CGROUP_IO_WIOS,
+    CGROUP_IO_FIELD_COUNT
+} CgroupIoField;
+
+// Resource usage of the cgroup v2 group this process runs in. The raw
+// counters are kept so that each sample's rates are deltas against the
+// previous one. cpu_limit is quota / period in CPUs (0 when unlimited)
+// and cpu_usage is relative to it, or to all online CPUs without a quota.
+// memory_max is CGROUP_UNLIMITED and memory_usage 0 without a limit.
+// The root group has no cpu.max or memory files, and io.stat needs the io
+// controller; the has_ flags say which parts were read.
+typedef struct {
+    int available;
+    int has_cpu_max;
+    int has_memory;
+    int has_io;
+    const char *path;
+    uint64_t sample_ns;
+    uint64_t usage_usec;
+    uint64_t user_usec;
+    uint64_t system_usec;
+    uint64_t nr_periods;
+    uint64_t nr_throttled;
+    uint64_t throttled_usec;
+    uint64_t quota_usec;
+    uint64_t period_usec;
+    uint64_t memory_current;
+    uint64_t memory_max;
+    uint64_t memory_stat[CGROUP_MEM_FIELD_COUNT];
+    uint64_t io[CGROUP_IO_FIELD_COUNT];
+    double cpu_limit;
+    double cpu_usage;
+    double cpus_used;
+    double throttled_percent;
+    double throttled_ms;
+    double memory_usage;
+    double io_rate[CGROUP_IO_FIELD_COUNT];
+    PressureInfo pressure;
+} CgroupStats;
+
+#define DEVICE_NAME_MAX 32
+
+// Cumulative /proc/diskstats counters of a whole block device and the
+// rates derived from them against the previous sample. Latencies are the
+// average time per completed request; queue_depth is the average number
+// of requests in flight, from the weighted time-in-queue field.
+typedef struct {
+    char name[DEVICE_NAME_MAX];
+    uint64_t reads;
+    uint64_t read_sectors;
+    uint64_t read_ms;
+    uint64_t writes;
+    uint64_t write_sectors;
+    uint64_t write_ms;
+    uint64_t in_flight;
+    uint64_t io_ms;
+    uint64_t weighted_ms;
+    double read_bytes_rate;
+    double write_bytes_rate;
+    double read_iops;
+    double write_iops;
+    double read_latency_ms;
+    double write_latency_ms;
+    double utilization;
+    double queue_depth;
+} DiskStats;
+
+// Cumulative /proc/net/dev counters of an interface and their rates.
+// speed_mbps comes from sysfs and is 0 when the link speed is unknown.
+typedef struct {
+    char name[DEVICE_NAME_MAX];
+    int is_virtual;
+    int speed_mbps;
+    uint64_t rx_bytes;
+    uint64_t rx_packets;
+    uint64_t rx_errors;
+    uint64_t rx_drops;
+    uint64_t tx_bytes;
+    uint64_t tx_packets;
+    uint64_t tx_errors;
+    uint64_t tx_drops;
+    double rx_bytes_rate;
+    double tx_bytes_rate;
+    double rx_packet_rate;
+    double tx_packet_rate;
+    double rx_error_rate;
+    double tx_error_rate;
+    double rx_drop_rate;
+    double tx_drop_rate;
+    double utilization;
+} NetStats;
+
+// Per-CPU counters in structure-of-arrays layout, indexed by logical CPU
+// id and sized from the possible-CPU mask. CPUs that are offline or
+// missing from the numbering have online[cpu] == 0. state_usage[s] is the
+// share of the last interval spent in state s. core_usage is the
+// SMT-merged usage of a physical core, stored at its lowest CPU id.
 typedef struct {
-    double usage;
-    int temperature;
-    CPUStats stats;
-} CoreInfo;
+    int capacity;
+    uint64_t *time[CPU_STATE_COUNT];
+    uint64_t *total;
+    double *usage;
+    double *state_usage[CPU_STATE_COUNT];
+    double *core_usage;
+    int *temperature;
+    uint8_t *online;
+    void *storage;
+} PerCPUStats;
 
 typedef struct {
     HardwareInfo hw_info;
-    CoreInfo cores[MAX_CORES];
+    const Topology *topology;
+    uint64_t timestamp;
+    uint64_t monotonic_ns;
+    CPUStats total_stats;
+    double total_usage;
+    double total_state_usage[CPU_STATE_COUNT];
+    const UsageWindows *windows;
+    const ProcessTop *processes;
+    const CpuFreqStats *cpufreq;
+    const SelfStats *self_stats;
+    uint32_t fields;
+    PerCPUStats cpus;
     int num_cores;
+    int num_packages;
+    int package_temperature[MAX_PACKAGES];
+    double package_usage[MAX_PACKAGES];
+    int num_nodes;
+    double node_usage[MAX_NODES];
+    MemoryInfo memory;
+    int node_capacity;
+    int num_mem_nodes;
+    MemoryInfo *node_memory;
     uint64_t total_memory;
     uint64_t free_memory;
     uint64_t available_memory;
     uint64_t cached_memory;
     uint64_t swap_total;
     uint64_t swap_free;
+    PressureInfo pressure;
+    CgroupStats cgroup;
+    // Grown by the collector as devices appear. A device only goes missing
+    // from a sample, and is counted as dropped, when there was no memory
+    // to hold it; lines of the kernel's list that could not be read at all
+    // count as one.
+    int disk_capacity;
+    int num_disks;
+    int disks_dropped;
+    DiskStats *disks;
+    int net_capacity;
+    int num_net_devices;
+    int net_devices_dropped;
+    NetStats *net_devices;
 } SystemInfo;
 
+void set_probe_timeout(unsigned timeout_ms);
+int set_sysroot(const char *root);
+HardwareProbe *hardware_probe_start(uint32_t probes, int use_helper);
+int hardware_probe_finish(HardwareProbe *probe, HardwareInfo *info);
 void collect_hardware_info(HardwareInfo *info);
+int system_info_init(SystemInfo *info);
+int system_info_init_capacity(SystemInfo *info, int capacity);
+void system_info_free(SystemInfo *info);
 void collect_system_info(SystemInfo *info, SystemInfo *prev_info);
-void output_json(const SystemInfo *info);
+int set_usage_windows(const unsigned *window_ms, int count, unsigned interval_ms);
+int set_top_processes(int count);
+void set_collected_fields(uint32_t fields);
+void output_json(const SystemInfo *info, int pretty);
 
 #endif
@@ -0,0 +1,222 @@
+#include "hwcache.h"
+#include "cpustat.h"
+#include "fields.h"
+#include "reader.h"
+#include "selfstats.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define HWCACHE_DIR "/run/hardware-info"
+#define HWCACHE_FILE "hardware.cache"
+#define HWCACHE_MAGIC 0x43494848u  // "HHIC"
+// Bump whenever the layout of HardwareInfo, Topology or the header changes.
+// Version 5 replaces the world-readable files earlier versions wrote.
+#define HWCACHE_VERSION 6
+#define BOOT_ID "/proc/sys/kernel/random/boot_id"
+#define MICROCODE_VERSION "/sys/devices/system/cpu/cpu0/microcode/version"
+
+// On-disk layout: this header followed by a raw HardwareInfo, the fixed
+// part of the Topology and its per-CPU arrays. The cache is only valid
+// for the boot and microcode revision it was written under, and only
+// for runs that agree on asking systemd-detect-virt.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t payload_size;
+    char boot_id[UUID_LENGTH];
+    uint64_t microcode;
+    uint32_t virt_helper;
+    uint32_t checksum;
+} HwCacheHeader;
+
+typedef struct {
+    char boot_id[UUID_LENGTH];
+    uint64_t microcode;
+    uint32_t virt_helper;
+} HwCacheKey;
+
+#define FNV1A_INIT 2166136261u
+
+static uint32_t fnv1a_update(uint32_t hash, const void *data, size_t len) {
+    const unsigned char *p = data;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// The cache holds the serial numbers and UUID that sysfs only shows to
+// root, so neither the directory nor the file is readable by others.
+static int cache_path(char *path, size_t size) {
+    if (mkdir(HWCACHE_DIR, 0700) == 0 || access(HWCACHE_DIR, W_OK) == 0) {
+        snprintf(path, size, "%s/%s", HWCACHE_DIR, HWCACHE_FILE);
+        return 1;
+    }
+    // Unprivileged users fall back to their own runtime directory.
+    const char *runtime = getenv("XDG_RUNTIME_DIR");
+    if (runtime && *runtime) {
+        snprintf(path, size, "%s/hardware-info.cache", runtime);
+        return 1;
+    }
+    return 0;
+}
+
+static int current_key(HwCacheKey *key, int use_helper) {
+    char buffer[64];
+
+    memset(key, 0, sizeof(*key));
+    // Whether systemd-detect-virt was allowed decides what an otherwise
+    // inconclusive virtualization probe reports.
+    key->virt_helper = use_helper != 0;
+    if (!read_file_line(BOOT_ID, key->boot_id, sizeof(key->boot_id))) return 0;
+    // Late microcode loading changes what cpuinfo reports, so the revision
+    // is part of the key. Not every platform exposes it.
+    if (read_file_line(MICROCODE_VERSION, buffer, sizeof(buffer))) {
+        key->microcode = strtoull(buffer, NULL, 16);
+    }
+    return 1;
+}
+
+static size_t payload_size(int capacity) {
+    return sizeof(HardwareInfo) + sizeof(Topology) + topology_storage_size(capacity);
+}
+
+int hwcache_load(HardwareInfo *info, Topology *topology, int use_helper) {
+    char path[BUFFER_SIZE];
+    HwCacheKey key;
+    struct stat st;
+    int valid = 0;
+    int capacity = possible_cpu_count();
+
+    if (!cache_path(path, sizeof(path)) || !current_key(&key, use_helper)) return 0;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    if (fstat(fd, &st) < 0 || st.st_size != (off_t)(sizeof(HwCacheHeader) + payload_size(capacity))) {
+        close(fd);
+        return 0;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return 0;
+
+    const HwCacheHeader *header = map;
+    const char *payload = (const char *)map + sizeof(HwCacheHeader);
+    const Topology *cached = (const Topology *)(payload + sizeof(HardwareInfo));
+    if (header->magic == HWCACHE_MAGIC &&
+        header->version == HWCACHE_VERSION &&
+        header->header_size == sizeof(HwCacheHeader) &&
+        header->payload_size == payload_size(capacity) &&
+        memcmp(header->boot_id, key.boot_id, UUID_LENGTH) == 0 &&
+        header->microcode == key.microcode &&
+        header->virt_helper == key.virt_helper &&
+        header->checksum == fnv1a_update(FNV1A_INIT, payload, payload_size(capacity)) &&
+        cached->capacity == capacity &&
+        topology_init(topology, capacity)) {
+        memcpy(info, payload, sizeof(HardwareInfo));
+        // Only the counts are taken from the fixed part; the array
+        // pointers belong to the process that wrote the cache.
+        memcpy(topology, cached, offsetof(Topology, package));
+        memcpy(topology->storage, (const char *)cached + sizeof(Topology),
+               topology_storage_size(capacity));
+        valid = 1;
+    }
+
+    munmap(map, st.st_size);
+    return valid;
+}
+// The cache is written to a temporary file and renamed into place so
+// concurrent readers never see a partial record.
+void hwcache_store(const HardwareInfo *info, const Topology *topology, int use_helper) {
+    char path[BUFFER_SIZE];
+    char tmp_path[BUFFER_SIZE + 8];
+    HwCacheKey key;
+    HwCacheHeader header;
+    Topology fixed;
+
+    if (!cache_path(path, sizeof(path)) || !current_key(&key, use_helper)) return;
+
+    memset(&header, 0, sizeof(header));
+    header.magic = HWCACHE_MAGIC;
+    header.version = HWCACHE_VERSION;
+    header.header_size = sizeof(HwCacheHeader);
+    header.payload_size = payload_size(topology->capacity);
+    memcpy(header.boot_id, key.boot_id, UUID_LENGTH);
+    header.microcode = key.microcode;
+    header.virt_helper = key.virt_helper;
+
+    // The pointers in the fixed part are meaningless to another process,
+    // so they are zeroed to keep the file (and its checksum) stable.
+    memset(&fixed, 0, sizeof(fixed));
+    memcpy(&fixed, topology, offsetof(Topology, package));
+    size_t arrays = topology_storage_size(topology->capacity);
+    uint32_t hash = fnv1a_update(FNV1A_INIT, info, sizeof(HardwareInfo));
+    hash = fnv1a_update(hash, &fixed, sizeof(fixed));
+    header.checksum = fnv1a_update(hash, topology->storage, arrays);
+
+    // mkstemp() creates the file 0600.
+    snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path);
+    int fd = mkstemp(tmp_path);
+    if (fd < 0) return;
+
+    int ok = write(fd, &header, sizeof(header)) == (ssize_t)sizeof(header) &&
+             write(fd, info, sizeof(HardwareInfo)) == (ssize_t)sizeof(HardwareInfo) &&
+             write(fd, &fixed, sizeof(fixed)) == (ssize_t)sizeof(fixed) &&
+             write(fd, topology->storage, arrays) == (ssize_t)arrays;
+    close(fd);
+
+    if (!ok || rename(tmp_path, path) != 0) unlink(tmp_path);
+}
+
+// Answers from this boot's cache if it can, and otherwise starts the
+// static probes the fields need and collects the topology while they
+// run. The probes must be passed to hwcache_finish() before info is
+// used; NULL means there is nothing left to wait for. Fields that need
+// neither leave info and topology empty.
+//
+// A tree under a sysroot describes some other machine, which must neither
+// be answered from nor written to this boot's cache.
+HardwareProbe *hwcache_begin(HardwareInfo *info, Topology *topology, int refresh, int use_helper,
+                             uint32_t fields) {
+    uint32_t probes = fields_probes(fields);
+    PhaseTimer phase;
+
+    memset(info, 0, sizeof(HardwareInfo));
+    if (!probes && !(fields & FIELDS_NEED_TOPOLOGY)) return NULL;
+    if (!sysroot_active() && !refresh) {
+        phase_begin(&phase);
+        int hit = hwcache_load(info, topology, use_helper);
+        phase_end(&phase, PHASE_HWCACHE);
+        if (hit) return NULL;
+    }
+    HardwareProbe *probe = probes ? hardware_probe_start(probes, use_helper) : NULL;
+    if (fields & FIELDS_NEED_TOPOLOGY) {
+        phase_begin(&phase);
+        collect_topology(topology, possible_cpu_count());
+        phase_end(&phase, PHASE_TOPOLOGY);
+    }
+    return probe;
+}
+
+// Only complete results are cached: a probe that timed out or was not
+// needed leaves the cache for the next run to fill.
+void hwcache_finish(HardwareProbe *probe, HardwareInfo *info, const Topology *topology,
+                    int use_helper) {
+    if (!probe) return;
+    int complete = hardware_probe_finish(probe, info);
+    if (complete && topology->storage && !sysroot_active()) hwcache_store(info, topology, use_helper);
+}
+
+void collect_hardware_info_cached(HardwareInfo *info, Topology *topology, int refresh, int use_helper) {
+    hwcache_finish(hwcache_begin(info, topology, refresh, use_helper, FIELDS_ALL), info, topology,
+                   use_helper);
+}
@@ -0,0 +1,15 @@
+#ifndef HWCACHE_H
+#define HWCACHE_H
+
+#include "hardware_info.h"
+#include "topology.h"
+
+int hwcache_load(HardwareInfo *info, Topology *topology, int use_helper);
+void hwcache_store(const HardwareInfo *info, const Topology *topology, int use_helper);
+HardwareProbe *hwcache_begin(HardwareInfo *info, Topology *topology, int refresh, int use_helper,
+                             uint32_t fields);
+void hwcache_finish(HardwareProbe *probe, HardwareInfo *info, const Topology *topology,
+                    int use_helper);
+void collect_hardware_info_cached(HardwareInfo *info, Topology *topology, int refresh, int use_helper);
+
+#endif
@@ -0,0 +1,312 @@
+#include "iostats.h"
+#include "tokenizer.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROC_DISKSTATS "/proc/diskstats"
+#define PROC_NET_DEV "/proc/net/dev"
+#define IOSTATS_INITIAL_SIZE 65536
+#define DEVICES_INITIAL 16
+#define SECTOR_SIZE 512
+#define DISKSTATS_FIELDS 11
+#define NET_DEV_FIELDS 16
+
+int iostats_init(IoStats *io) {
+    memset(io, 0, sizeof(*io));
+    io->diskstats = (CachedFile)CACHED_FILE_INIT(PROC_DISKSTATS);
+    io->net_dev = (CachedFile)CACHED_FILE_INIT(PROC_NET_DEV);
+    io->buf = malloc(IOSTATS_INITIAL_SIZE);
+    io->buf_size = io->buf ? IOSTATS_INITIAL_SIZE : 0;
+    return io->buf != NULL;
+}
+
+void iostats_free(IoStats *io) {
+    cached_file_close(&io->diskstats);
+    cached_file_close(&io->net_dev);
+    for (int k = 0; k < io->nets.count; k++) cached_file_close(&io->nets.lines[k].speed);
+    free(io->nets.lines);
+    free(io->disks.lines);
+    free(io->buf);
+    memset(io, 0, sizeof(*io));
+}
+
+// Doubles the capacity of array until it holds needed elements. Returns
+// the array, which may have moved, or NULL with the old one untouched.
+static void *grow_array(void *array, int *capacity, int needed, size_t size) {
+    if (needed <= *capacity) return array;
+    int cap = *capacity > 0 ? *capacity : DEVICES_INITIAL;
+    while (cap < needed) cap *= 2;
+    void *grown = realloc(array, (size_t)cap * size);
+    if (grown) *capacity = cap;
+    return grown;
+}
+
+// Reads file whole, doubling the buffer while a read fills it, and
+// returns the length of its complete lines. When the buffer cannot grow
+// any more the lines that fit are returned and *truncated is set.
+static size_t read_whole(IoStats *io, CachedFile *file, int *truncated) {
+    ssize_t len;
+    *truncated = 0;
+    while ((len = cached_file_read(file, io->buf, io->buf_size)) == (ssize_t)io->buf_size - 1) {
+        char *grown = realloc(io->buf, io->buf_size * 2);
+        if (!grown) {
+            *truncated = 1;
+            while (len > 0 && io->buf[len - 1] != '\n') len--;
+            break;
+        }
+        io->buf = grown;
+        io->buf_size *= 2;
+    }
+    return len > 0 ? (size_t)len : 0;
+}
+
+// Makes room for line k; the speed files keep pointing into their lines
+// when the table moves.
+static int table_reserve(DeviceTable *t, int k) {
+    int old = t->capacity;
+    DeviceLine *lines = grow_array(t->lines, &t->capacity, k + 1, sizeof(DeviceLine));
+    if (!lines) return 0;
+    t->lines = lines;
+    for (int i = 0; i < old; i++) {
+        if (lines[i].speed.path) lines[i].speed.path = lines[i].speed_path;
+    }
+    for (int i = old; i < t->capacity; i++) {
+        memset(&lines[i], 0, sizeof(lines[i]));
+        lines[i].speed = (CachedFile)CACHED_FILE_INIT(NULL);
+    }
+    return 1;
+}
+
+// Returns 1 when line k still names the same device. Otherwise the new
+// name is stored and 0 tells the caller to resolve it. Names longer than
+// the table holds are compared by their stored prefix.
+static int table_match(DeviceTable *t, int k, const char *name, size_t len) {
+    DeviceLine *l = &t->lines[k];
+    size_t n = len < DEVICE_NAME_MAX - 1 ? len : DEVICE_NAME_MAX - 1;
+    if (k < t->count && memcmp(l->name, name, n) == 0 && l->name[n] == '\0') return 1;
+    memcpy(l->name, name, n);
+    l->name[n] = '\0';
+    return 0;
+}
+
+static double delta(uint64_t curr, uint64_t prev) {
+    return curr > prev ? (double)(curr - prev) : 0.0;
+}
+
+// Devices usually keep their position between samples, so the same index
+// is tried before searching by name.
+static int find_previous(const char *name, int hint, const char *names, size_t stride, int count) {
+    if (hint < count && strcmp(names + hint * stride, name) == 0) return hint;
+    for (int i = 0; i < count; i++) {
+        if (strcmp(names + i * stride, name) == 0) return i;
+    }
+    return -1;
+}
+
+static double elapsed_seconds(const SystemInfo *info, const SystemInfo *prev) {
+    if (!prev || info->monotonic_ns <= prev->monotonic_ns) return 0.0;
+    return (info->monotonic_ns - prev->monotonic_ns) / 1e9;
+}
+
+// Whole disks only: partitions would count the same I/O twice. Loop and
+// RAM disks are left out as they only mirror I/O accounted elsewhere.
+static int disk_included(const char *name) {
+    char path[BUFFER_SIZE];
+
+    if (strncmp(name, "loop", 4) == 0 || strncmp(name, "ram", 3) == 0) return 0;
+    // sysfs spells the '/' in names such as cciss/c0d0 as '!'.
+    int n = snprintf(path, sizeof(path), "/sys/block/%s", name);
+    for (char *c = path + n - strlen(name); *c; c++) {
+        if (*c == '/') *c = '!';
+    }
+    return file_exists(path);
+}
+
+static void disk_rates(DiskStats *d, const DiskStats *p, double seconds) {
+    double ms = seconds * 1000.0;
+    double reads = delta(d->reads, p->reads);
+    double writes = delta(d->writes, p->writes);
+
+    d->read_bytes_rate = delta(d->read_sectors, p->read_sectors) * SECTOR_SIZE / seconds;
+    d->write_bytes_rate = delta(d->write_sectors, p->write_sectors) * SECTOR_SIZE / seconds;
+    d->read_iops = reads / seconds;
+    d->write_iops = writes / seconds;
+    d->read_latency_ms = reads > 0 ? delta(d->read_ms, p->read_ms) / reads : 0.0;
+    d->write_latency_ms = writes > 0 ? delta(d->write_ms, p->write_ms) / writes : 0.0;
+    d->utilization = 100.0 * delta(d->io_ms, p->io_ms) / ms;
+    if (d->utilization > 100.0) d->utilization = 100.0;
+    d->queue_depth = delta(d->weighted_ms, p->weighted_ms) / ms;
+}
+
+// "major minor name" followed by at least eleven counters; kernels since
+// 4.18 and 5.5 append discard and flush fields, which are not used.
+void collect_disks(IoStats *io, SystemInfo *info, const SystemInfo *prev) {
+    DeviceTable *t = &io->disks;
+    int k = 0, out = 0;
+
+    int truncated;
+    info->disks_dropped = 0;
+    const char *p = io->buf, *end = io->buf + read_whole(io, &io->diskstats, &truncated);
+    while (p < end && table_reserve(t, k)) {
+        uint64_t major, minor, v[DISKSTATS_FIELDS];
+        const char *line = p;
+        if (!(p = parse_u64(p, end, &major)) || !(p = parse_u64(p, end, &minor))) {
+            p = skip_line(line, end);
+            continue;
+        }
+        const char *name = p = skip_blanks(p, end);
+        while (p < end && *p != ' ' && *p != '\n') p++;
+        DeviceLine *l = &t->lines[k];
+        if (!table_match(t, k, name, p - name)) l->included = disk_included(l->name);
+
+        if (l->included) {
+            int f = 0;
+            while (f < DISKSTATS_FIELDS && (p = parse_u64(p, end, &v[f]))) f++;
+            DiskStats *disks = f == DISKSTATS_FIELDS
+                                   ? grow_array(info->disks, &info->disk_capacity, out + 1, sizeof(DiskStats))
+                                   : NULL;
+            if (disks) {
+                info->disks = disks;
+                DiskStats *d = &disks[out++];
+                memcpy(d->name, l->name, DEVICE_NAME_MAX);
+                d->reads = v[0];
+                d->read_sectors = v[2];
+                d->read_ms = v[3];
+                d->writes = v[4];
+                d->write_sectors = v[6];
+                d->write_ms = v[7];
+                d->in_flight = v[8];
+                d->io_ms = v[9];
+                d->weighted_ms = v[10];
+            } else if (f == DISKSTATS_FIELDS) {
+                info->disks_dropped++;
+            }
+        }
+        p = skip_line(p ? p : line, end);
+        k++;
+    }
+    // Lines that were never parsed hold at least one more device.
+    if (p < end || truncated) info->disks_dropped++;
+    t->count = k;
+    info->num_disks = out;
+
+    double seconds = elapsed_seconds(info, prev);
+    for (int i = 0; i < out; i++) {
+        DiskStats *d = &info->disks[i];
+        int j = seconds > 0.0 && prev->num_disks > 0
+                    ? find_previous(d->name, i, prev->disks[0].name, sizeof(DiskStats), prev->num_disks)
+                    : -1;
+        if (j >= 0) {
+            disk_rates(d, &prev->disks[j], seconds);
+        } else {
+            memset(&d->read_bytes_rate, 0, sizeof(*d) - offsetof(DiskStats, read_bytes_rate));
+        }
+    }
+}
+
+// Interfaces under /sys/devices/virtual/net have no hardware behind them
+// (loopback, bridges, veth, tunnels) and are given no speed file.
+static void resolve_net_device(DeviceLine *l) {
+    char path[BUFFER_SIZE];
+
+    snprintf(path, sizeof(path), "/sys/devices/virtual/net/%s", l->name);
+    l->is_virtual = file_exists(path);
+    cached_file_close(&l->speed);
+    snprintf(l->speed_path, NET_SPEED_PATH_MAX, "/sys/class/net/%s/speed", l->name);
+    l->speed.path = l->speed_path;
+    if (l->is_virtual) l->speed.fd = CACHED_FILE_ABSENT;
+}
+
+// Links that are down fail the read or report -1.
+static int read_net_speed(DeviceLine *l) {
+    char buf[32];
+    if (cached_file_read(&l->speed, buf, sizeof(buf)) <= 0) return 0;
+    int speed = atoi(buf);
+    return speed > 0 ? speed : 0;
+}
+
+static void net_rates(NetStats *n, const NetStats *p, double seconds) {
+    n->rx_bytes_rate = delta(n->rx_bytes, p->rx_bytes) / seconds;
+    n->tx_bytes_rate = delta(n->tx_bytes, p->tx_bytes) / seconds;
+    n->rx_packet_rate = delta(n->rx_packets, p->rx_packets) / seconds;
+    n->tx_packet_rate = delta(n->tx_packets, p->tx_packets) / seconds;
+    n->rx_error_rate = delta(n->rx_errors, p->rx_errors) / seconds;
+    n->tx_error_rate = delta(n->tx_errors, p->tx_errors) / seconds;
+    n->rx_drop_rate = delta(n->rx_drops, p->rx_drops) / seconds;
+    n->tx_drop_rate = delta(n->tx_drops, p->tx_drops) / seconds;
+    n->utilization = 0.0;
+    if (n->speed_mbps > 0) {
+        double busiest = n->rx_bytes_rate > n->tx_bytes_rate ? n->rx_bytes_rate : n->tx_bytes_rate;
+        n->utilization = 100.0 * busiest * 8.0 / (n->speed_mbps * 1e6);
+    }
+}
+
+// Two header lines, then "name: <8 receive counters> <8 transmit
+// counters>" per interface, in the same order the kernel's
+// /sys/class/net/<name>/statistics files expose them.
+void collect_net_devices(IoStats *io, SystemInfo *info, const SystemInfo *prev) {
+    DeviceTable *t = &io->nets;
+    int k = 0, out = 0;
+
+    int truncated;
+    info->net_devices_dropped = 0;
+    const char *p = io->buf, *end = io->buf + read_whole(io, &io->net_dev, &truncated);
+    p = skip_line(skip_line(p, end), end);
+    while (p < end && table_reserve(t, k)) {
+        uint64_t v[NET_DEV_FIELDS];
+        const char *name = p = skip_blanks(p, end);
+        while (p < end && *p != ':' && *p != '\n') p++;
+        if (p == end || *p != ':') {
+            p = skip_line(p, end);
+            continue;
+        }
+        DeviceLine *l = &t->lines[k];
+        if (!table_match(t, k, name, p - name)) resolve_net_device(l);
+        p++;
+
+        int f = 0;
+        while (f < NET_DEV_FIELDS && (p = parse_u64(p, end, &v[f]))) f++;
+        NetStats *nets = f == NET_DEV_FIELDS
+                             ? grow_array(info->net_devices, &info->net_capacity, out + 1, sizeof(NetStats))
+                             : NULL;
+        if (nets) {
+            info->net_devices = nets;
+            NetStats *n = &nets[out++];
+            memcpy(n->name, l->name, DEVICE_NAME_MAX);
+            n->is_virtual = l->is_virtual;
+            n->speed_mbps = read_net_speed(l);
+            n->rx_bytes = v[0];
+            n->rx_packets = v[1];
+            n->rx_errors = v[2];
+            n->rx_drops = v[3];
+            n->tx_bytes = v[8];
+            n->tx_packets = v[9];
+            n->tx_errors = v[10];
+            n->tx_drops = v[11];
+        } else if (f == NET_DEV_FIELDS) {
+            info->net_devices_dropped++;
+        }
+        p = skip_line(p ? p : name, end);
+        k++;
+    }
+    if (p < end || truncated) info->net_devices_dropped++;
+    for (int i = k; i < t->count; i++) cached_file_close(&t->lines[i].speed);
+    t->count = k;
+    info->num_net_devices = out;
+
+    double seconds = elapsed_seconds(info, prev);
+    for (int i = 0; i < out; i++) {
+        NetStats *n = &info->net_devices[i];
+        int j = seconds > 0.0 && prev->num_net_devices > 0
+                    ? find_previous(n->name, i, prev->net_devices[0].name, sizeof(NetStats),
+                                    prev->num_net_devices)
+                    : -1;
+        if (j >= 0) {
+            net_rates(n, &prev->net_devices[j], seconds);
+        } else {
+            memset(&n->rx_bytes_rate, 0, sizeof(*n) - offsetof(NetStats, rx_bytes_rate));
+        }
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef IOSTATS_H
+#define IOSTATS_H
+
+#include "hardware_info.h"
+#include "reader.h"
+
+#define NET_SPEED_PATH_MAX (sizeof("/sys/class/net//speed") + DEVICE_NAME_MAX)
+
+// A device name seen on a line of /proc/diskstats or /proc/net/dev the
+// last time, and what was resolved for it from sysfs. included is only
+// used for disks, is_virtual and speed only for interfaces. The link
+// speed changes with renegotiation and cable pulls, so its file is kept
+// open and read with every sample; speed.path points at speed_path.
+typedef struct {
+    char name[DEVICE_NAME_MAX];
+    uint8_t included;
+    uint8_t is_virtual;
+    char speed_path[NET_SPEED_PATH_MAX];
+    CachedFile speed;
+} DeviceLine;
+
+// The lines of the last sample. As long as a sample lists the same names
+// in the same order nothing is looked up again; a line whose name differs
+// is resolved on the spot. The table grows with the file.
+typedef struct {
+    int count;
+    int capacity;
+    DeviceLine *lines;
+} DeviceTable;
+
+// buf grows until the larger of the two files fits in one read.
+typedef struct {
+    CachedFile diskstats;
+    CachedFile net_dev;
+    char *buf;
+    size_t buf_size;
+    DeviceTable disks;
+    DeviceTable nets;
+} IoStats;
+
+int iostats_init(IoStats *io);
+void iostats_free(IoStats *io);
+void collect_disks(IoStats *io, SystemInfo *info, const SystemInfo *prev);
+void collect_net_devices(IoStats *io, SystemInfo *info, const SystemInfo *prev);
+
+#endif
@@ -0,0 +1,315 @@
+#include "json_writer.h"
+#include "selfstats.h"
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define JSON_INITIAL_SIZE 16384
+
+static const char digit_pairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static const char hex_digits[] = "0123456789abcdef";
+
+void json_writer_init(JsonWriter *w, int pretty) {
+    memset(w, 0, sizeof(*w));
+    w->owned = 1;
+    w->pretty = pretty;
+}
+
+void json_writer_init_buffer(JsonWriter *w, char *buf, size_t size, int pretty) {
+    memset(w, 0, sizeof(*w));
+    w->buf = buf;
+    w->cap = size;
+    w->pretty = pretty;
+}
+
+// Keeps the buffer so that steady-state sampling does not allocate.
+void json_writer_reset(JsonWriter *w) {
+    w->len = 0;
+    w->overflow = 0;
+    w->depth = 0;
+    w->has_items[0] = 0;
+}
+
+void json_writer_free(JsonWriter *w) {
+    if (w->owned) free(w->buf);
+    w->buf = NULL;
+    w->len = w->cap = 0;
+}
+
+static int reserve(JsonWriter *w, size_t n) {
+    if (w->len + n <= w->cap) return 1;
+    if (!w->owned) {
+        w->overflow = 1;
+        return 0;
+    }
+    size_t cap = w->cap ? w->cap : JSON_INITIAL_SIZE;
+    while (cap < w->len + n) cap *= 2;
+    char *grown = realloc(w->buf, cap);
+    if (!grown) {
+        w->overflow = 1;
+        return 0;
+    }
+    w->buf = grown;
+    w->cap = cap;
+    return 1;
+}
+
+static void put(JsonWriter *w, const char *s, size_t n) {
+    if (!reserve(w, n)) return;
+    memcpy(w->buf + w->len, s, n);
+    w->len += n;
+}
+
+static void put_char(JsonWriter *w, char c) {
+    if (!reserve(w, 1)) return;
+    w->buf[w->len++] = c;
+}
+
+static void put_indent(JsonWriter *w, int depth) {
+    if (!reserve(w, 1 + 2 * depth)) return;
+    w->buf[w->len++] = '\n';
+    memset(w->buf + w->len, ' ', 2 * depth);
+    w->len += 2 * depth;
+}
+
+static void put_u64(JsonWriter *w, uint64_t v) {
+    char tmp[20];
+    char *p = tmp + sizeof(tmp);
+    while (v >= 100) {
+        unsigned idx = (unsigned)(v % 100) * 2;
+        v /= 100;
+        *--p = digit_pairs[idx + 1];
+        *--p = digit_pairs[idx];
+    }
+    if (v >= 10) {
+        *--p = digit_pairs[v * 2 + 1];
+        *--p = digit_pairs[v * 2];
+    } else {
+        *--p = (char)('0' + v);
+    }
+    put(w, p, tmp + sizeof(tmp) - p);
+}
+
+// Returns the length of the well-formed UTF-8 sequence at s, or 0 for a
+// stray byte, a truncated or overlong sequence, a surrogate or a code
+// point above U+10FFFF.
+static int utf8_length(const unsigned char *s) {
+    unsigned char lo = 0x80, hi = 0xbf;
+    int n;
+    if (s[0] >= 0xc2 && s[0] <= 0xdf) {
+        n = 2;
+    } else if (s[0] >= 0xe0 && s[0] <= 0xef) {
+        n = 3;
+        if (s[0] == 0xe0) lo = 0xa0;
+        if (s[0] == 0xed) hi = 0x9f;
+    } else if (s[0] >= 0xf0 && s[0] <= 0xf4) {
+        n = 4;
+        if (s[0] == 0xf0) lo = 0x90;
+        if (s[0] == 0xf4) hi = 0x8f;
+    } else {
+        return 0;
+    }
+    if (s[1] < lo || s[1] > hi) return 0;
+    for (int i = 2; i < n; i++) {
+        if ((s[i] & 0xc0) != 0x80) return 0;
+    }
+    return n;
+}
+
+// Strings come from firmware and sysfs and are not guaranteed to be
+// UTF-8, so every byte that is not part of a well-formed sequence is
+// replaced by U+FFFD to keep the document valid.
+static void put_escaped(JsonWriter *w, const char *s) {
+    put_char(w, '"');
+    const char *run = s;
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c >= 0x20 && c < 0x80 && c != '"' && c != '\\') continue;
+        if (c >= 0x80) {
+            int n = utf8_length((const unsigned char *)s);
+            if (n) {
+                s += n - 1;
+                continue;
+            }
+        }
+        put(w, run, s - run);
+        run = s + 1;
+        switch (c) {
+            case '"': put(w, "\\\"", 2); break;
+            case '\\': put(w, "\\\\", 2); break;
+            case '\n': put(w, "\\n", 2); break;
+            case '\r': put(w, "\\r", 2); break;
+            case '\t': put(w, "\\t", 2); break;
+            case '\b': put(w, "\\b", 2); break;
+            case '\f': put(w, "\\f", 2); break;
+            default: {
+                if (c >= 0x80) {
+                    put(w, "\xef\xbf\xbd", 3);
+                    break;
+                }
+                char esc[6] = {'\\', 'u', '0', '0', hex_digits[c >> 4], hex_digits[c & 0xf]};
+                put(w, esc, sizeof(esc));
+                break;
+            }
+        }
+    }
+    put(w, run, s - run);
+    put_char(w, '"');
+}
+
+// Emits the separator, indentation and key that precede every value.
+static void begin_value(JsonWriter *w, const char *key) {
+    if (w->depth > 0) {
+        if (w->has_items[w->depth]) put_char(w, ',');
+        w->has_items[w->depth] = 1;
+        if (w->pretty) put_indent(w, w->depth);
+    }
+    if (key) {
+        put_escaped(w, key);
+        if (w->pretty) {
+            put(w, ": ", 2);
+        } else {
+            put_char(w, ':');
+        }
+    }
+}
+
+static void open_container(JsonWriter *w, const char *key, char c) {
+    begin_value(w, key);
+    put_char(w, c);
+    if (w->depth < JSON_MAX_DEPTH - 1) w->depth++;
+    w->has_items[w->depth] = 0;
+}
+
+// An empty container closes on the line it opened, as [] or {}.
+static void close_container(JsonWriter *w, char c) {
+    int empty = !w->has_items[w->depth];
+    if (w->depth > 0) w->depth--;
+    if (w->pretty && !empty) put_indent(w, w->depth);
+    put_char(w, c);
+}
+
+void json_begin_object(JsonWriter *w, const char *key) {
+    open_container(w, key, '{');
+}
+
+void json_end_object(JsonWriter *w) {
+    close_container(w, '}');
+}
+
+void json_begin_array(JsonWriter *w, const char *key) {
+    open_container(w, key, '[');
+}
+
+void json_end_array(JsonWriter *w) {
+    close_container(w, ']');
+}
+
+void json_string(JsonWriter *w, const char *key, const char *value) {
+    begin_value(w, key);
+    if (value) {
+        put_escaped(w, value);
+    } else {
+        put(w, "null", 4);
+    }
+}
+
+void json_null(JsonWriter *w, const char *key) {
+    begin_value(w, key);
+    put(w, "null", 4);
+}
+
+void json_bool(JsonWriter *w, const char *key, int value) {
+    begin_value(w, key);
+    if (value) {
+        put(w, "true", 4);
+    } else {
+        put(w, "false", 5);
+    }
+}
+
+void json_int(JsonWriter *w, const char *key, int64_t value) {
+    begin_value(w, key);
+    if (value < 0) {
+        put_char(w, '-');
+        put_u64(w, (uint64_t)0 - (uint64_t)value);
+    } else {
+        put_u64(w, (uint64_t)value);
+    }
+}
+
+void json_uint(JsonWriter *w, const char *key, uint64_t value) {
+    begin_value(w, key);
+    put_u64(w, value);
+}
+
+// Fixed-point formatting without printf: the value is rounded to an
+// integer number of 10^-decimals units and printed as two integers.
+void json_fixed(JsonWriter *w, const char *key, double value, int decimals) {
+    static const uint64_t scales[] = {1, 10, 100, 1000, 10000, 100000, 1000000};
+    begin_value(w, key);
+    if (!isfinite(value) || fabs(value) >= 9e15) {
+        put(w, "null", 4);
+        return;
+    }
+    if (decimals < 0) decimals = 0;
+    if (decimals > 6) decimals = 6;
+
+    uint64_t scale = scales[decimals];
+    double scaled = fabs(value) * (double)scale + 0.5;
+    uint64_t units = (uint64_t)scaled;
+    if (value < 0 && units > 0) put_char(w, '-');
+    put_u64(w, units / scale);
+    if (decimals == 0) return;
+
+    char frac[6];
+    uint64_t rem = units % scale;
+    for (int i = decimals - 1; i >= 0; i--) {
+        frac[i] = (char)('0' + rem % 10);
+        rem /= 10;
+    }
+    put_char(w, '.');
+    put(w, frac, decimals);
+}
+
+void json_hex(JsonWriter *w, const char *key, uint64_t value) {
+    char tmp[19];
+    char *p = tmp + sizeof(tmp);
+    *--p = '"';
+    do {
+        *--p = hex_digits[value & 0xf];
+        value >>= 4;
+    } while (value);
+    *--p = 'x';
+    *--p = '0';
+    begin_value(w, key);
+    put_char(w, '"');
+    put(w, p, tmp + sizeof(tmp) - p);
+}
+
+// Appends pre-formatted text such as a trailing newline.
+void json_raw(JsonWriter *w, const char *text, size_t len) {
+    put(w, text, len);
+}
+
+int json_writer_flush(JsonWriter *w, int fd) {
+    size_t off = 0;
+    if (w->overflow) return 0;
+    while (off < w->len) {
+        ssize_t n = write(fd, w->buf + off, w->len - off);
+        count_syscalls(1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        off += n;
+    }
+    w->len = 0;
+    return 1;
+}
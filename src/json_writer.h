@@ -0,0 +1,44 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define JSON_MAX_DEPTH 16
+
+// Streaming JSON serializer that formats into a single buffer, either a
+// growable heap buffer or one supplied by the caller, so a document is
+// emitted with one write(2). Commas, indentation and string escaping are
+// handled by the writer. Keys are passed as NULL for array elements and
+// the root value.
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+    int owned;
+    int overflow;
+    int pretty;
+    int depth;
+    unsigned char has_items[JSON_MAX_DEPTH];
+} JsonWriter;
+
+void json_writer_init(JsonWriter *w, int pretty);
+void json_writer_init_buffer(JsonWriter *w, char *buf, size_t size, int pretty);
+void json_writer_reset(JsonWriter *w);
+void json_writer_free(JsonWriter *w);
+int json_writer_flush(JsonWriter *w, int fd);
+
+void json_begin_object(JsonWriter *w, const char *key);
+void json_end_object(JsonWriter *w);
+void json_begin_array(JsonWriter *w, const char *key);
+void json_end_array(JsonWriter *w);
+void json_string(JsonWriter *w, const char *key, const char *value);
+void json_null(JsonWriter *w, const char *key);
+void json_bool(JsonWriter *w, const char *key, int value);
+void json_int(JsonWriter *w, const char *key, int64_t value);
+void json_uint(JsonWriter *w, const char *key, uint64_t value);
+void json_fixed(JsonWriter *w, const char *key, double value, int decimals);
+void json_hex(JsonWriter *w, const char *key, uint64_t value);
+void json_raw(JsonWriter *w, const char *text, size_t len);
+
+#endif
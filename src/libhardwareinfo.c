@@ -0,0 +1,195 @@
+#include "hardwareinfo.h"
+#include "hardware_info.h"
+#include "collector.h"
+#include "hwcache.h"
+#include "output.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct hwinfo_collector {
+    Collector collector;
+    Topology topology;
+    SystemInfo samples[2];
+    SystemInfo *prev;
+    SystemInfo *curr;
+    JsonWriter writer;
+};
+
+int hwinfo_api_version(void) {
+    return HWINFO_API_VERSION;
+}
+
+int hwinfo_set_sysroot(const char *root) {
+    return set_sysroot(root) ? 0 : -1;
+}
+
+hwinfo_collector *hwinfo_open(unsigned flags) {
+    hwinfo_collector *c = calloc(1, sizeof(*c));
+    if (!c) return NULL;
+
+    if (!collector_init(&c->collector) ||
+        !system_info_init(&c->samples[0]) ||
+        !system_info_init(&c->samples[1])) {
+        hwinfo_close(c);
+        return NULL;
+    }
+    c->prev = &c->samples[0];
+    c->curr = &c->samples[1];
+    json_writer_init(&c->writer, 1);
+
+    // Both flags apply to this handle only.
+    collect_hardware_info_cached(&c->curr->hw_info, &c->topology, (flags & HWINFO_REFRESH_STATIC) != 0,
+                                 (flags & HWINFO_VIRT_HELPER) != 0);
+    c->prev->hw_info = c->curr->hw_info;
+    c->prev->topology = c->curr->topology = &c->topology;
+
+    // The baseline lands in curr so that it becomes prev on the first
+    // hwinfo_sample() call.
+    collector_sample(&c->collector, c->curr, NULL);
+    return c;
+}
+
+void hwinfo_close(hwinfo_collector *c) {
+    if (!c) return;
+    collector_free(&c->collector);
+    system_info_free(&c->samples[0]);
+    system_info_free(&c->samples[1]);
+    topology_free(&c->topology);
+    json_writer_free(&c->writer);
+    free(c);
+}
+
+int hwinfo_sample(hwinfo_collector *c) {
+    SystemInfo *tmp = c->prev;
+    c->prev = c->curr;
+    c->curr = tmp;
+    collector_sample(&c->collector, c->curr, c->prev);
+    return c->curr->num_cores > 0 ? 0 : -1;
+}
+
+long hwinfo_serialize(hwinfo_collector *c, char *buf, size_t size, int format) {
+    c->writer.pretty = format != HWINFO_JSON_COMPACT;
+    json_writer_reset(&c->writer);
+    write_system_info_json(&c->writer, c->curr);
+    if (c->writer.overflow) return -1;
+
+    size_t len = c->writer.len;
+    if (buf && size > 0) {
+        size_t n = len < size - 1 ? len : size - 1;
+        memcpy(buf, c->writer.buf, n);
+        buf[n] = '\0';
+    }
+    return (long)len;
+}
+
+int hwinfo_cpu_capacity(const hwinfo_collector *c) {
+    return c->curr->cpus.capacity;
+}
+
+static int valid_cpu(const hwinfo_collector *c, int cpu) {
+    return cpu >= 0 && cpu < c->curr->cpus.capacity;
+}
+
+int hwinfo_cpu_online(const hwinfo_collector *c, int cpu) {
+    return valid_cpu(c, cpu) && c->curr->cpus.online[cpu];
+}
+
+double hwinfo_cpu_usage(const hwinfo_collector *c, int cpu) {
+    return valid_cpu(c, cpu) ? c->curr->cpus.usage[cpu] : 0.0;
+}
+
+double hwinfo_total_usage(const hwinfo_collector *c) {
+    return c->curr->total_usage;
+}
+
+int hwinfo_cpu_temperature(const hwinfo_collector *c, int cpu, int *celsius) {
+    if (!valid_cpu(c, cpu) || c->curr->cpus.temperature[cpu] == TEMPERATURE_UNKNOWN) return -1;
+    *celsius = c->curr->cpus.temperature[cpu];
+    return 0;
+}
+
+int hwinfo_package_count(const hwinfo_collector *c) {
+    return c->curr->num_packages;
+}
+
+int hwinfo_package_temperature(const hwinfo_collector *c, int package, int *celsius) {
+    const SystemInfo *info = c->curr;
+    if (package < 0 || package >= info->num_packages ||
+        info->package_temperature[package] == TEMPERATURE_UNKNOWN) return -1;
+    *celsius = info->package_temperature[package];
+    return 0;
+}
+
+int hwinfo_set_windows(hwinfo_collector *c, const unsigned *window_ms, int count,
+                       unsigned interval_ms) {
+    if (count < 0 || count > MAX_USAGE_WINDOWS) return -1;
+    return collector_set_windows(&c->collector, window_ms, count, interval_ms) ? 0 : -1;
+}
+
+int hwinfo_window_usage(const hwinfo_collector *c, int window, int cpu,
+                        double *usage, double *span_ms) {
+    const UsageWindows *windows = c->curr->windows;
+    if (!windows || window < 0 || window >= windows->count) return -1;
+    if (cpu != -1 && !hwinfo_cpu_online(c, cpu)) return -1;
+
+    const UsageWindow *w = &windows->window[window];
+    if (w->span_ns == 0) return -1;
+    *usage = cpu == -1 ? w->usage : w->core_usage[cpu];
+    if (span_ms) *span_ms = w->span_ns / 1e6;
+    return 0;
+}
+
+int hwinfo_cpu_frequency(const hwinfo_collector *c, int cpu, double *mhz) {
+    const CpuFreqStats *freq = c->curr->cpufreq;
+    if (!freq || !hwinfo_cpu_online(c, cpu) || cpu >= freq->capacity) return -1;
+    if (freq->mhz[cpu] <= 0) return -1;
+    *mhz = freq->mhz[cpu];
+    return 0;
+}
+
+int hwinfo_idle_state_count(const hwinfo_collector *c) {
+    const CpuFreqStats *freq = c->curr->cpufreq;
+    return freq ? freq->num_idle_states : 0;
+}
+
+const char *hwinfo_idle_state_name(const hwinfo_collector *c, int state) {
+    if (state < 0 || state >= hwinfo_idle_state_count(c)) return NULL;
+    return c->curr->cpufreq->idle_names[state];
+}
+
+int hwinfo_cpu_idle(const hwinfo_collector *c, int cpu, int state, double *residency) {
+    const CpuFreqStats *freq = c->curr->cpufreq;
+    if (!freq || !freq->idle_valid || state < 0 || state >= freq->num_idle_states) return -1;
+    if (!hwinfo_cpu_online(c, cpu) || cpu >= freq->capacity) return -1;
+    *residency = freq->idle_residency[state][cpu];
+    return 0;
+}
+
+void hwinfo_get_memory(const hwinfo_collector *c, hwinfo_memory *out) {
+    const SystemInfo *info = c->curr;
+    out->total = info->total_memory;
+    out->free = info->free_memory;
+    out->available = info->available_memory;
+    out->cached = info->cached_memory;
+    out->swap_total = info->swap_total;
+    out->swap_free = info->swap_free;
+}
+
+int hwinfo_get_cgroup(const hwinfo_collector *c, hwinfo_cgroup *out) {
+    const CgroupStats *cg = &c->curr->cgroup;
+
+    memset(out, 0, sizeof(*out));
+    if (!cg->available) return -1;
+    out->available = 1;
+    out->cpu_limit = cg->cpu_limit;
+    out->cpu_usage = cg->cpu_usage;
+    out->throttled_percent = cg->throttled_percent;
+    out->memory_current = cg->memory_current;
+    out->memory_max = cg->memory_max == CGROUP_UNLIMITED ? 0 : cg->memory_max;
+    out->memory_usage = cg->memory_usage;
+    return 0;
+}
+
+uint64_t hwinfo_timestamp_ms(const hwinfo_collector *c) {
+    return c->curr->timestamp / 1000000;
+}
@@ -1,16 +1,563 @@
 #include "hardware_info.h"
+#include "fields.h"
+#include "hwcache.h"
+#include "procscan.h"
+#include "psi.h"
+#include "record.h"
+#include "rollup.h"
+#include "selfstats.h"
+#include "shm.h"
+#include "window.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
 #include <unistd.h>
 
-int main(void) {
-    SystemInfo info, prev_info;
-    memset(&info, 0, sizeof(SystemInfo));
-    memset(&prev_info, 0, sizeof(SystemInfo));
-    collect_hardware_info(&info.hw_info);
-    collect_system_info(&prev_info, NULL);
-    sleep(1);
-    collect_system_info(&info, &prev_info);
-    output_json(&info);
-    return 0;
+#define DEFAULT_INTERVAL_MS 1000
+#define MIN_INTERVAL_MS 1
+// Also the epoll timeout in watch mode, which is an int.
+#define MAX_INTERVAL_MS INT_MAX
+#define NSEC_PER_MSEC 1000000L
+#define NSEC_PER_SEC 1000000000L
+
+typedef enum {
+    FORMAT_JSON,
+    FORMAT_NDJSON,
+    FORMAT_BINARY
+} OutputFormat;
+
+// hardware-info is linked with -Wl,--wrap for these (see the Makefile),
+// which routes the allocations made by its own code through a counter
+// for --self-stats. Allocations libc makes internally are not seen.
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void *__real_aligned_alloc(size_t alignment, size_t size);
+char *__real_strdup(const char *s);
+
+void *__wrap_malloc(size_t size) {
+    self_counters.allocations++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    self_counters.allocations++;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    self_counters.allocations++;
+    return __real_realloc(ptr, size);
+}
+
+void *__wrap_aligned_alloc(size_t alignment, size_t size) {
+    self_counters.allocations++;
+    return __real_aligned_alloc(alignment, size);
+}
+
+char *__wrap_strdup(const char *s) {
+    self_counters.allocations++;
+    return __real_strdup(s);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [--interval=<ms>] [--count=<n>] [--systemd-detect-virt]\n"
+            "       [--refresh] [--compact] [--format=json|ndjson|binary]\n"
+            "       [--publish-shm[=<name>]] [--read-shm[=<name>]]\n"
+            "       [--windows=<ms>[,<ms>...]] [--watch=<trigger>]...\n"
+            "       [--top=<n>] [--sysroot=<dir>] [--self-stats]\n"
+            "       [--probe-timeout=<ms>] [--fields=<field>[,<field>...]]\n"
+            "       [--serve-rollups=<socket>] [--query-rollups=<socket> <request>]\n"
+            "  --interval=<ms>  sampling interval in milliseconds (default %d)\n"
+            "  --count=<n>      number of snapshots to emit, 0 for unlimited\n"
+            "                   (default 1, or unlimited when --interval is given)\n"
+            "  --systemd-detect-virt\n"
+            "                   ask systemd-detect-virt when the built-in\n"
+            "                   virtualization probes are inconclusive\n"
+            "  --refresh        re-probe static hardware information instead of\n"
+            "                   using the cache written earlier in this boot\n"
+            "  --compact        print JSON without indentation or newlines\n"
+            "  --format=<fmt>   json (default), ndjson (one compact line per\n"
+            "                   snapshot) or binary (delta-encoded recording,\n"
+            "                   see hardware-info-replay)\n"
+            "  --publish-shm[=<name>]\n"
+            "                   publish every sample and a short history to a\n"
+            "                   POSIX shared-memory segment (default %s)\n"
+            "  --read-shm[=<name>]\n"
+            "                   print the latest sample published by another\n"
+            "                   hardware-info instead of collecting one\n"
+            "  --windows=<ms>[,<ms>...]\n"
+            "                   also report CPU usage over up to %d trailing\n"
+            "                   windows, e.g. 100,1000,10000\n"
+            "  --watch=[cgroup.]<cpu|memory|io>[:<some|full>[:<stall_us>:<window_us>]]\n"
+            "                   sleep until a pressure stall trigger fires and\n"
+            "                   emit a snapshot each time (default some:%d:%d);\n"
+            "                   may be repeated. With --interval, also emit a\n"
+            "                   snapshot when no trigger fired for that long\n"
+            "  --top=<n>        list the n processes using the most CPU and the\n"
+            "                   n with the largest resident set (at most %d)\n"
+            "  --sysroot=<dir>  read /proc, /sys and the other system files\n"
+            "                   below dir instead, e.g. from a captured tree\n"
+            "  --self-stats     add a collector_stats object with the time,\n"
+            "                   I/O and allocations of each collection phase\n"
+            "  --probe-timeout=<ms>\n"
+            "                   give each static hardware probe this long before\n"
+            "                   reporting its fields as null (default 1000 ms,\n"
+            "                   3000 ms for virtualization detection)\n"
+            "  --fields=<field>[,<field>...]\n"
+            "                   collect and print only these parts of a snapshot,\n"
+            "                   e.g. hardware.cpu,memory; a field selects all\n"
+            "                   below it. Without cpu_usage.usage, cpu_usage.frequency,\n"
+            "                   disks, network, processes or cgroup the snapshot\n"
+            "                   is taken without waiting for a second sample\n"
+            "  --serve-rollups=<socket>\n"
+            "                   keep min/avg/max of usage, per-CPU usage, memory\n"
+            "                   and per-CPU temperature at raw, 10s, 1m and 1h\n"
+            "                   resolution and answer range queries on this\n"
+            "                   Unix domain socket\n"
+            "  --query-rollups=<socket> <metric>[:<cpu>] <range> [raw|10s|1m|1h]\n"
+            "                   ask a collector serving rollups, e.g.\n"
+            "                   core_usage:17 15m 10s\n",
+            prog, DEFAULT_INTERVAL_MS, SHM_DEFAULT_NAME, MAX_USAGE_WINDOWS,
+            PSI_DEFAULT_STALL_US, PSI_DEFAULT_WINDOW_US, MAX_TOP_PROCESSES);
+}
+
+static int parse_long(const char *arg, long min, long *out) {
+    char *end;
+    errno = 0;
+    long value = strtol(arg, &end, 10);
+    if (errno || end == arg || *end != '\0' || value < min) return 0;
+    *out = value;
+    return 1;
+}
+
+// Comma-separated list of window lengths in milliseconds.
+static int parse_windows(const char *arg, unsigned *out, int *count) {
+    *count = 0;
+    while (*arg) {
+        char *end;
+        errno = 0;
+        unsigned long value = strtoul(arg, &end, 10);
+        if (errno || end == arg || value == 0 || value > UINT32_MAX) return 0;
+        if (*end != ',' && *end != '\0') return 0;
+        if (*count == MAX_USAGE_WINDOWS) return 0;
+        out[(*count)++] = (unsigned)value;
+        arg = *end ? end + 1 : end;
+    }
+    return *count > 0;
+}
+
+static void timespec_add_ns(struct timespec *ts, long ns) {
+    ts->tv_sec += ns / NSEC_PER_SEC;
+    ts->tv_nsec += ns % NSEC_PER_SEC;
+    if (ts->tv_nsec >= NSEC_PER_SEC) {
+        ts->tv_sec++;
+        ts->tv_nsec -= NSEC_PER_SEC;
+    }
+}
+
+static int timespec_before(const struct timespec *a, const struct timespec *b) {
+    if (a->tv_sec != b->tv_sec) return a->tv_sec < b->tv_sec;
+    return a->tv_nsec < b->tv_nsec;
+}
+
+// Set by SIGINT and SIGTERM. The handlers are installed without
+// SA_RESTART, so the sleep or epoll wait in progress returns EINTR and the
+// sampling loop ends through its cleanup, which removes the shared-memory
+// segment and the rollup socket.
+static volatile sig_atomic_t stop_requested;
+
+static void request_stop(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+static void handle_stop_signals(void) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = request_stop;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+}
+
+// Sleep until an absolute CLOCK_MONOTONIC deadline so that ticks don't
+// accumulate drift from the time spent collecting and printing.
+// A stop request ends the sleep early.
+static void sleep_until(const struct timespec *deadline) {
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL) == EINTR && !stop_requested)
+        ;
+}
+
+static int print_rollup_query(const char *prog, const char *socket, char *const words[],
+                              int count) {
+    char request[ROLLUP_MAX_REQUEST + 1];
+    size_t len = 0;
+
+    if (count == 0) {
+        fprintf(stderr, "%s: --query-rollups needs a request, e.g. usage 15m\n", prog);
+        return 1;
+    }
+    for (int i = 0; i < count; i++) {
+        size_t n = strlen(words[i]);
+        if (len + n + 1 > sizeof(request)) {
+            fprintf(stderr, "%s: request too long\n", prog);
+            return 1;
+        }
+        if (i) request[len++] = ' ';
+        memcpy(request + len, words[i], n);
+        len += n;
+    }
+    request[len] = '\0';
+
+    int status = rollup_request(socket, request, STDOUT_FILENO);
+    if (status < 0) fprintf(stderr, "%s: no hardware-info serving rollups at '%s'\n", prog, socket);
+    return status != 1;
+}
+
+static int print_shm_snapshot(const char *prog, const char *name, int pretty) {
+    ShmSegment segment;
+    SystemInfo info;
+
+    if (!shm_reader_open(&segment, name)) {
+        fprintf(stderr, "%s: no hardware-info publisher at '%s'\n", prog, name);
+        return 1;
+    }
+    if (!system_info_init_capacity(&info, shm_capacity(&segment))) {
+        fprintf(stderr, "%s: out of memory\n", prog);
+        shm_close(&segment);
+        return 1;
+    }
+    int ok = shm_read(&segment, 0, &info);
+    if (ok) {
+        output_json(&info, pretty);
+    } else {
+        fprintf(stderr, "%s: no sample published at '%s' yet\n", prog, name);
+    }
+    system_info_free(&info);
+    shm_close(&segment);
+    return !ok;
+}
+
+int main(int argc, char *argv[]) {
+    static const struct option options[] = {
+        {"interval", required_argument, NULL, 'i'},
+        {"count", required_argument, NULL, 'c'},
+        {"systemd-detect-virt", no_argument, NULL, 'V'},
+        {"refresh", no_argument, NULL, 'r'},
+        {"compact", no_argument, NULL, 'C'},
+        {"format", required_argument, NULL, 'f'},
+        {"publish-shm", optional_argument, NULL, 'P'},
+        {"read-shm", optional_argument, NULL, 'R'},
+        {"windows", required_argument, NULL, 'w'},
+        {"watch", required_argument, NULL, 'W'},
+        {"top", required_argument, NULL, 't'},
+        {"sysroot", required_argument, NULL, 's'},
+        {"self-stats", no_argument, NULL, 'S'},
+        {"probe-timeout", required_argument, NULL, 'T'},
+        {"fields", required_argument, NULL, 'F'},
+        {"serve-rollups", required_argument, NULL, 'U'},
+        {"query-rollups", required_argument, NULL, 'Q'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    long interval_ms = DEFAULT_INTERVAL_MS;
+    long count = -1;
+    int interval_set = 0;
+    int refresh = 0;
+    int virt_helper = 0;
+    int pretty = 1;
+    OutputFormat format = FORMAT_JSON;
+    const char *publish_shm = NULL;
+    const char *read_shm = NULL;
+    const char *serve_rollups = NULL;
+    const char *query_rollups = NULL;
+    unsigned windows[MAX_USAGE_WINDOWS];
+    int num_windows = 0;
+    PsiTrigger triggers[MAX_PSI_TRIGGERS];
+    int num_triggers = 0;
+    long top = 0;
+    long probe_timeout = 0;
+    uint32_t fields = FIELDS_ALL;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "i:c:h", options, NULL)) != -1) {
+        switch (opt) {
+            case 'i':
+                if (!parse_long(optarg, MIN_INTERVAL_MS, &interval_ms) || interval_ms > MAX_INTERVAL_MS) {
+                    fprintf(stderr, "%s: invalid interval '%s'\n", argv[0], optarg);
+                    return 1;
+                }
+                interval_set = 1;
+                break;
+            case 'c':
+                if (!parse_long(optarg, 0, &count)) {
+                    fprintf(stderr, "%s: invalid count '%s'\n", argv[0], optarg);
+                    return 1;
+                }
+                break;
+            case 'V':
+                virt_helper = 1;
+                break;
+            case 'r':
+                refresh = 1;
+                break;
+            case 'C':
+                pretty = 0;
+                break;
+            case 'f':
+                if (strcmp(optarg, "json") == 0) {
+                    format = FORMAT_JSON;
+                } else if (strcmp(optarg, "ndjson") == 0) {
+                    format = FORMAT_NDJSON;
+                } else if (strcmp(optarg, "binary") == 0) {
+                    format = FORMAT_BINARY;
+                } else {
+                    fprintf(stderr, "%s: unknown format '%s'\n", argv[0], optarg);
+                    return 1;
+                }
+                break;
+            case 'P':
+                publish_shm = optarg ? optarg : SHM_DEFAULT_NAME;
+                break;
+            case 'R':
+                read_shm = optarg ? optarg : SHM_DEFAULT_NAME;
+                break;
+            case 'w':
+                if (!parse_windows(optarg, windows, &num_windows)) {
+                    fprintf(stderr, "%s: invalid windows '%s'\n", argv[0], optarg);
+                    return 1;
+                }
+                break;
+            case 'W':
+                if (num_triggers == MAX_PSI_TRIGGERS ||
+                    !psi_parse_trigger(optarg, &triggers[num_triggers])) {
+                    fprintf(stderr, "%s: invalid trigger '%s'\n", argv[0], optarg);
+                    return 1;
+                }
+                num_triggers++;
+                break;
+            case 't':
+                if (!parse_long(optarg, 1, &top) || top > MAX_TOP_PROCESSES) {
+                    fprintf(stderr, "%s: invalid process count '%s'\n", argv[0], optarg);
+                    return 1;
+                }
+                break;
+            case 's':
+                if (!set_sysroot(optarg)) {
+                    fprintf(stderr, "%s: sysroot path too long\n", argv[0]);
+                    return 1;
+                }
+                break;
+            case 'S':
+                selfstats_enable();
+                break;
+            case 'T':
+                if (!parse_long(optarg, 1, &probe_timeout) || probe_timeout > UINT32_MAX) {
+                    fprintf(stderr, "%s: invalid probe timeout '%s'\n", argv[0], optarg);
+                    return 1;
+                }
+                set_probe_timeout((unsigned)probe_timeout);
+                break;
+            case 'F':
+                if (!fields_parse(optarg, &fields)) {
+                    fprintf(stderr, "%s: invalid fields '%s'\n", argv[0], optarg);
+                    return 1;
+                }
+                break;
+            case 'U':
+                serve_rollups = optarg;
+                break;
+            case 'Q':
+                query_rollups = optarg;
+                break;
+            case 'h':
+                usage(argv[0]);
+                return 0;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (count < 0) count = interval_set || num_triggers ? 0 : 1;
+    if (format == FORMAT_NDJSON) pretty = 0;
+
+    if (read_shm) return print_shm_snapshot(argv[0], read_shm, pretty);
+    if (query_rollups) return print_rollup_query(argv[0], query_rollups, argv + optind, argc - optind);
+    // Recordings and shared-memory segments always hold whole samples.
+    if (fields != FIELDS_ALL && (format == FORMAT_BINARY || publish_shm)) {
+        fprintf(stderr, "%s: --fields only applies to JSON output\n", argv[0]);
+        return 1;
+    }
+    set_collected_fields(fields);
+    handle_stop_signals();
+
+    // Two samples are kept in memory and swapped every tick, so each
+    // snapshot's CPU usage is the delta against the previous tick.
+    static SystemInfo samples[2];
+    SystemInfo *prev = &samples[0];
+    SystemInfo *curr = &samples[1];
+    if (!system_info_init(prev) || !system_info_init(curr)) {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        return 1;
+    }
+
+    // The static probes run on worker threads while the baseline is taken
+    // and the first interval passes; see hardware_info.c.
+    static Topology topology;
+    HardwareProbe *probe = hwcache_begin(&curr->hw_info, &topology, refresh, virt_helper, fields);
+    prev->topology = curr->topology = &topology;
+    if (num_windows && !set_usage_windows(windows, num_windows, (unsigned)interval_ms)) {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        return 1;
+    }
+    if (top && !set_top_processes((int)top)) {
+        fprintf(stderr, "%s: cannot scan /proc\n", argv[0]);
+        return 1;
+    }
+    // Without a field that is a rate or a share of the interval, the first
+    // snapshot needs no baseline and is taken right away.
+    int need_delta = (fields & FIELDS_NEED_DELTA) != 0;
+    if (need_delta) collect_system_info(prev, NULL);
+
+    struct timespec next, now;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    if (need_delta) timespec_add_ns(&next, interval_ms * NSEC_PER_MSEC);
+    // The first tick's sleep is spent here instead, so that the header of
+    // a recording or shared-memory segment has the probed identity. In
+    // watch mode the first trigger may be far off, so the probes are only
+    // waited for.
+    if (probe && !num_triggers) sleep_until(&next);
+    hwcache_finish(probe, &curr->hw_info, &topology, virt_helper);
+    prev->hw_info = curr->hw_info;
+
+    // Binary recordings carry the static information once, followed by the
+    // baseline sample so that a replay can compute usage for every tick.
+    // From here on a failure unwinds through the labels at the end of
+    // main, so that the segment and the socket are not left behind.
+    int status = 1;
+    static RecordWriter recorder;
+    if (format == FORMAT_BINARY) {
+        if (!record_writer_init(&recorder, prev->cpus.capacity)) {
+            fprintf(stderr, "%s: out of memory\n", argv[0]);
+            goto free_recorder;
+        }
+        record_write_header(&recorder, &prev->hw_info);
+        record_write_sample(&recorder, prev);
+        record_writer_flush(&recorder, STDOUT_FILENO);
+    }
+
+    static ShmSegment segment;
+    if (publish_shm) {
+        if (!shm_publisher_open(&segment, publish_shm, &prev->hw_info,
+                                prev->cpus.capacity, SHM_DEFAULT_HISTORY)) {
+            if (errno == EBUSY) {
+                fprintf(stderr, "%s: another publisher is running on '%s'\n", argv[0], publish_shm);
+            } else {
+                fprintf(stderr, "%s: cannot create shared memory segment '%s': %s\n", argv[0],
+                        publish_shm, strerror(errno));
+            }
+            goto free_recorder;
+        }
+    }
+
+    // Rollups are fed every snapshot from here on, each of which has a
+    // predecessor to take usage against.
+    static Rollups rollups;
+    static RollupServer server;
+    if (serve_rollups) {
+        if (!rollups_init(&rollups, prev->cpus.capacity)) {
+            fprintf(stderr, "%s: out of memory\n", argv[0]);
+            goto close_segment;
+        }
+        if (!rollup_server_start(&server, &rollups, serve_rollups)) {
+            fprintf(stderr, "%s: cannot serve rollups at '%s': %s\n", argv[0], serve_rollups,
+                    strerror(errno));
+            goto stop_server;
+        }
+    }
+
+    // In watch mode the kernel wakes us when a stall threshold is crossed,
+    // so nothing runs while the system is quiet.
+    static PsiWatch watch;
+    if (num_triggers) {
+        if (!psi_watch_open(&watch)) {
+            fprintf(stderr, "%s: epoll: %s\n", argv[0], strerror(errno));
+            goto close_watch;
+        }
+        for (int i = 0; i < num_triggers; i++) {
+            if (!psi_watch_add(&watch, &triggers[i])) {
+                fprintf(stderr, "%s: cannot register %s pressure trigger: %s\n", argv[0],
+                        psi_resource_name(triggers[i].resource), strerror(errno));
+                goto close_watch;
+            }
+        }
+    }
+    int watch_timeout = interval_set ? (int)interval_ms : -1;
+
+    for (long emitted = 0; (count == 0 || emitted < count) && !stop_requested; emitted++) {
+        if (num_triggers) {
+            int fired;
+            do {
+                fired = psi_watch_wait(&watch, watch_timeout);
+            } while (fired < 0 && errno == EINTR && !stop_requested);
+            if (fired < 0 && !stop_requested) {
+                fprintf(stderr, "%s: pressure trigger failed: %s\n", argv[0], strerror(errno));
+                break;
+            }
+        } else {
+            sleep_until(&next);
+        }
+        if (stop_requested) break;
+
+        collect_system_info(curr, prev);
+        if (serve_rollups) rollups_update(&rollups, curr);
+        // A snapshot is written before its own output has been timed, so
+        // the output phase always reports the snapshot before.
+        PhaseTimer output;
+        phase_begin(&output);
+        if (publish_shm) shm_publish(&segment, curr);
+        if (format == FORMAT_BINARY) {
+            record_write_sample(&recorder, curr);
+            record_writer_flush(&recorder, STDOUT_FILENO);
+        } else {
+            output_json(curr, pretty);
+        }
+        phase_end(&output, PHASE_OUTPUT);
+
+        SystemInfo *tmp = prev;
+        prev = curr;
+        curr = tmp;
+
+        // If a tick overran the interval, skip the missed deadlines rather
+        // than firing a burst of back-to-back samples to catch up.
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        do {
+            timespec_add_ns(&next, interval_ms * NSEC_PER_MSEC);
+        } while (timespec_before(&next, &now));
+    }
+
+    status = 0;
+
+close_watch:
+    if (num_triggers) psi_watch_close(&watch);
+stop_server:
+    if (serve_rollups) {
+        rollup_server_stop(&server);
+        rollups_free(&rollups);
+    }
+close_segment:
+    if (publish_shm) shm_publisher_close(&segment, publish_shm);
+free_recorder:
+    if (format == FORMAT_BINARY) record_writer_free(&recorder);
+    system_info_free(prev);
+    system_info_free(curr);
+    topology_free(&topology);
+    return status;
 }
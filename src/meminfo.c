@@ -0,0 +1,192 @@
+#include "meminfo.h"
+#include "reader.h"
+#include "tokenizer.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define NODE_POSSIBLE "/sys/devices/system/node/possible"
+#define MEMINFO_KB 1
+#define MEMINFO_COUNT 0
+#define MEMINFO_BUCKETS 64
+
+typedef struct {
+    const char *key;
+    const char *json_name;
+    int unit;
+} MeminfoKey;
+
+static const MeminfoKey meminfo_keys[MEMINFO_FIELD_COUNT] = {
+    [MEMINFO_MEM_TOTAL] = {"MemTotal", "mem_total", MEMINFO_KB},
+    [MEMINFO_MEM_FREE] = {"MemFree", "mem_free", MEMINFO_KB},
+    [MEMINFO_MEM_AVAILABLE] = {"MemAvailable", "mem_available", MEMINFO_KB},
+    [MEMINFO_MEM_USED] = {"MemUsed", "mem_used", MEMINFO_KB},
+    [MEMINFO_BUFFERS] = {"Buffers", "buffers", MEMINFO_KB},
+    [MEMINFO_CACHED] = {"Cached", "cached", MEMINFO_KB},
+    [MEMINFO_SWAP_CACHED] = {"SwapCached", "swap_cached", MEMINFO_KB},
+    [MEMINFO_ACTIVE] = {"Active", "active", MEMINFO_KB},
+    [MEMINFO_INACTIVE] = {"Inactive", "inactive", MEMINFO_KB},
+    [MEMINFO_ACTIVE_ANON] = {"Active(anon)", "active_anon", MEMINFO_KB},
+    [MEMINFO_INACTIVE_ANON] = {"Inactive(anon)", "inactive_anon", MEMINFO_KB},
+    [MEMINFO_ACTIVE_FILE] = {"Active(file)", "active_file", MEMINFO_KB},
+    [MEMINFO_INACTIVE_FILE] = {"Inactive(file)", "inactive_file", MEMINFO_KB},
+    [MEMINFO_UNEVICTABLE] = {"Unevictable", "unevictable", MEMINFO_KB},
+    [MEMINFO_MLOCKED] = {"Mlocked", "mlocked", MEMINFO_KB},
+    [MEMINFO_SWAP_TOTAL] = {"SwapTotal", "swap_total", MEMINFO_KB},
+    [MEMINFO_SWAP_FREE] = {"SwapFree", "swap_free", MEMINFO_KB},
+    [MEMINFO_ZSWAP] = {"Zswap", "zswap", MEMINFO_KB},
+    [MEMINFO_ZSWAPPED] = {"Zswapped", "zswapped", MEMINFO_KB},
+    [MEMINFO_DIRTY] = {"Dirty", "dirty", MEMINFO_KB},
+    [MEMINFO_WRITEBACK] = {"Writeback", "writeback", MEMINFO_KB},
+    [MEMINFO_FILE_PAGES] = {"FilePages", "file_pages", MEMINFO_KB},
+    [MEMINFO_ANON_PAGES] = {"AnonPages", "anon_pages", MEMINFO_KB},
+    [MEMINFO_MAPPED] = {"Mapped", "mapped", MEMINFO_KB},
+    [MEMINFO_SHMEM] = {"Shmem", "shmem", MEMINFO_KB},
+    [MEMINFO_KRECLAIMABLE] = {"KReclaimable", "kreclaimable", MEMINFO_KB},
+    [MEMINFO_SLAB] = {"Slab", "slab", MEMINFO_KB},
+    [MEMINFO_SRECLAIMABLE] = {"SReclaimable", "sreclaimable", MEMINFO_KB},
+    [MEMINFO_SUNRECLAIM] = {"SUnreclaim", "sunreclaim", MEMINFO_KB},
+    [MEMINFO_KERNEL_STACK] = {"KernelStack", "kernel_stack", MEMINFO_KB},
+    [MEMINFO_PAGE_TABLES] = {"PageTables", "page_tables", MEMINFO_KB},
+    [MEMINFO_SEC_PAGE_TABLES] = {"SecPageTables", "sec_page_tables", MEMINFO_KB},
+    [MEMINFO_NFS_UNSTABLE] = {"NFS_Unstable", "nfs_unstable", MEMINFO_KB},
+    [MEMINFO_BOUNCE] = {"Bounce", "bounce", MEMINFO_KB},
+    [MEMINFO_WRITEBACK_TMP] = {"WritebackTmp", "writeback_tmp", MEMINFO_KB},
+    [MEMINFO_COMMIT_LIMIT] = {"CommitLimit", "commit_limit", MEMINFO_KB},
+    [MEMINFO_COMMITTED_AS] = {"Committed_AS", "committed_as", MEMINFO_KB},
+    [MEMINFO_VMALLOC_TOTAL] = {"VmallocTotal", "vmalloc_total", MEMINFO_KB},
+    [MEMINFO_VMALLOC_USED] = {"VmallocUsed", "vmalloc_used", MEMINFO_KB},
+    [MEMINFO_VMALLOC_CHUNK] = {"VmallocChunk", "vmalloc_chunk", MEMINFO_KB},
+    [MEMINFO_PERCPU] = {"Percpu", "percpu", MEMINFO_KB},
+    [MEMINFO_HARDWARE_CORRUPTED] = {"HardwareCorrupted", "hardware_corrupted", MEMINFO_KB},
+    [MEMINFO_ANON_HUGE_PAGES] = {"AnonHugePages", "anon_huge_pages", MEMINFO_KB},
+    [MEMINFO_SHMEM_HUGE_PAGES] = {"ShmemHugePages", "shmem_huge_pages", MEMINFO_KB},
+    [MEMINFO_SHMEM_PMD_MAPPED] = {"ShmemPmdMapped", "shmem_pmd_mapped", MEMINFO_KB},
+    [MEMINFO_FILE_HUGE_PAGES] = {"FileHugePages", "file_huge_pages", MEMINFO_KB},
+    [MEMINFO_FILE_PMD_MAPPED] = {"FilePmdMapped", "file_pmd_mapped", MEMINFO_KB},
+    [MEMINFO_BALLOON] = {"Balloon", "balloon", MEMINFO_KB},
+    [MEMINFO_CMA_TOTAL] = {"CmaTotal", "cma_total", MEMINFO_KB},
+    [MEMINFO_CMA_FREE] = {"CmaFree", "cma_free", MEMINFO_KB},
+    [MEMINFO_UNACCEPTED] = {"Unaccepted", "unaccepted", MEMINFO_KB},
+    [MEMINFO_HUGEPAGES_TOTAL] = {"HugePages_Total", "hugepages_total", MEMINFO_COUNT},
+    [MEMINFO_HUGEPAGES_FREE] = {"HugePages_Free", "hugepages_free", MEMINFO_COUNT},
+    [MEMINFO_HUGEPAGES_RSVD] = {"HugePages_Rsvd", "hugepages_rsvd", MEMINFO_COUNT},
+    [MEMINFO_HUGEPAGES_SURP] = {"HugePages_Surp", "hugepages_surp", MEMINFO_COUNT},
+    [MEMINFO_HUGEPAGE_SIZE] = {"Hugepagesize", "hugepage_size", MEMINFO_KB},
+    [MEMINFO_HUGETLB] = {"Hugetlb", "hugetlb", MEMINFO_KB},
+    [MEMINFO_DIRECT_MAP_4K] = {"DirectMap4k", "direct_map_4k", MEMINFO_KB},
+    [MEMINFO_DIRECT_MAP_2M] = {"DirectMap2M", "direct_map_2m", MEMINFO_KB},
+    [MEMINFO_DIRECT_MAP_1G] = {"DirectMap1G", "direct_map_1g", MEMINFO_KB},
+};
+
+_Static_assert(MEMINFO_FIELD_COUNT <= 64, "MemoryInfo.present is a 64-bit mask");
+
+// Keys are dispatched on their length and first and last characters.
+// The multipliers were picked so that no bucket of the table above holds
+// more than two keys; meminfo_buckets lists them per bucket (-1 marks an
+// empty slot) and has to be regenerated when a key is added. Unlisted
+// buckets are {0, 0} and simply fail the key comparison. A line costs one
+// hash and usually one string comparison.
+static unsigned bucket_of(const char *key, size_t len) {
+    return ((unsigned)len * 25 + (unsigned char)key[0] + (unsigned char)key[len - 1] * 14) %
+           MEMINFO_BUCKETS;
+}
+
+static const int8_t meminfo_buckets[MEMINFO_BUCKETS][2] = {
+    [0] = {MEMINFO_NFS_UNSTABLE, -1},
+    [2] = {MEMINFO_MEM_FREE, -1},
+    [3] = {MEMINFO_SUNRECLAIM, MEMINFO_FILE_PMD_MAPPED},
+    [5] = {MEMINFO_SWAP_CACHED, MEMINFO_SRECLAIMABLE},
+    [6] = {MEMINFO_SHMEM, MEMINFO_HUGEPAGES_SURP},
+    [7] = {MEMINFO_UNACCEPTED, -1},
+    [12] = {MEMINFO_PERCPU, -1},
+    [13] = {MEMINFO_DIRECT_MAP_2M, -1},
+    [16] = {MEMINFO_ANON_HUGE_PAGES, -1},
+    [17] = {MEMINFO_CACHED, -1},
+    [18] = {MEMINFO_WRITEBACK, -1},
+    [19] = {MEMINFO_SLAB, MEMINFO_HUGETLB},
+    [20] = {MEMINFO_PAGE_TABLES, -1},
+    [21] = {MEMINFO_FILE_HUGE_PAGES, -1},
+    [23] = {MEMINFO_INACTIVE, -1},
+    [26] = {MEMINFO_ZSWAPPED, -1},
+    [27] = {MEMINFO_MAPPED, -1},
+    [28] = {MEMINFO_SWAP_TOTAL, MEMINFO_VMALLOC_CHUNK},
+    [29] = {MEMINFO_ACTIVE, -1},
+    [30] = {MEMINFO_BOUNCE, MEMINFO_HUGEPAGES_RSVD},
+    [31] = {MEMINFO_DIRTY, -1},
+    [33] = {MEMINFO_SWAP_FREE, MEMINFO_VMALLOC_USED},
+    [34] = {MEMINFO_SEC_PAGE_TABLES, -1},
+    [35] = {MEMINFO_WRITEBACK_TMP, -1},
+    [37] = {MEMINFO_INACTIVE_ANON, MEMINFO_INACTIVE_FILE},
+    [39] = {MEMINFO_HUGEPAGES_TOTAL, -1},
+    [41] = {MEMINFO_HARDWARE_CORRUPTED, MEMINFO_SHMEM_PMD_MAPPED},
+    [42] = {MEMINFO_VMALLOC_TOTAL, -1},
+    [43] = {MEMINFO_ACTIVE_ANON, MEMINFO_ACTIVE_FILE},
+    [44] = {MEMINFO_ANON_PAGES, MEMINFO_HUGEPAGES_FREE},
+    [46] = {MEMINFO_UNEVICTABLE, MEMINFO_COMMIT_LIMIT},
+    [49] = {MEMINFO_FILE_PAGES, MEMINFO_DIRECT_MAP_4K},
+    [51] = {MEMINFO_CMA_TOTAL, -1},
+    [52] = {MEMINFO_MEM_USED, MEMINFO_MLOCKED},
+    [53] = {MEMINFO_BALLOON, -1},
+    [55] = {MEMINFO_ZSWAP, -1},
+    [56] = {MEMINFO_KERNEL_STACK, MEMINFO_CMA_FREE},
+    [57] = {MEMINFO_COMMITTED_AS, MEMINFO_DIRECT_MAP_1G},
+    [58] = {MEMINFO_HUGEPAGE_SIZE, -1},
+    [59] = {MEMINFO_BUFFERS, MEMINFO_SHMEM_HUGE_PAGES},
+    [61] = {MEMINFO_MEM_TOTAL, MEMINFO_KRECLAIMABLE},
+    [63] = {MEMINFO_MEM_AVAILABLE, -1},
+};
+
+static int lookup(const char *key, size_t len) {
+    if (len == 0) return -1;
+    const int8_t *bucket = meminfo_buckets[bucket_of(key, len)];
+    for (int i = 0; i < 2 && bucket[i] >= 0; i++) {
+        const char *candidate = meminfo_keys[bucket[i]].key;
+        if (strncmp(candidate, key, len) == 0 && candidate[len] == '\0') return bucket[i];
+    }
+    return -1;
+}
+
+const char *meminfo_json_name(MeminfoField field) {
+    return meminfo_keys[field].json_name;
+}
+
+// Parses /proc/meminfo or a node's meminfo (whose lines carry a "Node N "
+// prefix) in one pass. Unknown keys, such as those of newer kernels, are
+// skipped.
+void parse_meminfo(const char *buf, size_t len, MemoryInfo *out) {
+    const char *p = buf;
+    const char *end = buf + len;
+
+    out->present = 0;
+    while (p < end) {
+        if (end - p > 5 && memcmp(p, "Node ", 5) == 0) {
+            uint64_t node;
+            const char *after = parse_u64(p + 5, end, &node);
+            if (!after) break;
+            p = skip_blanks(after, end);
+        }
+        const char *colon = memchr(p, ':', end - p);
+        if (!colon) break;
+
+        uint64_t value;
+        int field = lookup(p, colon - p);
+        const char *next = parse_u64(colon + 1, end, &value);
+        if (field >= 0 && next) {
+            out->value[field] = meminfo_keys[field].unit == MEMINFO_KB ? value * 1024 : value;
+            out->present |= 1ULL << field;
+        }
+        p = skip_line(next ? next : colon, end);
+    }
+}
+
+int possible_node_count(void) {
+    char buffer[BUFFER_SIZE];
+    int count = 1;
+
+    if (read_file_line(NODE_POSSIBLE, buffer, sizeof(buffer))) {
+        const char *last = strrchr(buffer, '-');
+        if (!last) last = strrchr(buffer, ',');
+        count = atoi(last ? last + 1 : buffer) + 1;
+    }
+    return count > MAX_NODES ? MAX_NODES : count;
+}
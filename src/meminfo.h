@@ -0,0 +1,11 @@
+#ifndef MEMINFO_H
+#define MEMINFO_H
+
+#include "hardware_info.h"
+#include <stddef.h>
+
+const char *meminfo_json_name(MeminfoField field);
+void parse_meminfo(const char *buf, size_t len, MemoryInfo *out);
+int possible_node_count(void);
+
+#endif
@@ -0,0 +1,537 @@
+#include "output.h"
+#include "cgroup.h"
+#include "cpufreq.h"
+#include "fields.h"
+#include "meminfo.h"
+#include "procscan.h"
+#include "psi.h"
+#include "selfstats.h"
+#include "topology.h"
+#include "window.h"
+#include <unistd.h>
+
+static const char *virt_types[] = {
+    "none", "kvm", "qemu", "vmware", "virtualbox", "xen",
+    "hyper-v", "docker", "lxc", "openvz", "parallels", "cloud", "unknown"
+};
+
+static const char *probe_names[PROBE_COUNT] = {
+    "cpuinfo", "virtualization", "dmi"
+};
+
+static const char *cpu_state_names[CPU_STATE_COUNT] = {
+    "user", "nice", "system", "idle", "iowait",
+    "irq", "softirq", "steal", "guest", "guest_nice"
+};
+
+static void write_topology(JsonWriter *w, const Topology *topo) {
+    json_begin_object(w, "topology");
+    json_int(w, "packages", topo->num_packages);
+    json_int(w, "dies", topo->num_dies);
+    json_int(w, "cores", topo->num_cores);
+    json_int(w, "threads", topo->num_threads);
+    json_int(w, "numa_nodes", topo->num_nodes);
+    json_begin_array(w, "caches");
+    for (int i = 0; i < topo->num_caches; i++) {
+        const CacheLevel *cache = &topo->caches[i];
+        json_begin_object(w, NULL);
+        json_int(w, "level", cache->level);
+        json_string(w, "type", cache->type);
+        json_uint(w, "size_kb", cache->size_kb);
+        json_uint(w, "line_size", cache->line_size);
+        json_uint(w, "ways", cache->ways);
+        json_int(w, "instances", cache->instances);
+        json_int(w, "shared_by", cache->shared_by);
+        json_end_object(w);
+    }
+    json_end_array(w);
+    json_end_object(w);
+}
+
+// Fields left to a probe that missed its deadline are null rather than
+// empty, and "timeouts" names the probes.
+static void write_probed(JsonWriter *w, const char *key, const char *value, int timed_out) {
+    if (timed_out) {
+        json_null(w, key);
+    } else {
+        json_string(w, key, value);
+    }
+}
+
+static void write_hardware_cpu(JsonWriter *w, const HardwareInfo *hw, int no_cpuinfo) {
+    json_begin_object(w, "cpu");
+    write_probed(w, "model", hw->cpu_model, no_cpuinfo);
+    write_probed(w, "vendor", hw->cpu_vendor, no_cpuinfo);
+    if (no_cpuinfo) {
+        json_null(w, "family");
+        json_null(w, "stepping");
+        json_null(w, "microcode");
+    } else {
+        json_uint(w, "family", hw->cpu_family);
+        json_uint(w, "stepping", hw->cpu_stepping);
+        json_hex(w, "microcode", hw->cpu_microcode);
+    }
+    json_string(w, "architecture", hw->is_arm ? "ARM" : "x86");
+    json_end_object(w);
+}
+
+static void write_hardware(JsonWriter *w, const SystemInfo *info) {
+    const HardwareInfo *hw = &info->hw_info;
+    uint32_t fields = info->fields;
+    int no_cpuinfo = (hw->timed_out >> PROBE_CPUINFO) & 1;
+    int no_virt = (hw->timed_out >> PROBE_VIRTUALIZATION) & 1;
+    int no_dmi = (hw->timed_out >> PROBE_DMI) & 1;
+
+    json_begin_object(w, "hardware");
+    if (fields & FIELD_BIT(FIELD_SYSTEM_UUID)) write_probed(w, "system_uuid", hw->system_uuid, no_dmi);
+    if (fields & FIELD_BIT(FIELD_MOTHERBOARD_SERIAL)) {
+        write_probed(w, "motherboard_serial", hw->motherboard_serial, no_dmi);
+    }
+    if (fields & FIELD_BIT(FIELD_PRODUCT_NAME)) write_probed(w, "product_name", hw->product_name, no_dmi);
+
+    if (fields & FIELD_BIT(FIELD_VIRTUALIZATION)) {
+        json_begin_object(w, "virtualization");
+        if (no_virt) {
+            json_null(w, "is_virtual");
+        } else {
+            json_bool(w, "is_virtual", hw->is_virtual);
+        }
+        if (hw->is_virtual) {
+            json_string(w, "type", hw->hypervisor_vendor);
+            json_string(w, "hypervisor", virt_types[hw->virt_type]);
+        } else {
+            json_null(w, "type");
+            json_null(w, "hypervisor");
+        }
+        json_end_object(w);
+    }
+
+    if (fields & FIELD_BIT(FIELD_HARDWARE_CPU)) write_hardware_cpu(w, hw, no_cpuinfo);
+    if (fields & FIELD_BIT(FIELD_BIOS)) {
+        json_begin_object(w, "bios");
+        write_probed(w, "vendor", hw->bios_vendor, no_dmi);
+        write_probed(w, "version", hw->bios_version, no_dmi);
+        json_end_object(w);
+    }
+    if (info->topology && (fields & FIELD_BIT(FIELD_TOPOLOGY))) write_topology(w, info->topology);
+
+    json_begin_array(w, "timeouts");
+    for (int p = 0; p < PROBE_COUNT; p++) {
+        if ((hw->timed_out >> p) & 1) json_string(w, NULL, probe_names[p]);
+    }
+    json_end_array(w);
+    json_end_object(w);
+}
+
+
+// One entry per physical core with at least one online thread; siblings
+// always have higher ids than the core's representative CPU.
+static void write_physical_cores(JsonWriter *w, const SystemInfo *info) {
+    const Topology *topo = info->topology;
+    const PerCPUStats *cpus = &info->cpus;
+    int n = topo->capacity < cpus->capacity ? topo->capacity : cpus->capacity;
+
+    json_begin_array(w, "physical_cores");
+    for (int core = 0; core < n; core++) {
+        if (topo->core[core] != core) continue;
+        int online = 0;
+        for (int cpu = core; cpu < n; cpu++) online |= topo->core[cpu] == core && cpus->online[cpu];
+        if (!online) continue;
+
+        json_begin_object(w, NULL);
+        json_int(w, "package", topo->package[core]);
+        json_int(w, "core_id", topo->core_id[core]);
+        json_begin_array(w, "cpus");
+        for (int cpu = core; cpu < n; cpu++) {
+            if (topo->core[cpu] == core) json_int(w, NULL, cpu);
+        }
+        json_end_array(w);
+        json_fixed(w, "usage", cpus->core_usage[core], 2);
+        json_end_object(w);
+    }
+    json_end_array(w);
+}
+
+static void write_states(JsonWriter *w, const double *states) {
+    json_begin_object(w, "states");
+    for (int s = 0; s < CPU_STATE_COUNT; s++) {
+        json_fixed(w, cpu_state_names[s], states[s], 2);
+    }
+    json_end_object(w);
+}
+
+static void write_windows(JsonWriter *w, const SystemInfo *info) {
+    const UsageWindows *windows = info->windows;
+    const PerCPUStats *cpus = &info->cpus;
+
+    json_begin_array(w, "windows");
+    for (int i = 0; i < windows->count; i++) {
+        const UsageWindow *window = &windows->window[i];
+        json_begin_object(w, NULL);
+        json_uint(w, "window_ms", window->window_ms);
+        if (window->span_ns == 0) {
+            json_null(w, "span_ms");
+            json_null(w, "usage");
+            json_end_object(w);
+            continue;
+        }
+        json_fixed(w, "span_ms", window->span_ns / 1e6, 1);
+        json_fixed(w, "usage", window->usage, 2);
+        write_states(w, window->states);
+        json_begin_array(w, "core_usage");
+        for (int c = 0; c < cpus->capacity; c++) {
+            if (cpus->online[c]) json_fixed(w, NULL, window->core_usage[c], 2);
+        }
+        json_end_array(w);
+        json_end_object(w);
+    }
+    json_end_array(w);
+}
+
+// Frequency is null when unknown, such as on the first APERF/MPERF
+// sample; idle states only appear once there is an interval to measure.
+static void write_cpu_frequency(JsonWriter *w, const CpuFreqStats *freq, int cpu) {
+    if (cpu >= freq->capacity) return;
+    if (freq->source != FREQ_SOURCE_NONE) {
+        if (freq->mhz[cpu] > 0) {
+            json_fixed(w, "frequency_mhz", freq->mhz[cpu], 0);
+        } else {
+            json_null(w, "frequency_mhz");
+        }
+    }
+    if (!freq->idle_valid) return;
+    json_begin_object(w, "idle_states");
+    for (int s = 0; s < freq->num_idle_states; s++) {
+        json_begin_object(w, freq->idle_names[s]);
+        json_fixed(w, "residency", freq->idle_residency[s][cpu], 2);
+        json_fixed(w, "entries_per_sec", freq->idle_rate[s][cpu], 1);
+        json_end_object(w);
+    }
+    json_end_object(w);
+}
+
+static void write_packages(JsonWriter *w, const SystemInfo *info, int usage, int temperature) {
+    json_begin_array(w, "packages");
+    for (int p = 0; p < info->num_packages; p++) {
+        json_begin_object(w, NULL);
+        json_int(w, "package", p);
+        if (temperature && info->package_temperature[p] == TEMPERATURE_UNKNOWN) {
+            json_null(w, "temperature");
+        } else if (temperature) {
+            json_int(w, "temperature", info->package_temperature[p]);
+        }
+        if (info->topology && usage) json_fixed(w, "usage", info->package_usage[p], 2);
+        json_end_object(w);
+    }
+    json_end_array(w);
+}
+
+// cpu_usage.temperature and cpu_usage.frequency add their values to the
+// per-core and per-package entries; everything else is cpu_usage.usage.
+static void write_cpu_usage(JsonWriter *w, const SystemInfo *info) {
+    const PerCPUStats *cpus = &info->cpus;
+    int usage = (info->fields >> FIELD_CPU_USAGE) & 1;
+    int temperature = (info->fields >> FIELD_TEMPERATURE) & 1;
+
+    json_begin_object(w, "cpu_usage");
+    json_int(w, "cores", info->num_cores);
+    if (usage) {
+        json_fixed(w, "total_usage", info->total_usage, 2);
+        write_states(w, info->total_state_usage);
+    }
+    if (info->cpufreq) json_string(w, "frequency_source", freq_source_name(info->cpufreq->source));
+    json_begin_array(w, "core_info");
+    for (int i = 0; i < cpus->capacity; i++) {
+        if (!cpus->online[i]) continue;
+        json_begin_object(w, NULL);
+        json_int(w, "core", i);
+        if (usage) {
+            json_fixed(w, "usage", cpus->usage[i], 2);
+            json_begin_object(w, "states");
+            for (int s = 0; s < CPU_STATE_COUNT; s++) {
+                json_fixed(w, cpu_state_names[s], cpus->state_usage[s][i], 2);
+            }
+            json_end_object(w);
+        }
+        if (temperature && cpus->temperature[i] == TEMPERATURE_UNKNOWN) {
+            json_null(w, "temperature");
+        } else if (temperature) {
+            json_int(w, "temperature", cpus->temperature[i]);
+        }
+        if (info->cpufreq) write_cpu_frequency(w, info->cpufreq, i);
+        json_end_object(w);
+    }
+    json_end_array(w);
+    if (usage || temperature) write_packages(w, info, usage, temperature);
+    if (info->topology && usage) {
+        json_begin_array(w, "numa_nodes");
+        for (int n = 0; n < info->num_nodes; n++) {
+            json_begin_object(w, NULL);
+            json_int(w, "node", n);
+            json_fixed(w, "usage", info->node_usage[n], 2);
+            json_end_object(w);
+        }
+        json_end_array(w);
+        write_physical_cores(w, info);
+    }
+    if (info->windows && usage) write_windows(w, info);
+    json_end_object(w);
+}
+
+// Writes every field the kernel reported, into a new object when key is
+// given or into the current one otherwise.
+static void write_meminfo_fields(JsonWriter *w, const char *key, const MemoryInfo *m) {
+    if (key) json_begin_object(w, key);
+    for (int f = 0; f < MEMINFO_FIELD_COUNT; f++) {
+        if (m->present & (1ULL << f)) json_uint(w, meminfo_json_name(f), m->value[f]);
+    }
+    if (key) json_end_object(w);
+}
+
+static void write_memory(JsonWriter *w, const SystemInfo *info) {
+    json_begin_object(w, "memory");
+    json_uint(w, "total", info->total_memory);
+    json_uint(w, "free", info->free_memory);
+    json_uint(w, "available", info->available_memory);
+    json_uint(w, "cached", info->cached_memory);
+    json_uint(w, "swap_total", info->swap_total);
+    json_uint(w, "swap_free", info->swap_free);
+    if (info->memory.present) write_meminfo_fields(w, "details", &info->memory);
+    if (info->num_mem_nodes > 0) {
+        json_begin_array(w, "nodes");
+        for (int n = 0; n < info->num_mem_nodes; n++) {
+            if (!info->node_memory[n].present) continue;
+            json_begin_object(w, NULL);
+            json_int(w, "node", n);
+            write_meminfo_fields(w, NULL, &info->node_memory[n]);
+            json_end_object(w);
+        }
+        json_end_array(w);
+    }
+    json_end_object(w);
+}
+
+static void write_pressure(JsonWriter *w, const PressureInfo *pressure) {
+    json_begin_object(w, "pressure");
+    for (int r = 0; r < PSI_RESOURCE_COUNT; r++) {
+        if (!(pressure->present & (((1u << PSI_KIND_COUNT) - 1) << (r * PSI_KIND_COUNT)))) continue;
+        json_begin_object(w, psi_resource_name(r));
+        for (int k = 0; k < PSI_KIND_COUNT; k++) {
+            if (!(pressure->present & (1u << (r * PSI_KIND_COUNT + k)))) continue;
+            const PsiLine *line = &pressure->line[r][k];
+            json_begin_object(w, psi_kind_name(k));
+            json_fixed(w, "avg10", line->avg10, 2);
+            json_fixed(w, "avg60", line->avg60, 2);
+            json_fixed(w, "avg300", line->avg300, 2);
+            json_uint(w, "total_usec", line->total_usec);
+            json_end_object(w);
+        }
+        json_end_object(w);
+    }
+    json_end_object(w);
+}
+
+static void write_disks(JsonWriter *w, const SystemInfo *info) {
+    json_begin_array(w, "disks");
+    for (int i = 0; i < info->num_disks; i++) {
+        const DiskStats *d = &info->disks[i];
+        json_begin_object(w, NULL);
+        json_string(w, "name", d->name);
+        json_fixed(w, "read_bytes_per_sec", d->read_bytes_rate, 1);
+        json_fixed(w, "write_bytes_per_sec", d->write_bytes_rate, 1);
+        json_fixed(w, "read_iops", d->read_iops, 1);
+        json_fixed(w, "write_iops", d->write_iops, 1);
+        json_fixed(w, "read_latency_ms", d->read_latency_ms, 3);
+        json_fixed(w, "write_latency_ms", d->write_latency_ms, 3);
+        json_fixed(w, "utilization", d->utilization, 2);
+        json_fixed(w, "queue_depth", d->queue_depth, 2);
+        json_uint(w, "in_flight", d->in_flight);
+        json_end_object(w);
+    }
+    json_end_array(w);
+    if (info->disks_dropped > 0) json_int(w, "disks_dropped", info->disks_dropped);
+}
+
+static void write_network(JsonWriter *w, const SystemInfo *info) {
+    json_begin_array(w, "network");
+    for (int i = 0; i < info->num_net_devices; i++) {
+        const NetStats *n = &info->net_devices[i];
+        json_begin_object(w, NULL);
+        json_string(w, "name", n->name);
+        json_bool(w, "virtual", n->is_virtual);
+        if (n->speed_mbps > 0) {
+            json_int(w, "speed_mbps", n->speed_mbps);
+            json_fixed(w, "utilization", n->utilization, 2);
+        } else {
+            json_null(w, "speed_mbps");
+            json_null(w, "utilization");
+        }
+        json_uint(w, "rx_bytes", n->rx_bytes);
+        json_uint(w, "tx_bytes", n->tx_bytes);
+        json_fixed(w, "rx_bytes_per_sec", n->rx_bytes_rate, 1);
+        json_fixed(w, "tx_bytes_per_sec", n->tx_bytes_rate, 1);
+        json_fixed(w, "rx_packets_per_sec", n->rx_packet_rate, 1);
+        json_fixed(w, "tx_packets_per_sec", n->tx_packet_rate, 1);
+        json_fixed(w, "rx_errors_per_sec", n->rx_error_rate, 1);
+        json_fixed(w, "tx_errors_per_sec", n->tx_error_rate, 1);
+        json_fixed(w, "rx_drops_per_sec", n->rx_drop_rate, 1);
+        json_fixed(w, "tx_drops_per_sec", n->tx_drop_rate, 1);
+        json_end_object(w);
+    }
+    json_end_array(w);
+    if (info->net_devices_dropped > 0) json_int(w, "network_dropped", info->net_devices_dropped);
+}
+
+static void write_process_list(JsonWriter *w, const char *key, const ProcessSample *list, int n) {
+    json_begin_array(w, key);
+    for (int i = 0; i < n; i++) {
+        const ProcessSample *p = &list[i];
+        char state[2] = { p->state, '\0' };
+        json_begin_object(w, NULL);
+        json_int(w, "pid", p->pid);
+        json_string(w, "comm", p->comm);
+        json_string(w, "state", state);
+        json_int(w, "threads", p->threads);
+        json_fixed(w, "cpu_usage", p->cpu_usage, 2);
+        json_uint(w, "rss", p->rss_bytes);
+        json_end_object(w);
+    }
+    json_end_array(w);
+}
+
+static void write_processes(JsonWriter *w, const ProcessTop *top) {
+    json_begin_object(w, "processes");
+    json_int(w, "total", top->total);
+    json_fixed(w, "scan_ms", top->scan_ns / 1e6, 3);
+    write_process_list(w, "top_cpu", top->by_cpu, top->num_cpu);
+    write_process_list(w, "top_memory", top->by_memory, top->num_memory);
+    json_end_object(w);
+}
+
+static void write_cgroup_cpu(JsonWriter *w, const CgroupStats *cg) {
+    json_begin_object(w, "cpu");
+    if (cg->cpu_limit > 0.0) {
+        json_fixed(w, "limit", cg->cpu_limit, 2);
+        json_uint(w, "quota_usec", cg->quota_usec);
+    } else {
+        json_null(w, "limit");
+        json_null(w, "quota_usec");
+    }
+    if (cg->has_cpu_max) json_uint(w, "period_usec", cg->period_usec);
+    json_fixed(w, "usage", cg->cpu_usage, 2);
+    json_fixed(w, "cpus_used", cg->cpus_used, 3);
+    json_uint(w, "usage_usec", cg->usage_usec);
+    json_uint(w, "user_usec", cg->user_usec);
+    json_uint(w, "system_usec", cg->system_usec);
+    json_uint(w, "periods", cg->nr_periods);
+    json_uint(w, "throttled_periods", cg->nr_throttled);
+    json_uint(w, "throttled_usec", cg->throttled_usec);
+    json_fixed(w, "throttled_percent", cg->throttled_percent, 2);
+    json_fixed(w, "throttled_ms", cg->throttled_ms, 3);
+    json_end_object(w);
+}
+
+static void write_cgroup_memory(JsonWriter *w, const CgroupStats *cg) {
+    json_begin_object(w, "memory");
+    json_uint(w, "current", cg->memory_current);
+    if (cg->memory_max != CGROUP_UNLIMITED) {
+        json_uint(w, "max", cg->memory_max);
+        json_fixed(w, "usage", cg->memory_usage, 2);
+    } else {
+        json_null(w, "max");
+        json_null(w, "usage");
+    }
+    // What the OOM killer and most container tooling consider in use:
+    // inactive page cache can be reclaimed without pressure.
+    uint64_t inactive_file = cg->memory_stat[CGROUP_MEM_INACTIVE_FILE];
+    json_uint(w, "working_set",
+              cg->memory_current > inactive_file ? cg->memory_current - inactive_file : 0);
+    for (int f = 0; f < CGROUP_MEM_FIELD_COUNT; f++) {
+        json_uint(w, cgroup_memory_key(f), cg->memory_stat[f]);
+    }
+    json_end_object(w);
+}
+
+static void write_cgroup_io(JsonWriter *w, const CgroupStats *cg) {
+    json_begin_object(w, "io");
+    for (int f = 0; f < CGROUP_IO_FIELD_COUNT; f++) {
+        json_uint(w, cgroup_io_key(f), cg->io[f]);
+    }
+    json_fixed(w, "read_bytes_per_sec", cg->io_rate[CGROUP_IO_RBYTES], 1);
+    json_fixed(w, "write_bytes_per_sec", cg->io_rate[CGROUP_IO_WBYTES], 1);
+    json_fixed(w, "read_ios_per_sec", cg->io_rate[CGROUP_IO_RIOS], 1);
+    json_fixed(w, "write_ios_per_sec", cg->io_rate[CGROUP_IO_WIOS], 1);
+    json_end_object(w);
+}
+
+// Limits of "max" are written as null, as are the percentages relative
+// to them.
+static void write_cgroup(JsonWriter *w, const CgroupStats *cg) {
+    json_begin_object(w, "cgroup");
+    json_string(w, "path", cg->path);
+    write_cgroup_cpu(w, cg);
+    if (cg->has_memory) write_cgroup_memory(w, cg);
+    if (cg->has_io) write_cgroup_io(w, cg);
+    if (cg->pressure.present) write_pressure(w, &cg->pressure);
+    json_end_object(w);
+}
+
+// Phases that have not run, such as the hardware probes on a cache hit,
+// are left out. The counters are those of the phase's last run.
+static void write_collector_stats(JsonWriter *w, const SelfStats *stats) {
+    json_begin_object(w, "collector_stats");
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        const PhaseStats *p = &stats->phase[i];
+        if (p->runs == 0) continue;
+        json_begin_object(w, phase_name(i));
+        json_uint(w, "runs", p->runs);
+        json_uint(w, "last_ns", p->last_ns);
+        json_uint(w, "min_ns", p->min_ns);
+        json_uint(w, "avg_ns", p->total_ns / p->runs);
+        json_uint(w, "p99_ns", phase_percentile(p, 0.99));
+        json_uint(w, "max_ns", p->max_ns);
+        json_uint(w, "files_opened", p->last.files_opened);
+        json_uint(w, "bytes_read", p->last.bytes_read);
+        json_uint(w, "syscalls", p->last.syscalls);
+        json_uint(w, "allocations", p->last.allocations);
+        json_end_object(w);
+    }
+    json_end_object(w);
+}
+
+// Only the fields selected for the snapshot are written; see fields.h.
+void write_system_info_json(JsonWriter *w, const SystemInfo *info) {
+    uint32_t fields = info->fields;
+
+    json_begin_object(w, NULL);
+    json_uint(w, "timestamp", info->timestamp / 1000000);
+    if (fields & FIELDS_HARDWARE) write_hardware(w, info);
+    if (fields & FIELDS_CPU_USAGE) write_cpu_usage(w, info);
+    if (fields & FIELD_BIT(FIELD_MEMORY)) write_memory(w, info);
+    if ((fields & FIELD_BIT(FIELD_PRESSURE)) && info->pressure.present) write_pressure(w, &info->pressure);
+    if (fields & FIELD_BIT(FIELD_DISKS)) write_disks(w, info);
+    if (fields & FIELD_BIT(FIELD_NETWORK)) write_network(w, info);
+    if ((fields & FIELD_BIT(FIELD_PROCESSES)) && info->processes) write_processes(w, info->processes);
+    if ((fields & FIELD_BIT(FIELD_CGROUP)) && info->cgroup.available) write_cgroup(w, &info->cgroup);
+    if ((fields & FIELD_BIT(FIELD_COLLECTOR_STATS)) && info->self_stats) {
+        write_collector_stats(w, info->self_stats);
+    }
+    json_end_object(w);
+}
+
+// The writer is kept across calls so that streaming mode reuses one
+// buffer and every snapshot costs a single write(2).
+void output_json(const SystemInfo *info, int pretty) {
+    static JsonWriter writer;
+    static int initialized = 0;
+
+    if (!initialized) {
+        json_writer_init(&writer, pretty);
+        initialized = 1;
+    }
+    writer.pretty = pretty;
+    json_writer_reset(&writer);
+    write_system_info_json(&writer, info);
+    json_raw(&writer, "\n", 1);
+    json_writer_flush(&writer, STDOUT_FILENO);
+}
@@ -0,0 +1,9 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include "hardware_info.h"
+#include "json_writer.h"
+
+void write_system_info_json(JsonWriter *w, const SystemInfo *info);
+
+#endif
@@ -0,0 +1,372 @@
+#define _GNU_SOURCE
+#include "procscan.h"
+#include "reader.h"
+#include "selfstats.h"
+#include "tokenizer.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#define PROC_DIR "/proc"
+#define DIRENT_BUF_SIZE 65536
+#define STAT_BUF_SIZE 1024
+#define PID_TABLE_MIN 1024
+#define FD_BUDGET_MIN 256
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// Fields of /proc/<pid>/stat after "pid (comm) state", numbered as in
+// proc(5).
+#define STAT_NUM_THREADS 20
+#define STAT_UTIME 14
+#define STAT_STIME 15
+#define STAT_STARTTIME 22
+#define STAT_RSS 24
+
+typedef struct {
+    char state;
+    char comm[PROCESS_COMM_MAX];
+    uint64_t cpu_ticks;
+    uint64_t start_time;
+    uint64_t rss_pages;
+    uint64_t threads;
+} StatFields;
+
+static uint32_t pid_hash(int32_t pid, uint32_t capacity) {
+    return ((uint32_t)pid * 2654435761u) & (capacity - 1);
+}
+
+static int table_alloc(PidTable *t, uint32_t capacity) {
+    t->entries = calloc(capacity, sizeof(ProcEntry));
+    t->capacity = t->entries ? capacity : 0;
+    t->count = 0;
+    return t->entries != NULL;
+}
+
+static ProcEntry *table_find(const PidTable *t, int32_t pid) {
+    for (uint32_t i = pid_hash(pid, t->capacity);; i = (i + 1) & (t->capacity - 1)) {
+        ProcEntry *e = &t->entries[i];
+        if (e->pid == pid) return e;
+        if (e->pid == 0) return NULL;
+    }
+}
+
+// Linear probing; pids are unique within one scan, so no lookup first.
+static ProcEntry *table_insert(PidTable *t, int32_t pid) {
+    uint32_t i = pid_hash(pid, t->capacity);
+    while (t->entries[i].pid != 0) i = (i + 1) & (t->capacity - 1);
+    t->count++;
+    return &t->entries[i];
+}
+
+// Keeps the load factor at or below one half.
+static int table_reserve(PidTable *t, uint32_t count) {
+    if (count * 2 <= t->capacity) return 1;
+
+    PidTable grown;
+    if (!table_alloc(&grown, t->capacity * 2)) return 0;
+    for (uint32_t i = 0; i < t->capacity; i++) {
+        if (t->entries[i].pid != 0) *table_insert(&grown, t->entries[i].pid) = t->entries[i];
+    }
+    free(t->entries);
+    *t = grown;
+    return 1;
+}
+
+// Descriptors are kept open while the budget allows, so that a process
+// seen before costs a single pread instead of openat, read and close.
+// Half of the descriptor limit is left to the rest of the program.
+static int fd_budget(void) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0) return 0;
+    rlim_t half = limit.rlim_cur == RLIM_INFINITY ? INT_MAX : limit.rlim_cur / 2;
+    if (half > INT_MAX) half = INT_MAX;
+    return half >= FD_BUDGET_MIN ? (int)half : 0;
+}
+
+int process_scanner_init(ProcessScanner *scanner, int top_n) {
+    memset(scanner, 0, sizeof(*scanner));
+    scanner->proc_fd = sysroot_open(PROC_DIR, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    scanner->top_n = top_n > MAX_TOP_PROCESSES ? MAX_TOP_PROCESSES : top_n;
+    scanner->fd_budget = fd_budget();
+    scanner->ticks_per_sec = sysconf(_SC_CLK_TCK);
+    scanner->page_size = sysconf(_SC_PAGESIZE);
+    scanner->dirents = malloc(DIRENT_BUF_SIZE);
+    if (scanner->proc_fd < 0 || !scanner->dirents || !table_alloc(&scanner->tables[0], PID_TABLE_MIN) ||
+        !table_alloc(&scanner->tables[1], PID_TABLE_MIN)) {
+        process_scanner_free(scanner);
+        return 0;
+    }
+    return 1;
+}
+
+static void close_entries(ProcessScanner *scanner, PidTable *t) {
+    for (uint32_t i = 0; i < t->capacity; i++) {
+        if (t->entries[i].pid != 0 && t->entries[i].fd >= 0) {
+            close(t->entries[i].fd);
+            scanner->open_fds--;
+        }
+    }
+}
+
+void process_scanner_free(ProcessScanner *scanner) {
+    for (int i = 0; i < 2; i++) {
+        if (scanner->tables[i].entries) close_entries(scanner, &scanner->tables[i]);
+        free(scanner->tables[i].entries);
+        scanner->tables[i].entries = NULL;
+    }
+    if (scanner->proc_fd >= 0) close(scanner->proc_fd);
+    scanner->proc_fd = -1;
+    free(scanner->dirents);
+    scanner->dirents = NULL;
+}
+
+static const char *skip_field(const char *p, const char *end) {
+    while (p < end && *p != ' ') p++;
+    return skip_blanks(p, end);
+}
+
+// The command name is in parentheses and may itself contain spaces and
+// parentheses, so the fields start after the last ')'.
+static int parse_stat(const char *buf, size_t len, StatFields *out) {
+    const char *end = buf + len;
+    const char *open = memchr(buf, '(', len);
+    const char *close = memrchr(buf, ')', len);
+    if (!open || !close || close < open || end - close < 4) return 0;
+
+    size_t comm_len = close - open - 1;
+    if (comm_len >= PROCESS_COMM_MAX) comm_len = PROCESS_COMM_MAX - 1;
+    memcpy(out->comm, open + 1, comm_len);
+    out->comm[comm_len] = '\0';
+    out->state = close[2];
+
+    uint64_t utime = 0, stime = 0;
+    const char *p = skip_field(close + 2, end);
+    for (int field = 4; field <= STAT_RSS && p < end; field++) {
+        uint64_t *target = NULL;
+        switch (field) {
+            case STAT_UTIME: target = &utime; break;
+            case STAT_STIME: target = &stime; break;
+            case STAT_NUM_THREADS: target = &out->threads; break;
+            case STAT_STARTTIME: target = &out->start_time; break;
+            case STAT_RSS: target = &out->rss_pages; break;
+        }
+        if (target) {
+            if (!(p = parse_u64(p, end, target))) return 0;
+            p = skip_blanks(p, end);
+        } else {
+            p = skip_field(p, end);
+        }
+    }
+    out->cpu_ticks = utime + stime;
+    return 1;
+}
+
+static ssize_t pread_stat(int fd, char *buf) {
+    ssize_t n;
+    do {
+        n = pread(fd, buf, STAT_BUF_SIZE - 1, 0);
+        count_read(n);
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+
+// Reads /proc/<pid>/stat through the descriptor kept from the previous
+// scan when there is one. Once its process has exited that descriptor
+// fails with ESRCH even if the pid was reused, and the path is opened
+// again for whichever process has the pid now.
+static ssize_t read_stat(ProcessScanner *scanner, const char *name, int *fd, char *buf) {
+    if (*fd >= 0) {
+        ssize_t n = pread_stat(*fd, buf);
+        if (n > 0) return n;
+        close(*fd);
+        count_syscalls(1);
+        scanner->open_fds--;
+        *fd = -1;
+    }
+
+    char path[32];
+    size_t name_len = strlen(name);
+    if (name_len > sizeof(path) - sizeof("/stat")) return -1;
+    memcpy(path, name, name_len);
+    memcpy(path + name_len, "/stat", sizeof("/stat"));
+
+    int new_fd = openat(scanner->proc_fd, path, O_RDONLY | O_CLOEXEC);
+    count_open(new_fd);
+    if (new_fd < 0) return -1;
+    ssize_t n = pread_stat(new_fd, buf);
+    if (n > 0 && scanner->open_fds < scanner->fd_budget) {
+        *fd = new_fd;
+        scanner->open_fds++;
+    } else {
+        close(new_fd);
+        count_syscalls(1);
+    }
+    return n;
+}
+
+static long read_dirents(ProcessScanner *scanner) {
+    long n = syscall(SYS_getdents64, scanner->proc_fd, scanner->dirents, DIRENT_BUF_SIZE);
+    count_syscalls(1);
+    return n;
+}
+
+typedef double (*SampleKey)(const ProcessSample *);
+
+static double cpu_key(const ProcessSample *s) {
+    return s->cpu_usage;
+}
+
+static double memory_key(const ProcessSample *s) {
+    return (double)s->rss_bytes;
+}
+
+static void sift_down(ProcessSample *heap, int n, int i, SampleKey key) {
+    for (;;) {
+        int smallest = i, l = 2 * i + 1, r = l + 1;
+        if (l < n && key(&heap[l]) < key(&heap[smallest])) smallest = l;
+        if (r < n && key(&heap[r]) < key(&heap[smallest])) smallest = r;
+        if (smallest == i) return;
+        ProcessSample tmp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+// A min-heap of the n largest keys seen so far: a sample only enters by
+// displacing the smallest, so each process costs one comparison unless
+// it belongs in the top n.
+static void heap_offer(ProcessSample *heap, int *size, int n, const ProcessSample *s, SampleKey key) {
+    if (*size < n) {
+        int i = (*size)++;
+        heap[i] = *s;
+        while (i > 0 && key(&heap[(i - 1) / 2]) > key(&heap[i])) {
+            ProcessSample tmp = heap[i];
+            heap[i] = heap[(i - 1) / 2];
+            heap[(i - 1) / 2] = tmp;
+            i = (i - 1) / 2;
+        }
+    } else if (n > 0 && key(s) > key(&heap[0])) {
+        heap[0] = *s;
+        sift_down(heap, n, 0, key);
+    }
+}
+
+// Heap sort leaves the largest key first.
+static void heap_sort_descending(ProcessSample *heap, int size, SampleKey key) {
+    for (int end = size - 1; end > 0; end--) {
+        ProcessSample tmp = heap[0];
+        heap[0] = heap[end];
+        heap[end] = tmp;
+        sift_down(heap, end, 0, key);
+    }
+}
+
+static int parse_pid(const char *name) {
+    int pid = 0;
+    for (; *name; name++) {
+        if ((unsigned)(*name - '0') >= 10) return 0;
+        pid = pid * 10 + (*name - '0');
+    }
+    return pid;
+}
+
+const ProcessTop *process_scan(ProcessScanner *scanner, uint64_t now_ns) {
+    char stat_buf[STAT_BUF_SIZE];
+    ProcessTop *top = &scanner->results;
+    PidTable *prev = &scanner->tables[scanner->current];
+    PidTable *next = &scanner->tables[!scanner->current];
+    double elapsed_ticks = scanner->last_scan_ns
+                               ? (now_ns - scanner->last_scan_ns) / 1e9 * scanner->ticks_per_sec
+                               : 0.0;
+    struct timespec start, finish;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    memset(next->entries, 0, next->capacity * sizeof(ProcEntry));
+    next->count = 0;
+    top->total = top->num_cpu = top->num_memory = 0;
+
+    lseek(scanner->proc_fd, 0, SEEK_SET);
+    count_syscalls(1);
+    long n;
+    while ((n = read_dirents(scanner)) > 0) {
+        for (long off = 0; off < n;) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(scanner->dirents + off);
+            off += d->d_reclen;
+            int pid = parse_pid(d->d_name);
+            if (pid <= 0 || !table_reserve(next, next->count + 1)) continue;
+
+            // The descriptor moves to the new table with the entry.
+            ProcEntry *old = table_find(prev, pid);
+            int fd = -1;
+            if (old) {
+                fd = old->fd;
+                old->fd = -1;
+            }
+
+            StatFields stat;
+            ssize_t len = read_stat(scanner, d->d_name, &fd, stat_buf);
+            if (len <= 0 || !parse_stat(stat_buf, len, &stat)) {
+                if (fd >= 0) {
+                    close(fd);
+                    count_syscalls(1);
+                    scanner->open_fds--;
+                }
+                continue;
+            }
+
+            // A process first seen now started after the previous scan, so
+            // all of its CPU time falls into this interval; on the very
+            // first scan there is no interval to measure.
+            uint64_t used = 0;
+            if (old && old->start_time == stat.start_time) {
+                used = stat.cpu_ticks > old->cpu_ticks ? stat.cpu_ticks - old->cpu_ticks : 0;
+            } else if (scanner->last_scan_ns) {
+                used = stat.cpu_ticks;
+            }
+
+            ProcEntry *e = table_insert(next, pid);
+            e->pid = pid;
+            e->fd = fd;
+            e->start_time = stat.start_time;
+            e->cpu_ticks = stat.cpu_ticks;
+
+            ProcessSample sample = {
+                .pid = pid,
+                .state = stat.state,
+                .threads = (int)stat.threads,
+                .cpu_usage = elapsed_ticks > 0.0 ? 100.0 * used / elapsed_ticks : 0.0,
+                .rss_bytes = stat.rss_pages * scanner->page_size,
+            };
+            memcpy(sample.comm, stat.comm, PROCESS_COMM_MAX);
+            top->total++;
+            if (used > 0) heap_offer(top->by_cpu, &top->num_cpu, scanner->top_n, &sample, cpu_key);
+            heap_offer(top->by_memory, &top->num_memory, scanner->top_n, &sample, memory_key);
+        }
+    }
+
+    // Whatever is left in the old table has exited.
+    close_entries(scanner, prev);
+    prev->count = 0;
+    scanner->current = !scanner->current;
+    scanner->last_scan_ns = now_ns;
+
+    heap_sort_descending(top->by_cpu, top->num_cpu, cpu_key);
+    heap_sort_descending(top->by_memory, top->num_memory, memory_key);
+    clock_gettime(CLOCK_MONOTONIC, &finish);
+    top->scan_ns = (finish.tv_sec - start.tv_sec) * 1000000000ULL + finish.tv_nsec - start.tv_nsec;
+    return top;
+}
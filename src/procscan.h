@@ -0,0 +1,67 @@
+#ifndef PROCSCAN_H
+#define PROCSCAN_H
+
+#include "hardware_info.h"
+
+#define MAX_TOP_PROCESSES 100
+#define PROCESS_COMM_MAX 16
+
+// cpu_usage is in percent of one CPU over the time since the previous
+// scan, as top(1) reports it.
+typedef struct {
+    int pid;
+    char state;
+    int threads;
+    char comm[PROCESS_COMM_MAX];
+    double cpu_usage;
+    uint64_t rss_bytes;
+} ProcessSample;
+
+struct ProcessTop {
+    int total;
+    uint64_t scan_ns;
+    int num_cpu;
+    int num_memory;
+    ProcessSample by_cpu[MAX_TOP_PROCESSES];
+    ProcessSample by_memory[MAX_TOP_PROCESSES];
+};
+
+// The counters of every process seen in a scan, keyed by pid with open
+// addressing. start_time tells a reused pid apart from the process that
+// had it before. fd is the process's /proc/<pid>/stat kept open for the
+// next scan, or -1.
+typedef struct {
+    int32_t pid;
+    int32_t fd;
+    uint64_t start_time;
+    uint64_t cpu_ticks;
+} ProcEntry;
+
+typedef struct {
+    ProcEntry *entries;
+    uint32_t capacity;
+    uint32_t count;
+} PidTable;
+
+// Scans /proc through a held directory descriptor. The tables of the
+// previous and the current scan are swapped every time, so processes
+// that exited are exactly those left behind in the old one.
+typedef struct {
+    int proc_fd;
+    char *dirents;
+    int top_n;
+    PidTable tables[2];
+    int current;
+    int open_fds;
+    int fd_budget;
+    uint64_t last_scan_ns;
+    long ticks_per_sec;
+    long page_size;
+    ProcessTop results;
+} ProcessScanner;
+
+int process_scanner_init(ProcessScanner *scanner, int top_n);
+void process_scanner_free(ProcessScanner *scanner);
+const ProcessTop *process_scan(ProcessScanner *scanner, uint64_t now_ns);
+
+#endif
@@ -0,0 +1,216 @@
+#include "psi.h"
+#include "cgroup.h"
+#include "tokenizer.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#define PSI_FILE_SIZE 256
+
+static const char *const resource_names[PSI_RESOURCE_COUNT] = {
+    [PSI_CPU] = "cpu",
+    [PSI_MEMORY] = "memory",
+    [PSI_IO] = "io",
+};
+
+static const char *const kind_names[PSI_KIND_COUNT] = {
+    [PSI_SOME] = "some",
+    [PSI_FULL] = "full",
+};
+
+const char *psi_resource_name(PsiResource resource) {
+    return resource_names[resource];
+}
+
+const char *psi_kind_name(PsiKind kind) {
+    return kind_names[kind];
+}
+
+// The averages are printed with two decimals ("12.34").
+static const char *parse_percent(const char *p, const char *end, double *out) {
+    uint64_t whole, frac;
+    p = parse_u64(p, end, &whole);
+    if (!p) return NULL;
+    *out = (double)whole;
+    if (p < end && *p == '.') {
+        const char *start = p + 1;
+        const char *q = parse_u64(start, end, &frac);
+        if (!q) return start;
+        double scale = 1.0;
+        for (const char *d = start; d < q; d++) scale *= 10.0;
+        *out += frac / scale;
+        p = q;
+    }
+    return p;
+}
+
+// "some avg10=0.00 avg60=0.00 avg300=0.00 total=0" and the same for
+// "full"; a single read of the file yields both lines.
+void parse_pressure(const char *buf, size_t len, PsiResource resource, PressureInfo *out) {
+    const char *p = buf, *end = buf + len;
+
+    while (p < end) {
+        PsiKind kind;
+        if (end - p >= 5 && memcmp(p, "some ", 5) == 0) {
+            kind = PSI_SOME;
+        } else if (end - p >= 5 && memcmp(p, "full ", 5) == 0) {
+            kind = PSI_FULL;
+        } else {
+            p = skip_line(p, end);
+            continue;
+        }
+
+        PsiLine *line = &out->line[resource][kind];
+        const char *line_end = memchr(p, '\n', end - p);
+        if (!line_end) line_end = end;
+        p += 5;
+        while (p && p < line_end) {
+            const char *eq = memchr(p, '=', line_end - p);
+            if (!eq) break;
+            size_t key_len = eq - p;
+            if (key_len == 5 && memcmp(p, "avg10", 5) == 0) {
+                p = parse_percent(eq + 1, line_end, &line->avg10);
+            } else if (key_len == 5 && memcmp(p, "avg60", 5) == 0) {
+                p = parse_percent(eq + 1, line_end, &line->avg60);
+            } else if (key_len == 6 && memcmp(p, "avg300", 6) == 0) {
+                p = parse_percent(eq + 1, line_end, &line->avg300);
+            } else if (key_len == 5 && memcmp(p, "total", 5) == 0) {
+                p = parse_u64(eq + 1, line_end, &line->total_usec);
+            } else {
+                p = eq + 1;
+            }
+            if (p) p = skip_blanks(p, line_end);
+        }
+        out->present |= 1u << (resource * PSI_KIND_COUNT + kind);
+        p = line_end < end ? line_end + 1 : end;
+    }
+}
+
+// files[] holds the cpu, memory and io pressure files of either
+// /proc/pressure or a cgroup directory; missing ones are left out.
+void read_pressure(CachedFile files[PSI_RESOURCE_COUNT], PressureInfo *out) {
+    char buf[PSI_FILE_SIZE];
+
+    out->present = 0;
+    for (int r = 0; r < PSI_RESOURCE_COUNT; r++) {
+        ssize_t len = cached_file_read(&files[r], buf, sizeof(buf));
+        if (len > 0) parse_pressure(buf, len, r, out);
+    }
+}
+
+// [cgroup.]<cpu|memory|io>[:<some|full>[:<stall_us>:<window_us>]]
+int psi_parse_trigger(const char *spec, PsiTrigger *out) {
+    char resource[32], kind[8] = "some";
+    unsigned long stall = PSI_DEFAULT_STALL_US, window = PSI_DEFAULT_WINDOW_US;
+    int used = -1;
+
+    // Each form has to consume the whole spec, so trailing text or a
+    // fourth colon is rejected rather than ignored.
+    int colons = 0;
+    for (const char *c = spec; *c; c++) colons += *c == ':';
+    if (strchr(spec, '-') || strchr(spec, ' ')) return 0;
+    switch (colons) {
+        case 0: sscanf(spec, "%31[^:]%n", resource, &used); break;
+        case 1: sscanf(spec, "%31[^:]:%7[^:]%n", resource, kind, &used); break;
+        case 3: sscanf(spec, "%31[^:]:%7[^:]:%lu:%lu%n", resource, kind, &stall, &window, &used); break;
+        default: return 0;
+    }
+    if (used < 0 || spec[used] != '\0') return 0;
+
+    memset(out, 0, sizeof(*out));
+    const char *name = resource;
+    if (strncmp(name, "cgroup.", 7) == 0) {
+        out->cgroup = 1;
+        name += 7;
+    }
+    int r = 0;
+    while (r < PSI_RESOURCE_COUNT && strcmp(name, resource_names[r]) != 0) r++;
+    int k = 0;
+    while (k < PSI_KIND_COUNT && strcmp(kind, kind_names[k]) != 0) k++;
+    if (r == PSI_RESOURCE_COUNT || k == PSI_KIND_COUNT || stall == 0 || stall > window) return 0;
+
+    out->resource = r;
+    out->kind = k;
+    out->stall_us = stall;
+    out->window_us = window;
+    return 1;
+}
+
+int psi_watch_open(PsiWatch *watch) {
+    memset(watch, 0, sizeof(*watch));
+    watch->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    return watch->epoll_fd >= 0;
+}
+
+// A trigger is armed by writing "<some|full> <stall> <window>" to its own
+// descriptor of the pressure file; it stays armed until that descriptor
+// is closed. The kernel validates the window (500 ms to 10 s) and, for
+// unprivileged users, requires it to be a multiple of 2 s.
+int psi_watch_add(PsiWatch *watch, const PsiTrigger *trigger) {
+    char path[PATH_MAX], dir[PATH_MAX], cgroup_path[PATH_MAX], spec[64];
+
+    if (watch->count == MAX_PSI_TRIGGERS) {
+        errno = ENOSPC;
+        return 0;
+    }
+    if (trigger->cgroup) {
+        if (!cgroup_resolve(dir, sizeof(dir), cgroup_path, sizeof(cgroup_path))) {
+            errno = ENOENT;
+            return 0;
+        }
+        int n = snprintf(path, sizeof(path), "%s/%s.pressure", dir, resource_names[trigger->resource]);
+        if (n >= (int)sizeof(path)) {
+            errno = ENAMETOOLONG;
+            return 0;
+        }
+    } else {
+        snprintf(path, sizeof(path), PROC_PRESSURE "/%s", resource_names[trigger->resource]);
+    }
+
+    int fd = sysroot_open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) return 0;
+    int len = snprintf(spec, sizeof(spec), "%s %lu %lu", kind_names[trigger->kind],
+                       trigger->stall_us, trigger->window_us);
+    struct epoll_event event = { .events = EPOLLPRI, .data.u32 = (uint32_t)watch->count };
+    if (write(fd, spec, len + 1) < 0 || epoll_ctl(watch->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return 0;
+    }
+    watch->fds[watch->count++] = fd;
+    return 1;
+}
+
+// Returns the number of triggers that fired, 0 on timeout, or -1 when a
+// monitored cgroup was removed (EPOLLERR) or epoll itself failed. A
+// signal is not retried but returned as EINTR, so that the caller can
+// look at what its handler did.
+int psi_watch_wait(PsiWatch *watch, int timeout_ms) {
+    struct epoll_event events[MAX_PSI_TRIGGERS];
+
+    int n = epoll_wait(watch->epoll_fd, events, MAX_PSI_TRIGGERS, timeout_ms);
+    if (n < 0) return -1;
+
+    int fired = 0;
+    for (int i = 0; i < n; i++) {
+        if (events[i].events & EPOLLERR) {
+            errno = ENODEV;
+            return -1;
+        }
+        if (events[i].events & EPOLLPRI) fired++;
+    }
+    return fired;
+}
+
+void psi_watch_close(PsiWatch *watch) {
+    for (int i = 0; i < watch->count; i++) close(watch->fds[i]);
+    if (watch->epoll_fd >= 0) close(watch->epoll_fd);
+    watch->count = 0;
+    watch->epoll_fd = -1;
+}
@@ -0,0 +1,43 @@
+#ifndef PSI_H
+#define PSI_H
+
+#include "hardware_info.h"
+#include "reader.h"
+#include <stddef.h>
+
+#define PROC_PRESSURE "/proc/pressure"
+#define MAX_PSI_TRIGGERS 8
+// Unprivileged triggers need a window that is a multiple of 2 s.
+#define PSI_DEFAULT_STALL_US 150000
+#define PSI_DEFAULT_WINDOW_US 2000000
+
+// A stall threshold: wake up when tasks were stalled on resource for
+// stall_us within any window_us, system-wide or for this cgroup.
+typedef struct {
+    int cgroup;
+    PsiResource resource;
+    PsiKind kind;
+    unsigned long stall_us;
+    unsigned long window_us;
+} PsiTrigger;
+
+// Registered triggers and the epoll instance that waits on all of them.
+// The kernel signals a trigger with EPOLLPRI at most once per window.
+typedef struct {
+    int epoll_fd;
+    int count;
+    int fds[MAX_PSI_TRIGGERS];
+} PsiWatch;
+
+const char *psi_resource_name(PsiResource resource);
+const char *psi_kind_name(PsiKind kind);
+void parse_pressure(const char *buf, size_t len, PsiResource resource, PressureInfo *out);
+void read_pressure(CachedFile files[PSI_RESOURCE_COUNT], PressureInfo *out);
+
+int psi_parse_trigger(const char *spec, PsiTrigger *out);
+int psi_watch_open(PsiWatch *watch);
+int psi_watch_add(PsiWatch *watch, const PsiTrigger *trigger);
+int psi_watch_wait(PsiWatch *watch, int timeout_ms);
+void psi_watch_close(PsiWatch *watch);
+
+#endif
@@ -0,0 +1,193 @@
+#include "reader.h"
+#include "hardware_info.h"
+#include "selfstats.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static char sysroot[PATH_MAX];
+static size_t sysroot_len;
+
+// Redirects every /proc, /sys, /dev and /etc path below root, so that a
+// captured tree can stand in for the live system. NULL, "" or "/" go
+// back to the live system. Must be called before the first collector is
+// created, as paths are resolved when it is.
+int set_sysroot(const char *root) {
+    size_t len = root ? strlen(root) : 0;
+    while (len > 0 && root[len - 1] == '/') len--;
+    if (len >= sizeof(sysroot)) return 0;
+    if (len > 0) memcpy(sysroot, root, len);
+    sysroot[len] = '\0';
+    sysroot_len = len;
+    return 1;
+}
+
+int sysroot_active(void) {
+    return sysroot_len > 0;
+}
+
+// Returns path itself on the live system, and otherwise the path below
+// the root in buf, or NULL when it does not fit.
+const char *sysroot_path(const char *path, char *buf, size_t size) {
+    if (sysroot_len == 0 || path[0] != '/') return path;
+    size_t len = strlen(path);
+    if (sysroot_len + len >= size) return NULL;
+    memcpy(buf, sysroot, sysroot_len);
+    memcpy(buf + sysroot_len, path, len + 1);
+    return buf;
+}
+
+int sysroot_open(const char *path, int flags) {
+    char buf[PATH_MAX];
+    const char *resolved = sysroot_path(path, buf, sizeof(buf));
+    if (!resolved) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    int fd = open(resolved, flags);
+    count_open(fd);
+    return fd;
+}
+
+static int open_cached(CachedFile *file) {
+    file->fd = sysroot_open(file->path, O_RDONLY | O_CLOEXEC);
+    if (file->fd >= 0) return 1;
+    // A missing file is remembered so that absent sensors cost nothing on
+    // later samples; cached_file_reset() forces a new lookup.
+    if (errno == ENOENT || errno == ENODEV || errno == ENXIO) {
+        file->fd = CACHED_FILE_ABSENT;
+    } else {
+        file->fd = CACHED_FILE_CLOSED;
+    }
+    return 0;
+}
+
+static ssize_t pread_all(int fd, char *buf, size_t size) {
+    ssize_t n;
+    do {
+        n = pread(fd, buf, size, 0);
+        count_read(n);
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+
+// Reads the whole file (up to size - 1 bytes) into buf and NUL-terminates
+// it. procfs and sysfs generate the full content on a read at offset 0, so
+// a short read means end of file and one syscall per sample is enough.
+ssize_t cached_file_read(CachedFile *file, char *buf, size_t size) {
+    if (size == 0) return -1;
+    buf[0] = '\0';
+    if (file->fd == CACHED_FILE_ABSENT) return -1;
+    if (file->fd == CACHED_FILE_CLOSED && !open_cached(file)) return -1;
+
+    ssize_t n = pread_all(file->fd, buf, size - 1);
+    if (n < 0) {
+        // The backing object went away (hot-unplugged hwmon, offlined CPU):
+        // drop the stale descriptor and try to resolve the path once more.
+        close(file->fd);
+        count_syscalls(1);
+        if (!open_cached(file)) return -1;
+        n = pread_all(file->fd, buf, size - 1);
+        if (n < 0) {
+            cached_file_close(file);
+            return -1;
+        }
+    }
+    buf[n] = '\0';
+    return n;
+}
+
+void cached_file_reset(CachedFile *file) {
+    cached_file_close(file);
+}
+
+void cached_file_close(CachedFile *file) {
+    if (file->fd >= 0) {
+        close(file->fd);
+        count_syscalls(1);
+    }
+    file->fd = CACHED_FILE_CLOSED;
+}
+
+// One-shot variant for files that are only read once per run.
+ssize_t read_file(const char *path, char *buf, size_t size) {
+    CachedFile file = CACHED_FILE_INIT(path);
+    ssize_t n = cached_file_read(&file, buf, size);
+    cached_file_close(&file);
+    return n;
+}
+
+static void trim(char *str) {
+    if (!str) return;
+    char *end;
+    while (isspace(*str)) str++;
+    if (*str == 0) return;
+    end = str + strlen(str) - 1;
+    while (end > str && isspace(*end)) end--;
+    *(end + 1) = '\0';
+}
+
+int read_file_line(const char *filepath, char *buffer, size_t size) {
+    if (read_file(filepath, buffer, size) <= 0) return 0;
+    char *newline = strchr(buffer, '\n');
+    if (newline) *newline = '\0';
+    trim(buffer);
+    return 1;
+}
+
+int file_exists(const char *filepath) {
+    char buf[PATH_MAX];
+    const char *path = sysroot_path(filepath, buf, sizeof(buf));
+    if (!path) return 0;
+    count_syscalls(1);
+    return access(path, F_OK) == 0;
+}
+
+// Reads a file holding a single decimal integer, as most sysfs attributes
+// do, returning fallback when it is missing or malformed.
+int read_file_int(const char *path, int fallback) {
+    char buffer[64];
+    char *end;
+
+    if (!read_file_line(path, buffer, sizeof(buffer))) return fallback;
+    long value = strtol(buffer, &end, 10);
+    return end == buffer ? fallback : (int)value;
+}
+
+static int compare_int(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+// Returns the numbers N of the entries in dir named prefix N suffix,
+// sorted, so that hwmonN, nodeN or tempN_label are visited in order.
+int list_numbered(const char *dir, const char *prefix, const char *suffix, int *out, int max) {
+    size_t prefix_len = strlen(prefix);
+    int count = 0;
+    char buf[PATH_MAX];
+    const char *path = sysroot_path(dir, buf, sizeof(buf));
+    DIR *d = path ? opendir(path) : NULL;
+    count_open(d ? 0 : -1);
+    if (!d) return 0;
+
+    struct dirent *entry;
+    while ((entry = readdir(d)) && count < max) {
+        char *end;
+        if (strncmp(entry->d_name, prefix, prefix_len) != 0) continue;
+        long n = strtol(entry->d_name + prefix_len, &end, 10);
+        if (end == entry->d_name + prefix_len || strcmp(end, suffix) != 0) continue;
+        out[count++] = (int)n;
+    }
+    closedir(d);
+    // The fstat in opendir, getdents64 until it returns nothing and close,
+    // for a directory that fits glibc's buffer.
+    count_syscalls(4);
+    qsort(out, count, sizeof(int), compare_int);
+    return count;
+}
@@ -0,0 +1,34 @@
+#ifndef READER_H
+#define READER_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define CACHED_FILE_CLOSED -1
+#define CACHED_FILE_ABSENT -2
+
+// A procfs/sysfs file that is opened once and re-read in place with
+// pread(fd, buf, n, 0) on every sample. The path is not copied, so it
+// must outlive the handle.
+typedef struct {
+    const char *path;
+    int fd;
+} CachedFile;
+
+#define CACHED_FILE_INIT(p) { (p), CACHED_FILE_CLOSED }
+
+ssize_t cached_file_read(CachedFile *file, char *buf, size_t size);
+void cached_file_reset(CachedFile *file);
+void cached_file_close(CachedFile *file);
+
+int sysroot_active(void);
+const char *sysroot_path(const char *path, char *buf, size_t size);
+int sysroot_open(const char *path, int flags);
+
+ssize_t read_file(const char *path, char *buf, size_t size);
+int read_file_line(const char *filepath, char *buffer, size_t size);
+int file_exists(const char *filepath);
+int read_file_int(const char *path, int fallback);
+int list_numbered(const char *dir, const char *prefix, const char *suffix, int *out, int max);
+
+#endif
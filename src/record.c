@@ -0,0 +1,310 @@
+#include "record.h"
+#include "selfstats.h"
+#include "cpustat.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define RECORD_INITIAL_SIZE 4096
+#define MEMORY_FIELDS 6
+
+static int reserve(RecordWriter *w, size_t n) {
+    if (w->len + n <= w->cap) return 1;
+    size_t cap = w->cap ? w->cap : RECORD_INITIAL_SIZE;
+    while (cap < w->len + n) cap *= 2;
+    uint8_t *grown = realloc(w->buf, cap);
+    if (!grown) return 0;
+    w->buf = grown;
+    w->cap = cap;
+    return 1;
+}
+
+static void put_byte(RecordWriter *w, uint8_t b) {
+    if (reserve(w, 1)) w->buf[w->len++] = b;
+}
+
+static void put_varint(RecordWriter *w, uint64_t v) {
+    if (!reserve(w, 10)) return;
+    while (v >= 0x80) {
+        w->buf[w->len++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    w->buf[w->len++] = (uint8_t)v;
+}
+
+static void put_delta(RecordWriter *w, uint64_t curr, uint64_t prev) {
+    int64_t delta = (int64_t)(curr - prev);
+    put_varint(w, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+}
+
+static void put_string(RecordWriter *w, const char *s) {
+    size_t n = strlen(s);
+    put_varint(w, n);
+    if (reserve(w, n)) {
+        memcpy(w->buf + w->len, s, n);
+        w->len += n;
+    }
+}
+
+static int get_varint(RecordReader *r, uint64_t *out) {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (r->p >= r->end) return 0;
+        uint8_t b = *r->p++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *out = v;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int get_delta(RecordReader *r, uint64_t prev, uint64_t *out) {
+    uint64_t zz;
+    if (!get_varint(r, &zz)) return 0;
+    int64_t delta = (int64_t)(zz >> 1) ^ -(int64_t)(zz & 1);
+    *out = prev + (uint64_t)delta;
+    return 1;
+}
+
+static int get_string(RecordReader *r, char *dest, size_t size) {
+    uint64_t n;
+    if (!get_varint(r, &n) || n > (uint64_t)(r->end - r->p)) return 0;
+    size_t copy = n < size - 1 ? n : size - 1;
+    memcpy(dest, r->p, copy);
+    dest[copy] = '\0';
+    r->p += n;
+    return 1;
+}
+
+static void memory_fields(const SystemInfo *info, uint64_t out[MEMORY_FIELDS]) {
+    out[0] = info->total_memory;
+    out[1] = info->free_memory;
+    out[2] = info->available_memory;
+    out[3] = info->cached_memory;
+    out[4] = info->swap_total;
+    out[5] = info->swap_free;
+}
+
+static void set_memory_fields(SystemInfo *info, const uint64_t in[MEMORY_FIELDS]) {
+    info->total_memory = in[0];
+    info->free_memory = in[1];
+    info->available_memory = in[2];
+    info->cached_memory = in[3];
+    info->swap_total = in[4];
+    info->swap_free = in[5];
+}
+
+int record_writer_init(RecordWriter *w, int capacity) {
+    memset(w, 0, sizeof(*w));
+    return percpu_init(&w->last.cpus, capacity);
+}
+
+void record_writer_free(RecordWriter *w) {
+    free(w->buf);
+    percpu_free(&w->last.cpus);
+    memset(w, 0, sizeof(*w));
+}
+
+void record_write_header(RecordWriter *w, const HardwareInfo *hw) {
+    for (int i = 0; i < 4; i++) put_byte(w, RECORD_MAGIC[i]);
+    put_byte(w, RECORD_VERSION);
+    put_varint(w, w->last.cpus.capacity);
+    put_varint(w, CPU_STATE_COUNT);
+
+    put_string(w, hw->system_uuid);
+    put_string(w, hw->motherboard_serial);
+    put_string(w, hw->product_name);
+    put_string(w, hw->bios_vendor);
+    put_string(w, hw->bios_version);
+    put_string(w, hw->cpu_model);
+    put_string(w, hw->cpu_vendor);
+    put_varint(w, hw->cpu_family);
+    put_varint(w, hw->cpu_stepping);
+    put_varint(w, hw->cpu_microcode);
+    put_varint(w, hw->is_arm);
+    put_varint(w, hw->is_virtual);
+    put_varint(w, hw->virt_type);
+    put_string(w, hw->hypervisor_vendor);
+    put_varint(w, hw->timed_out);
+}
+
+void record_write_sample(RecordWriter *w, const SystemInfo *info) {
+    PerCPUStats *last = &w->last.cpus;
+    const PerCPUStats *cpus = &info->cpus;
+    int capacity = cpus->capacity < last->capacity ? cpus->capacity : last->capacity;
+    uint64_t mem[MEMORY_FIELDS], last_mem[MEMORY_FIELDS];
+
+    // The payload length is patched in once the record is complete.
+    put_byte(w, RECORD_SAMPLE);
+    if (!reserve(w, 5)) return;
+    size_t length_at = w->len;
+    w->len += 5;
+
+    put_delta(w, info->timestamp, w->last.timestamp);
+    for (int i = 0; i < last->capacity; i += 8) {
+        uint8_t bits = 0;
+        for (int b = 0; b < 8 && i + b < capacity; b++) {
+            bits |= (cpus->online[i + b] ? 1 : 0) << b;
+        }
+        put_byte(w, bits);
+    }
+    for (int s = 0; s < CPU_STATE_COUNT; s++) {
+        put_delta(w, info->total_stats.time[s], w->last.total_stats.time[s]);
+    }
+    for (int i = 0; i < capacity; i++) {
+        if (!cpus->online[i]) continue;
+        for (int s = 0; s < CPU_STATE_COUNT; s++) {
+            put_delta(w, cpus->time[s][i], last->time[s][i]);
+            last->time[s][i] = cpus->time[s][i];
+        }
+        put_delta(w, (uint64_t)(int64_t)cpus->temperature[i], (uint64_t)(int64_t)last->temperature[i]);
+        last->temperature[i] = cpus->temperature[i];
+    }
+    put_varint(w, info->num_packages);
+    for (int p = 0; p < info->num_packages; p++) {
+        put_delta(w, (uint64_t)(int64_t)info->package_temperature[p],
+                  (uint64_t)(int64_t)w->last.package_temperature[p]);
+        w->last.package_temperature[p] = info->package_temperature[p];
+    }
+    memory_fields(info, mem);
+    memory_fields(&w->last, last_mem);
+    for (int m = 0; m < MEMORY_FIELDS; m++) put_delta(w, mem[m], last_mem[m]);
+    put_varint(w, info->memory.present);
+    for (int f = 0; f < MEMINFO_FIELD_COUNT; f++) {
+        if (!(info->memory.present & (1ULL << f))) continue;
+        put_delta(w, info->memory.value[f], w->last.memory.value[f]);
+        w->last.memory.value[f] = info->memory.value[f];
+    }
+
+    // Fixed-width (padded) varint so the length can be written afterwards.
+    uint64_t payload = w->len - length_at - 5;
+    for (int i = 0; i < 5; i++) {
+        w->buf[length_at + i] = (uint8_t)((payload >> (7 * i)) & 0x7f) | (i < 4 ? 0x80 : 0);
+    }
+
+    w->last.timestamp = info->timestamp;
+    w->last.total_stats = info->total_stats;
+    set_memory_fields(&w->last, mem);
+}
+
+int record_writer_flush(RecordWriter *w, int fd) {
+    size_t off = 0;
+    while (off < w->len) {
+        ssize_t n = write(fd, w->buf + off, w->len - off);
+        count_syscalls(1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        off += n;
+    }
+    w->len = 0;
+    return 1;
+}
+
+int record_reader_open(RecordReader *r, const uint8_t *data, size_t len, HardwareInfo *hw) {
+    uint64_t capacity, states, value;
+
+    memset(r, 0, sizeof(*r));
+    r->p = data;
+    r->end = data + len;
+    if (len < 5 || memcmp(data, RECORD_MAGIC, 4) != 0 || data[4] != RECORD_VERSION) return 0;
+    r->p += 5;
+    if (!get_varint(r, &capacity) || !get_varint(r, &states)) return 0;
+    if (capacity == 0 || capacity > 1 << 20 || states != CPU_STATE_COUNT) return 0;
+
+    memset(hw, 0, sizeof(*hw));
+    if (!get_string(r, hw->system_uuid, UUID_LENGTH) ||
+        !get_string(r, hw->motherboard_serial, SERIAL_LENGTH) ||
+        !get_string(r, hw->product_name, MODEL_LENGTH) ||
+        !get_string(r, hw->bios_vendor, VENDOR_LENGTH) ||
+        !get_string(r, hw->bios_version, VENDOR_LENGTH) ||
+        !get_string(r, hw->cpu_model, MODEL_LENGTH) ||
+        !get_string(r, hw->cpu_vendor, VENDOR_LENGTH)) return 0;
+    if (!get_varint(r, &value)) return 0;
+    hw->cpu_family = (uint32_t)value;
+    if (!get_varint(r, &value)) return 0;
+    hw->cpu_stepping = (uint32_t)value;
+    if (!get_varint(r, &hw->cpu_microcode)) return 0;
+    if (!get_varint(r, &value)) return 0;
+    hw->is_arm = (int)value;
+    if (!get_varint(r, &value)) return 0;
+    hw->is_virtual = (int)value;
+    if (!get_varint(r, &value) || value > VIRT_UNKNOWN) return 0;
+    hw->virt_type = (VirtualizationType)value;
+    if (!get_string(r, hw->hypervisor_vendor, VENDOR_LENGTH)) return 0;
+    if (!get_varint(r, &value)) return 0;
+    hw->timed_out = (uint32_t)value;
+
+    return percpu_init(&r->last.cpus, (int)capacity);
+}
+
+// Decodes the next sample into out, whose per-CPU store must have the
+// recording's capacity. Returns 1 on success, 0 at end of input and -1
+// for a truncated or corrupt record.
+int record_read_sample(RecordReader *r, SystemInfo *out) {
+    PerCPUStats *last = &r->last.cpus;
+    uint64_t length, mem[MEMORY_FIELDS], last_mem[MEMORY_FIELDS], value;
+
+    if (r->p >= r->end) return 0;
+    if (*r->p++ != RECORD_SAMPLE || !get_varint(r, &length)) return -1;
+    if (length > (uint64_t)(r->end - r->p) || out->cpus.capacity != last->capacity) return -1;
+    const uint8_t *record_end = r->p + length;
+
+    if (!get_delta(r, r->last.timestamp, &out->timestamp)) return -1;
+    out->num_cores = 0;
+    for (int i = 0; i < last->capacity; i += 8) {
+        if (r->p >= record_end) return -1;
+        uint8_t bits = *r->p++;
+        for (int b = 0; b < 8 && i + b < last->capacity; b++) {
+            out->cpus.online[i + b] = (bits >> b) & 1;
+            out->num_cores += (bits >> b) & 1;
+        }
+    }
+    out->total_stats.total = 0;
+    for (int s = 0; s < CPU_STATE_COUNT; s++) {
+        if (!get_delta(r, r->last.total_stats.time[s], &out->total_stats.time[s])) return -1;
+        if (s < CPU_TOTAL_STATES) out->total_stats.total += out->total_stats.time[s];
+    }
+    for (int i = 0; i < last->capacity; i++) {
+        if (!out->cpus.online[i]) continue;
+        out->cpus.total[i] = 0;
+        for (int s = 0; s < CPU_STATE_COUNT; s++) {
+            if (!get_delta(r, last->time[s][i], &value)) return -1;
+            last->time[s][i] = out->cpus.time[s][i] = value;
+            if (s < CPU_TOTAL_STATES) out->cpus.total[i] += value;
+        }
+        if (!get_delta(r, (uint64_t)(int64_t)last->temperature[i], &value)) return -1;
+        last->temperature[i] = out->cpus.temperature[i] = (int)(int64_t)value;
+    }
+    if (!get_varint(r, &value) || value > MAX_PACKAGES) return -1;
+    out->num_packages = (int)value;
+    for (int p = 0; p < out->num_packages; p++) {
+        if (!get_delta(r, (uint64_t)(int64_t)r->last.package_temperature[p], &value)) return -1;
+        r->last.package_temperature[p] = out->package_temperature[p] = (int)(int64_t)value;
+    }
+    memory_fields(&r->last, last_mem);
+    for (int m = 0; m < MEMORY_FIELDS; m++) {
+        if (!get_delta(r, last_mem[m], &mem[m])) return -1;
+    }
+    set_memory_fields(out, mem);
+    if (!get_varint(r, &out->memory.present)) return -1;
+    for (int f = 0; f < MEMINFO_FIELD_COUNT; f++) {
+        if (!(out->memory.present & (1ULL << f))) continue;
+        if (!get_delta(r, r->last.memory.value[f], &value)) return -1;
+        r->last.memory.value[f] = out->memory.value[f] = value;
+    }
+    if (r->p != record_end) return -1;
+
+    r->last.timestamp = out->timestamp;
+    r->last.total_stats = out->total_stats;
+    set_memory_fields(&r->last, mem);
+    return 1;
+}
+
+void record_reader_free(RecordReader *r) {
+    percpu_free(&r->last.cpus);
+}
@@ -0,0 +1,48 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include "hardware_info.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Compact binary recording format for high-rate capture:
+//
+//   header:  "HWIR", u8 version, varint cpu capacity, varint state count,
+//            then the static HardwareInfo, field by field
+//   sample:  u8 'S', varint length, payload
+//   payload: zigzag delta of the timestamp, online-CPU bitmap, aggregate
+//            counters, counters and temperature of each online CPU, and
+//            the memory fields, every number a zigzag varint delta
+//            against the previous sample
+//
+// Deltas are taken against the last value seen for each CPU, so offline
+// CPUs simply carry their previous counters forward.
+
+#define RECORD_MAGIC "HWIR"
+#define RECORD_VERSION 4
+#define RECORD_SAMPLE 'S'
+
+typedef struct {
+    uint8_t *buf;
+    size_t len;
+    size_t cap;
+    SystemInfo last;
+} RecordWriter;
+
+typedef struct {
+    const uint8_t *p;
+    const uint8_t *end;
+    SystemInfo last;
+} RecordReader;
+
+int record_writer_init(RecordWriter *w, int capacity);
+void record_writer_free(RecordWriter *w);
+void record_write_header(RecordWriter *w, const HardwareInfo *hw);
+void record_write_sample(RecordWriter *w, const SystemInfo *info);
+int record_writer_flush(RecordWriter *w, int fd);
+
+int record_reader_open(RecordReader *r, const uint8_t *data, size_t len, HardwareInfo *hw);
+int record_read_sample(RecordReader *r, SystemInfo *out);
+void record_reader_free(RecordReader *r);
+
+#endif
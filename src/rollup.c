@@ -0,0 +1,516 @@
+#define _GNU_SOURCE
+#include "rollup.h"
+#include "fields.h"
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#define VALUE_MIN 0
+#define VALUE_AVG 1
+#define VALUE_MAX 2
+#define VALUE_ARRAYS 3
+#define LISTEN_BACKLOG 16
+#define CLIENT_TIMEOUT_SEC 1
+
+static const struct {
+    const char *name;
+    uint64_t width_ms;
+    int depth;
+} levels[ROLLUP_LEVELS] = {
+    [ROLLUP_RAW] = {"raw", 0, ROLLUP_RAW_DEPTH},
+    [ROLLUP_10S] = {"10s", 10000, ROLLUP_10S_DEPTH},
+    [ROLLUP_1M] = {"1m", 60000, ROLLUP_1M_DEPTH},
+    [ROLLUP_1H] = {"1h", 3600000, ROLLUP_1H_DEPTH},
+};
+
+static const struct {
+    const char *name;
+    int per_cpu;
+} metrics[ROLLUP_METRICS] = {
+    [ROLLUP_USAGE] = {"usage", 0},
+    [ROLLUP_MEMORY] = {"memory", 0},
+    [ROLLUP_CORE_USAGE] = {"core_usage", 1},
+    [ROLLUP_TEMPERATURE] = {"temperature", 1},
+};
+
+static int series_of(const Rollups *r, RollupMetric metric, int cpu) {
+    switch (metric) {
+        case ROLLUP_USAGE: return 0;
+        case ROLLUP_MEMORY: return 1;
+        case ROLLUP_CORE_USAGE: return 2 + cpu;
+        default: return 2 + r->capacity + cpu;
+    }
+}
+
+// Array v (VALUE_MIN, VALUE_AVG or VALUE_MAX) of bucket slot.
+static float *slot_values(const RollupRing *ring, int series, int slot, int v) {
+    return ring->values + ((size_t)slot * VALUE_ARRAYS + v) * series;
+}
+
+static void ring_free(RollupRing *ring) {
+    free(ring->start_ms);
+    free(ring->samples);
+    free(ring->values);
+    free(ring->sum);
+    free(ring->min);
+    free(ring->max);
+    free(ring->count);
+    memset(ring, 0, sizeof(*ring));
+}
+
+static int ring_init(RollupRing *ring, RollupLevel level, int series) {
+    memset(ring, 0, sizeof(*ring));
+    ring->width_ms = levels[level].width_ms;
+    ring->depth = levels[level].depth;
+    ring->start_ms = calloc(ring->depth, sizeof(uint64_t));
+    ring->samples = calloc(ring->depth, sizeof(uint32_t));
+    ring->values = calloc((size_t)ring->depth * VALUE_ARRAYS * series, sizeof(float));
+    if (!ring->start_ms || !ring->samples || !ring->values) return 0;
+    if (level == ROLLUP_RAW) return 1;
+
+    ring->sum = calloc(series, sizeof(double));
+    ring->min = calloc(series, sizeof(float));
+    ring->max = calloc(series, sizeof(float));
+    ring->count = calloc(series, sizeof(uint32_t));
+    return ring->sum && ring->min && ring->max && ring->count;
+}
+
+int rollups_init(Rollups *r, int capacity) {
+    memset(r, 0, sizeof(*r));
+    r->capacity = capacity;
+    r->series = 2 + 2 * capacity;
+    r->sample = calloc(r->series, sizeof(float));
+    int ok = r->sample != NULL;
+    for (int l = 0; l < ROLLUP_LEVELS; l++) ok = ring_init(&r->ring[l], l, r->series) && ok;
+    if (!ok) {
+        rollups_free(r);
+        return 0;
+    }
+    pthread_mutex_init(&r->lock, NULL);
+    return 1;
+}
+
+void rollups_free(Rollups *r) {
+    if (r->sample) pthread_mutex_destroy(&r->lock);
+    for (int l = 0; l < ROLLUP_LEVELS; l++) ring_free(&r->ring[l]);
+    free(r->sample);
+    memset(r, 0, sizeof(*r));
+}
+
+static void ring_advance(RollupRing *ring) {
+    ring->head = (ring->head + 1) % ring->depth;
+    if (ring->filled < ring->depth) ring->filled++;
+}
+
+static void close_bucket(RollupRing *ring, int series) {
+    int slot = ring->head;
+    float *min = slot_values(ring, series, slot, VALUE_MIN);
+    float *avg = slot_values(ring, series, slot, VALUE_AVG);
+    float *max = slot_values(ring, series, slot, VALUE_MAX);
+
+    ring->start_ms[slot] = ring->open_start_ms;
+    ring->samples[slot] = ring->open_samples;
+    for (int s = 0; s < series; s++) {
+        int seen = ring->count[s] > 0;
+        min[s] = seen ? ring->min[s] : NAN;
+        avg[s] = seen ? (float)(ring->sum[s] / ring->count[s]) : NAN;
+        max[s] = seen ? ring->max[s] : NAN;
+    }
+    ring->open = 0;
+    ring_advance(ring);
+}
+
+// A bucket closes when a sample arrives past its end. A sample from
+// before the open bucket, after the wall clock was set back, is folded
+// into it rather than reopening history.
+static void ring_add(RollupRing *ring, int series, const float *sample, uint64_t now_ms) {
+    if (ring->width_ms == 0) {
+        int slot = ring->head;
+        ring->start_ms[slot] = now_ms;
+        ring->samples[slot] = 1;
+        for (int v = 0; v < VALUE_ARRAYS; v++) {
+            memcpy(slot_values(ring, series, slot, v), sample, series * sizeof(float));
+        }
+        ring_advance(ring);
+        return;
+    }
+
+    if (ring->open && now_ms >= ring->open_start_ms + ring->width_ms) close_bucket(ring, series);
+    if (!ring->open) {
+        ring->open = 1;
+        ring->open_start_ms = now_ms - now_ms % ring->width_ms;
+        ring->open_samples = 0;
+        memset(ring->sum, 0, series * sizeof(double));
+        memset(ring->count, 0, series * sizeof(uint32_t));
+    }
+    for (int s = 0; s < series; s++) {
+        float v = sample[s];
+        if (isnan(v)) continue;
+        if (ring->count[s] == 0 || v < ring->min[s]) ring->min[s] = v;
+        if (ring->count[s] == 0 || v > ring->max[s]) ring->max[s] = v;
+        ring->sum[s] += v;
+        ring->count[s]++;
+    }
+    ring->open_samples++;
+}
+
+// Series a sample has no value for, because its field was not collected,
+// the CPU is offline or it has no sensor, are NaN.
+void rollups_update(Rollups *r, const SystemInfo *info) {
+    const PerCPUStats *cpus = &info->cpus;
+    int n = r->capacity < cpus->capacity ? r->capacity : cpus->capacity;
+    float *sample = r->sample;
+
+    for (int s = 0; s < r->series; s++) sample[s] = NAN;
+    if (info->fields & FIELD_BIT(FIELD_CPU_USAGE)) {
+        sample[series_of(r, ROLLUP_USAGE, 0)] = (float)info->total_usage;
+        for (int cpu = 0; cpu < n; cpu++) {
+            if (cpus->online[cpu]) sample[series_of(r, ROLLUP_CORE_USAGE, cpu)] = (float)cpus->usage[cpu];
+        }
+    }
+    if ((info->fields & FIELD_BIT(FIELD_MEMORY)) && info->total_memory) {
+        uint64_t available = info->available_memory < info->total_memory ? info->available_memory
+                                                                         : info->total_memory;
+        sample[series_of(r, ROLLUP_MEMORY, 0)] = (float)(info->total_memory - available);
+    }
+    if (info->fields & FIELD_BIT(FIELD_TEMPERATURE)) {
+        for (int cpu = 0; cpu < n; cpu++) {
+            if (cpus->online[cpu] && cpus->temperature[cpu] != TEMPERATURE_UNKNOWN) {
+                sample[series_of(r, ROLLUP_TEMPERATURE, cpu)] = (float)cpus->temperature[cpu];
+            }
+        }
+    }
+
+    uint64_t now_ms = info->timestamp / 1000000;
+    pthread_mutex_lock(&r->lock);
+    for (int l = 0; l < ROLLUP_LEVELS; l++) ring_add(&r->ring[l], r->series, sample, now_ms);
+    r->latest_ms = now_ms;
+    pthread_mutex_unlock(&r->lock);
+}
+
+// A duration such as 90s, 15m, 24h or 7d.
+static int parse_duration(const char *arg, uint64_t *out_ms) {
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(arg, &end, 10);
+    if (errno || end == arg || value == 0 || value > UINT32_MAX) return 0;
+    if (end[0] == '\0' || end[1] != '\0') return 0;
+    switch (*end) {
+        case 's': *out_ms = value * 1000ULL; break;
+        case 'm': *out_ms = value * 60000ULL; break;
+        case 'h': *out_ms = value * 3600000ULL; break;
+        case 'd': *out_ms = value * 86400000ULL; break;
+        default: return 0;
+    }
+    return 1;
+}
+
+// Without a resolution, raw samples are used as long as they reach back
+// over the range, else the finest resolution whose retention does.
+static RollupLevel pick_level(const Rollups *r, uint64_t range_ms) {
+    const RollupRing *raw = &r->ring[ROLLUP_RAW];
+    if (raw->filled < raw->depth || r->latest_ms - raw->start_ms[raw->head] >= range_ms) {
+        return ROLLUP_RAW;
+    }
+    for (int l = ROLLUP_10S; l < ROLLUP_1H; l++) {
+        if (levels[l].width_ms * levels[l].depth >= range_ms) return l;
+    }
+    return ROLLUP_1H;
+}
+
+static void write_value(JsonWriter *w, const char *key, RollupMetric metric, float value) {
+    if (isnan(value)) {
+        json_null(w, key);
+    } else if (metric == ROLLUP_MEMORY) {
+        json_uint(w, key, (uint64_t)(value + 0.5f));
+    } else {
+        json_fixed(w, key, value, metric == ROLLUP_TEMPERATURE ? 1 : 2);
+    }
+}
+
+static void write_bucket(JsonWriter *w, RollupMetric metric, uint64_t start_ms, uint32_t samples,
+                         float min, float avg, float max, int partial) {
+    json_begin_object(w, NULL);
+    json_uint(w, "timestamp", start_ms);
+    json_uint(w, "samples", samples);
+    write_value(w, "min", metric, min);
+    write_value(w, "avg", metric, avg);
+    write_value(w, "max", metric, max);
+    if (partial) json_bool(w, "partial", 1);
+    json_end_object(w);
+}
+
+static int query_error(JsonWriter *w, const char *message) {
+    json_begin_object(w, NULL);
+    json_string(w, "error", message);
+    json_end_object(w);
+    return 0;
+}
+
+// Request: <metric>[:<cpu>] <range> [raw|10s|1m|1h], e.g.
+// "core_usage:17 15m 10s". The response lists the buckets that overlap
+// the range ending at the latest sample, oldest first; the bucket still
+// being filled comes last and is marked partial.
+int rollups_query(Rollups *r, const char *request, JsonWriter *w) {
+    char copy[ROLLUP_MAX_REQUEST + 1];
+    char *tokens[4], *save = NULL;
+    int num_tokens = 0;
+
+    if (strlen(request) > ROLLUP_MAX_REQUEST) return query_error(w, "request too long");
+    strcpy(copy, request);
+    for (char *t = strtok_r(copy, " \t\r\n", &save); t && num_tokens < 4;
+         t = strtok_r(NULL, " \t\r\n", &save)) {
+        tokens[num_tokens++] = t;
+    }
+    if (num_tokens < 2 || num_tokens > 3) {
+        return query_error(w, "expected <metric>[:<cpu>] <range> [raw|10s|1m|1h]");
+    }
+
+    char *colon = strchr(tokens[0], ':');
+    if (colon) *colon = '\0';
+    int metric = 0;
+    while (metric < ROLLUP_METRICS && strcmp(metrics[metric].name, tokens[0]) != 0) metric++;
+    if (metric == ROLLUP_METRICS) return query_error(w, "unknown metric");
+    long cpu = 0;
+    if (metrics[metric].per_cpu) {
+        char *end;
+        if (!colon) return query_error(w, "metric needs a cpu, e.g. core_usage:0");
+        errno = 0;
+        cpu = strtol(colon + 1, &end, 10);
+        if (errno || end == colon + 1 || *end || cpu < 0 || cpu >= r->capacity) {
+            return query_error(w, "no such cpu");
+        }
+    } else if (colon) {
+        return query_error(w, "metric has no cpus");
+    }
+
+    uint64_t range_ms;
+    if (!parse_duration(tokens[1], &range_ms)) return query_error(w, "invalid range");
+    int level = ROLLUP_LEVELS;
+    if (num_tokens == 3) {
+        level = 0;
+        while (level < ROLLUP_LEVELS && strcmp(levels[level].name, tokens[2]) != 0) level++;
+        if (level == ROLLUP_LEVELS) return query_error(w, "unknown resolution");
+    }
+
+    pthread_mutex_lock(&r->lock);
+    if (r->latest_ms == 0) {
+        pthread_mutex_unlock(&r->lock);
+        return query_error(w, "no samples yet");
+    }
+    if (level == ROLLUP_LEVELS) level = pick_level(r, range_ms);
+    const RollupRing *ring = &r->ring[level];
+    int series = series_of(r, metric, (int)cpu);
+    uint64_t from = r->latest_ms > range_ms ? r->latest_ms - range_ms : 0;
+
+    json_begin_object(w, NULL);
+    json_string(w, "metric", metrics[metric].name);
+    if (metrics[metric].per_cpu) json_int(w, "cpu", cpu);
+    json_string(w, "resolution", levels[level].name);
+    json_uint(w, "from", from);
+    json_uint(w, "to", r->latest_ms);
+    json_begin_array(w, "buckets");
+    for (int age = ring->filled - 1; age >= 0; age--) {
+        int slot = (ring->head - 1 - age + ring->depth) % ring->depth;
+        uint64_t end = ring->start_ms[slot] + (ring->width_ms ? ring->width_ms : 1);
+        if (end <= from) continue;
+        write_bucket(w, metric, ring->start_ms[slot], ring->samples[slot],
+                     slot_values(ring, r->series, slot, VALUE_MIN)[series],
+                     slot_values(ring, r->series, slot, VALUE_AVG)[series],
+                     slot_values(ring, r->series, slot, VALUE_MAX)[series], 0);
+    }
+    if (ring->open) {
+        int seen = ring->count[series] > 0;
+        write_bucket(w, metric, ring->open_start_ms, ring->open_samples,
+                     seen ? ring->min[series] : NAN,
+                     seen ? (float)(ring->sum[series] / ring->count[series]) : NAN,
+                     seen ? ring->max[series] : NAN, 1);
+    }
+    json_end_array(w);
+    json_end_object(w);
+    pthread_mutex_unlock(&r->lock);
+    return 1;
+}
+
+static int send_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 1;
+}
+
+// Reads one request line and answers it. The timeouts keep a client that
+// stalls from holding up the ones behind it.
+static void answer(Rollups *r, int fd, JsonWriter *w) {
+    struct timeval timeout = {CLIENT_TIMEOUT_SEC, 0};
+    char request[ROLLUP_MAX_REQUEST + 2];
+    size_t len = 0;
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    while (len < sizeof(request) - 1 && !memchr(request, '\n', len)) {
+        ssize_t n = recv(fd, request + len, sizeof(request) - 1 - len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        len += n;
+    }
+    request[len] = '\0';
+    char *newline = strchr(request, '\n');
+    if (newline) *newline = '\0';
+
+    json_writer_reset(w);
+    rollups_query(r, request, w);
+    json_raw(w, "\n", 1);
+    send_all(fd, w->buf, w->len);
+}
+
+static void *serve(void *arg) {
+    RollupServer *s = arg;
+    JsonWriter w;
+
+    json_writer_init(&w, 0);
+    for (;;) {
+        int fd = accept4(s->fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            // rollup_server_stop() shuts the socket down, which fails
+            // accept with EINVAL.
+            if (errno == EINVAL || errno == EBADF) break;
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                usleep(100000);
+            }
+            continue;
+        }
+        answer(s->rollups, fd, &w);
+        close(fd);
+    }
+    json_writer_free(&w);
+    return NULL;
+}
+
+static int set_address(struct sockaddr_un *addr, const char *path) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        errno = ENAMETOOLONG;
+        return 0;
+    }
+    strcpy(addr->sun_path, path);
+    return 1;
+}
+
+// A socket file left behind by a collector that was killed is replaced;
+// one that still accepts connections belongs to a running collector, and
+// anything that is not a socket is never touched.
+static int remove_stale_socket(const struct sockaddr_un *addr) {
+    struct stat st;
+    if (lstat(addr->sun_path, &st) != 0 || !S_ISSOCK(st.st_mode)) {
+        errno = EADDRINUSE;
+        return 0;
+    }
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe < 0) return 0;
+    int alive = connect(probe, (const struct sockaddr *)addr, sizeof(*addr)) == 0;
+    close(probe);
+    if (alive) {
+        errno = EADDRINUSE;
+        return 0;
+    }
+    return unlink(addr->sun_path) == 0;
+}
+
+int rollup_server_start(RollupServer *s, Rollups *r, const char *path) {
+    struct sockaddr_un addr;
+
+    memset(s, 0, sizeof(*s));
+    s->fd = -1;
+    s->rollups = r;
+    if (!set_address(&addr, path)) return 0;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return 0;
+    int bound = bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+    if (!bound && errno == EADDRINUSE && remove_stale_socket(&addr)) {
+        bound = bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+    }
+    if (!bound || listen(fd, LISTEN_BACKLOG) != 0) {
+        int saved = errno;
+        if (bound) unlink(path);
+        close(fd);
+        errno = saved;
+        return 0;
+    }
+
+    s->fd = fd;
+    strcpy(s->path, path);
+    // Signals are left to the sampling loop.
+    sigset_t all, saved;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+    int err = pthread_create(&s->thread, NULL, serve, s);
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+    if (err) {
+        unlink(path);
+        close(fd);
+        s->fd = -1;
+        errno = err;
+        return 0;
+    }
+    return 1;
+}
+
+void rollup_server_stop(RollupServer *s) {
+    if (s->fd < 0) return;
+    shutdown(s->fd, SHUT_RDWR);
+    pthread_join(s->thread, NULL);
+    close(s->fd);
+    unlink(s->path);
+    s->fd = -1;
+}
+
+// Sends one request to a collector serving rollups and copies its
+// response to out_fd. Returns -1 when the collector cannot be reached,
+// 0 when it answered with an error and 1 otherwise.
+int rollup_request(const char *path, const char *request, int out_fd) {
+    struct sockaddr_un addr;
+    char buf[4096];
+    int status = -1;
+
+    if (!set_address(&addr, path)) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        !send_all(fd, request, strlen(request)) || !send_all(fd, "\n", 1)) {
+        close(fd);
+        return -1;
+    }
+    shutdown(fd, SHUT_WR);
+
+    for (;;) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        if (status < 0) status = strncmp(buf, "{\"error\"", n < 8 ? n : 8) != 0;
+        for (ssize_t off = 0; off < n;) {
+            ssize_t written = write(out_fd, buf + off, n - off);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                close(fd);
+                return status;
+            }
+            off += written;
+        }
+    }
+    close(fd);
+    return status;
+}
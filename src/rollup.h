@@ -0,0 +1,88 @@
+#ifndef ROLLUP_H
+#define ROLLUP_H
+
+#include "hardware_info.h"
+#include "json_writer.h"
+#include <pthread.h>
+#include <sys/un.h>
+
+// Retention of each resolution: 6 minutes of raw samples at the default
+// interval, an hour of 10 s buckets, a day of 1 min buckets and a week
+// of 1 h buckets.
+#define ROLLUP_RAW_DEPTH 360
+#define ROLLUP_10S_DEPTH 360
+#define ROLLUP_1M_DEPTH 1440
+#define ROLLUP_1H_DEPTH 168
+#define ROLLUP_MAX_REQUEST 256
+
+typedef enum {
+    ROLLUP_RAW,
+    ROLLUP_10S,
+    ROLLUP_1M,
+    ROLLUP_1H,
+    ROLLUP_LEVELS
+} RollupLevel;
+
+// Series are laid out as total usage, memory in use, then the usage and
+// the temperature of every possible CPU.
+typedef enum {
+    ROLLUP_USAGE,
+    ROLLUP_MEMORY,
+    ROLLUP_CORE_USAGE,
+    ROLLUP_TEMPERATURE,
+    ROLLUP_METRICS
+} RollupMetric;
+
+// Closed buckets of one resolution, plus the one still being filled.
+// Every bucket holds min, avg and max of each series, NaN where the
+// series had no value in it; raw buckets hold one sample each.
+typedef struct {
+    uint64_t width_ms;
+    int depth;
+    int head;
+    int filled;
+    uint64_t *start_ms;
+    uint32_t *samples;
+    float *values;
+    int open;
+    uint64_t open_start_ms;
+    uint32_t open_samples;
+    double *sum;
+    float *min;
+    float *max;
+    uint32_t *count;
+} RollupRing;
+
+// History of a sampling stream at several resolutions. Every sample is
+// folded into the open bucket of each resolution as it arrives, so the
+// memory used is fixed at init: 12 bytes per series per bucket, with
+// 2 + 2 * capacity series. The lock lets a server thread query while
+// the sampling loop updates.
+typedef struct {
+    pthread_mutex_t lock;
+    int capacity;
+    int series;
+    uint64_t latest_ms;
+    float *sample;
+    RollupRing ring[ROLLUP_LEVELS];
+} Rollups;
+
+// Answers one request per connection on a Unix domain socket from a
+// thread of its own.
+typedef struct {
+    Rollups *rollups;
+    int fd;
+    pthread_t thread;
+    char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+} RollupServer;
+
+int rollups_init(Rollups *r, int capacity);
+void rollups_update(Rollups *r, const SystemInfo *info);
+int rollups_query(Rollups *r, const char *request, JsonWriter *w);
+void rollups_free(Rollups *r);
+
+int rollup_server_start(RollupServer *s, Rollups *r, const char *path);
+void rollup_server_stop(RollupServer *s);
+int rollup_request(const char *path, const char *request, int out_fd);
+
+#endif
@@ -0,0 +1,107 @@
+#include "selfstats.h"
+#include <pthread.h>
+#include <time.h>
+
+__thread SelfCounters self_counters;
+
+// The static probes end their phases on worker threads.
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static SelfStats stats;
+static int enabled = 0;
+
+static const char *const phase_names[PHASE_COUNT] = {
+    [PHASE_HWCACHE] = "hwcache",
+    [PHASE_CPUINFO] = "cpuinfo",
+    [PHASE_VIRTUALIZATION] = "virtualization",
+    [PHASE_DMI] = "dmi",
+    [PHASE_TOPOLOGY] = "topology",
+    [PHASE_SAMPLE] = "sample",
+    [PHASE_STAT] = "stat",
+    [PHASE_SENSORS] = "sensors",
+    [PHASE_CPUFREQ] = "cpufreq",
+    [PHASE_MEMINFO] = "meminfo",
+    [PHASE_PRESSURE] = "pressure",
+    [PHASE_DISKS] = "disks",
+    [PHASE_NETWORK] = "network",
+    [PHASE_CGROUP] = "cgroup",
+    [PHASE_PROCESSES] = "processes",
+    [PHASE_OUTPUT] = "output",
+};
+
+const char *phase_name(Phase phase) {
+    return phase_names[phase];
+}
+
+// Timers are no-ops until enabled, so the phases cost a predictable
+// branch each when --self-stats is not given.
+void selfstats_enable(void) {
+    enabled = 1;
+}
+
+const SelfStats *selfstats_results(void) {
+    return enabled ? &stats : NULL;
+}
+
+static uint64_t monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static int bucket_of(uint64_t ns) {
+    if (ns < PHASE_SUB_BUCKETS) return (int)ns;
+    int exponent = 63 - __builtin_clzll(ns);
+    if (exponent >= PHASE_MAX_EXPONENT) return PHASE_BUCKETS - 1;
+    int sub = (int)(ns >> (exponent - 4)) & (PHASE_SUB_BUCKETS - 1);
+    return (exponent - 3) * PHASE_SUB_BUCKETS + sub;
+}
+
+static uint64_t bucket_upper_bound(int bucket) {
+    if (bucket < PHASE_SUB_BUCKETS) return bucket;
+    int shift = bucket / PHASE_SUB_BUCKETS - 1;
+    uint64_t lower = (uint64_t)(PHASE_SUB_BUCKETS + bucket % PHASE_SUB_BUCKETS) << shift;
+    return lower + (1ULL << shift) - 1;
+}
+
+void phase_begin(PhaseTimer *timer) {
+    if (!enabled) return;
+    timer->start = self_counters;
+    timer->start_ns = monotonic_ns();
+}
+
+void phase_end(PhaseTimer *timer, Phase phase) {
+    if (!enabled) return;
+    uint64_t ns = monotonic_ns() - timer->start_ns;
+    PhaseStats *p = &stats.phase[phase];
+
+    pthread_mutex_lock(&stats_lock);
+    p->last_ns = ns;
+    if (p->runs == 0 || ns < p->min_ns) p->min_ns = ns;
+    if (ns > p->max_ns) p->max_ns = ns;
+    p->total_ns += ns;
+    p->runs++;
+    p->histogram[bucket_of(ns)]++;
+    p->last.files_opened = self_counters.files_opened - timer->start.files_opened;
+    p->last.bytes_read = self_counters.bytes_read - timer->start.bytes_read;
+    p->last.syscalls = self_counters.syscalls - timer->start.syscalls;
+    p->last.allocations = self_counters.allocations - timer->start.allocations;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+// The upper bound of the bucket holding the given fraction of the runs,
+// kept within the durations actually seen.
+uint64_t phase_percentile(const PhaseStats *p, double fraction) {
+    if (p->runs == 0) return 0;
+    uint64_t rank = (uint64_t)(fraction * p->runs + 0.999999);
+    if (rank == 0) rank = 1;
+    uint64_t seen = 0;
+    for (int b = 0; b < PHASE_BUCKETS; b++) {
+        seen += p->histogram[b];
+        if (seen >= rank) {
+            uint64_t bound = bucket_upper_bound(b);
+            if (bound > p->max_ns) bound = p->max_ns;
+            return bound < p->min_ns ? p->min_ns : bound;
+        }
+    }
+    return p->max_ns;
+}
@@ -0,0 +1,90 @@
+#ifndef SELFSTATS_H
+#define SELFSTATS_H
+
+#include "hardware_info.h"
+#include <sys/types.h>
+
+// Log-linear histogram of phase durations: exact below 16 ns, then 16
+// buckets per power of two, so a percentile is within 1/16 of the true
+// value. Durations beyond 2^41 ns (some 36 minutes) share the last one.
+#define PHASE_SUB_BUCKETS 16
+#define PHASE_MAX_EXPONENT 41
+#define PHASE_BUCKETS ((PHASE_MAX_EXPONENT - 3) * PHASE_SUB_BUCKETS)
+
+typedef enum {
+    PHASE_HWCACHE,
+    PHASE_CPUINFO,
+    PHASE_VIRTUALIZATION,
+    PHASE_DMI,
+    PHASE_TOPOLOGY,
+    PHASE_SAMPLE,
+    PHASE_STAT,
+    PHASE_SENSORS,
+    PHASE_CPUFREQ,
+    PHASE_MEMINFO,
+    PHASE_PRESSURE,
+    PHASE_DISKS,
+    PHASE_NETWORK,
+    PHASE_CGROUP,
+    PHASE_PROCESSES,
+    PHASE_OUTPUT,
+    PHASE_COUNT
+} Phase;
+
+// Work done by this process, counted where it talks to the kernel: the
+// reader helpers and the few collectors that read their files directly.
+// Allocations are only counted when the binary is linked with the
+// allocator wrappers (see main.c). Every thread counts its own work, so
+// a phase only sees what the thread that timed it did.
+typedef struct {
+    uint64_t files_opened;
+    uint64_t bytes_read;
+    uint64_t syscalls;
+    uint64_t allocations;
+} SelfCounters;
+
+extern __thread SelfCounters self_counters;
+
+static inline void count_open(int fd) {
+    self_counters.syscalls++;
+    if (fd >= 0) self_counters.files_opened++;
+}
+
+static inline void count_read(ssize_t n) {
+    self_counters.syscalls++;
+    if (n > 0) self_counters.bytes_read += n;
+}
+
+static inline void count_syscalls(int n) {
+    self_counters.syscalls += n;
+}
+
+// Timing of one phase over every run so far; last holds what its most
+// recent run cost.
+typedef struct {
+    uint64_t runs;
+    uint64_t last_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    uint64_t total_ns;
+    SelfCounters last;
+    uint32_t histogram[PHASE_BUCKETS];
+} PhaseStats;
+
+struct SelfStats {
+    PhaseStats phase[PHASE_COUNT];
+};
+
+typedef struct {
+    uint64_t start_ns;
+    SelfCounters start;
+} PhaseTimer;
+
+void selfstats_enable(void);
+const SelfStats *selfstats_results(void);
+void phase_begin(PhaseTimer *timer);
+void phase_end(PhaseTimer *timer, Phase phase);
+uint64_t phase_percentile(const PhaseStats *stats, double fraction);
+const char *phase_name(Phase phase);
+
+#endif
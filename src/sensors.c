@@ -0,0 +1,333 @@
+#include "sensors.h"
+#include "topology.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define HWMON_CLASS "/sys/class/hwmon"
+#define THERMAL_CLASS "/sys/class/thermal"
+#define SENSOR_PATH_LENGTH 512
+#define MAX_HWMON_DEVICES 64
+#define MAX_CCDS 16
+
+typedef struct {
+    int package;
+    int core;
+    int l3;
+} CpuTopology;
+
+typedef struct {
+    int hwmon;
+    char device[SENSOR_PATH_LENGTH];
+    int tctl;
+    int tdie;
+    int ccd[MAX_CCDS];
+    int num_ccds;
+} K10temp;
+
+static int add_sensor(SensorMap *map, const char *path) {
+    CachedFile *files = realloc(map->files, (map->num_sensors + 1) * sizeof(CachedFile));
+    if (!files) return -1;
+    map->files = files;
+
+    char *copy = strdup(path);
+    if (!copy) return -1;
+    files[map->num_sensors] = (CachedFile)CACHED_FILE_INIT(copy);
+    return map->num_sensors++;
+}
+
+static int compare_int(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+static void copy_topology(CpuTopology *topo, int capacity, const Topology *topology) {
+    for (int cpu = 0; cpu < capacity; cpu++) {
+        int known = cpu < topology->capacity && topology->package[cpu] >= 0;
+        topo[cpu].package = known ? topology->package[cpu] : -1;
+        topo[cpu].core = known ? topology->core_id[cpu] : -1;
+        topo[cpu].l3 = known ? topology->l3[cpu] : -1;
+    }
+}
+
+static int valid_package(int package) {
+    return package >= 0 && package < MAX_PACKAGES;
+}
+
+// coretemp exposes one "Package id P" sensor and one "Core N" sensor per
+// physical core, where N is the topology core_id rather than a logical CPU
+// number. Core ids are sparse on many parts and every SMT sibling shares
+// its core's sensor.
+static void scan_coretemp(SensorMap *map, const char *dir, const CpuTopology *topo) {
+    char path[SENSOR_PATH_LENGTH], label[64];
+    int numbers[256];
+    int count = list_numbered(dir, "temp", "_label", numbers, 256);
+    int package = -1;
+
+    // The instance's package comes from its label or, failing that, from
+    // the platform device name (coretemp.P).
+    for (int i = 0; i < count && package < 0; i++) {
+        snprintf(path, sizeof(path), "%s/temp%d_label", dir, numbers[i]);
+        if (read_file_line(path, label, sizeof(label))) sscanf(label, "Package id %d", &package);
+    }
+    if (package < 0) {
+        char link[SENSOR_PATH_LENGTH], buf[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/device", dir);
+        const char *resolved = sysroot_path(path, buf, sizeof(buf));
+        ssize_t n = resolved ? readlink(resolved, link, sizeof(link) - 1) : -1;
+        if (n > 0) {
+            link[n] = '\0';
+            const char *dot = strrchr(link, '.');
+            if (dot) package = atoi(dot + 1);
+        }
+    }
+    if (!valid_package(package)) return;
+
+    for (int i = 0; i < count; i++) {
+        int core;
+        snprintf(path, sizeof(path), "%s/temp%d_label", dir, numbers[i]);
+        if (!read_file_line(path, label, sizeof(label))) continue;
+        snprintf(path, sizeof(path), "%s/temp%d_input", dir, numbers[i]);
+
+        if (strncmp(label, "Package id", 10) == 0) {
+            map->package_sensor[package] = add_sensor(map, path);
+        } else if (sscanf(label, "Core %d", &core) == 1) {
+            int sensor = -1;
+            for (int cpu = 0; cpu < map->capacity; cpu++) {
+                if (topo[cpu].package != package || topo[cpu].core != core) continue;
+                if (sensor < 0) sensor = add_sensor(map, path);
+                map->cpu_sensor[cpu] = sensor;
+            }
+        }
+    }
+}
+
+static void scan_k10temp(const char *dir, int hwmon, K10temp *k) {
+    char path[SENSOR_PATH_LENGTH], label[64], buf[PATH_MAX], real[PATH_MAX];
+    int numbers[64];
+    int count = list_numbered(dir, "temp", "_label", numbers, 64);
+
+    memset(k, 0, sizeof(*k));
+    k->tctl = k->tdie = -1;
+    k->hwmon = hwmon;
+    // realpath() needs PATH_MAX bytes. The device path only orders the
+    // k10temp instances, for which its first part is enough.
+    snprintf(path, sizeof(path), "%s/device", dir);
+    const char *resolved = sysroot_path(path, buf, sizeof(buf));
+    if (!resolved || !realpath(resolved, real)) snprintf(real, sizeof(real), "%s", dir);
+    snprintf(k->device, sizeof(k->device), "%.*s", (int)sizeof(k->device) - 1, real);
+
+    for (int i = 0; i < count; i++) {
+        int ccd;
+        snprintf(path, sizeof(path), "%s/temp%d_label", dir, numbers[i]);
+        if (!read_file_line(path, label, sizeof(label))) continue;
+        if (strcmp(label, "Tctl") == 0) {
+            k->tctl = numbers[i];
+        } else if (strcmp(label, "Tdie") == 0) {
+            k->tdie = numbers[i];
+        } else if (sscanf(label, "Tccd%d", &ccd) == 1 && ccd >= 1 && ccd <= MAX_CCDS) {
+            k->ccd[ccd - 1] = numbers[i];
+            if (ccd > k->num_ccds) k->num_ccds = ccd;
+        }
+    }
+}
+
+// k10temp reports Tctl (Tdie on older parts, without the fan-control
+// offset) for the package and one Tccd sensor per populated CCD. CPUs are
+// placed on CCDs by their L3 id: one L3 per CCD from Zen 3, two per CCD
+// (one per CCX) on Zen 2. Anything else falls back to the package value.
+static void map_k10temp(SensorMap *map, const K10temp *k, int package, const CpuTopology *topo) {
+    char path[SENSOR_PATH_LENGTH];
+    int groups[2 * MAX_CCDS];
+    int num_groups = 0;
+
+    int package_input = k->tdie >= 0 ? k->tdie : k->tctl;
+    if (package_input >= 0) {
+        snprintf(path, sizeof(path), HWMON_CLASS "/hwmon%d/temp%d_input", k->hwmon, package_input);
+        map->package_sensor[package] = add_sensor(map, path);
+    }
+    if (k->num_ccds == 0) return;
+
+    for (int cpu = 0; cpu < map->capacity; cpu++) {
+        if (topo[cpu].package != package || topo[cpu].l3 < 0) continue;
+        int known = 0;
+        for (int g = 0; g < num_groups; g++) known |= groups[g] == topo[cpu].l3;
+        if (known) continue;
+        if (num_groups == 2 * MAX_CCDS) return;
+        groups[num_groups++] = topo[cpu].l3;
+    }
+    qsort(groups, num_groups, sizeof(int), compare_int);
+
+    int per_ccd;
+    if (num_groups == k->num_ccds) {
+        per_ccd = 1;
+    } else if (num_groups == 2 * k->num_ccds) {
+        per_ccd = 2;
+    } else {
+        return;
+    }
+
+    int sensors[MAX_CCDS];
+    for (int c = 0; c < k->num_ccds; c++) {
+        sensors[c] = -1;
+        if (k->ccd[c] == 0) continue;
+        snprintf(path, sizeof(path), HWMON_CLASS "/hwmon%d/temp%d_input", k->hwmon, k->ccd[c]);
+        sensors[c] = add_sensor(map, path);
+    }
+    for (int cpu = 0; cpu < map->capacity; cpu++) {
+        if (topo[cpu].package != package) continue;
+        for (int g = 0; g < num_groups; g++) {
+            if (groups[g] == topo[cpu].l3) map->cpu_sensor[cpu] = sensors[g / per_ccd];
+        }
+    }
+}
+
+static int compare_k10temp(const void *a, const void *b) {
+    return strcmp(((const K10temp *)a)->device, ((const K10temp *)b)->device);
+}
+
+static int package_present(const CpuTopology *topo, int capacity, int package) {
+    for (int cpu = 0; cpu < capacity; cpu++) {
+        if (topo[cpu].package == package) return 1;
+    }
+    return 0;
+}
+
+static void scan_hwmon(SensorMap *map, const CpuTopology *topo) {
+    K10temp k10[MAX_PACKAGES];
+    char dir[64], path[SENSOR_PATH_LENGTH], name[64];
+    int numbers[MAX_HWMON_DEVICES];
+    int count = list_numbered(HWMON_CLASS, "hwmon", "", numbers, MAX_HWMON_DEVICES);
+    int num_k10 = 0;
+
+    for (int i = 0; i < count; i++) {
+        snprintf(dir, sizeof(dir), HWMON_CLASS "/hwmon%d", numbers[i]);
+        snprintf(path, sizeof(path), "%s/name", dir);
+        if (!read_file_line(path, name, sizeof(name))) continue;
+
+        if (strcmp(name, "coretemp") == 0) {
+            scan_coretemp(map, dir, topo);
+        } else if (strcmp(name, "k10temp") == 0 && num_k10 < MAX_PACKAGES) {
+            scan_k10temp(dir, numbers[i], &k10[num_k10++]);
+        }
+    }
+
+    // There is one k10temp instance per socket, on the socket's
+    // northbridge, and their PCI addresses follow the package order.
+    qsort(k10, num_k10, sizeof(K10temp), compare_k10temp);
+    int package = 0;
+    for (int i = 0; i < num_k10; i++) {
+        while (package < map->num_packages && !package_present(topo, map->capacity, package)) package++;
+        if (package >= map->num_packages) break;
+        map_k10temp(map, &k10[i], package++, topo);
+    }
+}
+
+// Without a CPU hwmon driver, fall back to thermal zones: x86_pkg_temp
+// zones (one per package, in package order), then an SoC/CPU zone as on
+// the Raspberry Pi, then thermal_zone0.
+static void scan_thermal(SensorMap *map) {
+    char path[SENSOR_PATH_LENGTH], type[64];
+    int numbers[MAX_HWMON_DEVICES];
+    int count = list_numbered(THERMAL_CLASS, "thermal_zone", "", numbers, MAX_HWMON_DEVICES);
+    int package = 0;
+    int fallback = -1;
+
+    for (int i = 0; i < count; i++) {
+        snprintf(path, sizeof(path), THERMAL_CLASS "/thermal_zone%d/type", numbers[i]);
+        if (!read_file_line(path, type, sizeof(type))) continue;
+        if (strcmp(type, "x86_pkg_temp") == 0) {
+            if (package < map->num_packages) {
+                snprintf(path, sizeof(path), THERMAL_CLASS "/thermal_zone%d/temp", numbers[i]);
+                map->package_sensor[package++] = add_sensor(map, path);
+            }
+        } else if (fallback < 0 && (strstr(type, "cpu") || strstr(type, "soc"))) {
+            fallback = numbers[i];
+        }
+    }
+    if (package > 0) return;
+
+    if (fallback < 0 && count > 0) fallback = numbers[0];
+    if (fallback < 0) return;
+    snprintf(path, sizeof(path), THERMAL_CLASS "/thermal_zone%d/temp", fallback);
+    int sensor = add_sensor(map, path);
+    for (int p = 0; p < map->num_packages; p++) map->package_sensor[p] = sensor;
+}
+
+// The topology is the one collected or cached for the hardware section,
+// so that sysfs is not walked a second time.
+int sensors_discover(SensorMap *map, int capacity, const Topology *topology) {
+    memset(map, 0, sizeof(*map));
+    map->capacity = capacity;
+    for (int p = 0; p < MAX_PACKAGES; p++) map->package_sensor[p] = -1;
+
+    map->cpu_sensor = malloc(capacity * sizeof(int));
+    CpuTopology *topo = malloc(capacity * sizeof(CpuTopology));
+    if (!map->cpu_sensor || !topo) {
+        free(topo);
+        sensors_free(map);
+        return 0;
+    }
+    copy_topology(topo, capacity, topology);
+
+    map->num_packages = 1;
+    for (int cpu = 0; cpu < capacity; cpu++) {
+        map->cpu_sensor[cpu] = -1;
+        if (valid_package(topo[cpu].package) && topo[cpu].package >= map->num_packages) {
+            map->num_packages = topo[cpu].package + 1;
+        }
+    }
+
+    scan_hwmon(map, topo);
+    int have_package = 0;
+    for (int p = 0; p < map->num_packages; p++) have_package |= map->package_sensor[p] >= 0;
+    if (!have_package) scan_thermal(map);
+
+    // CPUs without a core-level sensor report their package's temperature.
+    for (int cpu = 0; cpu < capacity; cpu++) {
+        if (map->cpu_sensor[cpu] >= 0) continue;
+        int package = valid_package(topo[cpu].package) ? topo[cpu].package : 0;
+        map->cpu_sensor[cpu] = map->package_sensor[package];
+    }
+    free(topo);
+
+    map->values = malloc((map->num_sensors ? map->num_sensors : 1) * sizeof(int));
+    if (!map->values) {
+        sensors_free(map);
+        return 0;
+    }
+    return 1;
+}
+
+void sensors_read(SensorMap *map, SystemInfo *info) {
+    char buffer[32];
+    int capacity = map->capacity < info->cpus.capacity ? map->capacity : info->cpus.capacity;
+
+    for (int s = 0; s < map->num_sensors; s++) {
+        map->values[s] = cached_file_read(&map->files[s], buffer, sizeof(buffer)) > 0
+                             ? atoi(buffer) / 1000
+                             : TEMPERATURE_UNKNOWN;
+    }
+    for (int cpu = 0; cpu < capacity; cpu++) {
+        int sensor = map->cpu_sensor[cpu];
+        info->cpus.temperature[cpu] = sensor >= 0 ? map->values[sensor] : TEMPERATURE_UNKNOWN;
+    }
+    info->num_packages = map->num_packages;
+    for (int p = 0; p < map->num_packages; p++) {
+        int sensor = map->package_sensor[p];
+        info->package_temperature[p] = sensor >= 0 ? map->values[sensor] : TEMPERATURE_UNKNOWN;
+    }
+}
+
+void sensors_free(SensorMap *map) {
+    for (int s = 0; s < map->num_sensors; s++) {
+        cached_file_close(&map->files[s]);
+        free((char *)map->files[s].path);
+    }
+    free(map->files);
+    free(map->values);
+    free(map->cpu_sensor);
+    memset(map, 0, sizeof(*map));
+}
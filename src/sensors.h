@@ -0,0 +1,24 @@
+#ifndef SENSORS_H
+#define SENSORS_H
+
+#include "hardware_info.h"
+#include "reader.h"
+
+// Temperature sensors resolved once from /sys/class/hwmon and
+// /sys/class/thermal. Every sensor file is read once per sample and the
+// value is fanned out to the CPUs and packages that map to it.
+typedef struct {
+    CachedFile *files;
+    int *values;
+    int num_sensors;
+    int *cpu_sensor;
+    int capacity;
+    int package_sensor[MAX_PACKAGES];
+    int num_packages;
+} SensorMap;
+
+int sensors_discover(SensorMap *map, int capacity, const Topology *topology);
+void sensors_read(SensorMap *map, SystemInfo *info);
+void sensors_free(SensorMap *map);
+
+#endif
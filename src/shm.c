@@ -0,0 +1,312 @@
+#include "shm.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SHM_MAGIC 0x4d484948u  // "HIHM"
+#define SHM_VERSION 5
+#define SHM_ALIGN 64
+#define SHM_READ_RETRIES 1000
+
+struct ShmHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t history;
+    uint64_t slot_size;
+    uint64_t seq;
+    uint64_t published;
+    HardwareInfo hw_info;
+};
+
+// Fixed part of a ring slot; the per-CPU arrays follow it in the same
+// order as PerCPUStats.
+typedef struct {
+    uint64_t timestamp;
+    CPUStats total_stats;
+    double total_usage;
+    double total_state_usage[CPU_STATE_COUNT];
+    int64_t num_cores;
+    int32_t num_packages;
+    int32_t package_temperature[MAX_PACKAGES];
+    MemoryInfo memory;
+    uint64_t total_memory;
+    uint64_t free_memory;
+    uint64_t available_memory;
+    uint64_t cached_memory;
+    uint64_t swap_total;
+    uint64_t swap_free;
+} ShmSlot;
+
+static size_t align_up(size_t n) {
+    return (n + SHM_ALIGN - 1) & ~(size_t)(SHM_ALIGN - 1);
+}
+
+static size_t header_size(void) {
+    return align_up(sizeof(ShmHeader));
+}
+
+static size_t slot_size(int capacity) {
+    size_t per_cpu = (CPU_STATE_COUNT + 1) * sizeof(uint64_t) +
+                     (CPU_STATE_COUNT + 1) * sizeof(double) +
+                     sizeof(int) + sizeof(uint8_t);
+    return align_up(sizeof(ShmSlot) + (size_t)capacity * per_cpu);
+}
+
+static char *slot_at(const ShmSegment *seg, uint64_t index) {
+    const ShmHeader *h = seg->header;
+    return (char *)seg->map + header_size() + (index % h->history) * h->slot_size;
+}
+
+static void copy_to_slot(char *dst, const SystemInfo *info, int capacity) {
+    ShmSlot *slot = (ShmSlot *)dst;
+    const PerCPUStats *cpus = &info->cpus;
+    size_t u64_bytes = capacity * sizeof(uint64_t);
+
+    slot->timestamp = info->timestamp;
+    slot->total_stats = info->total_stats;
+    slot->total_usage = info->total_usage;
+    memcpy(slot->total_state_usage, info->total_state_usage, sizeof(slot->total_state_usage));
+    slot->num_cores = info->num_cores;
+    slot->num_packages = info->num_packages;
+    memcpy(slot->package_temperature, info->package_temperature, sizeof(slot->package_temperature));
+    slot->memory = info->memory;
+    slot->total_memory = info->total_memory;
+    slot->free_memory = info->free_memory;
+    slot->available_memory = info->available_memory;
+    slot->cached_memory = info->cached_memory;
+    slot->swap_total = info->swap_total;
+    slot->swap_free = info->swap_free;
+
+    char *p = dst + sizeof(ShmSlot);
+    for (int s = 0; s < CPU_STATE_COUNT; s++) {
+        memcpy(p, cpus->time[s], u64_bytes);
+        p += u64_bytes;
+    }
+    memcpy(p, cpus->total, u64_bytes);
+    p += u64_bytes;
+    memcpy(p, cpus->usage, capacity * sizeof(double));
+    p += capacity * sizeof(double);
+    for (int s = 0; s < CPU_STATE_COUNT; s++) {
+        memcpy(p, cpus->state_usage[s], capacity * sizeof(double));
+        p += capacity * sizeof(double);
+    }
+    memcpy(p, cpus->temperature, capacity * sizeof(int));
+    p += capacity * sizeof(int);
+    memcpy(p, cpus->online, capacity);
+}
+
+static void copy_from_slot(SystemInfo *info, const char *src, int capacity) {
+    const ShmSlot *slot = (const ShmSlot *)src;
+    PerCPUStats *cpus = &info->cpus;
+    size_t u64_bytes = capacity * sizeof(uint64_t);
+
+    info->timestamp = slot->timestamp;
+    info->total_stats = slot->total_stats;
+    info->total_usage = slot->total_usage;
+    memcpy(info->total_state_usage, slot->total_state_usage, sizeof(info->total_state_usage));
+    info->num_cores = (int)slot->num_cores;
+    info->num_packages = slot->num_packages;
+    memcpy(info->package_temperature, slot->package_temperature, sizeof(info->package_temperature));
+    info->memory = slot->memory;
+    info->total_memory = slot->total_memory;
+    info->free_memory = slot->free_memory;
+    info->available_memory = slot->available_memory;
+    info->cached_memory = slot->cached_memory;
+    info->swap_total = slot->swap_total;
+    info->swap_free = slot->swap_free;
+
+    const char *p = src + sizeof(ShmSlot);
+    for (int s = 0; s < CPU_STATE_COUNT; s++) {
+        memcpy(cpus->time[s], p, u64_bytes);
+        p += u64_bytes;
+    }
+    memcpy(cpus->total, p, u64_bytes);
+    p += u64_bytes;
+    memcpy(cpus->usage, p, capacity * sizeof(double));
+    p += capacity * sizeof(double);
+    for (int s = 0; s < CPU_STATE_COUNT; s++) {
+        memcpy(cpus->state_usage[s], p, capacity * sizeof(double));
+        p += capacity * sizeof(double);
+    }
+    memcpy(cpus->temperature, p, capacity * sizeof(int));
+    p += capacity * sizeof(int);
+    memcpy(cpus->online, p, capacity);
+}
+
+// Returns 1 once a segment left by a publisher that is gone has been
+// removed, or there was none. While its lock is held the name cannot be
+// taken over by anyone else, so the segment created next is not replaced
+// by a publisher starting at the same time either: that one fails to
+// lock one of the two.
+static int remove_stale(const char *name, int *stale_fd) {
+    *stale_fd = shm_open(name, O_RDWR | O_CLOEXEC, 0);
+    if (*stale_fd < 0) return errno == ENOENT;
+    if (flock(*stale_fd, LOCK_EX | LOCK_NB) != 0) {
+        close(*stale_fd);
+        *stale_fd = -1;
+        if (errno == EWOULDBLOCK) errno = EBUSY;
+        return 0;
+    }
+    shm_unlink(name);
+    return 1;
+}
+
+// A fresh segment is created on every start so that readers of a previous
+// publisher never see a layout change underneath them; they keep their
+// old mapping until they reopen. Fails with EBUSY while another publisher
+// is live on the same name.
+int shm_publisher_open(ShmSegment *seg, const char *name, const HardwareInfo *hw,
+                       int capacity, int history) {
+    int stale_fd;
+
+    memset(seg, 0, sizeof(*seg));
+    seg->fd = -1;
+    if (history < 1) history = 1;
+    size_t size = header_size() + (size_t)history * slot_size(capacity);
+
+    if (!remove_stale(name, &stale_fd)) return 0;
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0644);
+    if (stale_fd >= 0) close(stale_fd);
+    if (fd < 0) {
+        if (errno == EEXIST) errno = EBUSY;
+        return 0;
+    }
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        close(fd);
+        errno = EBUSY;
+        return 0;
+    }
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, size) == 0) map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        int saved = errno;
+        shm_unlink(name);
+        close(fd);
+        errno = saved;
+        return 0;
+    }
+
+    seg->map = map;
+    seg->size = size;
+    seg->header = map;
+    seg->writable = 1;
+    seg->fd = fd;
+
+    ShmHeader *h = seg->header;
+    h->version = SHM_VERSION;
+    h->capacity = capacity;
+    h->history = history;
+    h->slot_size = slot_size(capacity);
+    h->seq = 0;
+    h->published = 0;
+    h->hw_info = *hw;
+    // Readers only trust the layout once the magic is visible.
+    __atomic_store_n(&h->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+    return 1;
+}
+
+// Writes the sample into the next ring slot. The sequence counter is odd
+// while the write is in progress, so readers that overlap it retry.
+void shm_publish(ShmSegment *seg, const SystemInfo *info) {
+    ShmHeader *h = seg->header;
+    int capacity = info->cpus.capacity < (int)h->capacity ? info->cpus.capacity : (int)h->capacity;
+    uint64_t seq = h->seq;
+
+    __atomic_store_n(&h->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    char *slot = slot_at(seg, h->published);
+    if (capacity < (int)h->capacity) memset(slot, 0, h->slot_size);
+    copy_to_slot(slot, info, capacity);
+    h->published++;
+
+    __atomic_store_n(&h->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+// The name goes first, while the lock still keeps it ours; readers that
+// have the segment mapped keep their copy.
+void shm_publisher_close(ShmSegment *seg, const char *name) {
+    if (seg->fd >= 0) shm_unlink(name);
+    shm_close(seg);
+}
+
+int shm_reader_open(ShmSegment *seg, const char *name) {
+    struct stat st;
+
+    memset(seg, 0, sizeof(*seg));
+    seg->fd = -1;
+    int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) return 0;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < header_size()) {
+        close(fd);
+        return 0;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return 0;
+
+    seg->map = map;
+    seg->size = st.st_size;
+    seg->header = map;
+
+    const ShmHeader *h = seg->header;
+    if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC ||
+        h->version != SHM_VERSION || h->history == 0 ||
+        h->slot_size != slot_size(h->capacity) ||
+        header_size() + (size_t)h->history * h->slot_size > seg->size) {
+        shm_close(seg);
+        return 0;
+    }
+    return 1;
+}
+
+int shm_capacity(const ShmSegment *seg) {
+    return (int)seg->header->capacity;
+}
+
+int shm_history_length(const ShmSegment *seg) {
+    return (int)seg->header->history;
+}
+
+// Copies the sample published `age` ticks ago (0 is the latest) into out,
+// whose per-CPU store must have shm_capacity() entries, and limits its
+// fields to SHM_FIELDS so that sections the slot does not carry are left
+// out of the output instead of showing up empty. Returns 0 when no such
+// sample exists yet or the writer kept racing the copy.
+int shm_read(const ShmSegment *seg, int age, SystemInfo *out) {
+    const ShmHeader *h = seg->header;
+    int capacity = (int)h->capacity;
+
+    if (out->cpus.capacity != capacity || age < 0 || (uint32_t)age >= h->history) return 0;
+
+    for (int attempt = 0; attempt < SHM_READ_RETRIES; attempt++) {
+        uint64_t seq = __atomic_load_n(&h->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            sched_yield();
+            continue;
+        }
+        uint64_t published = h->published;
+        if (published <= (uint64_t)age) return 0;
+
+        copy_from_slot(out, slot_at(seg, published - 1 - age), capacity);
+        out->hw_info = h->hw_info;
+        out->fields = SHM_FIELDS;
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&h->seq, __ATOMIC_RELAXED) == seq) return 1;
+    }
+    return 0;
+}
+
+void shm_close(ShmSegment *seg) {
+    if (seg->map) munmap(seg->map, seg->size);
+    if (seg->fd >= 0) close(seg->fd);
+    memset(seg, 0, sizeof(*seg));
+    seg->fd = -1;
+}
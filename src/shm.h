@@ -0,0 +1,45 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include "hardware_info.h"
+#include "fields.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHM_DEFAULT_NAME "/hardware-info"
+#define SHM_DEFAULT_HISTORY 60
+// What a slot carries: the static hardware information without the
+// topology, per-CPU usage and temperature, and the system-wide memory.
+#define SHM_FIELDS                                                                          \
+    ((FIELDS_HARDWARE & ~FIELD_BIT(FIELD_TOPOLOGY)) | FIELD_BIT(FIELD_CPU_USAGE) |         \
+     FIELD_BIT(FIELD_TEMPERATURE) | FIELD_BIT(FIELD_MEMORY))
+
+// A POSIX shared-memory segment holding the static HardwareInfo and a ring
+// of the most recent samples. One collector publishes; any number of
+// local readers map the segment and copy snapshots out under a seqlock,
+// without syscalls or locks once mapped. The publisher holds an flock on
+// the segment for as long as it runs, which is how a second publisher
+// tells a live segment from one left behind by a crash.
+typedef struct ShmHeader ShmHeader;
+
+typedef struct {
+    void *map;
+    size_t size;
+    ShmHeader *header;
+    int writable;
+    int fd;
+} ShmSegment;
+
+int shm_publisher_open(ShmSegment *seg, const char *name, const HardwareInfo *hw,
+                       int capacity, int history);
+void shm_publish(ShmSegment *seg, const SystemInfo *info);
+void shm_publisher_close(ShmSegment *seg, const char *name);
+
+int shm_reader_open(ShmSegment *seg, const char *name);
+int shm_capacity(const ShmSegment *seg);
+int shm_history_length(const ShmSegment *seg);
+int shm_read(const ShmSegment *seg, int age, SystemInfo *out);
+
+void shm_close(ShmSegment *seg);
+
+#endif
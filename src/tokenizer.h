@@ -0,0 +1,79 @@
+#ifndef TOKENIZER_H
+#define TOKENIZER_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Allocation-free integer tokenizer for procfs/sysfs buffers. Callers pass
+// the end of the valid data so that the 8-byte SWAR loads never read past
+// it; shorter tails fall back to a byte-at-a-time loop.
+
+#define SWAR_ONES 0x0101010101010101ULL
+
+static inline const char *skip_blanks(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    return p;
+}
+
+static inline const char *skip_line(const char *p, const char *end) {
+    const char *nl = memchr(p, '\n', end - p);
+    return nl ? nl + 1 : end;
+}
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+// Converts eight digit values (0-9, most significant in the lowest byte)
+// to an integer with three multiply/shift/mask steps.
+static inline uint64_t swar_digits8(uint64_t x) {
+    x = (x * 10) + (x >> 8);
+    x &= 0x00FF00FF00FF00FFULL;
+    x = (x * 100) + (x >> 16);
+    x &= 0x0000FFFF0000FFFFULL;
+    x = (x * 10000) + (x >> 32);
+    return x & 0xFFFFFFFFULL;
+}
+#endif
+
+// Parses an unsigned decimal after optional blanks. Returns a pointer
+// past the digits, or NULL when there is no number at p.
+static inline const char *parse_u64(const char *p, const char *end, uint64_t *out) {
+    uint64_t value = 0;
+
+    p = skip_blanks(p, end);
+    const char *start = p;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (end - p >= 8) {
+        uint64_t chunk;
+        memcpy(&chunk, p, 8);
+        uint64_t digits = chunk ^ (0x30 * SWAR_ONES);
+        // A byte is a digit iff its value is < 10, i.e. neither it nor
+        // it + 6 has any of the high nibble bits set.
+        uint64_t non_digit = ((digits + 0x06 * SWAR_ONES) | digits) & (0xF0 * SWAR_ONES);
+        if (non_digit == 0) {
+            value = value * 100000000ULL + swar_digits8(digits);
+            p += 8;
+            continue;
+        }
+        int n = __builtin_ctzll(non_digit) >> 3;
+        if (n > 0) {
+            static const uint64_t powers_of_ten[8] = {
+                1, 10, 100, 1000, 10000, 100000, 1000000, 10000000
+            };
+            // Move the n digits to the top bytes so leading zeros pad them.
+            value = value * powers_of_ten[n] + swar_digits8(digits << (64 - 8 * n));
+            p += n;
+        }
+        *out = value;
+        return p > start ? p : NULL;
+    }
+#endif
+
+    while (p < end && (unsigned)(*p - '0') < 10) {
+        value = value * 10 + (uint64_t)(*p - '0');
+        p++;
+    }
+    *out = value;
+    return p > start ? p : NULL;
+}
+
+#endif
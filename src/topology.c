@@ -0,0 +1,249 @@
+#include "topology.h"
+#include "reader.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CPU_SYSFS "/sys/devices/system/cpu"
+#define NODE_SYSFS "/sys/devices/system/node"
+#define TOPOLOGY_PATH_LENGTH 256
+#define MAX_CACHE_INDEX 16
+#define PER_CPU_ARRAYS 6
+
+size_t topology_storage_size(int capacity) {
+    return (size_t)PER_CPU_ARRAYS * capacity * sizeof(int32_t);
+}
+
+int topology_init(Topology *topo, int capacity) {
+    memset(topo, 0, sizeof(*topo));
+    int32_t *storage = malloc(topology_storage_size(capacity));
+    if (!storage) return 0;
+    memset(storage, 0xff, topology_storage_size(capacity));
+
+    topo->package = storage;
+    topo->die = storage + capacity;
+    topo->core_id = storage + 2 * capacity;
+    topo->core = storage + 3 * capacity;
+    topo->node = storage + 4 * capacity;
+    topo->l3 = storage + 5 * capacity;
+    topo->capacity = capacity;
+    topo->storage = storage;
+    return 1;
+}
+
+void topology_free(Topology *topo) {
+    free(topo->storage);
+    memset(topo, 0, sizeof(*topo));
+}
+
+// Sets array[cpu] = value for every CPU in a cpulist such as "0-3,8-11"
+// and returns how many CPUs it lists.
+static int cpulist_apply(const char *list, int capacity, int32_t *array, int32_t value) {
+    const char *p = list;
+    int count = 0;
+    while (*p) {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p) break;
+        long last = first;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p) break;
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            if (array && cpu >= 0 && cpu < capacity) array[cpu] = value;
+            count++;
+        }
+        p = end;
+        if (*p == ',') p++;
+    }
+    return count;
+}
+
+// Reads a cache size such as "48K" or "32M" in KiB.
+static uint32_t parse_cache_size(const char *text) {
+    char *end;
+    unsigned long size = strtoul(text, &end, 10);
+    if (*end == 'M') size *= 1024;
+    if (*end == 'G') size *= 1024 * 1024;
+    return (uint32_t)size;
+}
+
+static CacheLevel *find_cache(Topology *topo, int level, const char *type) {
+    for (int i = 0; i < topo->num_caches; i++) {
+        if (topo->caches[i].level == level && strcmp(topo->caches[i].type, type) == 0) {
+            return &topo->caches[i];
+        }
+    }
+    return NULL;
+}
+
+// Every cache instance is counted once, from the lowest CPU that shares
+// it, so hybrid parts with differently shared L2s still add up.
+static void read_caches(Topology *topo, int cpu) {
+    char dir[TOPOLOGY_PATH_LENGTH], path[TOPOLOGY_PATH_LENGTH + 32];
+    char type[16], shared[BUFFER_SIZE];
+    int indices[MAX_CACHE_INDEX];
+
+    snprintf(dir, sizeof(dir), CPU_SYSFS "/cpu%d/cache", cpu);
+    int count = list_numbered(dir, "index", "", indices, MAX_CACHE_INDEX);
+    for (int i = 0; i < count; i++) {
+        snprintf(path, sizeof(path), "%s/index%d/level", dir, indices[i]);
+        int level = read_file_int(path, -1);
+        snprintf(path, sizeof(path), "%s/index%d/type", dir, indices[i]);
+        if (level < 0 || !read_file_line(path, type, sizeof(type))) continue;
+        snprintf(path, sizeof(path), "%s/index%d/shared_cpu_list", dir, indices[i]);
+        if (!read_file_line(path, shared, sizeof(shared))) continue;
+        if (level == 3) topo->l3[cpu] = atoi(shared);
+        if (atoi(shared) != cpu) continue;
+
+        CacheLevel *cache = find_cache(topo, level, type);
+        if (!cache) {
+            if (topo->num_caches == MAX_CACHE_LEVELS) continue;
+            cache = &topo->caches[topo->num_caches++];
+            cache->level = level;
+            snprintf(cache->type, sizeof(cache->type), "%s", type);
+            snprintf(path, sizeof(path), "%s/index%d/size", dir, indices[i]);
+            char size[32];
+            if (read_file_line(path, size, sizeof(size))) cache->size_kb = parse_cache_size(size);
+            snprintf(path, sizeof(path), "%s/index%d/coherency_line_size", dir, indices[i]);
+            cache->line_size = (uint32_t)read_file_int(path, 0);
+            snprintf(path, sizeof(path), "%s/index%d/ways_of_associativity", dir, indices[i]);
+            cache->ways = (uint32_t)read_file_int(path, 0);
+            cache->shared_by = cpulist_apply(shared, 0, NULL, 0);
+        }
+        cache->instances++;
+    }
+}
+
+static int compare_cache(const void *a, const void *b) {
+    const CacheLevel *x = a, *y = b;
+    if (x->level != y->level) return x->level - y->level;
+    return strcmp(x->type, y->type);
+}
+
+static void read_nodes(Topology *topo) {
+    char path[TOPOLOGY_PATH_LENGTH], list[BUFFER_SIZE];
+    int nodes[MAX_NODES];
+    int count = list_numbered(NODE_SYSFS, "node", "", nodes, MAX_NODES);
+
+    topo->num_nodes = 1;
+    for (int i = 0; i < count; i++) {
+        if (nodes[i] >= MAX_NODES) continue;
+        snprintf(path, sizeof(path), NODE_SYSFS "/node%d/cpulist", nodes[i]);
+        if (!read_file_line(path, list, sizeof(list))) continue;
+        cpulist_apply(list, topo->capacity, topo->node, nodes[i]);
+        if (nodes[i] + 1 > topo->num_nodes) topo->num_nodes = nodes[i] + 1;
+    }
+    // Kernels without NUMA support have no node directory at all.
+    for (int cpu = 0; cpu < topo->capacity; cpu++) {
+        if (topo->node[cpu] < 0 && topo->package[cpu] >= 0) topo->node[cpu] = 0;
+    }
+}
+
+// Counts distinct (a, b) pairs among CPUs with a known a.
+static int count_distinct(const Topology *topo, const int32_t *a, const int32_t *b) {
+    int count = 0;
+    for (int cpu = 0; cpu < topo->capacity; cpu++) {
+        if (a[cpu] < 0) continue;
+        int seen = 0;
+        for (int other = 0; other < cpu && !seen; other++) {
+            seen = a[other] == a[cpu] && (!b || b[other] == b[cpu]);
+        }
+        count += !seen;
+    }
+    return count;
+}
+
+// Walks sysfs once. Offline CPUs have no topology directory and stay at
+// -1; the result is cached per boot, so --refresh picks up CPUs that were
+// brought online later.
+int collect_topology(Topology *topo, int capacity) {
+    char path[TOPOLOGY_PATH_LENGTH], list[BUFFER_SIZE];
+
+    if (!topology_init(topo, capacity)) return 0;
+
+    for (int cpu = 0; cpu < capacity; cpu++) {
+        snprintf(path, sizeof(path), CPU_SYSFS "/cpu%d/topology/physical_package_id", cpu);
+        topo->package[cpu] = read_file_int(path, -1);
+        if (topo->package[cpu] < 0) continue;
+        snprintf(path, sizeof(path), CPU_SYSFS "/cpu%d/topology/die_id", cpu);
+        topo->die[cpu] = read_file_int(path, 0);
+        snprintf(path, sizeof(path), CPU_SYSFS "/cpu%d/topology/core_id", cpu);
+        topo->core_id[cpu] = read_file_int(path, cpu);
+        snprintf(path, sizeof(path), CPU_SYSFS "/cpu%d/topology/thread_siblings_list", cpu);
+        topo->core[cpu] = read_file_line(path, list, sizeof(list)) ? atoi(list) : cpu;
+        topo->num_threads++;
+        read_caches(topo, cpu);
+    }
+    for (int cpu = 0; cpu < capacity; cpu++) {
+        if (topo->core[cpu] >= capacity) topo->core[cpu] = cpu;
+        topo->num_cores += topo->package[cpu] >= 0 && topo->core[cpu] == cpu;
+    }
+    topo->num_packages = count_distinct(topo, topo->package, NULL);
+    topo->num_dies = count_distinct(topo, topo->package, topo->die);
+    read_nodes(topo);
+    qsort(topo->caches, topo->num_caches, sizeof(CacheLevel), compare_cache);
+    return 1;
+}
+
+// Bytes of scratch space topology_aggregate() needs: a busy and a total
+// counter per physical core, package and node.
+size_t topology_scratch_size(int capacity) {
+    return (2 * (size_t)capacity + 2 * (MAX_PACKAGES + MAX_NODES)) * sizeof(uint64_t);
+}
+
+// Socket, NUMA node and physical core usage from the per-CPU counter
+// deltas of two samples, so no sysfs access happens per sample. scratch
+// must hold topology_scratch_size(topo->capacity) bytes.
+void topology_aggregate(const Topology *topo, SystemInfo *curr, const SystemInfo *prev,
+                        uint64_t *scratch) {
+    const PerCPUStats *c = &curr->cpus;
+    const PerCPUStats *p = &prev->cpus;
+    int n = topo->capacity;
+    if (c->capacity < n) n = c->capacity;
+    if (p->capacity < n) n = p->capacity;
+
+    uint64_t *core_total = scratch;
+    uint64_t *core_busy = core_total + topo->capacity;
+    uint64_t *package_total = core_busy + topo->capacity;
+    uint64_t *package_busy = package_total + MAX_PACKAGES;
+    uint64_t *node_total = package_busy + MAX_PACKAGES;
+    uint64_t *node_busy = node_total + MAX_NODES;
+    memset(scratch, 0, topology_scratch_size(topo->capacity));
+
+    for (int cpu = 0; cpu < n; cpu++) {
+        if (!(c->online[cpu] & p->online[cpu])) continue;
+        uint64_t total = c->total[cpu] - p->total[cpu];
+        uint64_t idle = c->time[CPU_IDLE][cpu] - p->time[CPU_IDLE][cpu];
+        uint64_t busy = total > idle ? total - idle : 0;
+
+        int core = topo->core[cpu];
+        if (core >= 0) {
+            core_total[core] += total;
+            core_busy[core] += busy;
+        }
+        int package = topo->package[cpu];
+        if (package >= 0 && package < MAX_PACKAGES) {
+            package_total[package] += total;
+            package_busy[package] += busy;
+        }
+        int node = topo->node[cpu];
+        if (node >= 0 && node < MAX_NODES) {
+            node_total[node] += total;
+            node_busy[node] += busy;
+        }
+    }
+
+    for (int cpu = 0; cpu < n; cpu++) {
+        c->core_usage[cpu] = core_total[cpu] ? 100.0 * core_busy[cpu] / core_total[cpu] : 0.0;
+    }
+    for (int i = 0; i < MAX_PACKAGES; i++) {
+        curr->package_usage[i] = package_total[i] ? 100.0 * package_busy[i] / package_total[i] : 0.0;
+    }
+    curr->num_nodes = topo->num_nodes;
+    for (int i = 0; i < MAX_NODES; i++) {
+        curr->node_usage[i] = node_total[i] ? 100.0 * node_busy[i] / node_total[i] : 0.0;
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include "hardware_info.h"
+#include <stddef.h>
+
+#define MAX_CACHE_LEVELS 8
+
+typedef struct {
+    int level;
+    char type[16];
+    uint32_t size_kb;
+    uint32_t line_size;
+    uint32_t ways;
+    int instances;
+    int shared_by;
+} CacheLevel;
+
+// Socket/die/core/NUMA layout and cache hierarchy, built once from sysfs
+// and cached per boot together with HardwareInfo. Per-CPU arrays are
+// indexed by logical CPU id and hold -1 for CPUs sysfs knows nothing
+// about. core[cpu] is the lowest CPU id among its SMT siblings, which
+// identifies the physical core without a separate numbering; l3[cpu] is
+// likewise the lowest CPU id sharing its L3 cache.
+struct Topology {
+    int capacity;
+    int num_packages;
+    int num_dies;
+    int num_cores;
+    int num_threads;
+    int num_nodes;
+    int num_caches;
+    CacheLevel caches[MAX_CACHE_LEVELS];
+    int32_t *package;
+    int32_t *die;
+    int32_t *core_id;
+    int32_t *core;
+    int32_t *node;
+    int32_t *l3;
+    void *storage;
+};
+
+int topology_init(Topology *topo, int capacity);
+size_t topology_storage_size(int capacity);
+void topology_free(Topology *topo);
+int collect_topology(Topology *topo, int capacity);
+size_t topology_scratch_size(int capacity);
+void topology_aggregate(const Topology *topo, SystemInfo *curr, const SystemInfo *prev,
+                        uint64_t *scratch);
+
+#endif
@@ -0,0 +1,300 @@
+#define _GNU_SOURCE
+#include "virt.h"
+#include "reader.h"
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#define DOCKER_CHECK "/proc/1/cgroup"
+#define DOCKER_ENV "/.dockerenv"
+#define PODMAN_ENV "/run/.containerenv"
+#define SYSTEMD_CONTAINER "/run/systemd/container"
+#define OPENVZ_CHECK "/proc/vz"
+#define OPENVZ_HOST "/proc/bc"
+#define LXC_CHECK "/proc/1/environ"
+#define XEN_CHECK "/sys/hypervisor/type"
+#define DMI_SYS_VENDOR "/sys/class/dmi/id/sys_vendor"
+#define DMI_PRODUCT_NAME "/sys/class/dmi/id/product_name"
+#define DT_HYPERVISOR "/sys/firmware/devicetree/base/hypervisor/compatible"
+
+typedef struct {
+    const char *pattern;
+    VirtualizationType type;
+} VirtMatch;
+
+// Signatures returned in EBX/ECX/EDX of CPUID leaf 0x40000000.
+static const VirtMatch cpuid_vendors[] = {
+    {"KVMKVMKVM", VIRT_KVM},
+    {"Linux KVM Hv", VIRT_KVM},
+    {"TCGTCGTCGTCG", VIRT_QEMU},
+    {"VMwareVMware", VIRT_VMWARE},
+    {"VBoxVBoxVBox", VIRT_VIRTUALBOX},
+    {"XenVMMXenVMM", VIRT_XEN},
+    {"Microsoft Hv", VIRT_HYPERV},
+    {"prl hyperv  ", VIRT_PARALLELS},
+    {" lrpepyh  vr", VIRT_PARALLELS},
+    {NULL, VIRT_NONE}
+};
+
+static const VirtMatch dmi_vendors[] = {
+    {"VMware", VIRT_VMWARE},
+    {"innotek", VIRT_VIRTUALBOX},
+    {"VirtualBox", VIRT_VIRTUALBOX},
+    {"Xen", VIRT_XEN},
+    {"Microsoft Corporation", VIRT_HYPERV},
+    {"QEMU", VIRT_QEMU},
+    {"Parallels", VIRT_PARALLELS},
+    {"Amazon EC2", VIRT_CLOUD},
+    {"Google", VIRT_CLOUD},
+    {"Azure", VIRT_CLOUD},
+    {NULL, VIRT_NONE}
+};
+
+static const VirtMatch dmi_products[] = {
+    {"KVM", VIRT_KVM},
+    {"VMware", VIRT_VMWARE},
+    {"VirtualBox", VIRT_VIRTUALBOX},
+    {"Parallels", VIRT_PARALLELS},
+    {"HVM domU", VIRT_XEN},
+    {NULL, VIRT_NONE}
+};
+
+static const VirtMatch device_tree[] = {
+    {"linux,kvm", VIRT_KVM},
+    {"xen,xen", VIRT_XEN},
+    {"vmware", VIRT_VMWARE},
+    {NULL, VIRT_NONE}
+};
+
+// Values of the container= variable and of /run/systemd/container.
+static const VirtMatch container_names[] = {
+    {"docker", VIRT_DOCKER},
+    {"podman", VIRT_DOCKER},
+    {"oci", VIRT_DOCKER},
+    {"lxc", VIRT_LXC},
+    {"openvz", VIRT_OPENVZ},
+    {NULL, VIRT_NONE}
+};
+
+static const VirtMatch helper_names[] = {
+    {"kvm", VIRT_KVM},
+    {"qemu", VIRT_QEMU},
+    {"vmware", VIRT_VMWARE},
+    {"oracle", VIRT_VIRTUALBOX},
+    {"virtualbox", VIRT_VIRTUALBOX},
+    {"xen", VIRT_XEN},
+    {"microsoft", VIRT_HYPERV},
+    {"parallels", VIRT_PARALLELS},
+    {"amazon", VIRT_CLOUD},
+    {"google", VIRT_CLOUD},
+    {"docker", VIRT_DOCKER},
+    {"podman", VIRT_DOCKER},
+    {"lxc", VIRT_LXC},
+    {"lxc-libvirt", VIRT_LXC},
+    {"openvz", VIRT_OPENVZ},
+    {NULL, VIRT_NONE}
+};
+
+static VirtualizationType match_substring(const VirtMatch *table, const char *value) {
+    for (int i = 0; table[i].pattern; i++) {
+        if (strstr(value, table[i].pattern)) return table[i].type;
+    }
+    return VIRT_NONE;
+}
+
+static VirtualizationType match_exact(const VirtMatch *table, const char *value) {
+    for (int i = 0; table[i].pattern; i++) {
+        if (strcmp(value, table[i].pattern) == 0) return table[i].type;
+    }
+    return VIRT_NONE;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static void cpuid_vendor(uint32_t leaf, char vendor[13]) {
+    uint32_t eax, ebx, ecx, edx;
+    __cpuid(leaf, eax, ebx, ecx, edx);
+    (void)eax;
+    memcpy(vendor, &ebx, 4);
+    memcpy(vendor + 4, &ecx, 4);
+    memcpy(vendor + 8, &edx, 4);
+    vendor[12] = '\0';
+}
+
+// The hypervisor bit (CPUID.1:ECX[31]) is set by every hypervisor that
+// wants to be detected; the vendor signature then lives in leaf 0x40000000.
+static VirtualizationType detect_cpuid(void) {
+    uint32_t eax, ebx, ecx, edx;
+    char vendor[13];
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & (1u << 31))) {
+        return VIRT_NONE;
+    }
+
+    cpuid_vendor(0x40000000, vendor);
+    VirtualizationType type = match_exact(cpuid_vendors, vendor);
+
+    // KVM guests with Hyper-V enlightenments report the Microsoft
+    // signature first and their own one at 0x40000100.
+    if (type == VIRT_HYPERV) {
+        cpuid_vendor(0x40000100, vendor);
+        if (strcmp(vendor, "KVMKVMKVM") == 0) type = VIRT_KVM;
+    }
+    return type != VIRT_NONE ? type : VIRT_UNKNOWN;
+}
+#else
+static VirtualizationType detect_cpuid(void) {
+    return VIRT_NONE;
+}
+#endif
+
+static VirtualizationType detect_container(void) {
+    char buffer[BUFFER_SIZE];
+    ssize_t n;
+
+    if (read_file_line(SYSTEMD_CONTAINER, buffer, sizeof(buffer))) {
+        VirtualizationType type = match_exact(container_names, buffer);
+        if (type != VIRT_NONE) return type;
+    }
+
+    if (file_exists(DOCKER_ENV) || file_exists(PODMAN_ENV)) return VIRT_DOCKER;
+
+    if (read_file(DOCKER_CHECK, buffer, sizeof(buffer)) > 0) {
+        if (strstr(buffer, "docker")) return VIRT_DOCKER;
+        if (strstr(buffer, "/lxc/")) return VIRT_LXC;
+    }
+
+    // The environment block is NUL-separated, so scan every variable.
+    n = read_file(LXC_CHECK, buffer, sizeof(buffer));
+    for (ssize_t off = 0; off < n; off += strlen(buffer + off) + 1) {
+        if (strncmp(buffer + off, "container=", 10) == 0) {
+            VirtualizationType type = match_exact(container_names, buffer + off + 10);
+            if (type != VIRT_NONE) return type;
+        }
+    }
+
+    // /proc/vz exists on OpenVZ hosts too; only containers lack /proc/bc.
+    if (file_exists(OPENVZ_CHECK) && !file_exists(OPENVZ_HOST)) return VIRT_OPENVZ;
+
+    return VIRT_NONE;
+}
+
+static VirtualizationType detect_firmware(void) {
+    char buffer[BUFFER_SIZE];
+    VirtualizationType type;
+
+    // ARM guests describe the hypervisor in the device tree.
+    if (read_file(DT_HYPERVISOR, buffer, sizeof(buffer)) > 0) {
+        type = match_substring(device_tree, buffer);
+        if (type != VIRT_NONE) return type;
+    }
+
+    if (read_file_line(DMI_SYS_VENDOR, buffer, sizeof(buffer))) {
+        type = match_substring(dmi_vendors, buffer);
+        if (type != VIRT_NONE) return type;
+    }
+
+    if (read_file_line(DMI_PRODUCT_NAME, buffer, sizeof(buffer))) {
+        type = match_substring(dmi_products, buffer);
+        if (type != VIRT_NONE) return type;
+    }
+
+    if (read_file_line(XEN_CHECK, buffer, sizeof(buffer)) && strcmp(buffer, "xen") == 0) {
+        return VIRT_XEN;
+    }
+
+    return VIRT_NONE;
+}
+
+// Runs on a probe worker, which blocks SIGINT and SIGTERM; the helper gets
+// an empty mask so that it can still be interrupted or stopped, which
+// popen() would not allow.
+static VirtualizationType detect_helper(void) {
+    char buffer[BUFFER_SIZE];
+    char *const argv[] = {"systemd-detect-virt", NULL};
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t none;
+    int pipefd[2];
+    pid_t pid;
+
+    if (pipe2(pipefd, O_CLOEXEC) != 0) return VIRT_NONE;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, pipefd[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawnattr_init(&attr);
+    sigemptyset(&none);
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+    int err = posix_spawnp(&pid, argv[0], &actions, &attr, argv, environ);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    close(pipefd[1]);
+    if (err != 0) {
+        close(pipefd[0]);
+        return VIRT_NONE;
+    }
+
+    size_t len = 0;
+    while (len < sizeof(buffer) - 1) {
+        ssize_t n = read(pipefd[0], buffer + len, sizeof(buffer) - 1 - len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        len += n;
+    }
+    close(pipefd[0]);
+    while (waitpid(pid, NULL, 0) < 0 && errno == EINTR)
+        ;
+    buffer[len] = '\0';
+    buffer[strcspn(buffer, "\n")] = '\0';
+    return match_exact(helper_names, buffer);
+}
+
+// Containers are reported ahead of the hypervisor underneath them, which
+// is what systemd-detect-virt does as well.
+VirtualizationType detect_virtualization(const Cpuinfo *cpuinfo, int use_helper) {
+    char buffer[BUFFER_SIZE];
+    VirtualizationType type;
+
+    type = detect_container();
+    if (type != VIRT_NONE) return type;
+
+    // CPUID and systemd-detect-virt describe the machine we run on, not
+    // a tree under a sysroot.
+    VirtualizationType cpu_type = sysroot_active() ? VIRT_NONE : detect_cpuid();
+    VirtualizationType fw_type = detect_firmware();
+
+    // Public clouds run on KVM or Xen; DMI tells which provider it is.
+    if (fw_type == VIRT_CLOUD) return VIRT_CLOUD;
+    if (cpu_type != VIRT_NONE && cpu_type != VIRT_UNKNOWN) return cpu_type;
+    if (fw_type != VIRT_NONE) return fw_type;
+
+    if (cpuinfo_copy(cpuinfo, "model name", buffer, sizeof(buffer))) {
+        if (strstr(buffer, "QEMU Virtual CPU")) return VIRT_QEMU;
+        if (strstr(buffer, "VMware")) return VIRT_VMWARE;
+        if (strstr(buffer, "VirtualBox")) return VIRT_VIRTUALBOX;
+        if (strstr(buffer, "Xen")) return VIRT_XEN;
+    }
+
+    if (cpu_type == VIRT_UNKNOWN || cpuinfo_has_flag(cpuinfo, "hypervisor")) {
+        type = VIRT_UNKNOWN;
+    }
+
+    // Spawning systemd-detect-virt costs a fork and two execs, so it is
+    // only consulted on request and only when the native probes are unsure.
+    if (use_helper && !sysroot_active() && (type == VIRT_NONE || type == VIRT_UNKNOWN)) {
+        VirtualizationType helper = detect_helper();
+        if (helper != VIRT_NONE) return helper;
+    }
+
+    return type;
+}
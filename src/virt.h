@@ -0,0 +1,9 @@
+#ifndef VIRT_H
+#define VIRT_H
+
+#include "hardware_info.h"
+#include "cpuinfo.h"
+
+VirtualizationType detect_virtualization(const Cpuinfo *cpuinfo, int use_helper);
+
+#endif
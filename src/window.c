@@ -0,0 +1,123 @@
+#include "window.h"
+#include "cpustat.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define NSEC_PER_MSEC 1000000ULL
+#define ENTRY_IDLE 0
+#define ENTRY_TOTAL 1
+#define ENTRY_ARRAYS 2
+
+// Per-CPU counter array a (ENTRY_IDLE or ENTRY_TOTAL) of entry slot.
+static uint64_t *entry_counters(const WindowRing *ring, int slot, int a) {
+    return ring->counters + ((size_t)slot * ENTRY_ARRAYS + a) * ring->capacity;
+}
+
+// Enough entries to reach back over the longest window at the given
+// sampling interval, plus the sample the window starts from.
+int window_ring_depth(const unsigned *window_ms, int count, unsigned interval_ms) {
+    unsigned longest = 0;
+    for (int i = 0; i < count; i++) {
+        if (window_ms[i] > longest) longest = window_ms[i];
+    }
+    if (interval_ms == 0) interval_ms = 1;
+    unsigned long depth = longest / interval_ms + 2;
+    return depth > MAX_WINDOW_DEPTH ? MAX_WINDOW_DEPTH : (int)depth;
+}
+
+int window_ring_init(WindowRing *ring, const unsigned *window_ms, int count, int depth,
+                     int capacity) {
+    memset(ring, 0, sizeof(*ring));
+    if (count > MAX_USAGE_WINDOWS) count = MAX_USAGE_WINDOWS;
+    if (depth < 2) depth = 2;
+
+    ring->depth = depth;
+    ring->capacity = capacity;
+    ring->timestamps = calloc(depth, sizeof(uint64_t));
+    ring->totals = calloc(depth, sizeof(CPUStats));
+    ring->counters = calloc((size_t)depth * ENTRY_ARRAYS * capacity, sizeof(uint64_t));
+    ring->online = calloc((size_t)depth * capacity, 1);
+    if (!ring->timestamps || !ring->totals || !ring->counters || !ring->online) {
+        window_ring_free(ring);
+        return 0;
+    }
+
+    for (int w = 0; w < count; w++) {
+        UsageWindow *window = &ring->results.window[w];
+        window->window_ms = window_ms[w];
+        window->core_usage = calloc(capacity, sizeof(double));
+        if (!window->core_usage) {
+            window_ring_free(ring);
+            return 0;
+        }
+        ring->results.count++;
+    }
+    return 1;
+}
+
+// Newest entry that is at least window_ms old, or the oldest one while
+// the ring has not reached back that far yet. Returns -1 when empty.
+static int find_start(const WindowRing *ring, uint64_t now_ns, unsigned window_ms) {
+    uint64_t window_ns = window_ms * NSEC_PER_MSEC;
+    int oldest = -1;
+
+    for (int age = 0; age < ring->filled; age++) {
+        int slot = (ring->head - 1 - age + ring->depth) % ring->depth;
+        oldest = slot;
+        if (now_ns - ring->timestamps[slot] >= window_ns) return slot;
+    }
+    return oldest;
+}
+
+static void compute_window(const WindowRing *ring, UsageWindow *window, int start,
+                           const SystemInfo *info, uint64_t now_ns) {
+    const PerCPUStats *curr = &info->cpus;
+    const uint64_t *restrict prev_total = entry_counters(ring, start, ENTRY_TOTAL);
+    const uint64_t *restrict prev_idle = entry_counters(ring, start, ENTRY_IDLE);
+    const uint8_t *restrict prev_online = ring->online + (size_t)start * ring->capacity;
+    double *restrict usage = window->core_usage;
+    int n = ring->capacity < curr->capacity ? ring->capacity : curr->capacity;
+
+    window->span_ns = now_ns - ring->timestamps[start];
+    window->usage = calculate_cpu_usage(&ring->totals[start], &info->total_stats);
+    calculate_state_usage(&ring->totals[start], &info->total_stats, window->states);
+    for (int i = 0; i < n; i++) {
+        double total_diff = (double)(curr->total[i] - prev_total[i]);
+        double idle_diff = (double)(curr->time[CPU_IDLE][i] - prev_idle[i]);
+        double valid = (double)(curr->online[i] & prev_online[i]) * (total_diff > 0.0);
+        double divisor = total_diff > 0.0 ? total_diff : 1.0;
+        usage[i] = valid * 100.0 * (1.0 - idle_diff / divisor);
+    }
+}
+
+// Answers every window against the ring, then records the new sample.
+void window_ring_update(WindowRing *ring, const SystemInfo *info, uint64_t now_ns) {
+    for (int w = 0; w < ring->results.count; w++) {
+        UsageWindow *window = &ring->results.window[w];
+        int start = find_start(ring, now_ns, window->window_ms);
+        if (start < 0) {
+            window->span_ns = 0;
+            continue;
+        }
+        compute_window(ring, window, start, info, now_ns);
+    }
+
+    int n = ring->capacity < info->cpus.capacity ? ring->capacity : info->cpus.capacity;
+    size_t u64_bytes = n * sizeof(uint64_t);
+    memcpy(entry_counters(ring, ring->head, ENTRY_IDLE), info->cpus.time[CPU_IDLE], u64_bytes);
+    memcpy(entry_counters(ring, ring->head, ENTRY_TOTAL), info->cpus.total, u64_bytes);
+    memcpy(ring->online + (size_t)ring->head * ring->capacity, info->cpus.online, n);
+    ring->totals[ring->head] = info->total_stats;
+    ring->timestamps[ring->head] = now_ns;
+    ring->head = (ring->head + 1) % ring->depth;
+    if (ring->filled < ring->depth) ring->filled++;
+}
+
+void window_ring_free(WindowRing *ring) {
+    for (int w = 0; w < ring->results.count; w++) free(ring->results.window[w].core_usage);
+    free(ring->timestamps);
+    free(ring->totals);
+    free(ring->counters);
+    free(ring->online);
+    memset(ring, 0, sizeof(*ring));
+}
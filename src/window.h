@@ -0,0 +1,48 @@
+#ifndef WINDOW_H
+#define WINDOW_H
+
+#include "hardware_info.h"
+
+#define MAX_USAGE_WINDOWS 8
+#define MAX_WINDOW_DEPTH 4096
+
+// Usage over a trailing window, measured from the ring entry closest to
+// window_ms before the latest sample. span_ns is the time actually
+// covered: shorter than the window until the ring has filled, and never
+// shorter than one sampling interval. span_ns == 0 means no data yet.
+typedef struct {
+    unsigned window_ms;
+    uint64_t span_ns;
+    double usage;
+    double states[CPU_STATE_COUNT];
+    double *core_usage;
+} UsageWindow;
+
+struct UsageWindows {
+    int count;
+    UsageWindow window[MAX_USAGE_WINDOWS];
+};
+
+// A ring of past counter snapshots, so that any number of windows can be
+// answered from one sampling stream without re-reading /proc/stat. Each
+// entry keeps the aggregate CPUStats with every state, and per CPU only
+// what usage needs: the idle and total counters and the online mask.
+typedef struct {
+    int depth;
+    int capacity;
+    int head;
+    int filled;
+    uint64_t *timestamps;
+    CPUStats *totals;
+    uint64_t *counters;
+    uint8_t *online;
+    UsageWindows results;
+} WindowRing;
+
+int window_ring_init(WindowRing *ring, const unsigned *window_ms, int count, int depth,
+                     int capacity);
+int window_ring_depth(const unsigned *window_ms, int count, unsigned interval_ms);
+void window_ring_update(WindowRing *ring, const SystemInfo *info, uint64_t now_ns);
+void window_ring_free(WindowRing *ring);
+
+#endif
@@ -0,0 +1,449 @@
+#include "hardware_info.h"
+#include "collector.h"
+#include "cpustat.h"
+#include "meminfo.h"
+#include "psi.h"
+#include "topology.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Runs every collector against the fixture trees many times and reports
+// the time and the number of system calls per run. Either is compared
+// with a baseline, and a collector that makes more calls than before, or
+// is slower by more than the threshold, fails the run.
+//
+// usage: bench [--iterations=<n>] [--baseline=<file>]... [--save=<file>]
+//              [--threshold=<percent>] <fixture-dir>
+//
+// A baseline has one "<fixture> <collector> <ns/op> <syscalls/op>" line
+// per measurement; "-" leaves a column unchecked. Later files override
+// earlier ones, so machine-specific timings can be layered over the
+// checked-in syscall counts.
+
+#define DEFAULT_ITERATIONS 2000
+#define DEFAULT_THRESHOLD 25.0
+// Iterations are split into rounds and the fastest round is reported,
+// which keeps a burst of unrelated load from reading as a regression.
+#define ROUNDS 5
+#define MAX_BASELINE 256
+#define NAME_MAX_LEN 32
+// The cpufreq and process collectors size how many descriptors they keep
+// open from RLIMIT_NOFILE, so the limit is pinned to keep syscall counts
+// comparable between machines.
+#define BENCH_NOFILE 16384
+
+// System calls are counted in wrappers that the linker puts in front of
+// the libc functions (-Wl,--wrap=<name>), so only calls made by the
+// collectors themselves are seen. Calls that libc makes on its own behalf
+// are estimated: opendir() is an openat and an fstat, readdir() one
+// getdents64 when it first fills its buffer and one more that finds the
+// end, which is exact for the directories small enough to fit in one
+// buffer, and realpath() a readlink per path component. The static
+// probes run on two threads at once.
+static _Atomic unsigned long syscalls;
+static __thread DIR *unread_dir;
+
+int __real_open(const char *path, int flags, ...);
+int __real_openat(int dirfd, const char *path, int flags, ...);
+ssize_t __real_read(int fd, void *buf, size_t count);
+ssize_t __real_pread(int fd, void *buf, size_t count, off_t offset);
+int __real_close(int fd);
+int __real_access(const char *path, int mode);
+ssize_t __real_readlink(const char *path, char *buf, size_t size);
+int __real_fstat(int fd, struct stat *st);
+off_t __real_lseek(int fd, off_t offset, int whence);
+long __real_syscall(long number, ...);
+DIR *__real_opendir(const char *path);
+struct dirent *__real_readdir(DIR *dir);
+int __real_closedir(DIR *dir);
+char *__real_realpath(const char *path, char *resolved);
+
+int __wrap_open(const char *path, int flags, ...) {
+    mode_t mode = 0;
+    if (flags & O_CREAT) {
+        va_list ap;
+        va_start(ap, flags);
+        mode = va_arg(ap, mode_t);
+        va_end(ap);
+    }
+    syscalls++;
+    return __real_open(path, flags, mode);
+}
+
+int __wrap_openat(int dirfd, const char *path, int flags, ...) {
+    mode_t mode = 0;
+    if (flags & O_CREAT) {
+        va_list ap;
+        va_start(ap, flags);
+        mode = va_arg(ap, mode_t);
+        va_end(ap);
+    }
+    syscalls++;
+    return __real_openat(dirfd, path, flags, mode);
+}
+
+ssize_t __wrap_read(int fd, void *buf, size_t count) {
+    syscalls++;
+    return __real_read(fd, buf, count);
+}
+
+ssize_t __wrap_pread(int fd, void *buf, size_t count, off_t offset) {
+    syscalls++;
+    return __real_pread(fd, buf, count, offset);
+}
+
+int __wrap_close(int fd) {
+    syscalls++;
+    return __real_close(fd);
+}
+
+int __wrap_access(const char *path, int mode) {
+    syscalls++;
+    return __real_access(path, mode);
+}
+
+ssize_t __wrap_readlink(const char *path, char *buf, size_t size) {
+    syscalls++;
+    return __real_readlink(path, buf, size);
+}
+
+int __wrap_fstat(int fd, struct stat *st) {
+    syscalls++;
+    return __real_fstat(fd, st);
+}
+
+off_t __wrap_lseek(int fd, off_t offset, int whence) {
+    syscalls++;
+    return __real_lseek(fd, offset, whence);
+}
+
+long __wrap_syscall(long number, ...) {
+    va_list ap;
+    long arg[6];
+
+    va_start(ap, number);
+    for (int i = 0; i < 6; i++) arg[i] = va_arg(ap, long);
+    va_end(ap);
+    syscalls++;
+    return __real_syscall(number, arg[0], arg[1], arg[2], arg[3], arg[4], arg[5]);
+}
+
+DIR *__wrap_opendir(const char *path) {
+    syscalls += 2;
+    unread_dir = __real_opendir(path);
+    return unread_dir;
+}
+
+struct dirent *__wrap_readdir(DIR *dir) {
+    struct dirent *entry = __real_readdir(dir);
+    if (dir == unread_dir || !entry) syscalls++;
+    if (dir == unread_dir) unread_dir = NULL;
+    return entry;
+}
+
+int __wrap_closedir(DIR *dir) {
+    syscalls++;
+    if (dir == unread_dir) unread_dir = NULL;
+    return __real_closedir(dir);
+}
+
+char *__wrap_realpath(const char *path, char *resolved) {
+    for (const char *p = path; *p; p++) syscalls += *p == '/' && p[1] && p[1] != '/';
+    return __real_realpath(path, resolved);
+}
+
+// Everything a collector needs between runs. The collectors read and
+// write the samples through curr and prev, which "sample" swaps after
+// every run as main.c does.
+typedef struct {
+    int capacity;
+    Collector collector;
+    Topology topology;
+    HardwareInfo hardware;
+    SystemInfo samples[2];
+    SystemInfo *curr;
+    SystemInfo *prev;
+} Bench;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void run_hardware(Bench *b) {
+    collect_hardware_info(&b->hardware);
+}
+
+static void run_topology(Bench *b) {
+    topology_free(&b->topology);
+    collect_topology(&b->topology, b->capacity);
+}
+
+static void run_stat(Bench *b) {
+    ssize_t len = cached_file_read(&b->collector.proc_stat, b->collector.stat_buf, PROC_STAT_SIZE);
+    if (len > 0) parse_proc_stat(b->collector.stat_buf, len, &b->curr->total_stats, &b->curr->cpus);
+}
+
+static void run_meminfo(Bench *b) {
+    ssize_t len = cached_file_read(&b->collector.proc_meminfo, b->collector.meminfo_buf, PROC_MEMINFO_SIZE);
+    if (len > 0) parse_meminfo(b->collector.meminfo_buf, len, &b->curr->memory);
+}
+
+static void run_sensors(Bench *b) {
+    sensors_read(&b->collector.sensors, b->curr);
+}
+
+static void run_cpufreq(Bench *b) {
+    cpufreq_sample(&b->collector.cpufreq, b->curr);
+}
+
+static void run_pressure(Bench *b) {
+    read_pressure(b->collector.pressure, &b->curr->pressure);
+}
+
+static void run_disks(Bench *b) {
+    collect_disks(&b->collector.io, b->curr, b->prev);
+}
+
+static void run_network(Bench *b) {
+    collect_net_devices(&b->collector.io, b->curr, b->prev);
+}
+
+static void run_cgroup(Bench *b) {
+    cgroup_sample(&b->collector.cgroup, &b->curr->cgroup, &b->prev->cgroup, b->curr->num_cores);
+}
+
+static void run_processes(Bench *b) {
+    process_scan(b->collector.processes, now_ns());
+}
+
+static void run_sample(Bench *b) {
+    SystemInfo *tmp = b->prev;
+    b->prev = b->curr;
+    b->curr = tmp;
+    collector_sample(&b->collector, b->curr, b->prev);
+}
+
+// One-shot collectors and the process scan, which is proportional to the
+// number of processes, run a fraction of the iterations.
+static const struct {
+    const char *name;
+    void (*run)(Bench *b);
+    int divisor;
+} collectors[] = {
+    {"hardware", run_hardware, 20},
+    {"topology", run_topology, 20},
+    {"stat", run_stat, 1},
+    {"meminfo", run_meminfo, 1},
+    {"sensors", run_sensors, 1},
+    {"cpufreq", run_cpufreq, 1},
+    {"pressure", run_pressure, 1},
+    {"disks", run_disks, 1},
+    {"network", run_network, 1},
+    {"cgroup", run_cgroup, 1},
+    {"processes", run_processes, 10},
+    {"sample", run_sample, 10},
+};
+
+static const char *const fixtures[] = {"laptop", "server", "kvm", "docker", "rpi"};
+
+typedef struct {
+    char fixture[NAME_MAX_LEN];
+    char collector[NAME_MAX_LEN];
+    double ns;
+    double syscalls;
+} BaselineEntry;
+
+static BaselineEntry baseline[MAX_BASELINE];
+static int baseline_count;
+
+static BaselineEntry *find_baseline(const char *fixture, const char *collector, int create) {
+    for (int i = 0; i < baseline_count; i++) {
+        if (strcmp(baseline[i].fixture, fixture) == 0 && strcmp(baseline[i].collector, collector) == 0) {
+            return &baseline[i];
+        }
+    }
+    if (!create || baseline_count == MAX_BASELINE) return NULL;
+    BaselineEntry *e = &baseline[baseline_count++];
+    snprintf(e->fixture, sizeof(e->fixture), "%s", fixture);
+    snprintf(e->collector, sizeof(e->collector), "%s", collector);
+    e->ns = e->syscalls = -1.0;
+    return e;
+}
+
+static int load_baseline(const char *path) {
+    char line[BUFFER_SIZE];
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        perror(path);
+        return 0;
+    }
+    int lineno = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        char fixture[NAME_MAX_LEN], collector[NAME_MAX_LEN], ns[32], calls[32];
+        lineno++;
+        if (line[0] == '#' || line[strspn(line, " \t\n")] == '\0') continue;
+        if (sscanf(line, "%31s %31s %31s %31s", fixture, collector, ns, calls) != 4) {
+            fprintf(stderr, "%s:%d: expected <fixture> <collector> <ns/op> <syscalls/op>\n", path, lineno);
+            fclose(fp);
+            return 0;
+        }
+        BaselineEntry *e = find_baseline(fixture, collector, 1);
+        if (!e) break;
+        if (strcmp(ns, "-") != 0) e->ns = strtod(ns, NULL);
+        if (strcmp(calls, "-") != 0) e->syscalls = strtod(calls, NULL);
+    }
+    fclose(fp);
+    return 1;
+}
+
+static void pin_nofile(void) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0) return;
+    if (limit.rlim_max != RLIM_INFINITY && limit.rlim_max < BENCH_NOFILE) {
+        fprintf(stderr, "warning: descriptor limit %llu is below %d, syscall counts will differ\n",
+                (unsigned long long)limit.rlim_max, BENCH_NOFILE);
+        limit.rlim_cur = limit.rlim_max;
+    } else {
+        limit.rlim_cur = BENCH_NOFILE;
+    }
+    setrlimit(RLIMIT_NOFILE, &limit);
+}
+
+static int bench_open(Bench *b, const char *root) {
+    memset(b, 0, sizeof(*b));
+    if (!set_sysroot(root)) return 0;
+    b->capacity = possible_cpu_count();
+    if (!collector_init(&b->collector) || !collector_set_top(&b->collector, 10) ||
+        !system_info_init_capacity(&b->samples[0], b->capacity) ||
+        !system_info_init_capacity(&b->samples[1], b->capacity)) {
+        return 0;
+    }
+    collect_topology(&b->topology, b->capacity);
+    b->curr = &b->samples[0];
+    b->prev = &b->samples[1];
+    b->curr->topology = b->prev->topology = &b->topology;
+    // Two samples, so that every collector starts from a warm state with
+    // deltas to compute.
+    collector_sample(&b->collector, b->prev, NULL);
+    collector_sample(&b->collector, b->curr, b->prev);
+    return 1;
+}
+
+static void bench_close(Bench *b) {
+    collector_free(&b->collector);
+    topology_free(&b->topology);
+    system_info_free(&b->samples[0]);
+    system_info_free(&b->samples[1]);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [--iterations=<n>] [--baseline=<file>]... [--save=<file>]\n"
+            "          [--threshold=<percent>] <fixture-dir>\n",
+            prog);
+}
+
+int main(int argc, char *argv[]) {
+    int iterations = DEFAULT_ITERATIONS;
+    double threshold = DEFAULT_THRESHOLD;
+    const char *save_path = NULL;
+    const char *dir = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--iterations=", 13) == 0) {
+            iterations = atoi(argv[i] + 13);
+        } else if (strncmp(argv[i], "--baseline=", 11) == 0) {
+            if (!load_baseline(argv[i] + 11)) return 2;
+        } else if (strncmp(argv[i], "--save=", 7) == 0) {
+            save_path = argv[i] + 7;
+        } else if (strncmp(argv[i], "--threshold=", 12) == 0) {
+            threshold = strtod(argv[i] + 12, NULL);
+        } else if (!dir && argv[i][0] != '-') {
+            dir = argv[i];
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (!dir || iterations <= 0 || threshold < 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    FILE *save = NULL;
+    if (save_path) {
+        save = fopen(save_path, "w");
+        if (!save) {
+            perror(save_path);
+            return 2;
+        }
+        fprintf(save, "# fixture collector ns/op syscalls/op, %d iterations\n", iterations);
+    }
+
+    pin_nofile();
+    int regressions = 0;
+    printf("%-8s %-10s %12s %12s  %s\n", "fixture", "collector", "ns/op", "syscalls/op", "baseline");
+    for (size_t f = 0; f < sizeof(fixtures) / sizeof(fixtures[0]); f++) {
+        char root[BUFFER_SIZE];
+        Bench *b = malloc(sizeof(Bench));
+        snprintf(root, sizeof(root), "%s/%s", dir, fixtures[f]);
+        if (!b || !bench_open(b, root)) {
+            fprintf(stderr, "%s: cannot collect from %s\n", fixtures[f], root);
+            return 2;
+        }
+
+        for (size_t c = 0; c < sizeof(collectors) / sizeof(collectors[0]); c++) {
+            int n = iterations / collectors[c].divisor / ROUNDS;
+            if (n == 0) n = 1;
+            collectors[c].run(b);
+
+            syscalls = 0;
+            double ns = 0.0;
+            for (int r = 0; r < ROUNDS; r++) {
+                uint64_t start = now_ns();
+                for (int i = 0; i < n; i++) collectors[c].run(b);
+                double round_ns = (double)(now_ns() - start) / n;
+                if (r == 0 || round_ns < ns) ns = round_ns;
+            }
+            double calls = (double)syscalls / ((double)n * ROUNDS);
+
+            const BaselineEntry *e = find_baseline(fixtures[f], collectors[c].name, 0);
+            char verdict[64] = "-";
+            if (e) {
+                int slower = e->ns >= 0 && ns > e->ns * (1.0 + threshold / 100.0);
+                int more_calls = e->syscalls >= 0 && calls > e->syscalls + 0.005;
+                if (more_calls) {
+                    snprintf(verdict, sizeof(verdict), "REGRESSED: %.2f syscalls/op", e->syscalls);
+                } else if (slower) {
+                    snprintf(verdict, sizeof(verdict), "REGRESSED: %.0f ns/op (+%.0f%%)", e->ns,
+                             (ns / e->ns - 1.0) * 100.0);
+                } else {
+                    snprintf(verdict, sizeof(verdict), "ok");
+                }
+                regressions += slower || more_calls;
+            }
+            printf("%-8s %-10s %12.0f %12.2f  %s\n", fixtures[f], collectors[c].name, ns, calls, verdict);
+            if (save) fprintf(save, "%s %s %.0f %.2f\n", fixtures[f], collectors[c].name, ns, calls);
+        }
+        bench_close(b);
+        free(b);
+    }
+    set_sysroot(NULL);
+
+    if (save && fclose(save) != 0) {
+        perror(save_path);
+        return 2;
+    }
+    if (regressions) printf("%d regression%s beyond the baseline\n", regressions, regressions == 1 ? "" : "s");
+    return regressions ? 1 : 0;
+}
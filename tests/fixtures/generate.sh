@@ -0,0 +1,424 @@
+#!/bin/sh
+# Builds the fixture trees that `make test` and `make bench` read through
+# --sysroot: a 4-core laptop, a 384-CPU dual-socket server, a KVM guest,
+# a Docker container and a Raspberry Pi. Each tree has the layout of
+# /proc and /sys as captured on that kind of machine, trimmed to the
+# files the collectors read. They are generated rather than checked in
+# because the server alone is some 17,000 files.
+#
+# usage: generate.sh <output-dir>
+set -eu
+
+out=${1:?usage: generate.sh <output-dir>}
+rm -rf "$out"
+mkdir -p "$out"
+
+# put <file> <line>...: writes one line per argument; the directory must
+# exist. Everything here is a shell builtin so that the server's tree is
+# written without forking per file.
+put() {
+    file=$1
+    shift
+    printf '%s\n' "$@" > "$file"
+}
+
+# Sets range to "a-b", or "a-b,c-d" with the SMT siblings of cores a-b,
+# without a subshell.
+cpu_range() {
+    if [ "$smt" -eq 2 ]; then
+        range="$1-$2,$(($1 + threads))-$(($2 + threads))"
+    else
+        range="$1-$2"
+    fi
+}
+
+# Writes /sys/devices/system/cpu and /proc/stat for $ncpu CPUs on
+# $sockets sockets with $smt threads per core and $l3s L3 caches per
+# socket. Linux numbers the first thread of every core before the second
+# ones, so CPU c and c + ncpu/2 are siblings. Frequency is $khz and the
+# cpuidle states are $idle_states (empty for none).
+cpus() {
+    sys=$root/sys/devices/system/cpu
+    threads=$((ncpu / smt))
+    per_socket=$((threads / sockets))
+    per_l3=$((per_socket / l3s))
+    mkdir -p "$sys" "$root/proc"
+    put "$sys/possible" "0-$((ncpu - 1))"
+    put "$sys/present" "0-$((ncpu - 1))"
+    put "$sys/online" "0-$((ncpu - 1))"
+
+    stat=$root/proc/stat
+    printf 'cpu  %d 120 %d %d 300 0 90 0 0 0\n' $((ncpu * 2000)) $((ncpu * 800)) $((ncpu * 50000)) > "$stat"
+    c=0
+    while [ "$c" -lt "$ncpu" ]; do
+        core=$((c % threads))
+        socket=$((core / per_socket))
+        core_id=$((core % per_socket))
+        l3=$((core_id / per_l3))
+        d=$sys/cpu$c
+        mkdir -p "$d/topology" "$d/cache/index0" "$d/cache/index1" "$d/cache/index2"
+        put "$d/topology/physical_package_id" "$socket"
+        put "$d/topology/die_id" 0
+        put "$d/topology/core_id" "$core_id"
+        siblings=$core
+        [ "$smt" -eq 2 ] && siblings="$core,$((core + threads))"
+        put "$d/topology/thread_siblings_list" "$siblings"
+        first=$((socket * per_socket + l3 * per_l3))
+        cpu_range "$first" $((first + per_l3 - 1))
+        specs="1:Data:$l1d:8:$siblings 1:Instruction:$l1i:8:$siblings 2:Unified:$l2:16:$siblings"
+        [ -n "$l3_size" ] && specs="$specs 3:Unified:$l3_size:16:$range"
+        i=0
+        for spec in $specs; do
+            IFS=:
+            set -- $spec
+            IFS=' 	
+'
+            mkdir -p "$d/cache/index$i"
+            put "$d/cache/index$i/level" "$1"
+            put "$d/cache/index$i/type" "$2"
+            put "$d/cache/index$i/size" "$3"
+            put "$d/cache/index$i/ways_of_associativity" "$4"
+            put "$d/cache/index$i/shared_cpu_list" "$5"
+            put "$d/cache/index$i/coherency_line_size" 64
+            i=$((i + 1))
+        done
+        [ -n "$l3_size" ] && put "$d/cache/index3/id" $((socket * l3s + l3))
+        if [ -n "$khz" ]; then
+            mkdir -p "$d/cpufreq"
+            put "$d/cpufreq/scaling_cur_freq" "$khz"
+        fi
+        s=0
+        for name in $idle_states; do
+            mkdir -p "$d/cpuidle/state$s"
+            put "$d/cpuidle/state$s/name" "$name"
+            put "$d/cpuidle/state$s/time" $(((s + 1) * 1000000 + c))
+            put "$d/cpuidle/state$s/usage" $(((s + 1) * 1000 + c))
+            s=$((s + 1))
+        done
+        printf 'cpu%d %d 2 %d %d 5 0 1 0 0 0\n' "$c" $((2000 + c)) $((800 + c)) 50000 >> "$stat"
+        c=$((c + 1))
+    done
+    printf '%s\n' "intr 1000 0 0" "ctxt 500000" "btime 1760000000" "processes 9000" \
+        "procs_running 2" "procs_blocked 0" "softirq 100 0 0 0 0 0 0 0 0 0 0" >> "$stat"
+}
+
+# One NUMA node per socket, or none at all when $nodes is 0.
+nodes() {
+    n=0
+    while [ "$n" -lt "$nodes" ]; do
+        d=$root/sys/devices/system/node/node$n
+        mkdir -p "$d"
+        cpu_range $((n * per_socket)) $(((n + 1) * per_socket - 1))
+        put "$d/cpulist" "$range"
+        put "$d/meminfo" "Node $n MemTotal:       $((mem_kb / nodes)) kB" \
+            "Node $n MemFree:        $((mem_kb / nodes / 2)) kB" \
+            "Node $n MemUsed:        $((mem_kb / nodes / 2)) kB" \
+            "Node $n FilePages:      $((mem_kb / nodes / 8)) kB" \
+            "Node $n AnonPages:      $((mem_kb / nodes / 4)) kB"
+        n=$((n + 1))
+    done
+    if [ "$nodes" -gt 0 ]; then
+        put "$root/sys/devices/system/node/possible" "0-$((nodes - 1))"
+        put "$root/sys/devices/system/node/online" "0-$((nodes - 1))"
+    fi
+}
+
+meminfo() {
+    put "$root/proc/meminfo" \
+        "MemTotal:       $mem_kb kB" \
+        "MemFree:        $((mem_kb / 2)) kB" \
+        "MemAvailable:   $((mem_kb * 3 / 4)) kB" \
+        "Buffers:        $((mem_kb / 64)) kB" \
+        "Cached:         $((mem_kb / 8)) kB" \
+        "SwapCached:            0 kB" \
+        "Active:         $((mem_kb / 4)) kB" \
+        "Inactive:       $((mem_kb / 8)) kB" \
+        "Active(anon):   $((mem_kb / 8)) kB" \
+        "Inactive(anon):        0 kB" \
+        "Active(file):   $((mem_kb / 8)) kB" \
+        "Inactive(file): $((mem_kb / 8)) kB" \
+        "Unevictable:           0 kB" \
+        "Mlocked:               0 kB" \
+        "SwapTotal:      $swap_kb kB" \
+        "SwapFree:       $swap_kb kB" \
+        "Dirty:               128 kB" \
+        "Writeback:             0 kB" \
+        "AnonPages:      $((mem_kb / 8)) kB" \
+        "Mapped:         $((mem_kb / 32)) kB" \
+        "Shmem:          $((mem_kb / 128)) kB" \
+        "KReclaimable:   $((mem_kb / 64)) kB" \
+        "Slab:           $((mem_kb / 32)) kB" \
+        "SReclaimable:   $((mem_kb / 64)) kB" \
+        "SUnreclaim:     $((mem_kb / 64)) kB" \
+        "KernelStack:       16384 kB" \
+        "PageTables:        32768 kB" \
+        "CommitLimit:    $((mem_kb / 2 + swap_kb)) kB" \
+        "Committed_AS:   $((mem_kb / 4)) kB" \
+        "VmallocTotal:   34359738367 kB" \
+        "VmallocUsed:       65536 kB" \
+        "VmallocChunk:          0 kB" \
+        "Percpu:            $((ncpu * 64)) kB" \
+        "AnonHugePages:         0 kB" \
+        "HugePages_Total:       0" \
+        "HugePages_Free:        0" \
+        "HugePages_Rsvd:        0" \
+        "HugePages_Surp:        0" \
+        "Hugepagesize:       2048 kB" \
+        "Hugetlb:               0 kB" \
+        "DirectMap4k:      262144 kB" \
+        "DirectMap2M:    $((mem_kb / 2)) kB"
+}
+
+pressure() {
+    mkdir -p "$root/proc/pressure"
+    put "$root/proc/pressure/cpu" "some avg10=1.25 avg60=0.80 avg300=0.40 total=123456789" \
+        "full avg10=0.00 avg60=0.00 avg300=0.00 total=0"
+    for r in memory io; do
+        put "$root/proc/pressure/$r" "some avg10=0.10 avg60=0.05 avg300=0.01 total=4567890" \
+            "full avg10=0.05 avg60=0.02 avg300=0.00 total=1234567"
+    done
+}
+
+# disks: whole devices listed in /sys/block, followed by partitions and
+# loop devices, which the collector leaves out.
+disks() {
+    mkdir -p "$root/sys/block"
+    : > "$root/proc/diskstats"
+    minor=0
+    for disk in $disk_names; do
+        mkdir -p "$root/sys/block/$disk"
+        printf '%4d %7d %s 81234 1200 9876543 40210 51234 900 6543210 70123 0 60000 110333\n' \
+            259 "$minor" "$disk" >> "$root/proc/diskstats"
+        printf '%4d %7d %s 1234 0 98765 402 512 0 65432 701 0 600 1103\n' \
+            259 $((minor + 1)) "${disk}p1" >> "$root/proc/diskstats"
+        minor=$((minor + 2))
+    done
+    printf '%4d %7d %s 12 0 96 1 0 0 0 0 0 4 1\n' 7 0 loop0 >> "$root/proc/diskstats"
+}
+
+# network: "name:speed" pairs; a speed of - marks a virtual interface.
+network() {
+    mkdir -p "$root/proc/net"
+    put "$root/proc/net/dev" \
+        "Inter-|   Receive                                                |  Transmit" \
+        " face |bytes    packets errs drop fifo frame compressed multicast|bytes    packets errs drop fifo colls carrier compressed"
+    for spec in $net_devices; do
+        name=${spec%%:*} speed=${spec#*:}
+        printf '%6s: 98765432 87654 0 12 0 0 0 345 12345678 23456 0 0 0 0 0 0\n' "$name" \
+            >> "$root/proc/net/dev"
+        mkdir -p "$root/sys/class/net/$name"
+        if [ "$speed" = - ]; then
+            mkdir -p "$root/sys/devices/virtual/net/$name"
+            put "$root/sys/class/net/$name/speed" -1
+        else
+            put "$root/sys/class/net/$name/speed" "$speed"
+        fi
+    done
+}
+
+# cgroup v2 mounted at /sys/fs/cgroup with this process in $cgroup.
+# $cpu_max and $memory_max are the limits, "max" when unlimited.
+cgroup() {
+    mkdir -p "$root/proc/self"
+    put "$root/proc/self/cgroup" "0::$cgroup"
+    put "$root/proc/self/mountinfo" \
+        "24 1 259:2 / / rw,relatime shared:1 - ext4 /dev/root rw" \
+        "35 24 0:30 / /sys/fs/cgroup rw,nosuid,nodev,noexec,relatime shared:9 - cgroup2 cgroup2 rw,nsdelegate"
+    d=$root/sys/fs/cgroup$cgroup
+    d=${d%/}
+    mkdir -p "$d"
+    put "$d/cpu.stat" "usage_usec 987654321" "user_usec 654321000" "system_usec 333333321" \
+        "nr_periods 4000" "nr_throttled 120" "throttled_usec 5400000"
+    put "$d/cpu.max" "$cpu_max 100000"
+    put "$d/memory.current" 268435456
+    put "$d/memory.max" "$memory_max"
+    put "$d/memory.stat" "anon 134217728" "file 100663296" "kernel 16777216" \
+        "kernel_stack 1048576" "pagetables 2097152" "sock 0" "shmem 4194304" \
+        "file_mapped 33554432" "file_dirty 65536" "file_writeback 0" "slab 8388608" \
+        "active_anon 125829120" "inactive_anon 8388608" "active_file 67108864" \
+        "inactive_file 33554432" "pgfault 1234567" "pgmajfault 321"
+    put "$d/io.stat" "259:0 rbytes=104857600 wbytes=52428800 rios=2500 wios=1200 dbytes=0 dios=0"
+    for r in cpu memory io; do
+        put "$d/$r.pressure" "some avg10=0.50 avg60=0.25 avg300=0.10 total=2345678" \
+            "full avg10=0.00 avg60=0.00 avg300=0.00 total=0"
+    done
+}
+
+# processes: $procs entries in /proc with a few heavy hitters at the
+# low pids.
+processes() {
+    p=1
+    while [ "$p" -le "$procs" ]; do
+        mkdir -p "$root/proc/$p"
+        case $p in
+            1) comm=systemd ;;
+            2) comm=compiler ;;
+            3) comm=database ;;
+            *) comm=worker$p ;;
+        esac
+        put "$root/proc/$p/stat" "$p ($comm) S 1 $p $p 0 -1 4194560 1000 0 0 0 $((p * 7 % 1000 + 10)) $((p % 50)) 0 0 20 0 $((p % 8 + 1)) 0 $((p * 10)) 104857600 $((p * 37 % 50000 + 100)) 18446744073709551615 1 1 0 0 0 0 0 0 0 0 0 0 17 0 0 0 0 0 0 0 0 0 0 0 0 0 0"
+        p=$((p + 1))
+    done
+}
+
+x86_cpuinfo() {
+    c=0
+    : > "$root/proc/cpuinfo"
+    while [ "$c" -lt "$ncpu" ]; do
+        core=$((c % threads))
+        printf '%s\n' "processor	: $c" "vendor_id	: $vendor" "cpu family	: $family" \
+            "model		: $model" "model name	: $model_name" "stepping	: $stepping" \
+            "microcode	: $microcode" "cpu MHz		: $((khz_nominal / 1000)).000" \
+            "physical id	: $((core / per_socket))" "siblings	: $((ncpu / sockets))" \
+            "core id		: $((core % per_socket))" "cpu cores	: $per_socket" \
+            "flags		: $flags" "" >> "$root/proc/cpuinfo"
+        c=$((c + 1))
+    done
+}
+
+dmi() {
+    d=$root/sys/class/dmi/id
+    mkdir -p "$d"
+    put "$d/sys_vendor" "$1"
+    put "$d/product_name" "$2"
+    put "$d/product_uuid" "$3"
+    put "$d/board_serial" "$4"
+    put "$d/bios_vendor" "$5"
+    put "$d/bios_version" "$6"
+}
+
+common() {
+    mkdir -p "$root/proc/sys/kernel/random" "$root/etc"
+    put "$root/proc/sys/kernel/random/boot_id" "4f1c0c1e-6a53-4b8e-9d9a-6a2f3c1d2e3f"
+    meminfo
+    pressure
+    disks
+    network
+    processes
+}
+
+flags_x86="fpu vme de pse tsc msr pae mce cx8 apic sep mtrr pge mca cmov pat pse36 clflush mmx fxsr sse sse2 ht syscall nx pdpe1gb rdtscp lm constant_tsc nopl xtopology nonstop_tsc cpuid aperfmperf pni pclmulqdq ssse3 fma cx16 pcid sse4_1 sse4_2 x2apic movbe popcnt aes xsave avx f16c rdrand lahf_lm abm avx2 bmi1 bmi2 erms"
+
+# 4-core, 8-thread laptop with coretemp, intel_pstate and deep C-states.
+root=$out/laptop
+ncpu=8 sockets=1 smt=2 l3s=1 nodes=1
+l1d=48K l1i=32K l2=1280K l3_size=12288K khz=2400000 idle_states="POLL C1 C6 C10"
+mem_kb=16161748 swap_kb=8388604
+disk_names=nvme0n1 net_devices="lo:- wlp0s20f3:-1 docker0:-"
+cgroup=/user.slice/user-1000.slice/session-2.scope cpu_max=max memory_max=max procs=300
+vendor=GenuineIntel family=6 model=140 stepping=1 microcode=0xa4 khz_nominal=3000000
+model_name="11th Gen Intel(R) Core(TM) i7-1185G7 @ 3.00GHz" flags=$flags_x86
+cpus
+nodes
+x86_cpuinfo
+common
+cgroup
+dmi LENOVO 20XW0055US 5c0a3c2e-1f4b-11b2-a85c-d1c7e6b2a001 L1HF16A02TR LENOVO "N32ET75W (1.51 )"
+put "$root/etc/machine-id" 3f2a6c1d9e8b4a7f8c6d5e4f3a2b1c0d
+h=$root/sys/class/hwmon/hwmon3
+mkdir -p "$h"
+put "$h/name" coretemp
+put "$h/temp1_label" "Package id 0"
+put "$h/temp1_input" 61000
+for n in 0 1 2 3; do
+    put "$h/temp$((n + 2))_label" "Core $n"
+    put "$h/temp$((n + 2))_input" $((52000 + n * 1000))
+done
+mkdir -p "$root/sys/class/hwmon/hwmon0"
+put "$root/sys/class/hwmon/hwmon0/name" ACAD
+
+# Dual-socket AMD EPYC server: 2 x 96 cores with SMT, one L3 per CCD and
+# a k10temp instance per socket reporting every CCD.
+root=$out/server
+ncpu=384 sockets=2 smt=2 l3s=12 nodes=2
+l1d=32K l1i=32K l2=1024K l3_size=32768K khz=2400000 idle_states="POLL C1 C2"
+mem_kb=1584737380 swap_kb=0
+disk_names="nvme0n1 nvme1n1 nvme2n1 nvme3n1" net_devices="lo:- eno1:25000 eno2:25000 bond0:-"
+cgroup=/system.slice/hardware-info.service cpu_max=max memory_max=max procs=2000
+vendor=AuthenticAMD family=25 model=17 stepping=1 microcode=0xa101148 khz_nominal=2400000
+model_name="AMD EPYC 9654 96-Core Processor" flags=$flags_x86
+cpus
+nodes
+x86_cpuinfo
+common
+cgroup
+dmi "Dell Inc." "PowerEdge R7625" 4c4c4544-0051-3510-8052-b7c04f4e3633 .7Q5RC44.CNCMS0035F00HG. \
+    "Dell Inc." 1.6.6
+for s in 0 1; do
+    h=$root/sys/class/hwmon/hwmon$((s + 1))
+    dev=$root/sys/devices/pci0000:$((s * 80))/0000:$((s * 80)):18.3
+    mkdir -p "$h" "$dev"
+    ln -s "../../../devices/pci0000:$((s * 80))/0000:$((s * 80)):18.3" "$h/device"
+    put "$h/name" k10temp
+    put "$h/temp1_label" Tctl
+    put "$h/temp1_input" $((58000 + s * 2000))
+    ccd=1
+    while [ "$ccd" -le 12 ]; do
+        put "$h/temp$((ccd + 2))_label" "Tccd$ccd"
+        put "$h/temp$((ccd + 2))_input" $((40000 + s * 10000 + ccd * 500))
+        ccd=$((ccd + 1))
+    done
+done
+
+# KVM guest on an OpenStack host: 4 vCPUs, haltpoll idle, no sensors and
+# no cpufreq.
+root=$out/kvm
+ncpu=4 sockets=1 smt=1 l3s=1 nodes=1
+l1d=32K l1i=32K l2=4096K l3_size=16384K khz="" idle_states="POLL haltpoll"
+mem_kb=8148532 swap_kb=0
+disk_names=vda net_devices="lo:- eth0:-1"
+cgroup=/system.slice/hardware-info.service cpu_max=max memory_max=max procs=100
+vendor=GenuineIntel family=6 model=85 stepping=7 microcode=0x1 khz_nominal=2992000
+model_name="Intel Xeon Processor (Cascadelake)" flags="$flags_x86 hypervisor"
+cpus
+nodes
+x86_cpuinfo
+common
+cgroup
+dmi "Red Hat" KVM 8d6f1c4a-2b3e-4f5a-9c8d-7e6f5a4b3c2d "" "SeaBIOS" 1.16.0-1.el9
+put "$root/etc/machine-id" 8d6f1c4a2b3e4f5a9c8d7e6f5a4b3c2d
+
+# Docker container on an 8-CPU host, limited to 2 CPUs and 1 GiB.
+root=$out/docker
+ncpu=8 sockets=1 smt=2 l3s=1 nodes=1
+l1d=32K l1i=32K l2=512K l3_size=32768K khz=3600000 idle_states=""
+mem_kb=32768000 swap_kb=2097148
+disk_names=sda net_devices="lo:- eth0:10000"
+cgroup=/ cpu_max=200000 memory_max=1073741824 procs=10
+vendor=AuthenticAMD family=23 model=113 stepping=0 microcode=0x8701021 khz_nominal=3600000
+model_name="AMD Ryzen 7 3700X 8-Core Processor" flags=$flags_x86
+cpus
+nodes
+x86_cpuinfo
+common
+cgroup
+: > "$root/.dockerenv"
+mkdir -p "$root/proc/1"
+put "$root/proc/1/cgroup" "0::/"
+
+# Raspberry Pi 4: four Cortex-A72 cores, no NUMA, no L3 and a single
+# SoC thermal zone.
+root=$out/rpi
+ncpu=4 sockets=1 smt=1 l3s=1 nodes=0
+l1d=32K l1i=48K l2=1024K l3_size="" khz=1500000 idle_states=""
+mem_kb=3884328 swap_kb=102396
+disk_names=mmcblk0 net_devices="lo:- eth0:1000 wlan0:-1"
+cgroup=/user.slice cpu_max=max memory_max=max procs=80
+cpus
+common
+cgroup
+: > "$root/proc/cpuinfo"
+c=0
+while [ "$c" -lt 4 ]; do
+    printf '%s\n' "processor	: $c" "BogoMIPS	: 108.00" \
+        "Features	: fp asimd evtstrm crc32 cpuid" "CPU implementer	: 0x41" \
+        "CPU architecture: 8" "CPU variant	: 0x0" "CPU part	: 0xd08" \
+        "CPU revision	: 3" "" >> "$root/proc/cpuinfo"
+    c=$((c + 1))
+done
+printf '%s\n' "Hardware	: BCM2835" "Revision	: c03114" "Serial		: 10000000abcdef01" \
+    "Model		: Raspberry Pi 4 Model B Rev 1.4" >> "$root/proc/cpuinfo"
+mkdir -p "$root/sys/firmware/devicetree/base" "$root/sys/class/thermal/thermal_zone0"
+printf 'Raspberry Pi 4 Model B Rev 1.4\0' > "$root/sys/firmware/devicetree/base/model"
+put "$root/sys/class/thermal/thermal_zone0/type" cpu-thermal
+put "$root/sys/class/thermal/thermal_zone0/temp" 48300
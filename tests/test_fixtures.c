@@ -0,0 +1,819 @@
+#include "hardware_info.h"
+#include "collector.h"
+#include "cpustat.h"
+#include "fields.h"
+#include "json_writer.h"
+#include "psi.h"
+#include "rollup.h"
+#include "selfstats.h"
+#include "shm.h"
+#include "topology.h"
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+// Runs the collectors against the trees written by fixtures/generate.sh
+// through set_sysroot() and checks what they report for each kind of
+// machine. The first sample of a fixture has no predecessor; the laptop
+// additionally gets a second one after its counters are advanced, which
+// checks the rates derived from the deltas. Last, a DMI attribute of the
+// kvm fixture is replaced by a FIFO nobody writes to, which hangs the
+// probe reading it until its deadline has passed, and the laptop is
+// sampled once more for a few fields only. The server gets fake MSR
+// devices and a low descriptor limit, so that most of them have to be
+// opened for every sample, and a thousand interfaces. The rollups are
+// fed made-up samples, whose buckets are known, and queried directly
+// and over a socket. Finally a shared-memory publisher is started next
+// to a running one and over a crashed one's segment, and the JSON writer
+// is given empty containers and strings that are not UTF-8.
+//
+// usage: test_fixtures <fixture-dir>
+
+static int failures;
+static int checks;
+static const char *fixture;
+
+#define CHECK(cond)                                                                    \
+    do {                                                                               \
+        checks++;                                                                      \
+        if (!(cond)) {                                                                 \
+            fprintf(stderr, "%s:%d: %s: %s\n", __FILE__, __LINE__, fixture, #cond);    \
+            failures++;                                                                \
+        }                                                                              \
+    } while (0)
+
+#define CHECK_STR(actual, expected) CHECK(strcmp((actual), (expected)) == 0)
+#define CHECK_NEAR(actual, expected, tolerance) CHECK(fabs((actual) - (expected)) <= (tolerance))
+
+// One fixture's hardware identity, topology and two samples, collected
+// the way main.c does it.
+typedef struct {
+    char root[BUFFER_SIZE];
+    Collector collector;
+    Topology topology;
+    SystemInfo prev;
+    SystemInfo curr;
+} Snapshot;
+
+static int open_snapshot(Snapshot *s, const char *dir, const char *name) {
+    memset(s, 0, sizeof(*s));
+    snprintf(s->root, sizeof(s->root), "%s/%s", dir, name);
+    fixture = name;
+    if (!set_sysroot(s->root)) {
+        fprintf(stderr, "%s: cannot use %s as the system root\n", name, s->root);
+        return 0;
+    }
+
+    int capacity = possible_cpu_count();
+    if (!collector_init(&s->collector) || !collector_set_top(&s->collector, 5) ||
+        !system_info_init_capacity(&s->prev, capacity) || !system_info_init_capacity(&s->curr, capacity)) {
+        fprintf(stderr, "%s: cannot initialize the collector\n", name);
+        return 0;
+    }
+    collect_hardware_info(&s->curr.hw_info);
+    collect_topology(&s->topology, capacity);
+    s->prev.topology = s->curr.topology = &s->topology;
+    collector_sample(&s->collector, &s->curr, NULL);
+    return 1;
+}
+
+static void sample_again(Snapshot *s) {
+    SystemInfo tmp = s->prev;
+    s->prev = s->curr;
+    s->curr = tmp;
+    s->curr.hw_info = s->prev.hw_info;
+    collector_sample(&s->collector, &s->curr, &s->prev);
+}
+
+static void close_snapshot(Snapshot *s) {
+    collector_free(&s->collector);
+    topology_free(&s->topology);
+    system_info_free(&s->prev);
+    system_info_free(&s->curr);
+}
+
+// Replaces the first occurrence of from with to in the fixture file
+// rel; used to advance counters between two samples and to put them
+// back afterwards.
+static int rewrite(const Snapshot *s, const char *rel, const char *from, const char *to) {
+    char path[BUFFER_SIZE + PATH_MAX];
+    char buf[65536];
+
+    snprintf(path, sizeof(path), "%s/%s", s->root, rel);
+    FILE *fp = fopen(path, "r");
+    if (!fp) return 0;
+    size_t len = fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    buf[len] = '\0';
+
+    char *at = strstr(buf, from);
+    if (!at) return 0;
+    fp = fopen(path, "w");
+    if (!fp) return 0;
+    fwrite(buf, 1, at - buf, fp);
+    fputs(to, fp);
+    fputs(at + strlen(from), fp);
+    return fclose(fp) == 0;
+}
+
+static const NetStats *find_net(const SystemInfo *info, const char *name) {
+    for (int i = 0; i < info->num_net_devices; i++) {
+        if (strcmp(info->net_devices[i].name, name) == 0) return &info->net_devices[i];
+    }
+    return NULL;
+}
+
+static const CacheLevel *find_cache(const Topology *topo, int level, const char *type) {
+    for (int i = 0; i < topo->num_caches; i++) {
+        if (topo->caches[i].level == level && strcmp(topo->caches[i].type, type) == 0) return &topo->caches[i];
+    }
+    return NULL;
+}
+
+static void check_common(const Snapshot *s, int cpus, int procs) {
+    const SystemInfo *info = &s->curr;
+
+    CHECK(info->num_cores == cpus);
+    CHECK(s->topology.num_threads == cpus);
+    CHECK(info->cpus.online[0] && info->cpus.online[cpus - 1]);
+    CHECK(info->memory.present & (1ULL << MEMINFO_MEM_TOTAL));
+    CHECK(info->available_memory == info->total_memory * 3 / 4 / 1024 * 1024);
+    CHECK(info->pressure.present == (1u << (PSI_RESOURCE_COUNT * PSI_KIND_COUNT)) - 1);
+    CHECK_NEAR(info->pressure.line[PSI_CPU][PSI_SOME].avg10, 1.25, 1e-9);
+    CHECK(info->cgroup.available);
+    CHECK(info->cgroup.memory_current == 268435456);
+    CHECK(info->processes && info->processes->total == procs);
+    // The first sample has nothing to take deltas against.
+    CHECK(info->total_usage == 0.0);
+    CHECK(info->cpufreq && !info->cpufreq->idle_valid);
+    CHECK(info->hw_info.timed_out == 0);
+
+    const PhaseStats *stat = info->self_stats ? &info->self_stats->phase[PHASE_STAT] : NULL;
+    CHECK(stat && stat->runs > 0);
+    // The first sample opens /proc/stat and reads it in one go.
+    CHECK(stat && stat->last.files_opened == 1 && stat->last.syscalls == 2 && stat->last.bytes_read > 0);
+    CHECK(stat && phase_percentile(stat, 0.99) >= stat->min_ns && phase_percentile(stat, 0.99) <= stat->max_ns);
+}
+
+static void check_laptop(Snapshot *s) {
+    const HardwareInfo *hw = &s->curr.hw_info;
+    const SystemInfo *info = &s->curr;
+
+    check_common(s, 8, 300);
+    CHECK(!hw->is_virtual);
+    CHECK(!hw->is_arm);
+    CHECK_STR(hw->product_name, "20XW0055US");
+    CHECK_STR(hw->system_uuid, "5c0a3c2e-1f4b-11b2-a85c-d1c7e6b2a001");
+    CHECK_STR(hw->motherboard_serial, "L1HF16A02TR");
+    CHECK_STR(hw->cpu_vendor, "GenuineIntel");
+    CHECK_STR(hw->cpu_model, "11th Gen Intel(R) Core(TM) i7-1185G7 @ 3.00GHz");
+    CHECK(hw->cpu_family == 6 && hw->cpu_microcode == 0xa4);
+
+    CHECK(s->topology.num_packages == 1);
+    CHECK(s->topology.num_cores == 4);
+    CHECK(s->topology.num_nodes == 1);
+    CHECK(s->topology.core[4] == 0);
+    const CacheLevel *l3 = find_cache(&s->topology, 3, "Unified");
+    CHECK(l3 && l3->size_kb == 12288 && l3->instances == 1 && l3->shared_by == 8);
+    const CacheLevel *l1d = find_cache(&s->topology, 1, "Data");
+    CHECK(l1d && l1d->instances == 4 && l1d->shared_by == 2);
+
+    // coretemp labels cores by core_id, which both SMT siblings share.
+    CHECK(info->cpus.temperature[0] == 52);
+    CHECK(info->cpus.temperature[4] == 52);
+    CHECK(info->cpus.temperature[3] == 55);
+    CHECK(info->num_packages == 1 && info->package_temperature[0] == 61);
+
+    CHECK(info->cpufreq->source == FREQ_SOURCE_CPUFREQ);
+    CHECK(info->cpufreq->mhz[0] == 2400.0 && info->cpufreq->mhz[7] == 2400.0);
+    CHECK(info->cpufreq->num_idle_states == 4);
+    CHECK_STR(info->cpufreq->idle_names[0], "POLL");
+    CHECK_STR(info->cpufreq->idle_names[3], "C10");
+
+    CHECK(info->total_memory == 16161748ULL * 1024);
+    CHECK(info->num_mem_nodes == 1);
+    CHECK(info->num_disks == 1);
+    CHECK_STR(info->disks[0].name, "nvme0n1");
+    CHECK(info->num_net_devices == 3);
+    const NetStats *lo = find_net(info, "lo");
+    const NetStats *wifi = find_net(info, "wlp0s20f3");
+    CHECK(lo && lo->is_virtual);
+    CHECK(wifi && !wifi->is_virtual && wifi->speed_mbps == 0);
+    CHECK_STR(info->cgroup.path, "/user.slice/user-1000.slice/session-2.scope");
+    CHECK(info->cgroup.has_cpu_max && info->cgroup.cpu_limit == 0.0);
+    CHECK(info->cgroup.memory_max == CGROUP_UNLIMITED);
+
+    // Advance CPU 0 by 100 busy and 300 idle ticks, C6 on CPU 0 by 50 ms
+    // over 10 entries and the compiler's utime by 100 ticks, and bring the
+    // wifi link up.
+    static const struct {
+        const char *file;
+        const char *before;
+        const char *after;
+    } bumps[] = {
+        {"proc/stat", "cpu0 2000 2 800 50000 ", "cpu0 2100 2 800 50300 "},
+        {"sys/devices/system/cpu/cpu0/cpuidle/state2/time", "3000000", "3050000"},
+        {"sys/devices/system/cpu/cpu0/cpuidle/state2/usage", "3000", "3010"},
+        {"proc/2/stat", "1000 0 0 0 24 ", "1000 0 0 0 124 "},
+        {"sys/class/net/wlp0s20f3/speed", "-1", "866"},
+    };
+    const int count = sizeof(bumps) / sizeof(bumps[0]);
+    int applied = 0;
+    while (applied < count && rewrite(s, bumps[applied].file, bumps[applied].before, bumps[applied].after)) {
+        applied++;
+    }
+    CHECK(applied == count);
+
+    struct timespec pause = {0, 100 * 1000000L};
+    nanosleep(&pause, NULL);
+    sample_again(s);
+    info = &s->curr;
+
+    CHECK_NEAR(info->cpus.usage[0], 25.0, 0.01);
+    CHECK_NEAR(info->cpus.usage[1], 0.0, 0.01);
+    CHECK(info->cpufreq->idle_valid);
+    // 50 ms of C6 over an interval of at least 100 ms.
+    CHECK(info->cpufreq->idle_residency[2][0] > 0.0 && info->cpufreq->idle_residency[2][0] <= 50.0);
+    CHECK(info->cpufreq->idle_rate[2][0] > 0.0 && info->cpufreq->idle_rate[2][0] <= 100.0);
+    CHECK(info->cpufreq->idle_residency[2][1] == 0.0);
+    CHECK(info->processes->num_cpu > 0);
+    CHECK(info->processes->by_cpu[0].pid == 2);
+    CHECK_STR(info->processes->by_cpu[0].comm, "compiler");
+    wifi = find_net(info, "wlp0s20f3");
+    CHECK(wifi && wifi->speed_mbps == 866);
+
+    while (applied-- > 0) rewrite(s, bumps[applied].file, bumps[applied].after, bumps[applied].before);
+}
+
+static void check_server(Snapshot *s) {
+    const HardwareInfo *hw = &s->curr.hw_info;
+    const SystemInfo *info = &s->curr;
+
+    check_common(s, 384, 2000);
+    CHECK(!hw->is_virtual);
+    CHECK_STR(hw->product_name, "PowerEdge R7625");
+    CHECK_STR(hw->cpu_vendor, "AuthenticAMD");
+    CHECK_STR(hw->cpu_model, "AMD EPYC 9654 96-Core Processor");
+    CHECK(hw->cpu_family == 25);
+
+    CHECK(s->topology.num_packages == 2);
+    CHECK(s->topology.num_cores == 192);
+    CHECK(s->topology.num_nodes == 2);
+    CHECK(s->topology.package[95] == 0 && s->topology.package[96] == 1);
+    CHECK(s->topology.core[288] == 96);
+    CHECK(s->topology.node[383] == 1);
+    const CacheLevel *l3 = find_cache(&s->topology, 3, "Unified");
+    CHECK(l3 && l3->size_kb == 32768 && l3->instances == 24 && l3->shared_by == 16);
+
+    // k10temp reports one Tccd per L3 of its socket and Tctl for the
+    // package; SMT siblings share their core's CCD.
+    CHECK(info->cpus.temperature[0] == 40);
+    CHECK(info->cpus.temperature[8] == 41);
+    CHECK(info->cpus.temperature[95] == 46);
+    CHECK(info->cpus.temperature[96] == 50);
+    CHECK(info->cpus.temperature[288] == 50);
+    CHECK(info->cpus.temperature[191] == 56);
+    CHECK(info->num_packages == 2);
+    CHECK(info->package_temperature[0] == 58 && info->package_temperature[1] == 60);
+
+    CHECK(info->cpufreq->source == FREQ_SOURCE_CPUFREQ);
+    CHECK(info->cpufreq->mhz[383] == 2400.0);
+    CHECK(info->cpufreq->num_idle_states == 3);
+
+    CHECK(info->num_mem_nodes == 2);
+    CHECK(info->node_memory[1].value[MEMINFO_MEM_TOTAL] == 1584737380ULL / 2 * 1024);
+    CHECK(info->swap_total == 0);
+    CHECK(info->num_disks == 4);
+    const NetStats *eno1 = find_net(info, "eno1");
+    const NetStats *bond = find_net(info, "bond0");
+    CHECK(eno1 && !eno1->is_virtual && eno1->speed_mbps == 25000);
+    CHECK(bond && bond->is_virtual);
+    CHECK(info->processes->num_memory == 5);
+}
+
+static void check_kvm(Snapshot *s) {
+    const HardwareInfo *hw = &s->curr.hw_info;
+    const SystemInfo *info = &s->curr;
+
+    check_common(s, 4, 100);
+    CHECK(hw->is_virtual);
+    CHECK(hw->virt_type == VIRT_KVM);
+    CHECK_STR(hw->product_name, "KVM Virtual Machine");
+    CHECK_STR(hw->system_uuid, "8d6f1c4a-2b3e-4f5a-9c8d-7e6f5a4b3c2d");
+    CHECK_STR(hw->cpu_model, "Intel Xeon Processor (Cascadelake)");
+
+    CHECK(s->topology.num_packages == 1);
+    CHECK(s->topology.num_cores == 4);
+
+    CHECK(info->package_temperature[0] == TEMPERATURE_UNKNOWN);
+    CHECK(info->cpus.temperature[0] == TEMPERATURE_UNKNOWN);
+    CHECK(info->cpufreq->source == FREQ_SOURCE_NONE);
+    CHECK(info->cpufreq->num_idle_states == 2);
+    CHECK_STR(info->cpufreq->idle_names[1], "haltpoll");
+
+    CHECK(info->num_disks == 1);
+    CHECK_STR(info->disks[0].name, "vda");
+    const NetStats *eth0 = find_net(info, "eth0");
+    CHECK(eth0 && !eth0->is_virtual && eth0->speed_mbps == 0);
+}
+
+static void check_docker(Snapshot *s) {
+    const HardwareInfo *hw = &s->curr.hw_info;
+    const SystemInfo *info = &s->curr;
+
+    check_common(s, 8, 10);
+    CHECK(hw->is_virtual);
+    CHECK(hw->virt_type == VIRT_DOCKER);
+    CHECK_STR(hw->cpu_model, "AMD Ryzen 7 3700X 8-Core Processor");
+
+    CHECK(info->cgroup.has_cpu_max);
+    CHECK_NEAR(info->cgroup.cpu_limit, 2.0, 1e-9);
+    CHECK(info->cgroup.has_memory);
+    CHECK(info->cgroup.memory_max == 1073741824);
+    CHECK_NEAR(info->cgroup.memory_usage, 25.0, 1e-9);
+    CHECK(info->cgroup.has_io);
+    CHECK(info->cgroup.io[CGROUP_IO_RBYTES] == 104857600);
+    CHECK(info->cgroup.memory_stat[CGROUP_MEM_ANON] == 134217728);
+
+    CHECK(info->cpufreq->source == FREQ_SOURCE_CPUFREQ);
+    CHECK(info->cpufreq->mhz[0] == 3600.0);
+    CHECK(info->cpufreq->num_idle_states == 0);
+    const NetStats *eth0 = find_net(info, "eth0");
+    CHECK(eth0 && eth0->speed_mbps == 10000);
+}
+
+static void check_rpi(Snapshot *s) {
+    const HardwareInfo *hw = &s->curr.hw_info;
+    const SystemInfo *info = &s->curr;
+
+    check_common(s, 4, 80);
+    CHECK(hw->is_arm);
+    CHECK(!hw->is_virtual);
+    CHECK_STR(hw->product_name, "Raspberry Pi 4 Model B Rev 1.4");
+    CHECK_STR(hw->cpu_model, "BCM2835");
+    CHECK_STR(hw->system_uuid, "10000000abcdef01");
+    CHECK_STR(hw->motherboard_serial, "c03114");
+
+    CHECK(s->topology.num_packages == 1);
+    CHECK(s->topology.num_cores == 4);
+    CHECK(s->topology.num_caches == 3);
+    CHECK(!find_cache(&s->topology, 3, "Unified"));
+
+    // A single SoC thermal zone covers every core.
+    CHECK(info->cpus.temperature[0] == 48 && info->cpus.temperature[3] == 48);
+    CHECK(info->cpufreq->source == FREQ_SOURCE_CPUFREQ);
+    CHECK(info->cpufreq->mhz[3] == 1500.0);
+    CHECK(info->cpufreq->num_idle_states == 0);
+    CHECK(info->num_mem_nodes == 0);
+    CHECK(info->num_disks == 1);
+    CHECK_STR(info->disks[0].name, "mmcblk0");
+    CHECK(info->num_net_devices == 3);
+}
+
+static void check_probe_timeout(const char *dir) {
+    char root[BUFFER_SIZE], path[BUFFER_SIZE + PATH_MAX], saved[BUFFER_SIZE + PATH_MAX + 8];
+    HardwareInfo hw;
+
+    fixture = "kvm";
+    snprintf(root, sizeof(root), "%s/kvm", dir);
+    snprintf(path, sizeof(path), "%s/sys/class/dmi/id/bios_version", root);
+    snprintf(saved, sizeof(saved), "%s.saved", path);
+    if (rename(path, saved) != 0 || mkfifo(path, 0644) != 0 || !set_sysroot(root)) {
+        fprintf(stderr, "kvm: cannot put a FIFO at %s\n", path);
+        failures++;
+        return;
+    }
+
+    set_probe_timeout(100);
+    collect_hardware_info(&hw);
+    set_probe_timeout(0);
+    CHECK(hw.timed_out == 1u << PROBE_DMI);
+    CHECK(hw.virt_type == VIRT_KVM);
+    CHECK_STR(hw.cpu_model, "Intel Xeon Processor (Cascadelake)");
+    CHECK_STR(hw.bios_vendor, "");
+
+    // Opening the other end lets the abandoned probe finish.
+    int fd = -1;
+    for (int i = 0; i < 1000 && fd < 0; i++) {
+        fd = open(path, O_WRONLY | O_NONBLOCK);
+        if (fd < 0) usleep(1000);
+    }
+    CHECK(fd >= 0);
+    if (fd >= 0) close(fd);
+    unlink(path);
+    rename(saved, path);
+}
+
+static void check_fields(const char *dir) {
+    char root[BUFFER_SIZE];
+    uint32_t fields;
+
+    fixture = "laptop";
+    CHECK(fields_parse("hardware.cpu,memory", &fields));
+    CHECK(fields == (FIELD_BIT(FIELD_HARDWARE_CPU) | FIELD_BIT(FIELD_MEMORY)));
+    CHECK(fields_parse("cpu_usage", &fields) && fields == FIELDS_CPU_USAGE);
+    CHECK(fields_parse("hardware", &fields) && fields == FIELDS_HARDWARE);
+    CHECK(!fields_parse("memory,bogus", &fields));
+    CHECK(!fields_parse("hardware.", &fields));
+    CHECK(fields_probes(FIELD_BIT(FIELD_HARDWARE_CPU)) == 1u << PROBE_CPUINFO);
+    CHECK(fields_probes(FIELD_BIT(FIELD_MEMORY)) == 0);
+
+    snprintf(root, sizeof(root), "%s/laptop", dir);
+    if (!set_sysroot(root)) {
+        fprintf(stderr, "laptop: cannot use %s as the system root\n", root);
+        failures++;
+        return;
+    }
+
+    // Only cpuinfo is probed, so the result is incomplete but not late.
+    HardwareInfo hw;
+    memset(&hw, 0, sizeof(hw));
+    CHECK(!hardware_probe_finish(hardware_probe_start(1u << PROBE_CPUINFO, 0), &hw));
+    CHECK(hw.timed_out == 0);
+    CHECK_STR(hw.cpu_model, "11th Gen Intel(R) Core(TM) i7-1185G7 @ 3.00GHz");
+    CHECK_STR(hw.product_name, "");
+
+    Collector c;
+    SystemInfo info;
+    if (!collector_init_fields(&c, FIELD_BIT(FIELD_MEMORY)) || !system_info_init(&info)) {
+        fprintf(stderr, "laptop: cannot initialize the collector\n");
+        failures++;
+        return;
+    }
+    uint64_t stat_runs = selfstats_results()->phase[PHASE_STAT].runs;
+    collector_sample(&c, &info, NULL);
+    CHECK(info.fields == FIELD_BIT(FIELD_MEMORY));
+    CHECK(info.available_memory == info.total_memory * 3 / 4 / 1024 * 1024);
+    CHECK(info.num_cores == 0);
+    CHECK(!info.processes && !info.cpufreq);
+    CHECK(!info.cgroup.available);
+    CHECK(info.pressure.present == 0);
+    CHECK(info.num_disks == 0 && info.num_net_devices == 0);
+    CHECK(selfstats_results()->phase[PHASE_STAT].runs == stat_runs);
+    collector_free(&c);
+    system_info_free(&info);
+}
+
+// The server's /proc/net/dev gets a thousand more interfaces, more than
+// the first buffer holds, and is put back afterwards.
+static void check_many_devices(const char *dir) {
+    char path[BUFFER_SIZE + 32];
+    static char saved[4096];
+    Collector c;
+    SystemInfo info;
+
+    fixture = "server";
+    snprintf(path, sizeof(path), "%s/server", dir);
+    if (!set_sysroot(path)) {
+        failures++;
+        return;
+    }
+    snprintf(path, sizeof(path), "%s/server/proc/net/dev", dir);
+    FILE *fp = fopen(path, "r");
+    size_t len = fp ? fread(saved, 1, sizeof(saved), fp) : 0;
+    if (fp) fclose(fp);
+    fp = len > 0 ? fopen(path, "a") : NULL;
+    if (!fp) {
+        failures++;
+        return;
+    }
+    for (int i = 0; i < 1000; i++) {
+        fprintf(fp, "veth%04d: 1000 10 0 0 0 0 0 0 2000 20 0 0 0 0 0 0\n", i);
+    }
+    fclose(fp);
+
+    if (collector_init_fields(&c, FIELD_BIT(FIELD_NETWORK)) && system_info_init(&info)) {
+        collector_sample(&c, &info, NULL);
+        CHECK(info.num_net_devices == 1004 && info.net_devices_dropped == 0);
+        CHECK(info.net_devices && strcmp(info.net_devices[1003].name, "veth0999") == 0);
+        CHECK(info.net_devices[1003].tx_bytes == 2000);
+        collector_free(&c);
+        system_info_free(&info);
+    } else {
+        failures++;
+    }
+    fp = fopen(path, "w");
+    if (fp) {
+        fwrite(saved, 1, len, fp);
+        fclose(fp);
+    }
+}
+
+// A file cannot hold MPERF (0xe7) and APERF (0xe8) apart: reading 8
+// bytes at 0xe7 gets APERF shifted up a byte, with a zero low byte. So
+// with TSC at 3 GHz the effective frequency reads as 3000 / 256 MHz.
+static int write_msrs(const char *root, int cpus, uint64_t tick) {
+    char path[BUFFER_SIZE + 32];
+    uint64_t regs[0x100 / 8] = {0};
+
+    regs[0x10 / 8] = tick * 3000000000ULL;
+    for (int cpu = 0; cpu < cpus; cpu++) {
+        snprintf(path, sizeof(path), "%s/dev", root);
+        mkdir(path, 0755);
+        snprintf(path, sizeof(path), "%s/dev/cpu", root);
+        mkdir(path, 0755);
+        snprintf(path, sizeof(path), "%s/dev/cpu/%d", root, cpu);
+        mkdir(path, 0755);
+        snprintf(path, sizeof(path), "%s/dev/cpu/%d/msr", root, cpu);
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return 0;
+        uint64_t aperf = tick * 1200000000ULL;
+        int ok = pwrite(fd, regs, sizeof(regs), 0) == (ssize_t)sizeof(regs) &&
+                 pwrite(fd, &aperf, 8, 0xe8) == 8;
+        close(fd);
+        if (!ok) return 0;
+    }
+    return 1;
+}
+
+static void remove_msrs(const char *root, int cpus) {
+    char path[BUFFER_SIZE + 32];
+    for (int cpu = 0; cpu < cpus; cpu++) {
+        snprintf(path, sizeof(path), "%s/dev/cpu/%d/msr", root, cpu);
+        unlink(path);
+        snprintf(path, sizeof(path), "%s/dev/cpu/%d", root, cpu);
+        rmdir(path);
+    }
+    snprintf(path, sizeof(path), "%s/dev/cpu", root);
+    rmdir(path);
+    snprintf(path, sizeof(path), "%s/dev", root);
+    rmdir(path);
+}
+
+static void check_msr_budget(const char *dir) {
+    char root[BUFFER_SIZE];
+    struct rlimit saved, limit;
+    CpuFreqMap map;
+    SystemInfo info;
+
+    fixture = "server";
+    snprintf(root, sizeof(root), "%s/server", dir);
+    if (!set_sysroot(root) || getrlimit(RLIMIT_NOFILE, &saved) != 0) {
+        failures++;
+        return;
+    }
+    int capacity = possible_cpu_count();
+    int ok = write_msrs(root, capacity, 1);
+    CHECK(ok);
+
+    // A quarter of 256 descriptors may stay open.
+    limit = saved;
+    limit.rlim_cur = 256;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    if (ok && cpufreq_discover(&map, capacity) && system_info_init_capacity(&info, capacity)) {
+        CHECK(map.results.source == FREQ_SOURCE_APERF_MPERF);
+        CHECK(map.keep_files == 64 && map.msr[63] >= 0 && map.msr[64] == -2);
+        memset(info.cpus.online, 1, capacity);
+        info.monotonic_ns = 1000000000ULL;
+        cpufreq_sample(&map, &info);
+        CHECK(write_msrs(root, capacity, 2));
+        info.monotonic_ns = 2000000000ULL;
+        const CpuFreqStats *freq = cpufreq_sample(&map, &info);
+        CHECK(freq && fabs(freq->mhz[0] - 3000.0 / 256) < 1e-6);
+        CHECK(freq && fabs(freq->mhz[capacity - 1] - 3000.0 / 256) < 1e-6);
+        cpufreq_free(&map);
+        system_info_free(&info);
+    } else {
+        failures++;
+    }
+    setrlimit(RLIMIT_NOFILE, &saved);
+    remove_msrs(root, capacity);
+}
+
+static void check_triggers(void) {
+    PsiTrigger t;
+
+    fixture = "triggers";
+    CHECK(psi_parse_trigger("cpu", &t) && t.kind == PSI_SOME && t.stall_us == PSI_DEFAULT_STALL_US);
+    CHECK(psi_parse_trigger("cgroup.memory:full", &t) && t.cgroup && t.kind == PSI_FULL);
+    CHECK(psi_parse_trigger("io:some:1000:2000000", &t) && t.stall_us == 1000 && t.window_us == 2000000);
+    CHECK(!psi_parse_trigger("cpu:some:1:2:3", &t));
+    CHECK(!psi_parse_trigger("cpu:some:1:2:", &t));
+    CHECK(!psi_parse_trigger("cpu:some:1:2x", &t));
+    CHECK(!psi_parse_trigger("cpu:some:1", &t));
+    CHECK(!psi_parse_trigger("cpu:", &t));
+    CHECK(!psi_parse_trigger("cpu:some:-1:5", &t));
+}
+
+#define ROLLUP_T0 1800000000000ULL  // a whole hour, in ms
+
+static int query_contains(Rollups *r, const char *request, const char *expected, int buckets) {
+    JsonWriter w;
+    json_writer_init(&w, 0);
+    rollups_query(r, request, &w);
+    json_raw(&w, "", 1);
+    int found = strstr(w.buf, expected) != NULL;
+    int count = 0;
+    for (const char *p = w.buf; (p = strstr(p, "\"timestamp\"")); p++) count++;
+    if (!found || (buckets >= 0 && count != buckets)) fprintf(stderr, "%s -> %s\n", request, w.buf);
+    json_writer_free(&w);
+    return found && (buckets < 0 || count == buckets);
+}
+
+static void check_rollups(void) {
+    Rollups r;
+    SystemInfo info;
+
+    fixture = "rollups";
+    if (!rollups_init(&r, 4) || !system_info_init_capacity(&info, 4)) {
+        fprintf(stderr, "rollups: out of memory\n");
+        failures++;
+        return;
+    }
+    CHECK(query_contains(&r, "usage 1m", "no samples yet", 0));
+
+    // One sample a second for 400 s: CPU 1 runs at i percent, memory in
+    // use cycles over 600..501 and CPU 0 is at 50..52 degrees. The other
+    // CPUs have no sensor.
+    memset(info.cpus.online, 1, 4);
+    info.total_memory = 1000;
+    for (int i = 0; i < 400; i++) {
+        info.timestamp = (ROLLUP_T0 + i * 1000ULL) * 1000000ULL;
+        info.cpus.usage[1] = i;
+        info.available_memory = 400 + i % 100;
+        info.cpus.temperature[0] = 50 + i % 3;
+        rollups_update(&r, &info);
+    }
+
+    CHECK(query_contains(&r, "core_usage:1 1m 10s",
+                         "\"from\":1800000339000,\"to\":1800000399000,\"buckets\":[{\"timestamp\":1800000330000,"
+                         "\"samples\":10,\"min\":330.00,\"avg\":334.50,\"max\":339.00}", 7));
+    CHECK(query_contains(&r, "core_usage:1 1m 10s",
+                         "{\"timestamp\":1800000390000,\"samples\":10,\"min\":390.00,\"avg\":394.50,"
+                         "\"max\":399.00,\"partial\":true}]}", 7));
+    CHECK(query_contains(&r, "memory 5m 1m",
+                         "[{\"timestamp\":1800000060000,\"samples\":60,\"min\":501,\"avg\":544,\"max\":600}", 6));
+    CHECK(query_contains(&r, "temperature:0 3s raw",
+                         "[{\"timestamp\":1800000396000,\"samples\":1,\"min\":50.0,\"avg\":50.0,\"max\":50.0}", 4));
+    CHECK(query_contains(&r, "temperature:1 1h 1h", "\"min\":null,\"avg\":null,\"max\":null,\"partial\":true", 1));
+    // The raw ring holds the last 360 samples.
+    CHECK(query_contains(&r, "usage 2m", "\"resolution\":\"raw\"", 121));
+    CHECK(query_contains(&r, "usage 10m", "\"resolution\":\"10s\"", -1));
+    CHECK(query_contains(&r, "usage 1d", "\"resolution\":\"1m\"", -1));
+    CHECK(query_contains(&r, "usage 2d", "\"resolution\":\"1h\"", -1));
+    CHECK(query_contains(&r, "usage 10m raw", "{\"timestamp\":1800000040000,", 360));
+    CHECK(query_contains(&r, "core_usage:4 1m", "no such cpu", 0));
+    CHECK(query_contains(&r, "core_usage 1m", "needs a cpu", 0));
+    CHECK(query_contains(&r, "usage 1m 5s", "unknown resolution", 0));
+    CHECK(query_contains(&r, "usage", "expected", 0));
+
+    char path[64];
+    RollupServer server;
+    FILE *out = tmpfile();
+    snprintf(path, sizeof(path), "/tmp/test_fixtures.%d.sock", (int)getpid());
+    CHECK(out && rollup_server_start(&server, &r, path));
+    if (out && server.fd >= 0) {
+        char response[1024] = "";
+        CHECK(rollup_request(path, "temperature:0 3s raw", fileno(out)) == 1);
+        CHECK(rollup_request(path, "temperature:9 3s raw", fileno(out)) == 0);
+        rewind(out);
+        CHECK(fread(response, 1, sizeof(response) - 1, out) > 0);
+        CHECK(strstr(response, "\"min\":50.0,\"avg\":50.0,\"max\":50.0}]}\n{\"error\":\"no such cpu\"}\n"));
+        rollup_server_stop(&server);
+        CHECK(access(path, F_OK) != 0);
+        CHECK(rollup_request(path, "usage 1m", fileno(out)) == -1);
+
+        // A file that is not a socket is never replaced.
+        FILE *file = fopen(path, "w");
+        CHECK(file && !rollup_server_start(&server, &r, path) && access(path, F_OK) == 0);
+        if (file) fclose(file);
+        unlink(path);
+    }
+    if (out) fclose(out);
+    system_info_free(&info);
+    rollups_free(&r);
+}
+
+static void check_shm(void) {
+    char name[64];
+    HardwareInfo hw;
+    ShmSegment first, second;
+    SystemInfo info;
+
+    fixture = "shm";
+    memset(&hw, 0, sizeof(hw));
+    snprintf(name, sizeof(name), "/hardware-info-test-%d", (int)getpid());
+    // A segment nobody holds is what a crashed publisher leaves behind.
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    CHECK(fd >= 0);
+    if (fd >= 0) close(fd);
+
+    CHECK(shm_publisher_open(&first, name, &hw, 4, 2));
+    CHECK(!shm_publisher_open(&second, name, &hw, 4, 2) && errno == EBUSY);
+    CHECK(shm_reader_open(&second, name) && shm_capacity(&second) == 4);
+    // Disks and interfaces are not published, so a reader leaves them out.
+    if (system_info_init_capacity(&info, 4)) {
+        shm_publish(&first, &info);
+        CHECK(shm_read(&second, 0, &info) && info.fields == SHM_FIELDS);
+        CHECK(!(info.fields & FIELD_BIT(FIELD_DISKS)) && !(info.fields & FIELD_BIT(FIELD_NETWORK)));
+        system_info_free(&info);
+    } else {
+        failures++;
+    }
+    shm_close(&second);
+    shm_publisher_close(&first, name);
+    fd = shm_open(name, O_RDONLY, 0);
+    CHECK(fd < 0 && errno == ENOENT);
+    if (fd >= 0) {
+        close(fd);
+        shm_unlink(name);
+    }
+}
+
+// Returns whether w holds exactly expected, and empties it.
+static int json_equals(JsonWriter *w, const char *expected) {
+    int equal = w->len == strlen(expected) && memcmp(w->buf, expected, w->len) == 0;
+    json_writer_reset(w);
+    return equal;
+}
+
+static void check_json(void) {
+    JsonWriter w;
+
+    fixture = "json";
+    json_writer_init(&w, 1);
+    json_begin_object(&w, NULL);
+    json_begin_array(&w, "timeouts");
+    json_end_array(&w);
+    json_begin_object(&w, "bios");
+    json_end_object(&w);
+    json_end_object(&w);
+    CHECK(json_equals(&w, "{\n  \"timeouts\": [],\n  \"bios\": {}\n}"));
+
+    json_string(&w, NULL, "caf\xc3\xa9 \xf0\x9f\x94\xa5");
+    CHECK(json_equals(&w, "\"caf\xc3\xa9 \xf0\x9f\x94\xa5\""));
+    // Latin-1, a truncated sequence, an overlong '/' and a surrogate.
+    json_string(&w, NULL, "caf\xe9 \xe2\x82 \xc0\xaf \xed\xa0\x80\t");
+    CHECK(json_equals(&w, "\"caf\xef\xbf\xbd \xef\xbf\xbd\xef\xbf\xbd "
+                          "\xef\xbf\xbd\xef\xbf\xbd \xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd\\t\""));
+    json_writer_free(&w);
+}
+
+static const struct {
+    const char *name;
+    void (*check)(Snapshot *s);
+} fixtures[] = {
+    {"laptop", check_laptop},
+    {"server", check_server},
+    {"kvm", check_kvm},
+    {"docker", check_docker},
+    {"rpi", check_rpi},
+};
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <fixture-dir>\n", argv[0]);
+        return 2;
+    }
+
+    selfstats_enable();
+    for (size_t i = 0; i < sizeof(fixtures) / sizeof(fixtures[0]); i++) {
+        Snapshot *s = malloc(sizeof(Snapshot));
+        if (!s) return 1;
+        int before = failures;
+        if (open_snapshot(s, argv[1], fixtures[i].name)) {
+            fixtures[i].check(s);
+            close_snapshot(s);
+        } else {
+            failures++;
+        }
+        free(s);
+        printf("%-8s %s\n", fixtures[i].name, failures == before ? "ok" : "FAILED");
+    }
+    int before = failures;
+    check_probe_timeout(argv[1]);
+    printf("%-8s %s\n", "timeout", failures == before ? "ok" : "FAILED");
+    before = failures;
+    check_fields(argv[1]);
+    printf("%-8s %s\n", "fields", failures == before ? "ok" : "FAILED");
+    before = failures;
+    check_msr_budget(argv[1]);
+    printf("%-8s %s\n", "msr", failures == before ? "ok" : "FAILED");
+    before = failures;
+    check_many_devices(argv[1]);
+    printf("%-8s %s\n", "devices", failures == before ? "ok" : "FAILED");
+    before = failures;
+    check_triggers();
+    printf("%-8s %s\n", "triggers", failures == before ? "ok" : "FAILED");
+    before = failures;
+    check_rollups();
+    printf("%-8s %s\n", "rollups", failures == before ? "ok" : "FAILED");
+    before = failures;
+    check_shm();
+    printf("%-8s %s\n", "shm", failures == before ? "ok" : "FAILED");
+    before = failures;
+    check_json();
+    printf("%-8s %s\n", "json", failures == before ? "ok" : "FAILED");
+    set_sysroot(NULL);
+
+    printf("%d checks, %d failed\n", checks, failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,113 @@
+#include "hardware_info.h"
+#include "cpustat.h"
+#include "fields.h"
+#include "record.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Converts a --format=binary recording back to JSON, one snapshot per
+// recorded sample, recomputing CPU usage from the raw counters.
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [--compact] [file]\n"
+            "  Reads a hardware-info --format=binary recording from file or\n"
+            "  standard input and prints it as JSON.\n",
+            prog);
+}
+
+static uint8_t *read_input(int fd, size_t *out_len) {
+    size_t cap = 65536, len = 0;
+    uint8_t *buf = malloc(cap);
+    while (buf) {
+        if (len == cap) {
+            uint8_t *grown = realloc(buf, cap * 2);
+            if (!grown) break;
+            buf = grown;
+            cap *= 2;
+        }
+        ssize_t n = read(fd, buf + len, cap - len);
+        if (n <= 0) {
+            *out_len = len;
+            return buf;
+        }
+        len += n;
+    }
+    free(buf);
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    const char *path = NULL;
+    int pretty = 1;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--compact") == 0) {
+            pretty = 0;
+        } else if (strcmp(argv[i], "--help") == 0) {
+            usage(argv[0]);
+            return 0;
+        } else if (!path) {
+            path = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    int fd = path ? open(path, O_RDONLY | O_CLOEXEC) : STDIN_FILENO;
+    if (fd < 0) {
+        perror(path);
+        return 1;
+    }
+    size_t len;
+    uint8_t *data = read_input(fd, &len);
+    if (path) close(fd);
+    if (!data) {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        return 1;
+    }
+
+    RecordReader reader;
+    SystemInfo samples[2];
+    memset(samples, 0, sizeof(samples));
+    if (!record_reader_open(&reader, data, len, &samples[0].hw_info)) {
+        fprintf(stderr, "%s: not a hardware-info recording\n", argv[0]);
+        return 1;
+    }
+    samples[1].hw_info = samples[0].hw_info;
+    // Recordings always hold whole samples; see --fields in main.c.
+    samples[0].fields = samples[1].fields = FIELDS_ALL;
+    if (!percpu_init(&samples[0].cpus, reader.last.cpus.capacity) ||
+        !percpu_init(&samples[1].cpus, reader.last.cpus.capacity)) {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        return 1;
+    }
+
+    // The first record is the baseline the recorder sampled before its
+    // first tick; every later one is printed with usage against the one
+    // before it, as the live tool does.
+    SystemInfo *prev = &samples[0];
+    SystemInfo *curr = &samples[1];
+    int status = record_read_sample(&reader, prev);
+    while (status > 0 && (status = record_read_sample(&reader, curr)) > 0) {
+        curr->total_usage = calculate_cpu_usage(&prev->total_stats, &curr->total_stats);
+        calculate_state_usage(&prev->total_stats, &curr->total_stats, curr->total_state_usage);
+        calculate_percpu_usage(&curr->cpus, &prev->cpus);
+        output_json(curr, pretty);
+
+        SystemInfo *tmp = prev;
+        prev = curr;
+        curr = tmp;
+    }
+    if (status < 0) fprintf(stderr, "%s: truncated or corrupt record\n", argv[0]);
+
+    record_reader_free(&reader);
+    percpu_free(&samples[0].cpus);
+    percpu_free(&samples[1].cpus);
+    free(data);
+    return status < 0;
+}